@@ -0,0 +1,699 @@
+//
+// bvh.cpp : Dynamic AABB tree, see bvh.h.
+//
+
+#include "bvh.h"
+
+#include <float.h>
+#include <chrono>
+
+static Aabb Union(const Aabb& a, const Aabb& b)
+{
+	return Aabb{ glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+// Surface area, the cost of a node in the SAH (the constant factor does not matter)
+static f32 Area(const Aabb& box)
+{
+	vec3 d = box.max - box.min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static bool Contains(const Aabb& outer, const Aabb& inner)
+{
+	return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+}
+
+static bool Overlaps(const Aabb& a, const Aabb& b)
+{
+	return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::greaterThanEqual(a.max, b.min));
+}
+
+static Aabb Fatten(const Aabb& box)
+{
+	vec3 margin = (box.max - box.min) * BVH_FAT_MARGIN;
+	return Aabb{ box.min - margin, box.max + margin };
+}
+
+Aabb TransformAabb(const Aabb& box, const mat4& matrix)
+{
+	Aabb result = { vec3(matrix[3]), vec3(matrix[3]) };
+	for (u32 c = 0; c < 3; ++c)
+	{
+		vec3 a = vec3(matrix[c]) * box.min[c];
+		vec3 b = vec3(matrix[c]) * box.max[c];
+		result.min += glm::min(a, b);
+		result.max += glm::max(a, b);
+	}
+	return result;
+}
+
+void InitBvh(Bvh* bvh, u32 entityCapacity)
+{
+	*bvh = Bvh{};
+	bvh->root = BVH_NULL;
+	bvh->freeList = BVH_NULL;
+	bvh->nodes.reserve(entityCapacity * 2);
+	bvh->entityLeaves.reserve(entityCapacity);
+}
+
+bool IsInBvh(const Bvh* bvh, u32 entity)
+{
+	return entity < bvh->entityLeaves.size() && bvh->entityLeaves[entity] != BVH_NULL;
+}
+
+static u32 AllocateNode(Bvh* bvh)
+{
+	u32 node = bvh->freeList;
+	if (node != BVH_NULL)
+	{
+		bvh->freeList = bvh->nodes[node].parent;
+	}
+	else
+	{
+		node = (u32)bvh->nodes.size();
+		bvh->nodes.push_back(BvhNode{});
+	}
+
+	BvhNode& n = bvh->nodes[node];
+	n.parent = n.child0 = n.child1 = n.entity = BVH_NULL;
+	return node;
+}
+
+static void FreeNode(Bvh* bvh, u32 node)
+{
+	bvh->nodes[node].parent = bvh->freeList;
+	bvh->freeList = node;
+}
+
+static bool IsLeaf(const BvhNode& node)
+{
+	return node.child0 == BVH_NULL;
+}
+
+// Swaps a child of node with a grandchild under its other child when that shrinks the
+// child that receives the swap the most (Kopta et al. 2012). node's own bounds do not change.
+static void RotateNode(Bvh* bvh, u32 nodeIndex)
+{
+	BvhNode& node = bvh->nodes[nodeIndex];
+	if (IsLeaf(node))
+		return;
+
+	u32 b = node.child0;
+	u32 c = node.child1;
+	const BvhNode& nodeB = bvh->nodes[b];
+	const BvhNode& nodeC = bvh->nodes[c];
+
+	// (child that moves down, internal child it moves into, grandchild that moves up)
+	u32 bestDown = BVH_NULL, bestInto = BVH_NULL, bestUp = BVH_NULL;
+	f32 bestGain = 0.0f;
+	if (!IsLeaf(nodeB))
+	{
+		f32 areaB = Area(nodeB.bounds);
+		f32 gainD = areaB - Area(Union(nodeC.bounds, bvh->nodes[nodeB.child1].bounds));	// C <-> D
+		f32 gainE = areaB - Area(Union(nodeC.bounds, bvh->nodes[nodeB.child0].bounds));	// C <-> E
+		if (gainD > bestGain) { bestGain = gainD; bestDown = c; bestInto = b; bestUp = nodeB.child0; }
+		if (gainE > bestGain) { bestGain = gainE; bestDown = c; bestInto = b; bestUp = nodeB.child1; }
+	}
+	if (!IsLeaf(nodeC))
+	{
+		f32 areaC = Area(nodeC.bounds);
+		f32 gainF = areaC - Area(Union(nodeB.bounds, bvh->nodes[nodeC.child1].bounds));	// B <-> F
+		f32 gainG = areaC - Area(Union(nodeB.bounds, bvh->nodes[nodeC.child0].bounds));	// B <-> G
+		if (gainF > bestGain) { bestGain = gainF; bestDown = b; bestInto = c; bestUp = nodeC.child0; }
+		if (gainG > bestGain) { bestGain = gainG; bestDown = b; bestInto = c; bestUp = nodeC.child1; }
+	}
+	if (bestDown == BVH_NULL)
+		return;
+
+	// bestUp takes the place of bestDown under node, and bestDown the place of bestUp under bestInto
+	BvhNode& into = bvh->nodes[bestInto];
+	if (node.child0 == bestDown) node.child0 = bestUp; else node.child1 = bestUp;
+	if (into.child0 == bestUp) into.child0 = bestDown; else into.child1 = bestDown;
+	bvh->nodes[bestUp].parent = nodeIndex;
+	bvh->nodes[bestDown].parent = bestInto;
+	into.bounds = Union(bvh->nodes[into.child0].bounds, bvh->nodes[into.child1].bounds);
+	bvh->rotationCount++;
+}
+
+// Recomputes the bounds of node and its ancestors, rotating each of them
+static void RefitAncestors(Bvh* bvh, u32 node)
+{
+	while (node != BVH_NULL)
+	{
+		BvhNode& n = bvh->nodes[node];
+		n.bounds = Union(bvh->nodes[n.child0].bounds, bvh->nodes[n.child1].bounds);
+		RotateNode(bvh, node);
+		node = bvh->nodes[node].parent;
+	}
+}
+
+// Branch and bound over the tree for the sibling with the lowest insertion cost: the
+// area of the new parent plus the area every ancestor would grow by (Bittner et al. 2012)
+static u32 FindBestSibling(const Bvh* bvh, const Aabb& leafBounds)
+{
+	struct Candidate { u32 node; f32 inheritedCost; };
+	static thread_local std::vector<Candidate> stack;
+
+	const f32 leafArea = Area(leafBounds);
+	u32 best = bvh->root;
+	f32 bestCost = Area(Union(bvh->nodes[bvh->root].bounds, leafBounds));
+
+	stack.clear();
+	stack.push_back(Candidate{ bvh->root, 0.0f });
+	while (!stack.empty())
+	{
+		Candidate candidate = stack.back();
+		stack.pop_back();
+
+		const BvhNode& node = bvh->nodes[candidate.node];
+		f32 directCost = Area(Union(node.bounds, leafBounds));
+		f32 cost = directCost + candidate.inheritedCost;
+		if (cost < bestCost)
+		{
+			best = candidate.node;
+			bestCost = cost;
+		}
+
+		// Anything below pays at least the leaf area plus what this node grows by
+		if (!IsLeaf(node))
+		{
+			f32 inheritedCost = candidate.inheritedCost + directCost - Area(node.bounds);
+			if (leafArea + inheritedCost < bestCost)
+			{
+				stack.push_back(Candidate{ node.child0, inheritedCost });
+				stack.push_back(Candidate{ node.child1, inheritedCost });
+			}
+		}
+	}
+	return best;
+}
+
+static void InsertLeaf(Bvh* bvh, u32 leaf)
+{
+	if (bvh->root == BVH_NULL)
+	{
+		bvh->root = leaf;
+		bvh->nodes[leaf].parent = BVH_NULL;
+		return;
+	}
+
+	u32 sibling = FindBestSibling(bvh, bvh->nodes[leaf].bounds);
+	u32 oldParent = bvh->nodes[sibling].parent;
+	u32 newParent = AllocateNode(bvh);
+
+	BvhNode& parent = bvh->nodes[newParent];
+	parent.parent = oldParent;
+	parent.child0 = sibling;
+	parent.child1 = leaf;
+	parent.bounds = Union(bvh->nodes[sibling].bounds, bvh->nodes[leaf].bounds);
+	bvh->nodes[sibling].parent = newParent;
+	bvh->nodes[leaf].parent = newParent;
+
+	if (oldParent == BVH_NULL)
+	{
+		bvh->root = newParent;
+	}
+	else
+	{
+		BvhNode& old = bvh->nodes[oldParent];
+		if (old.child0 == sibling) old.child0 = newParent; else old.child1 = newParent;
+	}
+
+	RefitAncestors(bvh, oldParent);
+}
+
+static void RemoveLeaf(Bvh* bvh, u32 leaf)
+{
+	if (leaf == bvh->root)
+	{
+		bvh->root = BVH_NULL;
+		return;
+	}
+
+	u32 parent = bvh->nodes[leaf].parent;
+	u32 grandParent = bvh->nodes[parent].parent;
+	u32 sibling = bvh->nodes[parent].child0 == leaf ? bvh->nodes[parent].child1 : bvh->nodes[parent].child0;
+
+	bvh->nodes[sibling].parent = grandParent;
+	if (grandParent == BVH_NULL)
+	{
+		bvh->root = sibling;
+	}
+	else
+	{
+		BvhNode& g = bvh->nodes[grandParent];
+		if (g.child0 == parent) g.child0 = sibling; else g.child1 = sibling;
+	}
+	FreeNode(bvh, parent);
+
+	RefitAncestors(bvh, grandParent);
+}
+
+void InsertBvhEntity(Bvh* bvh, u32 entity, const Aabb& bounds)
+{
+	ASSERT(!IsInBvh(bvh, entity), "Entity already in the BVH");
+	if (entity >= bvh->entityLeaves.size())
+		bvh->entityLeaves.resize(entity + 1, BVH_NULL);
+
+	u32 leaf = AllocateNode(bvh);
+	bvh->nodes[leaf].bounds = Fatten(bounds);
+	bvh->nodes[leaf].entity = entity;
+	bvh->entityLeaves[entity] = leaf;
+	bvh->leafCount++;
+
+	InsertLeaf(bvh, leaf);
+}
+
+void RemoveBvhEntity(Bvh* bvh, u32 entity)
+{
+	ASSERT(IsInBvh(bvh, entity), "Entity not in the BVH");
+	u32 leaf = bvh->entityLeaves[entity];
+	RemoveLeaf(bvh, leaf);
+	FreeNode(bvh, leaf);
+	bvh->entityLeaves[entity] = BVH_NULL;
+	bvh->leafCount--;
+}
+
+bool UpdateBvhEntity(Bvh* bvh, u32 entity, const Aabb& bounds)
+{
+	ASSERT(IsInBvh(bvh, entity), "Entity not in the BVH");
+	u32 leaf = bvh->entityLeaves[entity];
+	BvhNode& node = bvh->nodes[leaf];
+	if (Contains(node.bounds, bounds))
+		return false;
+
+	bool nearby = Overlaps(node.bounds, bounds);
+	node.bounds = Fatten(bounds);
+	if (nearby)
+	{
+		RefitAncestors(bvh, node.parent);
+	}
+	else
+	{
+		RemoveLeaf(bvh, leaf);
+		InsertLeaf(bvh, leaf);
+		bvh->reinsertionCount++;
+	}
+	return true;
+}
+
+// Appends every entity under node
+static void CollectLeaves(const Bvh* bvh, u32 node, std::vector<u32>& entities, std::vector<u32>& stack)
+{
+	size_t base = stack.size();
+	stack.push_back(node);
+	while (stack.size() > base)
+	{
+		const BvhNode& n = bvh->nodes[stack.back()];
+		stack.pop_back();
+		if (IsLeaf(n))
+		{
+			entities.push_back(n.entity);
+		}
+		else
+		{
+			stack.push_back(n.child0);
+			stack.push_back(n.child1);
+		}
+	}
+}
+
+void QueryBvhFrustum(const Bvh* bvh, const Frustum& frustum, std::vector<u32>& entities)
+{
+	if (bvh->root == BVH_NULL)
+		return;
+
+	static thread_local std::vector<u32> stack;
+	stack.clear();
+	stack.push_back(bvh->root);
+	while (!stack.empty())
+	{
+		u32 nodeIndex = stack.back();
+		stack.pop_back();
+		const BvhNode& node = bvh->nodes[nodeIndex];
+
+		// Outside when the corner furthest along a plane normal is behind it, completely
+		// inside when the nearest corner is in front of all of them
+		bool inside = true;
+		bool outside = false;
+		for (u32 i = 0; i < 6 && !outside; ++i)
+		{
+			vec3 normal = vec3(frustum.planes[i]);
+			vec3 positive = glm::mix(node.bounds.min, node.bounds.max, glm::greaterThanEqual(normal, vec3(0.0f)));
+			vec3 negative = glm::mix(node.bounds.max, node.bounds.min, glm::greaterThanEqual(normal, vec3(0.0f)));
+			outside = glm::dot(normal, positive) + frustum.planes[i].w < 0.0f;
+			inside = inside && glm::dot(normal, negative) + frustum.planes[i].w >= 0.0f;
+		}
+
+		if (outside)
+			continue;
+		if (inside || IsLeaf(node))
+		{
+			CollectLeaves(bvh, nodeIndex, entities, stack);
+			continue;
+		}
+		stack.push_back(node.child0);
+		stack.push_back(node.child1);
+	}
+}
+
+void QueryBvhSphere(const Bvh* bvh, vec3 center, f32 radius, std::vector<u32>& entities)
+{
+	if (bvh->root == BVH_NULL)
+		return;
+
+	static thread_local std::vector<u32> stack;
+	stack.clear();
+	stack.push_back(bvh->root);
+	while (!stack.empty())
+	{
+		const BvhNode& node = bvh->nodes[stack.back()];
+		stack.pop_back();
+
+		vec3 closest = glm::clamp(center, node.bounds.min, node.bounds.max);
+		vec3 d = closest - center;
+		if (glm::dot(d, d) > radius * radius)
+			continue;
+
+		if (IsLeaf(node))
+		{
+			entities.push_back(node.entity);
+		}
+		else
+		{
+			stack.push_back(node.child0);
+			stack.push_back(node.child1);
+		}
+	}
+}
+
+// Slab test with the inverse direction, returns the entry distance or FLT_MAX
+static f32 IntersectRayAabbInverse(vec3 origin, vec3 inverseDirection, const Aabb& box, f32 maxDistance)
+{
+	vec3 t0 = (box.min - origin) * inverseDirection;
+	vec3 t1 = (box.max - origin) * inverseDirection;
+	vec3 tmin = glm::min(t0, t1);
+	vec3 tmax = glm::max(t0, t1);
+	f32 enter = glm::max(glm::max(tmin.x, tmin.y), glm::max(tmin.z, 0.0f));
+	f32 exit = glm::min(glm::min(tmax.x, tmax.y), glm::min(tmax.z, maxDistance));
+	return enter <= exit ? enter : FLT_MAX;
+}
+
+f32 IntersectRayAabb(vec3 origin, vec3 direction, const Aabb& box)
+{
+	f32 distance = IntersectRayAabbInverse(origin, 1.0f / direction, box, FLT_MAX);
+	return distance == FLT_MAX ? -1.0f : distance;
+}
+
+f32 IntersectRayTriangle(vec3 origin, vec3 direction, vec3 a, vec3 b, vec3 c)
+{
+	vec3 edge1 = b - a;
+	vec3 edge2 = c - a;
+	vec3 p = glm::cross(direction, edge2);
+	f32 determinant = glm::dot(edge1, p);
+	if (fabsf(determinant) < 1e-12f)
+		return -1.0f;
+
+	f32 inverseDeterminant = 1.0f / determinant;
+	vec3 s = origin - a;
+	f32 u = glm::dot(s, p) * inverseDeterminant;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+
+	vec3 q = glm::cross(s, edge1);
+	f32 v = glm::dot(direction, q) * inverseDeterminant;
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+
+	return glm::dot(edge2, q) * inverseDeterminant;
+}
+
+u32 RaycastBvh(const Bvh* bvh, vec3 origin, vec3 direction, f32 maxDistance, BvhRayCallback callback, void* data, f32* hitDistance)
+{
+	u32 hitEntity = BVH_NULL;
+	if (bvh->root == BVH_NULL)
+		return hitEntity;
+
+	struct Candidate { u32 node; f32 distance; };
+	static thread_local std::vector<Candidate> stack;
+
+	const vec3 inverseDirection = 1.0f / direction;
+	f32 closest = maxDistance;
+	f32 rootDistance = IntersectRayAabbInverse(origin, inverseDirection, bvh->nodes[bvh->root].bounds, closest);
+	stack.clear();
+	if (rootDistance != FLT_MAX)
+		stack.push_back(Candidate{ bvh->root, rootDistance });
+
+	while (!stack.empty())
+	{
+		Candidate candidate = stack.back();
+		stack.pop_back();
+		if (candidate.distance > closest)
+			continue;
+
+		const BvhNode& node = bvh->nodes[candidate.node];
+		if (IsLeaf(node))
+		{
+			f32 distance = callback(data, node.entity, origin, direction, closest);
+			if (distance >= 0.0f && distance < closest)
+			{
+				closest = distance;
+				hitEntity = node.entity;
+			}
+			continue;
+		}
+
+		// The nearer child goes on top so it is visited first
+		f32 distance0 = IntersectRayAabbInverse(origin, inverseDirection, bvh->nodes[node.child0].bounds, closest);
+		f32 distance1 = IntersectRayAabbInverse(origin, inverseDirection, bvh->nodes[node.child1].bounds, closest);
+		Candidate near = { node.child0, distance0 };
+		Candidate far = { node.child1, distance1 };
+		if (distance1 < distance0)
+			std::swap(near, far);
+		if (far.distance != FLT_MAX)
+			stack.push_back(far);
+		if (near.distance != FLT_MAX)
+			stack.push_back(near);
+	}
+
+	if (hitDistance)
+		*hitDistance = closest;
+	return hitEntity;
+}
+
+BvhStats GetBvhStats(const Bvh* bvh)
+{
+	BvhStats stats = {};
+	stats.leafCount = bvh->leafCount;
+	if (bvh->root == BVH_NULL)
+		return stats;
+
+	struct Candidate { u32 node; u32 depth; };
+	std::vector<Candidate> stack;
+	stack.push_back(Candidate{ bvh->root, 0 });
+	f32 internalArea = 0.0f;
+	while (!stack.empty())
+	{
+		Candidate candidate = stack.back();
+		stack.pop_back();
+		const BvhNode& node = bvh->nodes[candidate.node];
+		stats.maxDepth = glm::max(stats.maxDepth, candidate.depth);
+		if (IsLeaf(node))
+			continue;
+
+		internalArea += Area(node.bounds);
+		stack.push_back(Candidate{ node.child0, candidate.depth + 1 });
+		stack.push_back(Candidate{ node.child1, candidate.depth + 1 });
+	}
+	stats.sahCost = internalArea / glm::max(Area(bvh->nodes[bvh->root].bounds), 1e-12f);
+	return stats;
+}
+
+// Deterministic values in [0, 1) for the benchmark
+static f32 NextRandom(u32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+struct BenchmarkRayData
+{
+	const std::vector<Aabb>* boxes;
+};
+
+static f32 IntersectBenchmarkBox(void* data, u32 entity, vec3 origin, vec3 direction, f32 maxDistance)
+{
+	const BenchmarkRayData* rayData = (const BenchmarkRayData*)data;
+	f32 distance = IntersectRayAabb(origin, direction, (*rayData->boxes)[entity]);
+	return distance <= maxDistance ? distance : -1.0f;
+}
+
+template <typename Function>
+static f64 MeasureMilliseconds(Function function)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	function();
+	auto end = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<f64, std::milli>(end - start).count();
+}
+
+BvhBenchmark BenchmarkBvh(u32 entityCount)
+{
+	BvhBenchmark result = {};
+	result.entityCount = entityCount;
+
+	// Unit sized boxes scattered in a cube that keeps the density of the scene constant
+	const f32 worldSize = 4.0f * cbrtf((f32)entityCount);
+	u32 random = 12345;
+	std::vector<Aabb> boxes(entityCount);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 center = vec3(NextRandom(random), NextRandom(random), NextRandom(random)) * worldSize;
+		vec3 extent = vec3(0.25f) + vec3(NextRandom(random), NextRandom(random), NextRandom(random)) * 0.5f;
+		boxes[i] = Aabb{ center - extent, center + extent };
+	}
+
+	Bvh bvh;
+	InitBvh(&bvh, entityCount);
+	result.insertMilliseconds = MeasureMilliseconds([&]()
+	{
+		for (u32 i = 0; i < entityCount; ++i)
+			InsertBvhEntity(&bvh, i, boxes[i]);
+	});
+
+	// Small moves, most stay in their fat box or get refitted
+	result.refitMilliseconds = MeasureMilliseconds([&]()
+	{
+		for (u32 i = 0; i < entityCount; ++i)
+		{
+			vec3 offset = (vec3(NextRandom(random), NextRandom(random), NextRandom(random)) - 0.5f) * 0.4f;
+			boxes[i].min += offset;
+			boxes[i].max += offset;
+			UpdateBvhEntity(&bvh, i, boxes[i]);
+		}
+	});
+
+	// A tenth of the entities teleported somewhere else
+	result.reinsertMilliseconds = MeasureMilliseconds([&]()
+	{
+		for (u32 i = 0; i < entityCount; i += 10)
+		{
+			vec3 offset = vec3(NextRandom(random), NextRandom(random), NextRandom(random)) * worldSize - (boxes[i].min + boxes[i].max) * 0.5f;
+			boxes[i].min += offset;
+			boxes[i].max += offset;
+			UpdateBvhEntity(&bvh, i, boxes[i]);
+		}
+	});
+	result.stats = GetBvhStats(&bvh);
+
+	// Cameras looking at the middle of the cube from around it
+	result.frustumQueryCount = 64;
+	std::vector<Frustum> frustums(result.frustumQueryCount);
+	for (u32 i = 0; i < result.frustumQueryCount; ++i)
+	{
+		f32 angle = 6.2831853f * i / result.frustumQueryCount;
+		vec3 target = vec3(worldSize * 0.5f);
+		vec3 eye = target + vec3(cosf(angle), 0.3f, sinf(angle)) * worldSize * 0.75f;
+		mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, worldSize * 0.5f) * glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f));
+		frustums[i] = ExtractFrustum(viewProjection);
+	}
+
+	std::vector<u32> found;
+	found.reserve(entityCount);
+	u64 bvhFound = 0, linearFound = 0;
+	result.frustumBvhMilliseconds = MeasureMilliseconds([&]()
+	{
+		for (const Frustum& frustum : frustums)
+		{
+			found.clear();
+			QueryBvhFrustum(&bvh, frustum, found);
+			bvhFound += found.size();
+		}
+	});
+	result.frustumLinearMilliseconds = MeasureMilliseconds([&]()
+	{
+		for (const Frustum& frustum : frustums)
+		{
+			found.clear();
+			for (u32 e = 0; e < entityCount; ++e)
+			{
+				bool outside = false;
+				for (u32 p = 0; p < 6 && !outside; ++p)
+				{
+					vec3 normal = vec3(frustum.planes[p]);
+					vec3 positive = glm::mix(boxes[e].min, boxes[e].max, glm::greaterThanEqual(normal, vec3(0.0f)));
+					outside = glm::dot(normal, positive) + frustum.planes[p].w < 0.0f;
+				}
+				if (!outside)
+					found.push_back(e);
+			}
+			linearFound += found.size();
+		}
+	});
+
+	result.sphereQueryCount = 4096;
+	result.sphereBvhMilliseconds = MeasureMilliseconds([&]()
+	{
+		u32 sphereRandom = 777;
+		for (u32 i = 0; i < result.sphereQueryCount; ++i)
+		{
+			vec3 center = vec3(NextRandom(sphereRandom), NextRandom(sphereRandom), NextRandom(sphereRandom)) * worldSize;
+			found.clear();
+			QueryBvhSphere(&bvh, center, 4.0f, found);
+		}
+	});
+	result.sphereLinearMilliseconds = MeasureMilliseconds([&]()
+	{
+		u32 sphereRandom = 777;
+		for (u32 i = 0; i < result.sphereQueryCount; ++i)
+		{
+			vec3 center = vec3(NextRandom(sphereRandom), NextRandom(sphereRandom), NextRandom(sphereRandom)) * worldSize;
+			found.clear();
+			for (u32 e = 0; e < entityCount; ++e)
+			{
+				vec3 d = glm::clamp(center, boxes[e].min, boxes[e].max) - center;
+				if (glm::dot(d, d) <= 16.0f)
+					found.push_back(e);
+			}
+		}
+	});
+
+	// Rays from outside the cube through random points in it
+	result.rayCount = 4096;
+	BenchmarkRayData rayData = { &boxes };
+	u32 bvhHits = 0, linearHits = 0;
+	result.rayBvhMilliseconds = MeasureMilliseconds([&]()
+	{
+		u32 rayRandom = 4242;
+		for (u32 i = 0; i < result.rayCount; ++i)
+		{
+			vec3 target = vec3(NextRandom(rayRandom), NextRandom(rayRandom), NextRandom(rayRandom)) * worldSize;
+			vec3 origin = vec3(-worldSize * 0.25f, worldSize * 0.5f, -worldSize * 0.25f);
+			if (RaycastBvh(&bvh, origin, target - origin, FLT_MAX, IntersectBenchmarkBox, &rayData, NULL) != BVH_NULL)
+				bvhHits++;
+		}
+	});
+	result.rayLinearMilliseconds = MeasureMilliseconds([&]()
+	{
+		u32 rayRandom = 4242;
+		for (u32 i = 0; i < result.rayCount; ++i)
+		{
+			vec3 target = vec3(NextRandom(rayRandom), NextRandom(rayRandom), NextRandom(rayRandom)) * worldSize;
+			vec3 origin = vec3(-worldSize * 0.25f, worldSize * 0.5f, -worldSize * 0.25f);
+			f32 closest = FLT_MAX;
+			for (u32 e = 0; e < entityCount; ++e)
+			{
+				f32 distance = IntersectRayAabb(origin, target - origin, boxes[e]);
+				if (distance >= 0.0f && distance < closest)
+					closest = distance;
+			}
+			if (closest != FLT_MAX)
+				linearHits++;
+		}
+	});
+
+	// The BVH answers from fat boxes, it can only find more
+	ASSERT(bvhFound >= linearFound && bvhHits == linearHits, "BVH queries disagree with the linear scans");
+	return result;
+}
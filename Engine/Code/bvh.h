@@ -0,0 +1,137 @@
+//
+// bvh.h : Dynamic bounding volume hierarchy over entities. Leaves hold a slightly
+// enlarged ("fat") box of their entity so small moves need no tree update at all;
+// bigger ones refit the leaf and its ancestors in place, and tree rotations on the way
+// up keep the surface area heuristic cost low as things move. Does not depend on the
+// graphics API.
+//
+
+#pragma once
+
+#include "culling.h"
+
+#define BVH_NULL UINT32_MAX
+
+// Leaves are enlarged by this fraction of their size on each side
+#define BVH_FAT_MARGIN 0.1f
+
+struct Aabb
+{
+	vec3 min;
+	vec3 max;
+};
+
+/**
+ * Box around an axis aligned box once transformed by matrix (Arvo's method).
+ */
+Aabb TransformAabb(const Aabb& box, const mat4& matrix);
+
+struct BvhNode
+{
+	Aabb bounds;
+	u32  parent;	// Next free node while in the free list
+	u32  child0;	// BVH_NULL for leaves
+	u32  child1;
+	u32  entity;	// Leaves only
+};
+
+/**
+ * Nodes live in one array and link to each other by index; freed nodes are reused.
+ * entityLeaves maps entity indices to their leaf (BVH_NULL when not in the tree).
+ */
+struct Bvh
+{
+	std::vector<BvhNode> nodes;
+	std::vector<u32>     entityLeaves;
+	u32                  root;
+	u32                  freeList;
+	u32                  leafCount;
+	u32                  rotationCount;		// Total, for stats
+	u32                  reinsertionCount;	// Total, for stats
+};
+
+void InitBvh(Bvh* bvh, u32 entityCapacity);
+
+bool IsInBvh(const Bvh* bvh, u32 entity);
+
+/**
+ * Adds a leaf for the entity next to the sibling that minimizes the increase of total
+ * surface area (branch and bound search over the tree).
+ */
+void InsertBvhEntity(Bvh* bvh, u32 entity, const Aabb& bounds);
+void RemoveBvhEntity(Bvh* bvh, u32 entity);
+
+/**
+ * Nothing to do while the new bounds stay inside the fat box of the leaf. Otherwise the
+ * leaf is refitted in place when its new box still overlaps the old one, and removed
+ * and inserted again when the entity jumped further. Returns whether the tree changed.
+ */
+bool UpdateBvhEntity(Bvh* bvh, u32 entity, const Aabb& bounds);
+
+/**
+ * Appends the entities whose fat box touches the frustum (conservative, entities up to
+ * BVH_FAT_MARGIN outside can be reported).
+ */
+void QueryBvhFrustum(const Bvh* bvh, const Frustum& frustum, std::vector<u32>& entities);
+
+/**
+ * Appends the entities whose fat box touches the sphere, same caveat as the frustum.
+ */
+void QueryBvhSphere(const Bvh* bvh, vec3 center, f32 radius, std::vector<u32>& entities);
+
+/**
+ * Exact test of a ray against one entity, called for each leaf the ray reaches closer
+ * than the best hit so far. Returns the hit distance along direction, or a negative
+ * value when the entity is missed or only hit beyond maxDistance, the best hit so far.
+ */
+typedef f32 (*BvhRayCallback)(void* data, u32 entity, vec3 origin, vec3 direction, f32 maxDistance);
+
+/**
+ * Closest entity hit by the ray within maxDistance, or BVH_NULL. Leaves are visited
+ * near to far and skipped once a closer hit is known. direction does not need to be
+ * normalized, distances are in units of it.
+ */
+u32 RaycastBvh(const Bvh* bvh, vec3 origin, vec3 direction, f32 maxDistance, BvhRayCallback callback, void* data, f32* hitDistance);
+
+/**
+ * Distance along the ray to the triangle, negative when missed (Moller-Trumbore, both sides).
+ */
+f32 IntersectRayTriangle(vec3 origin, vec3 direction, vec3 a, vec3 b, vec3 c);
+
+/**
+ * Distance along the ray to the box (0 when it starts inside), negative when missed.
+ */
+f32 IntersectRayAabb(vec3 origin, vec3 direction, const Aabb& box);
+
+struct BvhStats
+{
+	u32 leafCount;
+	u32 maxDepth;
+	f32 sahCost;	// Surface area of the internal nodes relative to the root's
+};
+
+BvhStats GetBvhStats(const Bvh* bvh);
+
+struct BvhBenchmark
+{
+	u32 entityCount;
+	f64 insertMilliseconds;			// Every entity inserted one by one
+	f64 refitMilliseconds;			// Every entity moved by a fraction of its size
+	f64 reinsertMilliseconds;		// Every entity moved far away
+	u32 frustumQueryCount;
+	f64 frustumBvhMilliseconds;
+	f64 frustumLinearMilliseconds;	// Same queries testing every entity
+	u32 sphereQueryCount;
+	f64 sphereBvhMilliseconds;
+	f64 sphereLinearMilliseconds;
+	u32 rayCount;
+	f64 rayBvhMilliseconds;
+	f64 rayLinearMilliseconds;
+	BvhStats stats;					// After the moves
+};
+
+/**
+ * Builds a tree over entityCount random boxes and times insertion, refits and queries
+ * against linear scans over the same boxes.
+ */
+BvhBenchmark BenchmarkBvh(u32 entityCount);
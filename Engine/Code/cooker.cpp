@@ -0,0 +1,728 @@
+//
+// cooker.cpp : Entry point of the asset cooker, a command line build of the engine code
+// (built with ASSET_COOKER, which leaves out the main of platform.cpp) that walks the
+// working directory and cooks every asset into what the engine loads at runtime:
+//   models    "<source>.cooked", imported with the load flags of GetEngineModelDescs
+//   textures  "<source>.ctex", block compressed mips, normal maps found through the materials
+//   cubemaps  "<directory>/cubemap.ccube", the decoded faces of any directory holding all six
+//   shaders   every permutation of the engine programs compiled and linked as a check,
+//             nothing is written for them
+// The manifest in the working directory keeps, for each asset, hashes of what it was cooked
+// from: its source bytes, the files it depends on (the .mtl of an .obj), its parameters and
+// the cooker and format versions. Only assets where any of those changed are cooked again,
+// spread over every core with the job system. Those that are up to date but whose source was
+// touched get the timestamp in their cooked file updated instead, so the engine accepts it.
+//
+// Usage: Cooker [working directory] [-force] [-compression bc1|bc7]
+//
+
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+
+#include "engine.h"
+
+#ifdef _DEBUG
+#include <GLFW/glfw3.h>
+#endif // _DEBUG
+
+#ifndef _DEBUG
+#include "../ThirdParty/glfw/include/GLFW/glfw3.h"
+#endif // !_DEBUG
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+
+// Bump it whenever a change in the engine cooks something different from the same inputs
+#define COOKER_VERSION 1
+
+#define COOKER_MANIFEST_PATH    "cooker.manifest"
+#define COOKER_MANIFEST_MAGIC   0x4E414D43 // "CMAN"
+#define COOKER_MANIFEST_VERSION 1
+
+// FNV-1a offset basis
+#define HASH_SEED 14695981039346656037ull
+
+enum AssetKind
+{
+	AssetKind_Model,
+	AssetKind_Texture,
+	AssetKind_Cubemap,
+	AssetKind_Shader,
+	AssetKind_Count
+};
+
+static const char* AssetKindNames[AssetKind_Count] = { "models", "textures", "cubemaps", "shaders" };
+
+struct ManifestEntry
+{
+	u32                      kind;
+	u64                      sourceTimestamp;	// The source hash is reused while it matches
+	u64                      sourceHash;
+	u64                      inputsHash;		// Dependencies, parameters and versions
+	std::vector<std::string> dependencies;
+	std::vector<std::string> normalMaps;		// Models only, textures their materials use as normals
+};
+
+struct CookAsset
+{
+	std::string              path;				// Source file, or the directory of a cubemap
+	AssetKind                kind;
+	u32                      programIdx;		// Shaders, into GetEngineProgramDescs
+	u32                      loadFlags;			// Models, those that change the cooked geometry
+	const ManifestEntry*     previous;			// NULL when it was not in the manifest
+	u64                      sourceTimestamp;
+	u64                      sourceHash;
+	u64                      inputsHash;
+	std::vector<std::string> dependencies;
+	std::vector<std::string> normalMaps;
+	TextureUsage             usage;
+	bool                     dirty;
+	bool                     failed;
+};
+
+// How every cooked file starts
+struct CookedFileHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceTimestamp;
+};
+
+struct CookerOptions
+{
+	const char*        workingDirectory;
+	bool               force;
+	TextureCompression compression;
+};
+
+static u64 HashBytes(const void* data, u64 size, u64 hash = HASH_SEED)
+{
+	// FNV-1a
+	const u8* bytes = (const u8*)data;
+	for (u64 i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+template <typename T>
+static u64 HashValue(const T& value, u64 hash)
+{
+	return HashBytes(&value, sizeof(T), hash);
+}
+
+static u64 HashString(const std::string& str, u64 hash)
+{
+	return HashBytes(str.data(), str.size(), HashValue((u32)str.size(), hash));
+}
+
+static std::string ToLower(std::string str)
+{
+	std::transform(str.begin(), str.end(), str.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+	return str;
+}
+
+static std::string GetExtension(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return std::string();
+	return ToLower(path.substr(dot));
+}
+
+static std::string GetDirectory(const std::string& path)
+{
+	size_t slash = path.find_last_of('/');
+	return slash == std::string::npos ? std::string(".") : path.substr(0, slash);
+}
+
+// Missing files hash to 0, so a dependency that appears later changes the hash as well
+static u64 HashFile(const char* filepath)
+{
+	if (GetFileLastWriteTimestamp(filepath) == 0)
+		return 0;
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(filepath);
+	return file.str ? HashBytes(file.str, file.len) : 0;
+}
+
+// The .mtl files an .obj pulls its materials from
+static void FindObjDependencies(const std::string& path, String file, std::vector<std::string>& dependencies)
+{
+	const char* cursor = file.str;
+	const char* end = file.str + file.len;
+	while (cursor < end)
+	{
+		const char* lineEnd = (const char*)memchr(cursor, '\n', end - cursor);
+		if (!lineEnd)
+			lineEnd = end;
+
+		if (lineEnd - cursor > 7 && strncmp(cursor, "mtllib ", 7) == 0)
+		{
+			std::string name(cursor + 7, lineEnd);
+			while (!name.empty() && (name.back() == '\r' || name.back() == ' ' || name.back() == '\t'))
+				name.pop_back();
+			if (!name.empty())
+				dependencies.push_back(GetDirectory(path) + "/" + name);
+		}
+		cursor = lineEnd + 1;
+	}
+}
+
+static void HashAssetSource(CookAsset& asset)
+{
+	asset.sourceTimestamp = asset.kind == AssetKind_Cubemap ? GetCubemapSourceTimestamp(asset.path.c_str()) : GetFileLastWriteTimestamp(asset.path.c_str());
+
+	// Unchanged since the last run as far as the file system can tell, no need to read it
+	if (asset.previous && asset.previous->kind == (u32)asset.kind && asset.previous->sourceTimestamp == asset.sourceTimestamp && asset.sourceTimestamp != 0)
+	{
+		asset.sourceHash = asset.previous->sourceHash;
+		asset.dependencies = asset.previous->dependencies;
+		return;
+	}
+
+	if (asset.kind == AssetKind_Cubemap)
+	{
+		asset.sourceHash = HASH_SEED;
+		for (u32 face = 0; face < 6; ++face)
+			asset.sourceHash = HashValue(HashFile(GetCubemapFacePath(asset.path.c_str(), face).c_str()), asset.sourceHash);
+		return;
+	}
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(asset.path.c_str());
+	asset.sourceHash = file.str ? HashBytes(file.str, file.len) : 0;
+	if (file.str && asset.kind == AssetKind_Model && GetExtension(asset.path) == ".obj")
+		FindObjDependencies(asset.path, file, asset.dependencies);
+}
+
+static u64 HashAssetInputs(const CookAsset& asset, const CookerOptions& options)
+{
+	u64 hash = HashValue((u32)COOKER_VERSION, HashValue((u32)asset.kind, HASH_SEED));
+	for (const std::string& dependency : asset.dependencies)
+		hash = HashValue(HashFile(dependency.c_str()), HashString(dependency, hash));
+
+	switch (asset.kind)
+	{
+	case AssetKind_Model:
+		hash = HashValue((u32)COOKED_MODEL_VERSION, hash);
+		hash = HashValue(asset.loadFlags, hash);
+		break;
+	case AssetKind_Texture:
+		hash = HashValue((u32)COOKED_TEXTURE_VERSION, hash);
+		hash = HashValue((u32)asset.usage, hash);
+		hash = HashValue((u32)options.compression, hash);
+		break;
+	case AssetKind_Cubemap:
+		hash = HashValue((u32)COOKED_CUBEMAP_VERSION, hash);
+		break;
+	case AssetKind_Shader:
+	{
+		const ProgramDesc& desc = GetEngineProgramDescs()[asset.programIdx];
+		hash = HashString(desc.programName, HashValue(desc.compute, hash));
+		for (const ProgramPermutationAxis& axis : desc.permutationAxes)
+		{
+			hash = HashString(axis.define, hash);
+			hash = HashBytes(axis.values.data(), axis.values.size() * sizeof(u32), hash);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return hash;
+}
+
+static std::string GetCookedPath(const CookAsset& asset)
+{
+	switch (asset.kind)
+	{
+	case AssetKind_Model:   return asset.path + ".cooked";
+	case AssetKind_Texture: return asset.path + ".ctex";
+	case AssetKind_Cubemap: return GetCookedCubemapPath(asset.path.c_str());
+	default:                return std::string();
+	}
+}
+
+// False when the cooked file is missing or not the current version, otherwise its source
+// timestamp is brought up to date
+static bool RestampCookedFile(const char* cookedPath, u32 magic, u32 version, u64 sourceTimestamp)
+{
+	FILE* file = fopen(cookedPath, "r+b");
+	if (!file)
+		return false;
+
+	CookedFileHeader header = {};
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == magic && header.version == version;
+	if (valid && header.sourceTimestamp != sourceTimestamp)
+	{
+		fseek(file, offsetof(CookedFileHeader, sourceTimestamp), SEEK_SET);
+		valid = fwrite(&sourceTimestamp, sizeof(sourceTimestamp), 1, file) == 1;
+	}
+	fclose(file);
+	return valid;
+}
+
+static bool IsCookedOutputValid(const CookAsset& asset)
+{
+	std::string cookedPath = GetCookedPath(asset);
+	switch (asset.kind)
+	{
+	case AssetKind_Model:   return RestampCookedFile(cookedPath.c_str(), COOKED_MODEL_MAGIC, COOKED_MODEL_VERSION, asset.sourceTimestamp);
+	case AssetKind_Texture: return RestampCookedFile(cookedPath.c_str(), COOKED_TEXTURE_MAGIC, COOKED_TEXTURE_VERSION, asset.sourceTimestamp);
+	case AssetKind_Cubemap: return RestampCookedFile(cookedPath.c_str(), COOKED_CUBEMAP_MAGIC, COOKED_CUBEMAP_VERSION, asset.sourceTimestamp);
+	default:                return true;
+	}
+}
+
+static void UpdateAssetDirty(CookAsset& asset, const CookerOptions& options)
+{
+	asset.inputsHash = HashAssetInputs(asset, options);
+	asset.dirty = options.force || !asset.previous || asset.previous->kind != (u32)asset.kind ||
+		asset.previous->sourceHash != asset.sourceHash || asset.previous->inputsHash != asset.inputsHash ||
+		!IsCookedOutputValid(asset);
+
+	// Clean models keep the normal maps found the last time they were cooked
+	if (!asset.dirty && asset.kind == AssetKind_Model)
+		asset.normalMaps = asset.previous->normalMaps;
+}
+
+static bool CookModel(CookAsset& asset)
+{
+	Mesh mesh = {};
+	mesh.loadFlags = asset.loadFlags;
+	std::vector<CookedMaterial> materials;
+	std::vector<u32> submeshMaterials;
+	if (!ImportModel(asset.path.c_str(), mesh, materials, submeshMaterials))
+		return false;
+
+	asset.normalMaps.clear();
+	for (const CookedMaterial& material : materials)
+	{
+		const std::string& normalMap = material.texturePaths[MaterialTexture_Normals];
+		if (!normalMap.empty())
+			asset.normalMaps.push_back(normalMap);
+	}
+
+	std::string cookedPath = GetCookedPath(asset);
+	if (!WriteCookedModel(cookedPath.c_str(), asset.sourceTimestamp, mesh, materials, submeshMaterials))
+	{
+		ELOG("Could not write the cooked model %s", cookedPath.c_str());
+		return false;
+	}
+	return true;
+}
+
+static void CookAssetOnJob(CookAsset& asset, const CookerOptions& options)
+{
+	ScopedTemporaryMemory temp(GetTempArena());
+	bool cooked = false;
+	switch (asset.kind)
+	{
+	case AssetKind_Model:   cooked = CookModel(asset); break;
+	case AssetKind_Texture: cooked = CookTexture(asset.path.c_str(), asset.usage, options.compression); break;
+	case AssetKind_Cubemap: cooked = CookCubemap(asset.path.c_str()); break;
+	default:                break;
+	}
+	asset.failed = !cooked;
+}
+
+static void CookAssetsOfKind(std::vector<CookAsset>& assets, AssetKind kind, const CookerOptions& options)
+{
+	std::vector<CookAsset*> dirtyAssets;
+	for (CookAsset& asset : assets)
+		if (asset.kind == kind && asset.dirty)
+			dirtyAssets.push_back(&asset);
+
+	// One asset per job, the encoders spread their own work on top
+	u32 grain = (u32)dirtyAssets.size() / (JOB_DEQUE_CAPACITY / 2) + 1;
+	ParallelFor((u32)dirtyAssets.size(), grain, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+			CookAssetOnJob(*dirtyAssets[i], options);
+	});
+}
+
+static GLFWwindow* CreateHiddenOpenGLContext()
+{
+	if (!glfwInit())
+	{
+		ELOG("glfwInit() failed");
+		return NULL;
+	}
+
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+	GLFWwindow* window = glfwCreateWindow(1, 1, "Cooker", NULL, NULL);
+	if (!window)
+	{
+		ELOG("glfwCreateWindow() failed");
+		glfwTerminate();
+		return NULL;
+	}
+
+	glfwMakeContextCurrent(window);
+	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+	{
+		ELOG("Failed to initialize OpenGL context");
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		return NULL;
+	}
+	return window;
+}
+
+// Starts every permutation of every dirty shader before waiting on any, so drivers with
+// parallel shader compilation get them all at once
+static void CheckShaders(std::vector<CookAsset>& assets)
+{
+	std::vector<CookAsset*> dirtyShaders;
+	for (CookAsset& asset : assets)
+		if (asset.kind == AssetKind_Shader && asset.dirty)
+			dirtyShaders.push_back(&asset);
+	if (dirtyShaders.empty())
+		return;
+
+	GLFWwindow* window = CreateHiddenOpenGLContext();
+	if (!window)
+	{
+		for (CookAsset* asset : dirtyShaders)
+			asset->failed = true;
+		return;
+	}
+
+	struct ShaderCompile
+	{
+		CookAsset*     asset;
+		ProgramCompile compile;
+		std::string    defines;
+	};
+	std::vector<ShaderCompile> compiles;
+
+	for (CookAsset* asset : dirtyShaders)
+	{
+		ScopedTemporaryMemory temp(GetTempArena());
+		String source = ReadTextFile(asset->path.c_str());
+		if (!source.str)
+		{
+			asset->failed = true;
+			continue;
+		}
+
+		const ProgramDesc& desc = GetEngineProgramDescs()[asset->programIdx];
+		u32 permutationCount = 1;
+		for (const ProgramPermutationAxis& axis : desc.permutationAxes)
+			permutationCount *= (u32)axis.values.size();
+
+		// Same mixed radix keys as GetProgramPermutation, the last axis varies fastest
+		for (u32 key = 0; key < permutationCount; ++key)
+		{
+			std::string defines;
+			for (u32 i = 0, remainder = key; i < desc.permutationAxes.size(); ++i)
+			{
+				const ProgramPermutationAxis& axis = desc.permutationAxes[desc.permutationAxes.size() - 1 - i];
+				defines = "#define " + axis.define + " " + std::to_string(axis.values[remainder % axis.values.size()]) + "\n" + defines;
+				remainder /= (u32)axis.values.size();
+			}
+
+			ShaderCompile compile = { asset, BeginProgramCompile(source, desc.programName, defines.c_str(), desc.compute), defines };
+			compiles.push_back(compile);
+		}
+	}
+
+	for (ShaderCompile& compile : compiles)
+	{
+		GLuint handle = EndProgramCompile(compile.compile, GetEngineProgramDescs()[compile.asset->programIdx].programName);
+		if (handle == 0)
+		{
+			ELOG("%s failed with the permutation:\n%s", compile.asset->path.c_str(), compile.defines.c_str());
+			compile.asset->failed = true;
+		}
+		glDeleteProgram(handle);
+	}
+
+	ILOG("Compiled %u program permutations of %u shaders", (u32)compiles.size(), (u32)dirtyShaders.size());
+	glfwDestroyWindow(window);
+	glfwTerminate();
+}
+
+static void ReadManifest(std::map<std::string, ManifestEntry>& manifest)
+{
+	if (GetFileLastWriteTimestamp(COOKER_MANIFEST_PATH) == 0)
+		return;
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(COOKER_MANIFEST_PATH);
+	CookedReader reader = { (const u8*)file.str, (const u8*)file.str + file.len, file.str != NULL };
+
+	if (ReadCookedValue<u32>(reader) != COOKER_MANIFEST_MAGIC ||
+		ReadCookedValue<u32>(reader) != COOKER_MANIFEST_VERSION)
+	{
+		return;
+	}
+
+	u32 entryCount = ReadCookedValue<u32>(reader);
+	for (u32 i = 0; i < entryCount && reader.valid; ++i)
+	{
+		std::string path = ReadCookedString(reader);
+		ManifestEntry entry = {};
+		entry.kind = ReadCookedValue<u32>(reader);
+		entry.sourceTimestamp = ReadCookedValue<u64>(reader);
+		entry.sourceHash = ReadCookedValue<u64>(reader);
+		entry.inputsHash = ReadCookedValue<u64>(reader);
+		u32 dependencyCount = ReadCookedValue<u32>(reader);
+		for (u32 j = 0; j < dependencyCount && reader.valid; ++j)
+			entry.dependencies.push_back(ReadCookedString(reader));
+		u32 normalMapCount = ReadCookedValue<u32>(reader);
+		for (u32 j = 0; j < normalMapCount && reader.valid; ++j)
+			entry.normalMaps.push_back(ReadCookedString(reader));
+		manifest[path] = entry;
+	}
+
+	if (!reader.valid)
+	{
+		ELOG("The manifest %s is corrupted, cooking everything again", COOKER_MANIFEST_PATH);
+		manifest.clear();
+	}
+}
+
+// Failed assets are left out, so the next run tries them again
+static bool WriteManifest(const std::vector<CookAsset>& assets)
+{
+	u32 entryCount = 0;
+	for (const CookAsset& asset : assets)
+		entryCount += asset.failed ? 0 : 1;
+
+	std::vector<u8> data;
+	WriteCookedValue(data, (u32)COOKER_MANIFEST_MAGIC);
+	WriteCookedValue(data, (u32)COOKER_MANIFEST_VERSION);
+	WriteCookedValue(data, entryCount);
+	for (const CookAsset& asset : assets)
+	{
+		if (asset.failed)
+			continue;
+
+		WriteCookedString(data, asset.path);
+		WriteCookedValue(data, (u32)asset.kind);
+		WriteCookedValue(data, asset.sourceTimestamp);
+		WriteCookedValue(data, asset.sourceHash);
+		WriteCookedValue(data, asset.inputsHash);
+		WriteCookedValue(data, (u32)asset.dependencies.size());
+		for (const std::string& dependency : asset.dependencies)
+			WriteCookedString(data, dependency);
+		WriteCookedValue(data, (u32)asset.normalMaps.size());
+		for (const std::string& normalMap : asset.normalMaps)
+			WriteCookedString(data, normalMap);
+	}
+
+	return WriteBinaryFile(COOKER_MANIFEST_PATH, data.data(), data.size());
+}
+
+static void FindAssets(std::vector<CookAsset>& assets)
+{
+	std::vector<std::string> filepaths;
+	ListDirectoryFiles(".", filepaths);
+	std::sort(filepaths.begin(), filepaths.end());
+
+	// Directories holding the six faces are cubemaps, their faces are not cooked as textures
+	std::set<std::string> cubemapFaces;
+	std::set<std::string> directories;
+	for (const std::string& filepath : filepaths)
+		directories.insert(GetDirectory(filepath));
+	for (const std::string& directory : directories)
+	{
+		if (GetCubemapSourceTimestamp(directory.c_str()) == 0)
+			continue;
+
+		CookAsset asset = {};
+		asset.path = directory;
+		asset.kind = AssetKind_Cubemap;
+		assets.push_back(asset);
+		for (u32 face = 0; face < 6; ++face)
+			cubemapFaces.insert(GetCubemapFacePath(directory.c_str(), face));
+	}
+
+	const std::vector<ProgramDesc>& programs = GetEngineProgramDescs();
+	const std::vector<ModelDesc>& models = GetEngineModelDescs();
+	for (const std::string& filepath : filepaths)
+	{
+		std::string extension = GetExtension(filepath);
+
+		CookAsset asset = {};
+		asset.path = filepath;
+		if (extension == ".obj" || extension == ".fbx" || extension == ".gltf" || extension == ".glb" || extension == ".dae" || extension == ".3ds")
+		{
+			asset.kind = AssetKind_Model;
+
+			// With the flags the engine loads it with, models it does not list get the default ones
+			u32 loadFlags = MESH_LOAD_DEFAULT_FLAGS;
+			for (const ModelDesc& model : models)
+				if (ToLower(model.filepath) == ToLower(filepath))
+					loadFlags = model.loadFlags;
+			asset.loadFlags = loadFlags & ~MESH_LOAD_RUNTIME_FLAGS;
+		}
+		else if (extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp")
+		{
+			if (cubemapFaces.count(filepath))
+				continue;
+			asset.kind = AssetKind_Texture;
+		}
+		else if (extension == ".glsl")
+		{
+			// The engine opens them with lowercase directories, which Windows does not mind
+			asset.programIdx = UINT32_MAX;
+			for (u32 i = 0; i < programs.size(); ++i)
+				if (ToLower(programs[i].filepath) == ToLower(filepath))
+					asset.programIdx = i;
+			if (asset.programIdx == UINT32_MAX)
+			{
+				ILOG("Skipping %s, no engine program uses it", filepath.c_str());
+				continue;
+			}
+			asset.kind = AssetKind_Shader;
+		}
+		else
+		{
+			continue;
+		}
+		assets.push_back(asset);
+	}
+}
+
+static bool ParseOptions(int argc, char** argv, CookerOptions& options)
+{
+	options.workingDirectory = NULL;
+	options.force = false;
+	options.compression = TextureCompression_BC7;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-force") == 0)
+		{
+			options.force = true;
+		}
+		else if (strcmp(argv[i], "-compression") == 0 && i + 1 < argc)
+		{
+			std::string compression = ToLower(argv[++i]);
+			if (compression == "bc1")
+				options.compression = TextureCompression_BC1;
+			else if (compression == "bc7")
+				options.compression = TextureCompression_BC7;
+			else
+				return false;
+		}
+		else if (argv[i][0] != '-' && !options.workingDirectory)
+		{
+			options.workingDirectory = argv[i];
+		}
+		else
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	CookerOptions options = {};
+	if (!ParseOptions(argc, argv, options))
+	{
+		ELOG("Usage: Cooker [working directory] [-force] [-compression bc1|bc7]");
+		return -1;
+	}
+
+	// Paths are kept relative to it, as the engine opens them
+	if (options.workingDirectory && chdir(options.workingDirectory) != 0)
+	{
+		ELOG("Could not change to the working directory %s", options.workingDirectory);
+		return -1;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	InitJobSystem(0);
+
+	std::map<std::string, ManifestEntry> manifest;
+	ReadManifest(manifest);
+
+	std::vector<CookAsset> assets;
+	FindAssets(assets);
+	for (CookAsset& asset : assets)
+	{
+		auto it = manifest.find(asset.path);
+		asset.previous = it != manifest.end() ? &it->second : NULL;
+	}
+
+	ParallelFor((u32)assets.size(), (u32)assets.size() / (JOB_DEQUE_CAPACITY / 2) + 1, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+			HashAssetSource(assets[i]);
+	});
+
+	// Models first, which textures are normal maps is only known from their materials
+	for (CookAsset& asset : assets)
+		if (asset.kind == AssetKind_Model)
+			UpdateAssetDirty(asset, options);
+	CookAssetsOfKind(assets, AssetKind_Model, options);
+
+	std::set<std::string> normalMaps;
+	for (const CookAsset& asset : assets)
+		normalMaps.insert(asset.normalMaps.begin(), asset.normalMaps.end());
+
+	for (CookAsset& asset : assets)
+	{
+		if (asset.kind == AssetKind_Model)
+			continue;
+		asset.usage = normalMaps.count(asset.path) ? TextureUsage_Normals : TextureUsage_Color;
+		UpdateAssetDirty(asset, options);
+	}
+	CookAssetsOfKind(assets, AssetKind_Texture, options);
+	CookAssetsOfKind(assets, AssetKind_Cubemap, options);
+	CheckShaders(assets);
+
+	u32 cookedCounts[AssetKind_Count] = {};
+	u32 upToDateCounts[AssetKind_Count] = {};
+	u32 failedCount = 0;
+	for (const CookAsset& asset : assets)
+	{
+		if (asset.failed)
+		{
+			ELOG("Failed to cook %s", asset.path.c_str());
+			failedCount++;
+		}
+		else if (asset.dirty)
+		{
+			cookedCounts[asset.kind]++;
+		}
+		else
+		{
+			upToDateCounts[asset.kind]++;
+		}
+	}
+
+	if (!WriteManifest(assets))
+		ELOG("Could not write the manifest %s", COOKER_MANIFEST_PATH);
+
+	for (u32 kind = 0; kind < AssetKind_Count; ++kind)
+		ILOG("%s: %u cooked, %u up to date", AssetKindNames[kind], cookedCounts[kind], upToDateCounts[kind]);
+	f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+	ILOG("Cooked in %.2f s on %u threads, %u failed", seconds, GetJobThreadCount(), failedCount);
+
+	ShutdownJobSystem();
+	return failedCount > 0 ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+//
+// culling.cpp : Per frame visibility tests, see culling.h.
+//
+
+#include "culling.h"
+
+#include <emmintrin.h>
+#include <float.h>
+
+Frustum ExtractFrustum(const mat4& viewProjection)
+{
+	// Rows of the matrix (glm is column major)
+	vec4 rows[4];
+	for (u32 r = 0; r < 4; ++r)
+		rows[r] = vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; // Left
+	frustum.planes[1] = rows[3] - rows[0]; // Right
+	frustum.planes[2] = rows[3] + rows[1]; // Bottom
+	frustum.planes[3] = rows[3] - rows[1]; // Top
+	frustum.planes[4] = rows[3] + rows[2]; // Near
+	frustum.planes[5] = rows[3] - rows[2]; // Far
+
+	for (u32 i = 0; i < 6; ++i)
+		frustum.planes[i] /= glm::length(vec3(frustum.planes[i]));
+
+	return frustum;
+}
+
+void BuildMeshletCullData(const std::vector<Meshlet>& meshlets, MeshletCullData& cullData)
+{
+	cullData = MeshletCullData{};
+	for (const Meshlet& meshlet : meshlets)
+	{
+		cullData.centerX.push_back(meshlet.center.x);
+		cullData.centerY.push_back(meshlet.center.y);
+		cullData.centerZ.push_back(meshlet.center.z);
+		cullData.radius.push_back(meshlet.radius);
+		cullData.coneAxisX.push_back(meshlet.coneAxis.x);
+		cullData.coneAxisY.push_back(meshlet.coneAxis.y);
+		cullData.coneAxisZ.push_back(meshlet.coneAxis.z);
+		cullData.coneCutoff.push_back(meshlet.coneCutoff);
+	}
+}
+
+// Visibility mask (one bit per meshlet) of a batch of MESHLET_CULL_BATCH meshlets
+static u32 CullMeshletBatch(const f32* centerX, const f32* centerY, const f32* centerZ, const f32* radius,
+	const f32* coneAxisX, const f32* coneAxisY, const f32* coneAxisZ, const f32* coneCutoff,
+	const Frustum& frustum, vec3 cameraPosition, bool cullBackfacing)
+{
+	__m128 cx = _mm_loadu_ps(centerX);
+	__m128 cy = _mm_loadu_ps(centerY);
+	__m128 cz = _mm_loadu_ps(centerZ);
+	__m128 r = _mm_loadu_ps(radius);
+	__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), r);
+
+	// Inside unless the sphere is completely behind one of the planes
+	__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+	for (u32 i = 0; i < 6; ++i)
+	{
+		const vec4& plane = frustum.planes[i];
+		__m128 distance = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+			_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+		visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, negativeRadius));
+	}
+
+	if (cullBackfacing)
+	{
+		// Every triangle faces away when dot(center - camera, axis) >= cutoff * |center - camera| + radius
+		__m128 dx = _mm_sub_ps(cx, _mm_set1_ps(cameraPosition.x));
+		__m128 dy = _mm_sub_ps(cy, _mm_set1_ps(cameraPosition.y));
+		__m128 dz = _mm_sub_ps(cz, _mm_set1_ps(cameraPosition.z));
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 projection = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(coneAxisX)), _mm_mul_ps(dy, _mm_loadu_ps(coneAxisY))),
+			_mm_mul_ps(dz, _mm_loadu_ps(coneAxisZ)));
+		__m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(coneCutoff), distance), r);
+		visible = _mm_andnot_ps(_mm_cmpge_ps(projection, limit), visible);
+	}
+
+	return (u32)_mm_movemask_ps(visible);
+}
+
+u32 CullMeshlets(const MeshletCullData& cullData, u32 firstMeshlet, u32 meshletCount, const Frustum& frustum, vec3 cameraPosition, bool cullBackfacing, u8* visible)
+{
+	ASSERT(firstMeshlet + meshletCount <= cullData.radius.size(), "Meshlet range out of bounds");
+
+	u32 visibleCount = 0;
+	u32 i = 0;
+	for (; i + MESHLET_CULL_BATCH <= meshletCount; i += MESHLET_CULL_BATCH)
+	{
+		u32 m = firstMeshlet + i;
+		u32 mask = CullMeshletBatch(&cullData.centerX[m], &cullData.centerY[m], &cullData.centerZ[m], &cullData.radius[m],
+			&cullData.coneAxisX[m], &cullData.coneAxisY[m], &cullData.coneAxisZ[m], &cullData.coneCutoff[m],
+			frustum, cameraPosition, cullBackfacing);
+
+		for (u32 k = 0; k < MESHLET_CULL_BATCH; ++k)
+		{
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += visible[i + k];
+		}
+	}
+
+	// The remaining meshlets go through a padded copy of the batch
+	if (i < meshletCount)
+	{
+		f32 batch[8][MESHLET_CULL_BATCH] = {};
+		const std::vector<f32>* columns[8] = { &cullData.centerX, &cullData.centerY, &cullData.centerZ, &cullData.radius,
+			&cullData.coneAxisX, &cullData.coneAxisY, &cullData.coneAxisZ, &cullData.coneCutoff };
+		for (u32 k = 0; k < meshletCount - i; ++k)
+		{
+			for (u32 c = 0; c < 8; ++c)
+				batch[c][k] = (*columns[c])[firstMeshlet + i + k];
+		}
+
+		u32 mask = CullMeshletBatch(batch[0], batch[1], batch[2], batch[3], batch[4], batch[5], batch[6], batch[7],
+			frustum, cameraPosition, cullBackfacing);
+
+		for (u32 k = 0; k < meshletCount - i; ++k)
+		{
+			visible[i + k] = (mask >> k) & 1;
+			visibleCount += visible[i + k];
+		}
+	}
+
+	return visibleCount;
+}
@@ -0,0 +1,50 @@
+//
+// culling.h : CPU visibility tests run every frame (frustum planes, meshlet cone and
+// frustum culling...). Like mesh_processing.h it does not depend on the graphics API.
+//
+
+#pragma once
+
+#include "mesh_processing.h"
+
+typedef glm::vec4 vec4;
+typedef glm::mat4 mat4;
+
+/**
+ * Planes of a view volume as (normal, distance) with the normals pointing inside, so
+ * a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for the six planes.
+ */
+struct Frustum
+{
+	vec4 planes[6];
+};
+
+/**
+ * Extracts the frustum planes from a projection matrix (Gribb-Hartmann). With a
+ * world-view-projection matrix the planes are in model space. The planes are
+ * normalized, so distances are in the units of that space.
+ */
+Frustum ExtractFrustum(const mat4& viewProjection);
+
+// Meshlets tested per iteration of the culling kernel (one SSE register)
+#define MESHLET_CULL_BATCH 4
+
+/**
+ * Structure-of-arrays copy of the meshlet bounds, so the culling kernel loads one
+ * field of MESHLET_CULL_BATCH meshlets at a time.
+ */
+struct MeshletCullData
+{
+	std::vector<f32> centerX, centerY, centerZ, radius;
+	std::vector<f32> coneAxisX, coneAxisY, coneAxisZ, coneCutoff;
+};
+
+void BuildMeshletCullData(const std::vector<Meshlet>& meshlets, MeshletCullData& cullData);
+
+/**
+ * Tests meshlets [firstMeshlet, firstMeshlet + meshletCount) against a model space
+ * frustum and, when cullBackfacing is set, against the camera position (also in model
+ * space) with their normal cones. visible receives 1 or 0 for each meshlet. Returns
+ * the number of visible meshlets.
+ */
+u32 CullMeshlets(const MeshletCullData& cullData, u32 firstMeshlet, u32 meshletCount, const Frustum& frustum, vec3 cameraPosition, bool cullBackfacing, u8* visible);
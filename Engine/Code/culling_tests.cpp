@@ -0,0 +1,358 @@
+//
+// culling_tests.cpp : Entry point of the culling tests, a command line build of the engine
+// code (built with ASSET_COOKER like the cooker, which leaves out the main of platform.cpp)
+// that checks the CPU culling without a GPU:
+//   software occlusion  a synthetic room rasterized into the masked buffer, the boxes it
+//                       reports as occluded checked against a per pixel ray cast reference,
+//                       then the occluders of the Room benchmarked on 1, 2, 4... threads
+//   PVS                 two synthetic rooms joined by a doorway, the set of points in each
+//                       checked for the props they see and the props of the other room
+// The Room is imported straight from its source, nothing is uploaded. Returns 0 when every
+// test passed.
+//
+// Usage: CullingTests [working directory]
+//
+
+#ifdef _WIN32
+#include <direct.h>
+#define chdir _chdir
+#else
+#include <unistd.h>
+#endif
+
+#include "engine.h"
+
+#include <thread>
+
+// Boxes the reference finds hidden that the masked buffer must also cull, the rest are
+// lost to its conservative depths
+#define OCCLUSION_TEST_MIN_CAUGHT 0.8f
+
+#define OCCLUSION_TEST_FRAMES         8
+#define OCCLUSION_TEST_BOXES_PER_FRAME 2000
+
+// Points of a cell the reference looks from to tell what the cell sees through a doorway
+#define PVS_TEST_CELL_SAMPLES 1024
+
+// Deterministic values in [0, 1)
+static f32 NextRandom(u32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+static void AddBox(std::vector<vec3>& positions, std::vector<u32>& indices, vec3 min, vec3 max)
+{
+	static const u32 faces[6][4] = { { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 4, 6, 2 }, { 1, 3, 7, 5 } };
+	static const u32 corners[6] = { 0, 1, 2, 0, 2, 3 };
+
+	u32 firstVertex = (u32)positions.size();
+	for (u32 i = 0; i < 8; ++i)
+		positions.push_back(vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z));
+	for (const auto& face : faces)
+		for (u32 corner : corners)
+			indices.push_back(firstVertex + face[corner]);
+}
+
+// Closest 1 / w of the occluders at the center of each pixel, cast through every triangle
+static std::vector<f32> RasterizeReference(const OccluderMesh& mesh, const mat4& viewProjection, u32 width, u32 height)
+{
+	std::vector<f32> depth((u64)width * height, 0.0f);
+	mat4 inverseViewProjection = glm::inverse(viewProjection);
+	for (u32 y = 0; y < height; ++y)
+	{
+		for (u32 x = 0; x < width; ++x)
+		{
+			vec2 ndc = vec2((x + 0.5f) / width, (y + 0.5f) / height) * 2.0f - 1.0f;
+			vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+			vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+			vec3 origin = vec3(nearPoint) / nearPoint.w;
+			vec3 direction = vec3(farPoint) / farPoint.w - origin;
+
+			f32& pixel = depth[(u64)y * width + x];
+			for (u32 i = 0; i + 2 < mesh.indices.size(); i += 3)
+			{
+				f32 t = IntersectRayTriangle(origin, direction, mesh.positions[mesh.indices[i]], mesh.positions[mesh.indices[i + 1]], mesh.positions[mesh.indices[i + 2]]);
+				if (t < 0.0f || t > 1.0f)
+					continue;
+				vec4 clip = viewProjection * vec4(origin + direction * t, 1.0f);
+				pixel = glm::max(pixel, 1.0f / clip.w);
+			}
+		}
+	}
+	return depth;
+}
+
+// Occluded when every pixel under the screen rectangle of the box has an occluder closer
+// than the closest corner of the box
+static bool IsAabbOccludedReference(const std::vector<f32>& depth, u32 width, u32 height, const Aabb& box, const mat4& viewProjection)
+{
+	vec2 screenMin = vec2(FLT_MAX);
+	vec2 screenMax = vec2(-FLT_MAX);
+	f32 boxDepth = 0.0f;
+	for (u32 i = 0; i < 8; ++i)
+	{
+		vec4 clip = viewProjection * vec4(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z, 1.0f);
+		if (clip.w < OCCLUSION_NEAR_W)
+			return false;
+		vec2 screen = (vec2(clip) / clip.w * 0.5f + 0.5f) * vec2(width, height);
+		screenMin = glm::min(screenMin, screen);
+		screenMax = glm::max(screenMax, screen);
+		boxDepth = glm::max(boxDepth, 1.0f / clip.w);
+	}
+
+	if (screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= width || screenMin.y >= height)
+		return false;
+
+	for (i32 y = glm::max(0, (i32)screenMin.y); y <= glm::min((i32)height - 1, (i32)screenMax.y); ++y)
+		for (i32 x = glm::max(0, (i32)screenMin.x); x <= glm::min((i32)width - 1, (i32)screenMax.x); ++x)
+			if (depth[(u64)y * width + x] <= boxDepth)
+				return false;
+	return true;
+}
+
+// A 20 x 6 x 20 room with a wall across the middle and a row of pillars, seen from a
+// camera going around it. A box reported occluded that the reference sees is a failure.
+static bool TestSoftwareOcclusion()
+{
+	OccluderMesh room;
+	AddBox(room.positions, room.indices, vec3(-10.0f, 0.0f, -10.0f), vec3(10.0f, 0.2f, 10.0f));
+	AddBox(room.positions, room.indices, vec3(-10.0f, 0.0f, -10.0f), vec3(-9.8f, 6.0f, 10.0f));
+	AddBox(room.positions, room.indices, vec3(9.8f, 0.0f, -10.0f), vec3(10.0f, 6.0f, 10.0f));
+	AddBox(room.positions, room.indices, vec3(-10.0f, 0.0f, -10.0f), vec3(10.0f, 6.0f, -9.8f));
+	AddBox(room.positions, room.indices, vec3(-10.0f, 0.0f, 9.8f), vec3(10.0f, 6.0f, 10.0f));
+	AddBox(room.positions, room.indices, vec3(-1.0f, 0.0f, -6.0f), vec3(1.0f, 6.0f, 6.0f));
+	for (u32 i = 0; i < 6; ++i)
+		AddBox(room.positions, room.indices, vec3(-8.0f + i * 3.0f, 0.0f, 3.0f), vec3(-7.0f + i * 3.0f, 4.0f, 4.0f));
+
+	MaskedOcclusionBuffer buffer;
+	InitMaskedOcclusionBuffer(&buffer, OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+
+	u32 random = 7;
+	u32 tested = 0;
+	u32 occluded = 0;
+	u32 referenceOccluded = 0;
+	u32 falseOcclusions = 0;
+	for (u32 frame = 0; frame < OCCLUSION_TEST_FRAMES; ++frame)
+	{
+		f32 angle = frame * 0.785f;
+		vec3 eye = vec3(cosf(angle) * 6.0f, 1.7f, sinf(angle) * 6.0f + (frame % 2 ? 0.0f : 2.0f));
+		mat4 view = glm::lookAt(eye, eye - vec3(cosf(angle), 0.0f, sinf(angle)), vec3(0.0f, 1.0f, 0.0f));
+		mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 60.0f) * view;
+
+		ClearMaskedOcclusionBuffer(&buffer);
+		OccluderInstance instance = { &room, viewProjection };
+		RasterizeOccluders(&buffer, &instance, 1);
+		std::vector<f32> reference = RasterizeReference(room, viewProjection, buffer.width, buffer.height);
+
+		for (u32 i = 0; i < OCCLUSION_TEST_BOXES_PER_FRAME; ++i)
+		{
+			vec3 center = vec3(-9.0f + 18.0f * NextRandom(random), 0.3f + 4.0f * NextRandom(random), -9.0f + 18.0f * NextRandom(random));
+			Aabb box = { center - vec3(0.2f), center + vec3(0.2f) };
+			bool boxOccluded = IsAabbOccluded(&buffer, box, viewProjection);
+			bool boxReferenceOccluded = IsAabbOccludedReference(reference, buffer.width, buffer.height, box, viewProjection);
+
+			tested++;
+			occluded += boxOccluded ? 1 : 0;
+			referenceOccluded += boxReferenceOccluded ? 1 : 0;
+			falseOcclusions += boxOccluded && !boxReferenceOccluded ? 1 : 0;
+		}
+	}
+
+	bool passed = falseOcclusions == 0 && occluded >= OCCLUSION_TEST_MIN_CAUGHT * referenceOccluded;
+	ILOG("Software occlusion %s: %u boxes, %u occluded of the %u the reference finds hidden, %u false occlusions",
+		passed ? "passed" : "FAILED", tested, occluded, referenceOccluded, falseOcclusions);
+	return passed;
+}
+
+// The occluders of the Room as LoadModel builds them, minus the upload
+static bool BenchmarkRoomOcclusion()
+{
+	const ModelDesc& room = GetEngineModelDescs()[EngineModel_Room];
+	if (GetFileLastWriteTimestamp(room.filepath) == 0)
+	{
+		ILOG("Skipping the Room occlusion benchmark, %s not found", room.filepath);
+		return true;
+	}
+
+	Mesh mesh = {};
+	mesh.loadFlags = room.loadFlags;
+	std::vector<CookedMaterial> materials;
+	std::vector<u32> submeshMaterials;
+	if (!ImportModel(room.filepath, mesh, materials, submeshMaterials))
+		return false;
+	for (const Submesh& submesh : mesh.submeshes)
+		BuildSubmeshOccluder(mesh, submesh);
+
+	std::vector<SoftwareOcclusionBenchmark> results;
+	BenchmarkSoftwareOcclusion(mesh.occluders.data(), (u32)mesh.occluders.size(), std::thread::hardware_concurrency(), results);
+	for (const SoftwareOcclusionBenchmark& benchmark : results)
+	{
+		ILOG("Room occlusion, %u threads: %u occluder triangles %.3f ms, %u boxes %.3f ms, %.1f%% occluded", benchmark.threadCount,
+			benchmark.occluderTriangles, benchmark.rasterMilliseconds, benchmark.objectCount, benchmark.testMilliseconds, benchmark.occludedRatio * 100.0f);
+	}
+	return !results.empty();
+}
+
+// Submesh of float positions around a box, the PVS objects are the submeshes
+static void AddBoxSubmesh(Mesh& mesh, std::vector<Aabb>& boxes, vec3 min, vec3 max)
+{
+	std::vector<vec3> positions;
+	Submesh submesh = {};
+	AddBox(positions, submesh.indices, min, max);
+	submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_FLOAT, GL_FALSE });
+	submesh.vertexBufferLayout.stride = sizeof(vec3);
+	submesh.vertices.assign((const u8*)positions.data(), (const u8*)(positions.data() + positions.size()));
+	submesh.vertexCount = (u32)positions.size();
+	submesh.indexCount = (u32)submesh.indices.size();
+	submesh.lods.push_back(MeshLod{ 0, submesh.indexCount, 0.0f, 0, 0 });
+	submesh.boundsMin = min;
+	submesh.boundsMax = max;
+	mesh.submeshes.push_back(submesh);
+	boxes.push_back(Aabb{ min, max });
+}
+
+// Whether a straight line from the eye reaches any of a grid of points inside the box
+// without going through another box
+static bool IsBoxVisibleReference(const std::vector<Aabb>& boxes, u32 target, vec3 eye)
+{
+	const Aabb& box = boxes[target];
+	vec3 inset = (box.max - box.min) * 0.1f;
+	for (u32 i = 0; i < 27; ++i)
+	{
+		vec3 t = vec3(i % 3, i / 3 % 3, i / 9) * 0.5f;
+		vec3 point = glm::mix(box.min + inset, box.max - inset, t);
+
+		bool blocked = false;
+		for (u32 j = 0; j < boxes.size() && !blocked; ++j)
+		{
+			f32 distance = j != target ? IntersectRayAabb(eye, point - eye, boxes[j]) : -1.0f;
+			blocked = distance >= 0.0f && distance < 1.0f;
+		}
+		if (!blocked)
+			return true;
+	}
+	return false;
+}
+
+// Two 10 x 3 x 10 rooms side by side, joined by a doorway in the wall between them, with
+// props on the floor of both. From a point of either room:
+//   - every prop the reference sees from that point must be in its set
+//   - the props of the other room in its set must be seen through the doorway from
+//     somewhere in its cell, the rest of that room is culled
+static bool TestPvs()
+{
+	Mesh mesh = {};
+	std::vector<Aabb> boxes;
+	AddBoxSubmesh(mesh, boxes, vec3(-10.0f, -0.2f, 0.0f), vec3(10.0f, 0.0f, 10.0f));	// Floor and ceiling
+	AddBoxSubmesh(mesh, boxes, vec3(-10.0f, 3.0f, 0.0f), vec3(10.0f, 3.2f, 10.0f));
+	AddBoxSubmesh(mesh, boxes, vec3(-10.2f, 0.0f, 0.0f), vec3(-10.0f, 3.0f, 10.0f));	// Outer walls
+	AddBoxSubmesh(mesh, boxes, vec3(10.0f, 0.0f, 0.0f), vec3(10.2f, 3.0f, 10.0f));
+	AddBoxSubmesh(mesh, boxes, vec3(-10.0f, 0.0f, -0.2f), vec3(10.0f, 3.0f, 0.0f));
+	AddBoxSubmesh(mesh, boxes, vec3(-10.0f, 0.0f, 10.0f), vec3(10.0f, 3.0f, 10.2f));
+	AddBoxSubmesh(mesh, boxes, vec3(-0.1f, 0.0f, 0.0f), vec3(0.1f, 3.0f, 4.0f));		// Middle wall, doorway at z 4 to 5
+	AddBoxSubmesh(mesh, boxes, vec3(-0.1f, 0.0f, 5.0f), vec3(0.1f, 3.0f, 10.0f));
+	AddBoxSubmesh(mesh, boxes, vec3(-0.1f, 2.2f, 4.0f), vec3(0.1f, 3.0f, 5.0f));
+
+	const u32 firstProp = (u32)mesh.submeshes.size();
+	for (u32 i = 0; i < 40; ++i)
+	{
+		f32 x = (i % 2 ? -1.0f : 1.0f) * (1.5f + (i / 2 % 4) * 2.0f);
+		f32 z = 1.0f + (i / 8) * 2.0f;
+		AddBoxSubmesh(mesh, boxes, vec3(x, 0.0f, z), vec3(x + 0.5f, 1.0f, z + 0.5f));
+	}
+
+	Pvs pvs;
+	BuildMeshPvs(mesh, &pvs);
+	ILOG("PVS built in %.0f ms: %u x %u x %u cells (%u interior), %u distinct sets, %llu rays, %.1f KB", pvs.buildMilliseconds,
+		pvs.cellCounts[0], pvs.cellCounts[1], pvs.cellCounts[2], pvs.interiorCellCount, (u32)pvs.setOffsets.size() - 1, pvs.rayCount, GetPvsSize(&pvs) / 1024.0f);
+
+	const vec3 eyes[] = { vec3(-8.0f, 1.7f, 1.0f), vec3(-5.0f, 1.7f, 8.0f), vec3(-8.0f, 1.7f, 4.5f), vec3(-3.0f, 1.7f, 2.0f), vec3(8.0f, 1.7f, 2.0f), vec3(5.0f, 1.7f, 6.0f) };
+
+	u32 random = 12345;
+	u32 missed = 0;
+	u32 leaked = 0;
+	u32 otherRoomProps = 0;
+	u32 otherRoomCulled = 0;
+	for (vec3 eye : eyes)
+	{
+		std::vector<u32> visible((pvs.objectCount + 31) / 32);
+		if (!GetPvsVisibleObjects(&pvs, eye, visible.data()))
+		{
+			ELOG("No PVS set at (%.1f, %.1f, %.1f), inside the rooms", eye.x, eye.y, eye.z);
+			return false;
+		}
+
+		u32 cell = FindPvsCell(&pvs, eye);
+		u32 cellCoords[3] = { cell % pvs.cellCounts[0], cell / pvs.cellCounts[0] % pvs.cellCounts[1], cell / (pvs.cellCounts[0] * pvs.cellCounts[1]) };
+		vec3 cellMin = pvs.bounds.min + vec3(cellCoords[0], cellCoords[1], cellCoords[2]) * pvs.cellSize;
+
+		// Eye points all over the part of the cell inside the room of the eye
+		vec3 roomMin = eye.x < 0.0f ? vec3(-10.0f, 0.0f, 0.0f) : vec3(0.1f, 0.0f, 0.0f);
+		vec3 roomMax = eye.x < 0.0f ? vec3(-0.1f, 3.0f, 10.0f) : vec3(10.0f, 3.0f, 10.0f);
+		vec3 sampleMin = glm::max(cellMin, roomMin);
+		vec3 sampleMax = glm::min(cellMin + vec3(pvs.cellSize), roomMax);
+		std::vector<vec3> cellEyes(PVS_TEST_CELL_SAMPLES);
+		for (vec3& cellEye : cellEyes)
+			cellEye = glm::mix(sampleMin, sampleMax, vec3(NextRandom(random), NextRandom(random), NextRandom(random)));
+
+		for (u32 object = firstProp; object < pvs.objectCount; ++object)
+		{
+			bool inSet = (visible[object / 32] >> (object % 32)) & 1;
+			if (!inSet && IsBoxVisibleReference(boxes, object, eye))
+				missed++;
+
+			bool otherRoom = (boxes[object].min.x < 0.0f) != (eye.x < 0.0f);
+			if (!otherRoom)
+				continue;
+
+			otherRoomProps++;
+			otherRoomCulled += inSet ? 0 : 1;
+			if (inSet)
+			{
+				bool seen = false;
+				for (u32 i = 0; i < cellEyes.size() && !seen; ++i)
+					seen = IsBoxVisibleReference(boxes, object, cellEyes[i]);
+				leaked += seen ? 0 : 1;
+			}
+		}
+	}
+
+	bool passed = missed == 0 && leaked == 0 && otherRoomCulled > 0;
+	ILOG("PVS %s: %u props of the other room culled of %u, %u in the sets not seen through the doorway, %u visible props missed",
+		passed ? "passed" : "FAILED", otherRoomCulled, otherRoomProps, leaked, missed);
+	return passed;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc > 2 || (argc == 2 && argv[1][0] == '-'))
+	{
+		ELOG("Usage: CullingTests [working directory]");
+		return -1;
+	}
+
+	// The Room is opened relative to it, as the engine does
+	if (argc == 2 && chdir(argv[1]) != 0)
+	{
+		ELOG("Could not change to the working directory %s", argv[1]);
+		return -1;
+	}
+
+	InitJobSystem(0);
+
+	u32 failedCount = 0;
+	failedCount += TestSoftwareOcclusion() ? 0 : 1;
+	failedCount += BenchmarkRoomOcclusion() ? 0 : 1;
+	failedCount += TestPvs() ? 0 : 1;
+
+	ShutdownJobSystem();
+
+	if (failedCount > 0)
+	{
+		ELOG("%u culling test(s) failed", failedCount);
+		return 1;
+	}
+	ILOG("All culling tests passed");
+	return 0;
+}
@@ -26,35 +26,70 @@
 #include "../ThirdParty/glm/include/glm/glm.hpp"
 #endif // !_DEBUG
 
+#include <float.h>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <map>
+#include <tuple>
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
-{
-	GLchar  infoLogBuffer[1024] = {};
-	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
-	GLsizei infoLogSize;
-	GLint   success;
 
+ProgramCompile BeginProgramCompile(String programSource, const char* shaderName, const char* permutationDefines, bool compute)
+{
 	char versionString[] = "#version 430\n";
 	char shaderNameDefine[128];
 	sprintf(shaderNameDefine, "#define %s\n", shaderName);
+
+	if (compute)
+	{
+		char computeShaderDefine[] = "#define COMPUTE\n";
+		const GLchar* computeShaderSource[] = {
+			versionString,
+			shaderNameDefine,
+			permutationDefines,
+			computeShaderDefine,
+			programSource.str
+		};
+		const GLint computeShaderLengths[] = {
+			(GLint)strlen(versionString),
+			(GLint)strlen(shaderNameDefine),
+			(GLint)strlen(permutationDefines),
+			(GLint)strlen(computeShaderDefine),
+			(GLint)programSource.len
+		};
+
+		ProgramCompile compile = {};
+		compile.computeShader = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compile.computeShader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+		glCompileShader(compile.computeShader);
+
+		compile.handle = glCreateProgram();
+		glAttachShader(compile.handle, compile.computeShader);
+		glLinkProgram(compile.handle);
+
+		return compile;
+	}
 	char vertexShaderDefine[] = "#define VERTEX\n";
 	char fragmentShaderDefine[] = "#define FRAGMENT\n";
 
 	const GLchar* vertexShaderSource[] = {
 		versionString,
 		shaderNameDefine,
+		permutationDefines,
 		vertexShaderDefine,
 		programSource.str
 	};
 	const GLint vertexShaderLengths[] = {
 		(GLint)strlen(versionString),
 		(GLint)strlen(shaderNameDefine),
+		(GLint)strlen(permutationDefines),
 		(GLint)strlen(vertexShaderDefine),
 		(GLint)programSource.len
 	};
 	const GLchar* fragmentShaderSource[] = {
 		versionString,
 		shaderNameDefine,
+		permutationDefines,
 		fragmentShaderDefine,
 		programSource.str
 	};
@@ -62,65 +97,410 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 	const GLint fragmentShaderLengths[] = {
 		(GLint)strlen(versionString),
 		(GLint)strlen(shaderNameDefine),
+		(GLint)strlen(permutationDefines),
 		(GLint)strlen(fragmentShaderDefine),
 		(GLint)programSource.len
 	};
 
-	GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-	glCompileShader(vshader);
-	glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
-	if (!success)
+	// No status is queried here: with GL_KHR_parallel_shader_compile the driver
+	// compiles and links in the background until someone asks for the result
+	ProgramCompile compile = {};
+
+	compile.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(compile.vertexShader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
+	glCompileShader(compile.vertexShader);
+
+	compile.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(compile.fragmentShader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
+	glCompileShader(compile.fragmentShader);
+
+	compile.handle = glCreateProgram();
+	glAttachShader(compile.handle, compile.vertexShader);
+	glAttachShader(compile.handle, compile.fragmentShader);
+	glLinkProgram(compile.handle);
+
+	return compile;
+}
+
+bool IsProgramCompileComplete(App* app, const ProgramCompile& compile)
+{
+	// Without the extension any status query blocks, so the compile is considered done
+	if (!app->parallelShaderCompile)
+		return true;
+
+	GLint completed = GL_FALSE;
+	glGetProgramiv(compile.handle, GL_COMPLETION_STATUS_KHR, &completed);
+	return completed == GL_TRUE;
+}
+
+GLuint EndProgramCompile(ProgramCompile& compile, const char* shaderName)
+{
+	GLchar  infoLogBuffer[1024] = {};
+	GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+	GLsizei infoLogSize;
+	GLint   success;
+	bool    failed = false;
+
+	if (compile.computeShader != 0)
 	{
-		glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-		ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+		glGetShaderiv(compile.computeShader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(compile.computeShader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+			ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+			failed = true;
+		}
 	}
 
-	GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-	glCompileShader(fshader);
-	glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-	if (!success)
+	if (compile.vertexShader != 0)
+	{
+		glGetShaderiv(compile.vertexShader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(compile.vertexShader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+			ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+			failed = true;
+		}
+	}
+
+	if (compile.fragmentShader != 0)
 	{
-		glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-		ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+		glGetShaderiv(compile.fragmentShader, GL_COMPILE_STATUS, &success);
+		if (!success)
+		{
+			glGetShaderInfoLog(compile.fragmentShader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+			ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+			failed = true;
+		}
 	}
 
-	GLuint programHandle = glCreateProgram();
-	glAttachShader(programHandle, vshader);
-	glAttachShader(programHandle, fshader);
-	glLinkProgram(programHandle);
-	glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+	glGetProgramiv(compile.handle, GL_LINK_STATUS, &success);
 	if (!success)
 	{
-		glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+		glGetProgramInfoLog(compile.handle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
 		ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+		failed = true;
 	}
 
-	glUseProgram(0);
+	GLuint programHandle = compile.handle;
+
+	GLuint shaders[] = { compile.vertexShader, compile.fragmentShader, compile.computeShader };
+	for (u32 i = 0; i < ARRAY_COUNT(shaders); ++i)
+	{
+		if (shaders[i] != 0)
+		{
+			glDetachShader(programHandle, shaders[i]);
+			glDeleteShader(shaders[i]);
+		}
+	}
+	compile = {};
 
-	glDetachShader(programHandle, vshader);
-	glDetachShader(programHandle, fshader);
-	glDeleteShader(vshader);
-	glDeleteShader(fshader);
+	if (failed)
+	{
+		glDeleteProgram(programHandle);
+		return 0;
+	}
 
 	return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+void CancelProgramCompile(ProgramCompile& compile)
+{
+	glDeleteShader(compile.vertexShader);
+	glDeleteShader(compile.fragmentShader);
+	glDeleteShader(compile.computeShader);
+	glDeleteProgram(compile.handle);
+	compile = {};
+}
+
+bool IsExtensionSupported(const char* extensionName)
+{
+	GLint numExtensions = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+	for (GLint i = 0; i < numExtensions; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, GLuint(i));
+		if (strcmp(extension, extensionName) == 0)
+			return true;
+	}
+	return false;
+}
+
+void DeleteProgramVAOs(App* app, GLuint programHandle)
+{
+	for (GeometryVertexPool& pool : app->geometryArena.vertexPools)
+	{
+		std::vector<Vao>& vaos = pool.vaos;
+		for (u32 k = 0; k < vaos.size(); )
+		{
+			if (vaos[k].programHandle == programHandle)
+			{
+				glDeleteVertexArrays(1, &vaos[k].handle);
+				vaos.erase(vaos.begin() + k);
+			}
+			else
+			{
+				++k;
+			}
+		}
+	}
+}
+
+u8 LoadProgramAttributes(Program& program);
+
+void BeginProgramReload(Program& program)
+{
+	String programSource = ReadTextFile(program.filepath.c_str());
+	if (!programSource.str)
+		return;
+
+	if (program.pendingCompile.handle != 0)
+		CancelProgramCompile(program.pendingCompile);
+
+	program.pendingCompile = BeginProgramCompile(programSource, program.programName.c_str(), program.defines.c_str(), program.compute);
+}
+
+bool FinishProgramReload(App* app, Program& program, bool wait)
+{
+	if (program.pendingCompile.handle == 0)
+		return true;
+
+	if (!wait && !IsProgramCompileComplete(app, program.pendingCompile))
+		return false;
+
+	GLuint newHandle = EndProgramCompile(program.pendingCompile, program.programName.c_str());
+	if (newHandle != 0)
+	{
+		// Only swap once the new program is known to be valid
+		if (program.handle != 0)
+		{
+			DeleteProgramVAOs(app, program.handle);
+			glDeleteProgram(program.handle);
+		}
+
+		program.handle = newHandle;
+		program.vertexInputLayout.attributes.clear();
+		LoadProgramAttributes(program);
+	}
+	else if (program.handle != 0)
+	{
+		ELOG("Keeping the last valid version of program %s", program.programName.c_str());
+	}
+
+	return true;
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const std::vector<ProgramPermutationAxis>& permutationAxes = {})
 {
-	String programSource = ReadTextFile(filepath);
+	Program program = {};
+	program.filepath = filepath;
+	program.programName = programName;
+	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	program.permutationAxes = permutationAxes;
+
+	// Programs with permutations are only compiled when a variant is requested,
+	// the rest start compiling now and are picked up by FinishProgramReload
+	if (permutationAxes.empty())
+	{
+		BeginProgramReload(program);
+	}
+
+	app->programs.push_back(program);
+
+	return app->programs.size() - 1;
+}
 
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
 	Program program = {};
-	program.handle = CreateProgramFromSource(programSource, programName);
 	program.filepath = filepath;
 	program.programName = programName;
 	program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+	program.compute = true;
+	BeginProgramReload(program);
+
 	app->programs.push_back(program);
 
 	return app->programs.size() - 1;
 }
 
+static u32 LoadProgram(App* app, const ProgramDesc& desc)
+{
+	return desc.compute ? LoadComputeProgram(app, desc.filepath, desc.programName) : LoadProgram(app, desc.filepath, desc.programName, desc.permutationAxes);
+}
+
+static std::vector<ProgramDesc> BuildEngineProgramDescs()
+{
+	//Permutation axes of the lighting programs
+	ProgramPermutationAxis debugViewAxis = { "DEBUG_VIEW", { 0, 1, 2, 3, 4, 5, 6 } };
+	ProgramPermutationAxis iblAxis = { "USE_IBL", { 0, 1 } };
+	ProgramPermutationAxis lightTypesAxis = { "LIGHT_TYPES", { 0, 1, 2, 3 }, PermutationMatch_Superset };
+	ProgramPermutationAxis maxLightsAxis = { "MAX_LIGHTS", { 4, 8, MAX_LIGHTS }, PermutationMatch_AtLeast };
+
+	//LocalParams from the instance buffer, see RenderInstanceGroups
+	ProgramPermutationAxis instancedAxis = { "INSTANCED", { 0, 1 } };
+
+	std::vector<ProgramDesc> descs(EngineProgram_Count);
+	descs[EngineProgram_ForwardGeometry] = { "shaders/forward_geometry.glsl", "FORWARD_GEOMETRY", false, { lightTypesAxis, maxLightsAxis, instancedAxis } };
+	descs[EngineProgram_DeferredGeometry] = { "shaders/deferred_geometry.glsl", "DEFERRED_GEOMETRY", false, { instancedAxis } };
+	descs[EngineProgram_Lights] = { "shaders/lights.glsl", "SHOW_LIGHTS", false, {} };
+	descs[EngineProgram_ForwardQuad] = { "shaders/forward_quad.glsl", "FORWARD_QUAD", false, {} };
+	descs[EngineProgram_DeferredQuad] = { "shaders/deferred_quad .glsl", "DEFERRED_QUAD", false, { debugViewAxis, lightTypesAxis, maxLightsAxis } };
+	descs[EngineProgram_DeferredPbrQuad] = { "shaders/pbr_deferred_quad.glsl", "DEFERRED_PBR_QUAD", false, { debugViewAxis, iblAxis, lightTypesAxis, maxLightsAxis } };
+	descs[EngineProgram_ForwardPbrGeometry] = { "shaders/pbr_forward_geometry .glsl", "FORWARD_PBR_GEOMETRY", false, { iblAxis, lightTypesAxis, maxLightsAxis, instancedAxis } };
+	descs[EngineProgram_Depth] = { "shaders/depth.glsl", "SHOW_DEPTH", false, {} };
+	descs[EngineProgram_Cubemap] = { "shaders/cubemap.glsl", "CUBEMAP", false, {} };
+	descs[EngineProgram_IrradianceMap] = { "shaders/irradiance_map.glsl", "IRRADIANCE_MAP", false, {} };
+	descs[EngineProgram_PrefilterMap] = { "shaders/prefilter_map.glsl", "PREFILTER_MAP", false, {} };
+	descs[EngineProgram_Brdf] = { "shaders/brdf.glsl", "BRDF", false, {} };
+	descs[EngineProgram_HiZBuild] = { "shaders/hiz.glsl", "HIZ_BUILD", true, {} };
+	descs[EngineProgram_OcclusionCull] = { "shaders/occlusion_cull.glsl", "OCCLUSION_CULL", true, {} };
+	return descs;
+}
+
+const std::vector<ProgramDesc>& GetEngineProgramDescs()
+{
+	static const std::vector<ProgramDesc> descs = BuildEngineProgramDescs();
+	return descs;
+}
+
+static std::vector<ModelDesc> BuildEngineModelDescs()
+{
+	std::vector<ModelDesc> descs(EngineModel_Count);
+	descs[EngineModel_Quad] = { "Primitives/Quad/quad.obj", MESH_LOAD_DEFAULT_FLAGS };
+	descs[EngineModel_Sphere] = { "Primitives/Sphere/sphere.obj", MeshLoad_KeepCpuData | MeshLoad_CompressVertices };
+	//The CPU geometry of the entity models is kept for picking
+	descs[EngineModel_Patrick] = { "Patrick/Patrick.obj", MeshLoad_KeepCpuData | MeshLoad_CompressVertices };
+	descs[EngineModel_Room] = { "Room/Room #1.obj", MeshLoad_CompressVertices | MeshLoad_Occluders | MeshLoad_Pvs | MeshLoad_StaticBatch };
+	return descs;
+}
+
+const std::vector<ModelDesc>& GetEngineModelDescs()
+{
+	static const std::vector<ModelDesc> descs = BuildEngineModelDescs();
+	return descs;
+}
+
+static u32 LoadModel(App* app, const ModelDesc& desc)
+{
+	return LoadModel(app, desc.filepath, desc.loadFlags);
+}
+
+u32 GetPermutationDefineValue(const FrameSnapshot* snapshot, const std::string& define, bool instanced)
+{
+	if (define == "DEBUG_VIEW")
+	{
+		return (u32)snapshot->renderTargetMode;
+	}
+	else if (define == "USE_IBL")
+	{
+		return snapshot->showSkybox ? 1 : 0;
+	}
+	else if (define == "LIGHT_TYPES")
+	{
+		return snapshot->lightTypes;
+	}
+	else if (define == "MAX_LIGHTS")
+	{
+		return snapshot->lightCount;
+	}
+	else if (define == "INSTANCED")
+	{
+		return instanced ? 1 : 0;
+	}
+
+	ELOG("Unknown permutation define %s", define.c_str());
+	return 0;
+}
+
+// Whether the permutation with the candidate key draws correctly when the requested one is asked for
+static bool IsPermutationCompatible(const std::vector<ProgramPermutationAxis>& axes, u32 candidateKey, u32 requestedKey)
+{
+	for (u32 i = axes.size(); i-- > 0;)
+	{
+		const ProgramPermutationAxis& axis = axes[i];
+		u32 candidate = axis.values[candidateKey % axis.values.size()];
+		u32 requested = axis.values[requestedKey % axis.values.size()];
+		candidateKey /= axis.values.size();
+		requestedKey /= axis.values.size();
+
+		switch (axis.match)
+		{
+		case PermutationMatch_Exact:    if (candidate != requested) return false; break;
+		case PermutationMatch_AtLeast:  if (candidate < requested) return false; break;
+		case PermutationMatch_Superset: if ((candidate & requested) != requested) return false; break;
+		}
+	}
+	return true;
+}
+
+u32 GetProgramPermutation(App* app, const FrameSnapshot* snapshot, u32 programIdx, bool instanced)
+{
+	Program& program = app->programs[programIdx];
+	if (program.permutationAxes.empty())
+		return programIdx;
+
+	// Mixed radix key, one digit per axis holding the index of the selected value
+	u32 key = 0;
+	std::string defines;
+	for (u32 i = 0; i < program.permutationAxes.size(); ++i)
+	{
+		const ProgramPermutationAxis& axis = program.permutationAxes[i];
+		u32 requestedValue = GetPermutationDefineValue(snapshot, axis.define, instanced);
+
+		u32 valueIdx = 0;
+		while (valueIdx + 1 < axis.values.size() && axis.values[valueIdx] < requestedValue)
+			valueIdx++;
+
+		key = key * axis.values.size() + valueIdx;
+		defines += "#define " + axis.define + " " + std::to_string(axis.values[valueIdx]) + "\n";
+	}
+
+	u32 variantIdx = UINT32_MAX;
+	for (u32 i = 0; i < program.permutations.size(); ++i)
+	{
+		if (program.permutations[i].key == key)
+		{
+			variantIdx = program.permutations[i].programIdx;
+			break;
+		}
+	}
+
+	// First use of this permutation, compile it and keep it as a regular program
+	if (variantIdx == UINT32_MAX)
+	{
+		Program variant = {};
+		variant.filepath = program.filepath;
+		variant.programName = program.programName;
+		variant.defines = defines;
+		variant.lastWriteTimestamp = GetFileLastWriteTimestamp(variant.filepath.c_str());
+		BeginProgramReload(variant);
+
+		variantIdx = app->programs.size();
+		app->programs.push_back(variant);
+		app->programs[programIdx].permutations.push_back(ProgramPermutation{ key, variantIdx });
+	}
+
+	Program& variant = app->programs[variantIdx];
+	if (variant.handle == 0 && !FinishProgramReload(app, variant, false))
+	{
+		// Keep drawing with a ready permutation that handles the same inputs while this one compiles,
+		// e.g. more lights than needed, otherwise a uLight[4] program could be fed 8 lights
+		const Program& base = app->programs[programIdx];
+		for (u32 i = 0; i < base.permutations.size(); ++i)
+		{
+			if (app->programs[base.permutations[i].programIdx].handle != 0 &&
+				IsPermutationCompatible(base.permutationAxes, base.permutations[i].key, key))
+				return base.permutations[i].programIdx;
+		}
+
+		// Nothing can stand in for it, wait for the compile rather than draw wrong
+		FinishProgramReload(app, variant, true);
+	}
+
+	return variantIdx;
+}
+
 u8 LoadProgramAttributes(Program& program)
 {
 	GLsizei attributeCount;
@@ -162,1046 +542,4764 @@ void FreeImage(Image image)
 	stbi_image_free(image.pixels);
 }
 
-GLuint CreateTexture2DFromImage(Image image)
+// Box filtered, each texel averages the 2x2 under it, clamped to the edges of odd sizes
+static void DownsampleLevel(const u8* source, ivec2 sourceSize, u8* destination, ivec2 size, u32 bytesPerPixel)
 {
-	GLenum internalFormat = GL_RGB8;
-	GLenum dataFormat = GL_RGB;
-	GLenum dataType = GL_UNSIGNED_BYTE;
+	for (i32 y = 0; y < size.y; ++y)
+	{
+		const u8* row0 = source + (u64)glm::min(2 * y, sourceSize.y - 1) * sourceSize.x * bytesPerPixel;
+		const u8* row1 = source + (u64)glm::min(2 * y + 1, sourceSize.y - 1) * sourceSize.x * bytesPerPixel;
+		for (i32 x = 0; x < size.x; ++x)
+		{
+			const u32 x0 = glm::min(2 * x, sourceSize.x - 1) * bytesPerPixel;
+			const u32 x1 = glm::min(2 * x + 1, sourceSize.x - 1) * bytesPerPixel;
+			u8* texel = destination + ((u64)y * size.x + x) * bytesPerPixel;
+			for (u32 c = 0; c < bytesPerPixel; ++c)
+				texel[c] = (u8)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+		}
+	}
+}
 
+static std::shared_ptr<TextureMipChain> BuildTextureMipChain(Image image)
+{
+	std::shared_ptr<TextureMipChain> mips = std::make_shared<TextureMipChain>();
 	switch (image.nchannels)
 	{
-	case 3: dataFormat = GL_RGB; internalFormat = GL_RGB8; break;
-	case 4: dataFormat = GL_RGBA; internalFormat = GL_RGBA8; break;
-	default: ELOG("LoadTexture2D() - Unsupported number of channels");
+	case 1:
+	case 3: mips->format = GL_RGB; mips->internalFormat = GL_RGB8; mips->bytesPerPixel = 3; break;
+	case 2:
+	case 4: mips->format = GL_RGBA; mips->internalFormat = GL_RGBA8; mips->bytesPerPixel = 4; break;
+	default: ELOG("LoadTexture2D() - Unsupported number of channels"); return NULL;
 	}
 
-	GLuint texHandle;
-	glGenTextures(1, &texHandle);
-	glBindTexture(GL_TEXTURE_2D, texHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	return texHandle;
+	const u8* pixels = (const u8*)image.pixels;
+	mips->sizes.push_back(image.size);
+	if (image.nchannels >= 3)
+	{
+		mips->levels.emplace_back(pixels, pixels + (u64)image.stride * image.size.y);
+	}
+	else
+	{
+		// Grey (and alpha) images, e.g. roughness or height maps, are expanded so the
+		// sampling and the block compression only deal with RGB and RGBA
+		const u64 pixelCount = (u64)image.size.x * image.size.y;
+		std::vector<u8> level(pixelCount * mips->bytesPerPixel);
+		for (u64 i = 0; i < pixelCount; ++i)
+		{
+			const u8* source = pixels + i * image.nchannels;
+			u8* destination = &level[i * mips->bytesPerPixel];
+			destination[0] = destination[1] = destination[2] = source[0];
+			if (image.nchannels == 2)
+				destination[3] = source[1];
+		}
+		mips->levels.push_back(std::move(level));
+	}
+	while (mips->sizes.back().x > 1 || mips->sizes.back().y > 1)
+	{
+		ivec2 sourceSize = mips->sizes.back();
+		ivec2 size = glm::max(sourceSize / 2, ivec2(1));
+		std::vector<u8> level((u64)size.x * size.y * mips->bytesPerPixel);
+		DownsampleLevel(mips->levels.back().data(), sourceSize, level.data(), size, mips->bytesPerPixel);
+		mips->sizes.push_back(size);
+		mips->levels.push_back(std::move(level));
+	}
+	return mips;
 }
 
-
-u32 LoadTexture2D(App* app, const char* filepath)
+// The finest skippedLevels are dropped for the quality tier, at least one level is kept
+static void DropFinestTextureLevels(TextureMipChain& mips, u32 skippedLevels)
 {
-	for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-		if (app->textures[texIdx].filepath == filepath)
-			return texIdx;
+	skippedLevels = glm::min(skippedLevels, (u32)mips.levels.size() - 1);
+	mips.sizes.erase(mips.sizes.begin(), mips.sizes.begin() + skippedLevels);
+	mips.levels.erase(mips.levels.begin(), mips.levels.begin() + skippedLevels);
 
-	Image image = LoadImage(filepath);
+	mips.tailLevel = 0;
+	while (glm::max(mips.sizes[mips.tailLevel].x, mips.sizes[mips.tailLevel].y) > TEXTURE_STREAMING_TAIL_SIZE)
+		mips.tailLevel++;
+}
 
-	if (image.pixels)
+static bool ImageHasAlpha(Image image)
+{
+	if (image.nchannels != 2 && image.nchannels != 4)
+		return false;
+	const u8* pixels = (const u8*)image.pixels;
+	for (u64 i = image.nchannels - 1; i < (u64)image.stride * image.size.y; i += image.nchannels)
 	{
-		Texture tex = {};
-		tex.handle = CreateTexture2DFromImage(image);
-		tex.filepath = filepath;
-		tex.size = image.size;
+		if (pixels[i] != 255)
+			return true;
+	}
+	return false;
+}
 
-		u32 texIdx = app->textures.size();
-		app->textures.push_back(tex);
+static BlockFormat ChooseBlockFormat(TextureUsage usage, bool hasAlpha, TextureCompression compression)
+{
+	if (usage == TextureUsage_Normals)
+		return BlockFormat_BC5;
+	if (hasAlpha)
+		return BlockFormat_BC3;
+	return compression == TextureCompression_BC1 ? BlockFormat_BC1 : BlockFormat_BC7;
+}
 
-		FreeImage(image);
-		return texIdx;
-	}
-	else
+static GLenum GetBlockFormatInternalFormat(BlockFormat format)
+{
+	switch (format)
 	{
-		return UINT32_MAX;
+	case BlockFormat_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BlockFormat_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat_BC5: return GL_COMPRESSED_RG_RGTC2;
+	default:              return GL_COMPRESSED_RGBA_BPTC_UNORM;
 	}
 }
 
-mat4 TransformScale(const vec3& scaleFactors)
+static void CompressTextureMipChain(TextureMipChain& mips, BlockFormat format)
 {
-	mat4 transform = glm::scale(scaleFactors);
-	return transform;
+	for (u32 level = 0; level < mips.levels.size(); ++level)
+	{
+		std::vector<u8> blocks(GetCompressedImageSize(format, mips.sizes[level]));
+		CompressImage(format, mips.levels[level].data(), mips.sizes[level], mips.bytesPerPixel, blocks.data());
+		mips.levels[level] = std::move(blocks);
+	}
+	mips.compressed = true;
+	mips.blockFormat = format;
+	mips.internalFormat = GetBlockFormatInternalFormat(format);
 }
 
-mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors)
+// Decodes the full chain, compressed and written to the cooked texture unless the
+// compression is off. The job system only spreads the compression when called from the
+// main thread or a job, the loader thread compresses on its own.
+static std::shared_ptr<TextureMipChain> CookTextureMipChain(const char* filepath, TextureUsage usage, TextureCompression compression)
 {
-	mat4 transform = glm::translate(pos);
-	transform = glm::scale(transform, scaleFactors);
-	return transform;
+	const u64 sourceTimestamp = GetFileLastWriteTimestamp(filepath);
+	Image image = LoadImage(filepath);
+	if (!image.pixels)
+		return NULL;
+
+	bool hasAlpha = ImageHasAlpha(image);
+	std::shared_ptr<TextureMipChain> mips = BuildTextureMipChain(image);
+	FreeImage(image);
+	if (!mips || compression == TextureCompression_Off)
+		return mips;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	CompressTextureMipChain(*mips, ChooseBlockFormat(usage, hasAlpha, compression));
+	f64 milliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	ILOG("Compressed %s to %s in %.0f ms", filepath, GetBlockFormatName(mips->blockFormat), milliseconds);
+
+	const std::string cookedPath = std::string(filepath) + ".ctex";
+	if (!WriteCookedTexture(cookedPath.c_str(), sourceTimestamp, hasAlpha, *mips))
+		ELOG("Could not write the cooked texture %s", cookedPath.c_str());
+	return mips;
 }
 
-mat4 TransformPositionRotationScale(const vec3& pos, const vec3& rotation, const vec3& scaleFactors)
+bool CookTexture(const char* filepath, TextureUsage usage, TextureCompression compression)
 {
-	mat4 transform = glm::translate(pos);
-	transform = glm::rotate(transform, glm::radians(90.0f), rotation);
-	transform = glm::scale(transform, scaleFactors);
-	return transform;
+	return CookTextureMipChain(filepath, usage, compression) != NULL;
 }
 
-void Init(App* app)
+// Compressed chains are read from the cooked texture while it is up to date, and cooked
+// into it otherwise
+static std::shared_ptr<TextureMipChain> LoadTextureMipChain(const char* filepath, TextureUsage usage, TextureCompression compression, u32 skippedLevels)
 {
-	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3))
+	std::shared_ptr<TextureMipChain> mips;
+	if (compression != TextureCompression_Off)
 	{
-		glDebugMessageCallback(OnGlError, app);
+		const std::string cookedPath = std::string(filepath) + ".ctex";
+		mips = std::make_shared<TextureMipChain>();
+		if (!ReadCookedTexture(cookedPath.c_str(), GetFileLastWriteTimestamp(filepath), usage, compression, *mips))
+			mips = NULL;
 	}
 
-	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
-
-	app->camera = Camera(vec3(0.25f, 1.25f, 6.75f));
-	app->camera.yaw = -90.0f;
-	app->camera.pitch = -10.0f;
-	app->camera.UpdateCameraVectors();
+	if (!mips)
+		mips = CookTextureMipChain(filepath, usage, compression);
+	if (!mips)
+		return NULL;
 
-	GLint maxUniformBufferSize;
+	DropFinestTextureLevels(*mips, skippedLevels);
+	return mips;
+}
 
-	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBufferSize);
-	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBufferAlignment);
+// Allocates a level (size 0 releases it), filled from data or the bound pixel buffer when given
+static void DefineTextureLevel(const TextureMipChain& mips, u32 level, ivec2 size, const void* data)
+{
+	if (mips.compressed)
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, mips.internalFormat, size.x, size.y, 0, GetCompressedImageSize(mips.blockFormat, size), data);
+	else
+		glTexImage2D(GL_TEXTURE_2D, level, mips.internalFormat, size.x, size.y, 0, mips.format, GL_UNSIGNED_BYTE, data);
+}
 
-	glGenBuffers(1, &app->bufferHandle);
-	glBindBuffer(GL_UNIFORM_BUFFER, app->bufferHandle);
-	glBufferData(GL_UNIFORM_BUFFER, maxUniformBufferSize, NULL, GL_STREAM_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+static u64 StageTextureLevel(App* app, GLuint textureHandle, const TextureMipChain& mips, u32 level)
+{
+	if (mips.compressed)
+		return StageCompressedTextureData(app, textureHandle, level, mips.sizes[level], mips.internalFormat, mips.blockFormat, mips.levels[level].data());
+	return StageTextureData(app, textureHandle, level, mips.sizes[level], mips.format, GL_UNSIGNED_BYTE, mips.bytesPerPixel, mips.levels[level].data(), false);
+}
 
-	app->cbuffer = CreateBuffer(maxUniformBufferSize, GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+// Defines the tail of the mip chain, with the base level clamped to it. The loader thread
+// fills it from its pixel buffer, the render thread (pixelBuffer 0) through the uploads.
+static GLuint CreateStreamedTexture(App* app, const TextureMipChain& mips, GLuint pixelBuffer)
+{
+	const u32 levelCount = (u32)mips.levels.size();
 
-	//Cubemap ===============================================================================================
-	GenerateCube(app);
-	CreateCubemap(app);
+	GLuint texHandle;
+	glGenTextures(1, &texHandle);
+	glBindTexture(GL_TEXTURE_2D, texHandle);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, mips.tailLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	GenerateQuad(app);
+	if (pixelBuffer != 0)
+	{
+		u32 size = 0;
+		for (u32 level = mips.tailLevel; level < levelCount; ++level)
+			size += (u32)mips.levels[level].size();
+
+		// Orphaned each time, the previous texture may still be being read
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		u8* pixels = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+		for (u32 level = mips.tailLevel, offset = 0; level < levelCount; offset += (u32)mips.levels[level++].size())
+			memcpy(pixels + offset, mips.levels[level].data(), mips.levels[level].size());
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		for (u32 level = mips.tailLevel, offset = 0; level < levelCount; offset += (u32)mips.levels[level++].size())
+			DefineTextureLevel(mips, level, mips.sizes[level], (const void*)(u64)offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	else
+	{
+		for (u32 level = mips.tailLevel; level < levelCount; ++level)
+			DefineTextureLevel(mips, level, mips.sizes[level], NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// The pixels come with the next flush of the uploads
+		for (u32 level = mips.tailLevel; level < levelCount; ++level)
+			StageTextureLevel(app, texHandle, mips, level);
+	}
+
+	return texHandle;
+}
+
+static void SwapTexture(App* app, Texture& texture, GLuint handle, std::shared_ptr<TextureMipChain> mips);
+
+u32 LoadTexture2D(App* app, const char* filepath, TextureUsage usage = TextureUsage_Color)
+{
+	for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+		if (app->textures[texIdx].filepath == filepath)
+			return texIdx;
+
+	// The loader thread decodes it, the slot shows the placeholder until then
+	if (app->useTextureLoader && app->textureLoader.context)
+	{
+		if (GetFileLastWriteTimestamp(filepath) == 0)
+		{
+			ELOG("Could not open file %s", filepath);
+			return UINT32_MAX;
+		}
+
+		// A missing or stale cooked texture, older or of another block format, is cooked
+		// again by the loader thread, see LoadTextureMipChain
+		Texture tex = {};
+		tex.handle = app->textureLoader.placeholderHandle;
+		tex.filepath = filepath;
+		tex.size = ivec2(1, 1);
+		tex.usage = usage;
+
+		u32 texIdx = app->textures.size();
+		app->textures.push_back(tex);
+
+		ReloadTexture(app, texIdx, true);
+		return texIdx;
+	}
+
+	std::shared_ptr<TextureMipChain> mips = LoadTextureMipChain(filepath, usage, app->textureCompression, app->textureQualityTier);
+	if (!mips)
+		return UINT32_MAX;
+
+	Texture tex = {};
+	tex.filepath = filepath;
+	tex.usage = usage;
+
+	u32 texIdx = app->textures.size();
+	app->textures.push_back(tex);
+
+	SwapTexture(app, app->textures[texIdx], CreateStreamedTexture(app, *mips, 0), mips);
+	return texIdx;
+}
+
+static void TextureLoaderMain(App* app)
+{
+	TextureLoader& loader = app->textureLoader;
+	MakeOpenGLContextCurrent(loader.context);
+	glGenBuffers(1, &loader.pixelBuffer);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	for (;;)
+	{
+		TextureLoadRequest request;
+		{
+			std::unique_lock<std::mutex> lock(loader.mutex);
+			loader.requestQueued.wait(lock, [&loader]() { return !loader.requests.empty() || loader.stopping; });
+			if (loader.stopping)
+				break;
+			request = std::move(loader.requests.front());
+			loader.requests.pop_front();
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		TextureLoadResult result = {};
+		result.textureIdx = request.textureIdx;
+
+		result.mips = LoadTextureMipChain(request.filepath.c_str(), request.usage, request.compression, request.skippedLevels);
+		if (result.mips)
+			result.handle = CreateStreamedTexture(app, *result.mips, loader.pixelBuffer);
+
+		// Flushed, or the render thread could wait forever on a fence never submitted
+		result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		result.milliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		loader.results.push_back(result);
+	}
+
+	glDeleteBuffers(1, &loader.pixelBuffer);
+	MakeOpenGLContextCurrent(NULL);
+}
+
+void InitTextureLoader(App* app)
+{
+	TextureLoader& loader = app->textureLoader;
+
+	const u8 grey[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &loader.placeholderHandle);
+	glBindTexture(GL_TEXTURE_2D, loader.placeholderHandle);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	loader.context = CreateSharedOpenGLContext();
+	if (!loader.context)
+	{
+		ELOG("No shared context, textures load on the render thread");
+		return;
+	}
+	loader.thread = std::thread(TextureLoaderMain, app);
+}
+
+void ShutdownTextureLoader(App* app)
+{
+	TextureLoader& loader = app->textureLoader;
+	if (loader.thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(loader.mutex);
+			loader.stopping = true;
+		}
+		loader.requestQueued.notify_one();
+		loader.thread.join();
+	}
+	if (loader.context)
+		DestroySharedOpenGLContext(loader.context);
+
+	for (const TextureLoadResult& result : loader.results)
+		glDeleteSync(result.fence);
+	for (const TextureLoadResult& result : loader.fenced)
+		glDeleteSync(result.fence);
+	glDeleteTextures(1, &loader.placeholderHandle);
+}
+
+void ReloadTexture(App* app, u32 textureIdx, bool useLoaderThread)
+{
+	TextureLoader& loader = app->textureLoader;
+	loader.pending++;
+	if (useLoaderThread && loader.context)
+	{
+		{
+			std::lock_guard<std::mutex> lock(loader.mutex);
+			const Texture& texture = app->textures[textureIdx];
+			loader.requests.push_back(TextureLoadRequest{ textureIdx, texture.filepath, app->textureQualityTier, texture.usage, app->textureCompression });
+		}
+		loader.requestQueued.notify_one();
+	}
+	else
+	{
+		app->pendingTextureReloads.push_back(textureIdx);
+	}
+}
+
+static void SwapTexture(App* app, Texture& texture, GLuint handle, std::shared_ptr<TextureMipChain> mips)
+{
+	// A level on its way to the old texture must not land on a deleted name
+	if (texture.mips && texture.streamingLevel != texture.residentLevel)
+		FlushUploads(app);
+
+	if (texture.handle != 0 && texture.handle != app->textureLoader.placeholderHandle)
+		glDeleteTextures(1, &texture.handle);
+	texture.handle = handle;
+	texture.size = mips->sizes[0];
+	texture.mips = mips;
+	texture.residentLevel = mips->tailLevel;
+	texture.streamingLevel = mips->tailLevel;
+	texture.streamingTicket = 0;
+	texture.lastNeededFrame = 0;
+	texture.residentBytes = 0;
+	for (u32 level = mips->tailLevel; level < mips->levels.size(); ++level)
+		texture.residentBytes += mips->levels[level].size();
+}
+
+// The way without the loader thread: loaded (or cooked) and uploaded in the frame
+static void ReloadTextureNow(App* app, u32 textureIdx, u32 skippedLevels, TextureCompression compression)
+{
+	Texture& texture = app->textures[textureIdx];
+	std::shared_ptr<TextureMipChain> mips = LoadTextureMipChain(texture.filepath.c_str(), texture.usage, compression, skippedLevels);
+	if (mips)
+	{
+		GLuint handle = CreateStreamedTexture(app, *mips, 0);
+		FlushUploads(app);
+		SwapTexture(app, texture, handle, mips);
+	}
+	app->textureLoader.pending--;
+}
+
+void CompleteTextureLoads(App* app)
+{
+	TextureLoader& loader = app->textureLoader;
+	{
+		std::lock_guard<std::mutex> lock(loader.mutex);
+		loader.fenced.insert(loader.fenced.end(), loader.results.begin(), loader.results.end());
+		loader.results.clear();
+	}
+
+	for (u32 i = 0; i < loader.fenced.size(); )
+	{
+		TextureLoadResult& result = loader.fenced[i];
+		GLenum status = glClientWaitSync(result.fence, 0, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		{
+			++i;
+			continue;
+		}
+
+		glDeleteSync(result.fence);
+		if (result.handle != 0)
+			SwapTexture(app, app->textures[result.textureIdx], result.handle, result.mips);
+		loader.lastLoadMilliseconds = result.milliseconds;
+		loader.pending--;
+		loader.fenced.erase(loader.fenced.begin() + i);
+	}
+}
+
+void RequestTextureLevels(App* app, FrameSnapshot* snapshot)
+{
+	snapshot->textureScreenSizes.assign(app->textures.size(), 0.0f);
+
+	const EntityStore& store = app->entityStore;
+	const f32 pixelsAtUnitDistance = app->displaySize.y / (2.0f * tanf(glm::radians(app->camera.zoom) * 0.5f));
+	for (u32 i : app->visibleEntities)
+	{
+		const Model& model = app->models[store.entities[i].modelIndex];
+		const Mesh& mesh = app->meshes[model.meshIdx];
+		const mat4& world = store.worldMatrices[i];
+
+		// The bounding sphere SelectEntityLod projects
+		f32 scale = glm::max(glm::length(vec3(world[0])), glm::max(glm::length(vec3(world[1])), glm::length(vec3(world[2]))));
+		vec3 center = vec3(world * vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+		f32 radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * scale;
+		f32 distance = glm::max(glm::length(center - app->camera.position) - radius, 1e-4f);
+		f32 screenSize = 2.0f * radius * pixelsAtUnitDistance / distance;
+
+		for (u32 materialIdx : model.materialIdx)
+		{
+			const Material& material = app->materials[materialIdx];
+			const u32 textures[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.specularTextureIdx,
+				material.normalsTextureIdx, material.bumpTextureIdx };
+			for (u32 textureIdx : textures)
+			{
+				if (textureIdx < snapshot->textureScreenSizes.size())
+					snapshot->textureScreenSizes[textureIdx] = glm::max(snapshot->textureScreenSizes[textureIdx], screenSize);
+			}
+		}
+	}
+}
+
+// Releases the levels finer than level, once the base level is clamped and they are no longer sampled
+static u32 EvictTextureLevels(Texture& texture, u32 level)
+{
+	const TextureMipChain& mips = *texture.mips;
+	glBindTexture(GL_TEXTURE_2D, texture.handle);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	for (u32 i = texture.residentLevel; i < level; ++i)
+	{
+		DefineTextureLevel(mips, i, ivec2(0), NULL);
+		texture.residentBytes -= mips.levels[i].size();
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	u32 count = level - texture.residentLevel;
+	texture.residentLevel = level;
+	texture.streamingLevel = level;
+	return count;
+}
+
+// Least recently needed texture with levels above its tail and none on its way, needed
+// before the given frame. A linear search, there are few textures.
+static u32 FindTextureToEvict(App* app, u32 skippedIdx, u64 neededBefore)
+{
+	u32 found = UINT32_MAX;
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		const Texture& texture = app->textures[i];
+		if (i == skippedIdx || !texture.mips || texture.streamingLevel != texture.residentLevel ||
+			texture.residentLevel >= texture.mips->tailLevel || texture.lastNeededFrame >= neededBefore)
+			continue;
+		if (found == UINT32_MAX || texture.lastNeededFrame < app->textures[found].lastNeededFrame)
+			found = i;
+	}
+	return found;
+}
+
+// Evicts the finest level of the texture found, returning the bytes released
+static u64 EvictLeastRecentlyNeeded(App* app, FrameStats& stats, u32 skippedIdx, u64 neededBefore)
+{
+	u32 textureIdx = FindTextureToEvict(app, skippedIdx, neededBefore);
+	if (textureIdx == UINT32_MAX)
+		return 0;
+
+	Texture& texture = app->textures[textureIdx];
+	u64 residentBytes = texture.residentBytes;
+	stats.textureBudgetEvictions += EvictTextureLevels(texture, texture.residentLevel + 1);
+	return residentBytes - texture.residentBytes;
+}
+
+void StreamTextures(App* app, FrameSnapshot* snapshot)
+{
+	FrameStats& stats = snapshot->stats;
+	const u64 frame = snapshot->frameIndex;
+
+	// Needed levels and finished uploads first, so the eviction order is up to date
+	std::vector<u32> neededLevels(app->textures.size(), 0);
+	u64 residentBytes = 0;
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		Texture& texture = app->textures[i];
+		if (!texture.mips)
+			continue;
+		const TextureMipChain& mips = *texture.mips;
+
+		// Finest level the largest draw sampling it can show, about a texel per pixel
+		u32 neededLevel = 0;
+		if (snapshot->useTextureStreaming)
+		{
+			f32 screenSize = i < snapshot->textureScreenSizes.size() ? snapshot->textureScreenSizes[i] : 0.0f;
+			f32 textureSize = (f32)glm::max(texture.size.x, texture.size.y);
+			neededLevel = screenSize > 0.0f ? (u32)glm::max(floorf(log2f(textureSize / screenSize)), 0.0f) : mips.tailLevel;
+			neededLevel = glm::min(neededLevel, mips.tailLevel);
+		}
+		if (neededLevel <= texture.residentLevel)
+			texture.lastNeededFrame = frame;
+		neededLevels[i] = neededLevel;
+
+		// The draws sample a streamed level once its upload has been issued
+		if (texture.streamingLevel != texture.residentLevel && IsUploadIssued(app, texture.streamingTicket))
+		{
+			texture.residentLevel = texture.streamingLevel;
+			glBindTexture(GL_TEXTURE_2D, texture.handle);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, texture.residentLevel);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+
+		// Unneeded for a while
+		if (texture.streamingLevel == texture.residentLevel && neededLevel > texture.residentLevel &&
+			frame - texture.lastNeededFrame > TEXTURE_STREAMING_EVICT_FRAMES)
+		{
+			stats.textureLevelsEvicted += EvictTextureLevels(texture, neededLevel);
+		}
+		residentBytes += texture.residentBytes;
+	}
+
+	// Over the budget once it was lowered, whatever is on screen
+	while (residentBytes > snapshot->textureBudgetBytes)
+	{
+		u64 releasedBytes = EvictLeastRecentlyNeeded(app, stats, UINT32_MAX, UINT64_MAX);
+		if (releasedBytes == 0)
+			break;
+		residentBytes -= releasedBytes;
+	}
+
+	// Finer levels, making room with those not needed this frame
+	u32 stagedBytes = 0;
+	for (u32 i = 0; i < app->textures.size(); ++i)
+	{
+		Texture& texture = app->textures[i];
+		if (!texture.mips || texture.streamingLevel != texture.residentLevel || neededLevels[i] >= texture.residentLevel)
+			continue;
+		const TextureMipChain& mips = *texture.mips;
+
+		const u32 level = texture.residentLevel - 1;
+		const u32 levelBytes = (u32)mips.levels[level].size();
+		if (stagedBytes > 0 && stagedBytes + levelBytes > TEXTURE_STREAMING_BUDGET_BYTES)
+			continue;
+
+		while (residentBytes + levelBytes > snapshot->textureBudgetBytes)
+		{
+			u64 releasedBytes = EvictLeastRecentlyNeeded(app, stats, i, frame);
+			if (releasedBytes == 0)
+				break;
+			residentBytes -= releasedBytes;
+		}
+		if (residentBytes + levelBytes > snapshot->textureBudgetBytes)
+		{
+			stats.textureLevelsOverBudget++;
+			continue;
+		}
+
+		glBindTexture(GL_TEXTURE_2D, texture.handle);
+		DefineTextureLevel(mips, level, mips.sizes[level], NULL);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		texture.streamingTicket = StageTextureLevel(app, texture.handle, mips, level);
+		texture.streamingLevel = level;
+		texture.residentBytes += levelBytes;
+		residentBytes += levelBytes;
+		stagedBytes += levelBytes;
+		stats.textureLevelsStreamed++;
+	}
+
+	for (const Texture& texture : app->textures)
+	{
+		if (!texture.mips)
+			continue;
+		stats.texturesStreaming += texture.streamingLevel != texture.residentLevel ? 1 : 0;
+		for (const std::vector<u8>& level : texture.mips->levels)
+			stats.textureFullBytes += level.size();
+	}
+	stats.textureResidentBytes = residentBytes;
+
+	app->textureEvictions += stats.textureLevelsEvicted;
+	app->textureBudgetEvictions += stats.textureBudgetEvictions;
+	stats.textureEvictionsTotal = app->textureEvictions;
+	stats.textureBudgetEvictionsTotal = app->textureBudgetEvictions;
+}
+
+void BenchmarkTextureCompression(App* app)
+{
+	app->textureCompressionBenchmarks.clear();
+	TextureCompression compression = app->textureCompression != TextureCompression_Off ? app->textureCompression : TextureCompression_BC7;
+
+	for (const Texture& texture : app->textures)
+	{
+		Image image = LoadImage(texture.filepath.c_str());
+		if (!image.pixels)
+			continue;
+		if (image.nchannels < 3)
+		{
+			FreeImage(image);
+			continue;
+		}
+
+		TextureCompressionBenchmark benchmark = {};
+		benchmark.filepath = texture.filepath;
+		benchmark.format = ChooseBlockFormat(texture.usage, ImageHasAlpha(image), compression);
+		benchmark.size = image.size;
+
+		std::vector<u8> blocks(GetCompressedImageSize(benchmark.format, image.size));
+		auto start = std::chrono::high_resolution_clock::now();
+		CompressImage(benchmark.format, (const u8*)image.pixels, image.size, image.nchannels, blocks.data());
+		f64 seconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - start).count();
+		benchmark.megapixelsPerSecond = (f64)image.size.x * image.size.y / glm::max(seconds, 1e-9) / 1e6;
+
+		// Only the channels the format keeps
+		std::vector<u8> decoded((u64)image.size.x * image.size.y * 4);
+		DecompressImage(benchmark.format, blocks.data(), image.size, decoded.data());
+		u32 channelCount = benchmark.format == BlockFormat_BC1 ? 3 : (benchmark.format == BlockFormat_BC5 ? 2 : image.nchannels);
+		benchmark.psnr = ComputeImagePsnr((const u8*)image.pixels, image.nchannels, decoded.data(), image.size, channelCount);
+
+		for (ivec2 size = image.size; ; size = glm::max(size / 2, ivec2(1)))
+		{
+			benchmark.uncompressedBytes += (u64)size.x * size.y * image.nchannels;
+			benchmark.compressedBytes += GetCompressedImageSize(benchmark.format, size);
+			if (size == ivec2(1))
+				break;
+		}
+		FreeImage(image);
+
+		ILOG("Texture compression of %s (%dx%d) to %s: %.1f MPixels/s, PSNR %.1f dB, %.1f KB instead of %.1f KB", benchmark.filepath.c_str(),
+			benchmark.size.x, benchmark.size.y, GetBlockFormatName(benchmark.format), benchmark.megapixelsPerSecond, benchmark.psnr,
+			benchmark.compressedBytes / 1024.0f, benchmark.uncompressedBytes / 1024.0f);
+		app->textureCompressionBenchmarks.push_back(benchmark);
+	}
+}
+
+void StartTextureLoadBenchmark(App* app)
+{
+	TextureLoadBenchmarkState& state = app->textureLoadBenchmark;
+	state = TextureLoadBenchmarkState{};
+	state.running = true;
+	app->textureLoadBenchmarks.clear();
+}
+
+void UpdateTextureLoadBenchmark(App* app)
+{
+	TextureLoadBenchmarkState& state = app->textureLoadBenchmark;
+	if (!state.running)
+		return;
+
+	TextureLoadBenchmark& current = state.current;
+	if (state.frame == 0)
+	{
+		// Both runs start with nothing else loading
+		if (app->textureLoader.pending > 0)
+			return;
+
+		current.loaderThread = current.loaderThread && app->textureLoader.context;
+		current.textureCount = (u32)app->textures.size();
+		for (u32 i = 0; i < app->textures.size(); ++i)
+			ReloadTexture(app, i, current.loaderThread);
+	}
+	else
+	{
+		f64 frameMilliseconds = app->deltaTime * 1000.0;
+		current.frameCount++;
+		current.hitchCount += frameMilliseconds > LOAD_HITCH_MILLISECONDS ? 1 : 0;
+		current.worstFrameMilliseconds = glm::max(current.worstFrameMilliseconds, frameMilliseconds);
+		current.totalMilliseconds += frameMilliseconds;
+	}
+	state.frame++;
+
+	if (state.frame <= TEXTURE_LOAD_BENCHMARK_SETTLE_FRAMES || app->textureLoader.pending > 0)
+		return;
+
+	ILOG("Texture load benchmark, loader thread %s: %u textures, %u / %u frames over %.0f ms, worst %.1f ms, %.1f ms in total",
+		current.loaderThread ? "on" : "off", current.textureCount, current.hitchCount, current.frameCount, LOAD_HITCH_MILLISECONDS,
+		current.worstFrameMilliseconds, current.totalMilliseconds);
+	app->textureLoadBenchmarks.push_back(current);
+
+	// Off first, then on
+	bool wasLoaderThread = current.loaderThread || !app->textureLoader.context;
+	state = TextureLoadBenchmarkState{};
+	state.running = !wasLoaderThread;
+	state.current.loaderThread = true;
+}
+
+mat4 TransformScale(const vec3& scaleFactors)
+{
+	mat4 transform = glm::scale(scaleFactors);
+	return transform;
+}
+
+mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors)
+{
+	mat4 transform = glm::translate(pos);
+	transform = glm::scale(transform, scaleFactors);
+	return transform;
+}
+
+mat4 TransformPositionRotationScale(const vec3& pos, const vec3& rotation, const vec3& scaleFactors)
+{
+	mat4 transform = glm::translate(pos);
+	transform = glm::rotate(transform, glm::radians(90.0f), rotation);
+	transform = glm::scale(transform, scaleFactors);
+	return transform;
+}
+
+void Init(App* app)
+{
+	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 3))
+	{
+		glDebugMessageCallback(OnGlError, app);
+	}
+
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+	snprintf(app->openGlVersion, sizeof(app->openGlVersion), "%s", (const char*)glGetString(GL_VERSION));
+	snprintf(app->gpuName, sizeof(app->gpuName), "%s", (const char*)glGetString(GL_RENDERER));
+	snprintf(app->gpuVendor, sizeof(app->gpuVendor), "%s", (const char*)glGetString(GL_VENDOR));
+	snprintf(app->glslVersion, sizeof(app->glslVersion), "%s", (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i = 0; i < extensionCount; ++i)
+	{
+		app->glExtensions.push_back((const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i));
+	}
+
+	InitEntityStore(&app->entityStore, 256);
+	InitBvh(&app->entityBvh, 256);
+	InitMaskedOcclusionBuffer(&app->softwareOcclusionBuffer, OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+	InitPool(&app->lightPool, "Lights", sizeof(Light), MAX_LIGHTS);
+
+	app->camera = Camera(vec3(0.25f, 1.25f, 6.75f));
+	app->camera.yaw = -90.0f;
+	app->camera.pitch = -10.0f;
+	app->camera.UpdateCameraVectors();
+
+	GLint maxUniformBufferSize;
+
+	glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxUniformBufferSize);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &app->uniformBufferAlignment);
+
+	glGenBuffers(1, &app->bufferHandle);
+	glBindBuffer(GL_UNIFORM_BUFFER, app->bufferHandle);
+	glBufferData(GL_UNIFORM_BUFFER, maxUniformBufferSize, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	app->cbuffer = CreateBuffer(maxUniformBufferSize, GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+
+	//Programs ===============================================================================================
+	// Started before loading any asset so the driver can compile them in the background
+	app->parallelShaderCompile = IsExtensionSupported("GL_KHR_parallel_shader_compile") || IsExtensionSupported("GL_ARB_parallel_shader_compile");
+	if (app->parallelShaderCompile)
+	{
+		PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetOpenGLProcAddress("glMaxShaderCompilerThreadsKHR");
+		if (!glMaxShaderCompilerThreads)
+			glMaxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)GetOpenGLProcAddress("glMaxShaderCompilerThreadsARB");
+		if (glMaxShaderCompilerThreads)
+			glMaxShaderCompilerThreads(0xFFFFFFFF); // Let the driver choose
+	}
+
+	const std::vector<ProgramDesc>& programs = GetEngineProgramDescs();
+	app->forwardGeometryProgramIdx = LoadProgram(app, programs[EngineProgram_ForwardGeometry]);
+
+	//Geometry
+	app->deferredGeometryProgramIdx = LoadProgram(app, programs[EngineProgram_DeferredGeometry]);
+
+	app->lightsProgramIdx = LoadProgram(app, programs[EngineProgram_Lights]);
+
+	//Quad
+	app->forwardQuadProgramIdx = LoadProgram(app, programs[EngineProgram_ForwardQuad]);
+
+	app->deferredQuadProgramIdx = LoadProgram(app, programs[EngineProgram_DeferredQuad]);
+	app->deferredPBRQuadProgramIdx = LoadProgram(app, programs[EngineProgram_DeferredPbrQuad]);
+	app->forwardPBRGeometryProgramIdx = LoadProgram(app, programs[EngineProgram_ForwardPbrGeometry]);
+
+	app->depthProgramIdx = LoadProgram(app, programs[EngineProgram_Depth]);
+
+	//Cubemap
+	app->cubemapProgramIdx = LoadProgram(app, programs[EngineProgram_Cubemap]);
+
+	app->irradianceMapProgramIdx = LoadProgram(app, programs[EngineProgram_IrradianceMap]);
+
+	app->prefilterMapProgramIdx = LoadProgram(app, programs[EngineProgram_PrefilterMap]);
+
+	app->brdfProgramIdx = LoadProgram(app, programs[EngineProgram_Brdf]);
+
+	//Occlusion culling
+	app->hiZBuildProgramIdx = LoadProgram(app, programs[EngineProgram_HiZBuild]);
+	app->occlusionCullProgramIdx = LoadProgram(app, programs[EngineProgram_OcclusionCull]);
+
+	glGenBuffers(1, &app->instanceBuffer);
+	glGenBuffers(1, &app->occlusionObjectBuffer);
+	glGenBuffers(1, &app->occlusionCommandBuffer);
+	glGenBuffers(1, &app->occlusionVisibilityBuffer);
+	glGenBuffers(2, app->occlusionStatsBuffers);
+	for (u32 i = 0; i < ARRAY_COUNT(app->occlusionStatsBuffers); ++i)
+	{
+		OcclusionStats zero = {};
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->occlusionStatsBuffers[i]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(OcclusionStats), &zero, GL_DYNAMIC_READ);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	InitUploadManager(app);
+	InitTextureLoader(app);
+
+	//Cubemap ===============================================================================================
+	GenerateCube(app);
+	CreateCubemap(app);
+
+	GenerateQuad(app);
+
+	//Load Textures
+	app->diceTexIdx = LoadTexture2D(app, "dice.png");
+	app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
+	app->blackTexIdx = LoadTexture2D(app, "color_black.png");
+	app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
+	app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
+
+	//Engine models
+	InitGeometryArena(app);
+	const std::vector<ModelDesc>& models = GetEngineModelDescs();
+	app->directionalLightModel = LoadModel(app, models[EngineModel_Quad]);
+	app->sphereModel = LoadModel(app, models[EngineModel_Sphere]);
+
+	//Entitiy
+	app->model = LoadModel(app, models[EngineModel_Patrick]);
+	//app->model = LoadModel(app, models[EngineModel_Room]);
+	Entity& entity = app->entityStore.entities[CreateEntity(app, app->model, vec3(0.0f, 0.0f, 0.0f))];
+	entity.isStatic = (app->meshes[app->models[app->model].meshIdx].loadFlags & MeshLoad_StaticBatch) != 0;
+	entity.metallic = 1.0f;
+	entity.roughness = 0.75f;
+
+	//u32 materialIdx = app->models[app->sphereModel].materialIdx[0];
+	//app->materials[materialIdx].albedoTextureIdx = app->whiteTexIdx;
+	for (int i = 0; i < 10; ++i)
+	{
+		float x = cos(i * 0.1f * 6.28f) * 2.5f;
+		float z = sin(i * 0.1f * 6.28f) * 2.5f;
+		Entity& sphereEntity = app->entityStore.entities[CreateEntity(app, app->sphereModel, vec3(x, 0.0f, z))];
+		sphereEntity.metallic = i * 0.1f;
+		sphereEntity.roughness = 1.0f - (i * 0.1f);
+	}
+
+	//Lights
+	//Directional
+	app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(2.5f, 3.0f, 0.0f), vec3(0.2f, 0.250f, 0.8f), vec3(0.9f, 0.0f, 0.0f)));
+	app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(-2.9f, 2.75f, -2.0f), vec3(1.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 0.9f)));
+
+	//Point
+	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(-1.0f, 2.75, 2.2f), vec3(1.0f), vec3(0.0f, 1.0f, 0.0f)));
+	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(1.0f, 2.75, 2.2f), vec3(1.0f), vec3(0.5f, 0.2f, 0.5f)));
+	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(0.1f, 1.55, -0.2f), vec3(1.0f), vec3(0.33f, 0.2f, 0.05f)));
+	//app->lights.push_back(pointLight);
+
+	// ====================================================================================================================================================
+
+	//Rendering
+	app->currentRenderMode = RenderMode::DEFERRED;
+	app->currentRenderTargetMode = RenderTargetsMode::FINAL_RENDER;
+
+	// Wait for the programs that were compiling while the assets loaded
+	for (u32 i = 0; i < app->programs.size(); ++i)
+	{
+		FinishProgramReload(app, app->programs[i], true);
+	}
+
+	// The first frame draws every asset loaded so far
+	FlushUploads(app);
+
+	Program& forwardQuadProgram = app->programs[app->forwardQuadProgramIdx];
+	app->programUniformTexture = glGetUniformLocation(forwardQuadProgram.handle, "uTexture");
+
+	OnScreenResize(app);
+}
+
+void Shutdown(App* app)
+{
+	ShutdownTextureLoader(app);
+}
+
+void Gui(App* app)
+{
+	//Info window
+	ImGui::Begin("Info");
+	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
+	ImGui::Text("OpenGL version: %s", app->openGlVersion);
+	ImGui::Text("OpenGL Renderer: %s", app->gpuName);
+	ImGui::Text("OpenGL Vendor: %s", app->gpuVendor);
+	ImGui::Text("OpenGL GLSL version: %s", app->glslVersion);
+
+	ImGui::Text("Parallel shader compile: %s", app->parallelShaderCompile ? "yes" : "no");
+	ImGui::Text("Programs compiling: %u", app->renderStats.programsCompiling);
+
+	if (app->useRenderThread)
+		ImGui::Text("Render thread: on, %u frame(s) queued at most", app->frameQueueDepth);
+	else
+		ImGui::Text("Render thread: off");
+	ImGui::Text("Simulation %.2f ms, render %.2f ms, input to present %.2f ms",
+		app->simulationMilliseconds, app->renderStats.renderMilliseconds, app->averageLatencyMilliseconds);
+
+	u64 meshGpuBytes = 0;
+	u64 meshUncompressedBytes = 0;
+	for (u32 i = 0; i < app->meshes.size(); ++i)
+	{
+		const Mesh& mesh = app->meshes[i];
+		meshGpuBytes += mesh.vertexBufferSize + mesh.indexBufferSize;
+		meshUncompressedBytes += mesh.uncompressedVertexBufferSize + mesh.uncompressedIndexBufferSize;
+	}
+	ImGui::Text("Mesh memory: %.1f KB on GPU (%.1f KB uncompressed), %.1f KB resident on CPU",
+		meshGpuBytes / 1024.0f, meshUncompressedBytes / 1024.0f, GetResidentMeshBytes(app) / 1024.0f);
+
+	// Every vertex and index of a drawn mesh read at least once
+	u64 fetchedBytes = 0;
+	u64 fetchedUncompressedBytes = 0;
+	for (u32 i = 0; i < app->entityStore.count; ++i)
+	{
+		const Mesh& mesh = app->meshes[app->models[app->entityStore.entities[i].modelIndex].meshIdx];
+		fetchedBytes += mesh.vertexBufferSize + mesh.indexBufferSize;
+		fetchedUncompressedBytes += mesh.uncompressedVertexBufferSize + mesh.uncompressedIndexBufferSize;
+	}
+	ImGui::Text("Geometry fetched per frame: %.1f KB (%.1f KB uncompressed)", fetchedBytes / 1024.0f, fetchedUncompressedBytes / 1024.0f);
+	ImGui::Text("Frame time: %.2f ms", app->deltaTime * 1000.0f);
+	ImGui::Text("Triangles per frame: %llu (%llu with LODs and culling off)", app->renderStats.trianglesDrawn, app->trianglesFullDetail);
+	ImGui::Text("Meshlets visible: %llu / %llu", app->renderStats.meshletsVisible, app->renderStats.meshletsTested);
+	ImGui::Text("Draw calls: %u (%u entities instanced), geometry submitted in %.3f ms", app->renderStats.drawCalls,
+		app->renderStats.instancedDraws, app->renderStats.geometryMilliseconds);
+	ImGui::Text("Uploads: %u copies, %.1f KB in %.3f ms, %u (%.1f KB) queued, staging ring %s", app->renderStats.uploadCommands,
+		app->renderStats.uploadBytes / 1024.0f, app->renderStats.uploadMilliseconds, app->renderStats.uploadsPending,
+		app->renderStats.uploadBytesPending / 1024.0f, app->uploads.persistent ? "persistent" : "unsynchronized");
+	ImGui::Text("Texture loads: %u pending (last took %.1f ms on the loader thread), %u / %u frames over %.0f ms while loading",
+		(u32)app->textureLoader.pending, app->textureLoader.lastLoadMilliseconds, app->loadHitches, app->loadFrames, LOAD_HITCH_MILLISECONDS);
+	ImGui::Text("Texture streaming: %.1f / %.1f MB resident, %u levels staged and %u evicted, %u textures streaming",
+		app->renderStats.textureResidentBytes / (1024.0f * 1024.0f), app->renderStats.textureFullBytes / (1024.0f * 1024.0f),
+		app->renderStats.textureLevelsStreamed, app->renderStats.textureLevelsEvicted, app->renderStats.texturesStreaming);
+	ImGui::Text("Texture budget: %.1f / %.1f MB used, %llu levels evicted unneeded and %llu for the budget, %u needed levels left out",
+		app->renderStats.textureResidentBytes / (1024.0f * 1024.0f), app->textureBudgetBytes / (1024.0f * 1024.0f),
+		app->renderStats.textureEvictionsTotal, app->renderStats.textureBudgetEvictionsTotal, app->renderStats.textureLevelsOverBudget);
+	if (app->useOcclusionCulling)
+	{
+		const FrameStats& stats = app->renderStats;
+		ImGui::Text("Occlusion culling: %u / %u submeshes drawn (%u in the second pass), %llu / %llu triangles",
+			stats.occlusionObjectsVisible, stats.occlusionObjectsTested, stats.occlusionSecondPassObjects,
+			stats.occlusionTrianglesVisible, stats.occlusionTrianglesTested);
+	}
+	BvhStats bvhStats = GetBvhStats(&app->entityBvh);
+	ImGui::Text("Entities in the frustum: %u / %u (BVH depth %u, SAH cost %.1f, %u rotations, %u reinsertions)", (u32)app->visibleEntities.size(), app->entityStore.count,
+		bvhStats.maxDepth, bvhStats.sahCost, app->entityBvh.rotationCount, app->entityBvh.reinsertionCount);
+	if (app->usePvs)
+		ImGui::Text("PVS: %u / %u submeshes of static interiors culled", app->pvsCulledSubmeshes, app->pvsTestedSubmeshes);
+	if (app->useStaticBatching && app->staticBatches)
+	{
+		const StaticBatchSet& batches = *app->staticBatches;
+		ImGui::Text("Static batching: %u / %u batches drawn, merging %u submeshes of %u static entities (built in %.1f ms)", app->staticBatchesVisible,
+			(u32)batches.mesh.submeshes.size(), batches.sourceSubmeshCount, (u32)batches.entities.size(), batches.buildMilliseconds);
+	}
+	if (app->useSoftwareOcclusion)
+	{
+		ImGui::Text("Software occlusion: %u / %u entities occluded, %u occluder triangles, %.3f ms", app->softwareOcclusionCulled,
+			app->softwareOcclusionTested, app->softwareOcclusionBuffer.rasterizedTriangles, app->softwareOcclusionMilliseconds);
+	}
+	ImGui::Text("Transforms recomputed: %u world, %u world-view-projection, %u LocalParams uploaded",
+		app->entityStore.recomputedWorldCount, app->entityStore.recomputedWorldViewProjectionCount, app->uploadedEntityParams);
+	if (ImGui::TreeNode("Mesh optimization"))
+	{
+		for (u32 i = 0; i < app->meshes.size(); ++i)
+		{
+			const MeshOptimizationStats& stats = app->meshes[i].optimizationStats;
+			if (stats.triangleCount == 0)
+				continue;
+
+			ImGui::Text("Mesh %u: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f", i,
+				(f32)stats.cacheMissesBefore / stats.triangleCount, (f32)stats.cacheMissesAfter / stats.triangleCount,
+				(f32)stats.cacheMissesBefore / glm::max(stats.vertexCountBefore, 1ull), (f32)stats.cacheMissesAfter / glm::max(stats.vertexCountAfter, 1ull),
+				(f32)stats.pixelsShadedBefore / glm::max(stats.pixelsCovered, 1ull), (f32)stats.pixelsShadedAfter / glm::max(stats.pixelsCovered, 1ull));
+		}
+
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("PVS"))
+	{
+		for (u32 i = 0; i < app->meshes.size(); ++i)
+		{
+			const Pvs& pvs = app->meshes[i].pvs;
+			if (pvs.objectCount == 0)
+				continue;
+
+			ImGui::Text("Mesh %u: %u x %u x %u cells (%u interior), %u distinct sets of %u submeshes, %.1f KB, built in %.0f ms with %llu rays", i,
+				pvs.cellCounts[0], pvs.cellCounts[1], pvs.cellCounts[2], pvs.interiorCellCount, (u32)pvs.setOffsets.size() - 1, pvs.objectCount,
+				GetPvsSize(&pvs) / 1024.0f, pvs.buildMilliseconds, pvs.rayCount);
+		}
+
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("Geometry arena"))
+	{
+		const GeometryArenaStats& arena = app->renderStats.geometryArena;
+		for (u32 i = 0; i < arena.vertexPoolCount && i < GEOMETRY_ARENA_MAX_STATS_POOLS; ++i)
+		{
+			const RangeAllocatorStats& stats = arena.vertices[i];
+			ImGui::Text("Vertex pool %u (%u B vertices): %.1f / %.1f MB in %u ranges, %u free blocks (largest %.1f MB), fragmentation %.1f%%", i,
+				arena.vertexStrides[i], (f64)stats.allocatedSize * arena.vertexStrides[i] / MB(1), (f64)stats.capacity * arena.vertexStrides[i] / MB(1),
+				stats.allocationCount, stats.freeBlockCount, (f64)stats.largestFreeBlock * arena.vertexStrides[i] / MB(1), stats.fragmentation * 100.0f);
+		}
+		const RangeAllocatorStats& indices = arena.indices;
+		ImGui::Text("Indices: %.1f / %.1f MB in %u ranges, %u free blocks (largest %.1f MB), fragmentation %.1f%%",
+			(f64)indices.allocatedSize / MB(1), (f64)indices.capacity / MB(1), indices.allocationCount, indices.freeBlockCount,
+			(f64)indices.largestFreeBlock / MB(1), indices.fragmentation * 100.0f);
+		ImGui::Text("Buffers grown %u times", arena.growCount);
+
+		for (u32 i = 0; i < app->models.size(); ++i)
+		{
+			const Mesh& mesh = app->meshes[app->models[i].meshIdx];
+			if (mesh.unloaded)
+				continue;
+
+			ImGui::PushID(i);
+			ImGui::Text("Model %u: %.1f KB", i, (mesh.vertexBufferSize + mesh.indexBufferSize) / 1024.0f);
+			ImGui::SameLine();
+			if (ImGui::Button("Unload"))
+				UnloadModel(app, i);
+			ImGui::PopID();
+		}
+
+		if (ImGui::Button("Benchmark range allocator"))
+		{
+			RangeAllocatorBenchmark benchmark = BenchmarkRangeAllocator(1000000);
+			ILOG("Range allocator x%u: %.1f ns per operation, %u allocations failed, %u live, fragmentation %.1f%%", benchmark.operationCount,
+				benchmark.nanosecondsPerOperation, benchmark.failedAllocations, benchmark.stats.allocationCount, benchmark.stats.fragmentation * 100.0f);
+			app->rangeAllocatorBenchmarks.push_back(benchmark);
+		}
+		for (const RangeAllocatorBenchmark& benchmark : app->rangeAllocatorBenchmarks)
+		{
+			ImGui::Text("x%u: %.1f ns per operation, %u allocations failed, %u live, fragmentation %.1f%%", benchmark.operationCount,
+				benchmark.nanosecondsPerOperation, benchmark.failedAllocations, benchmark.stats.allocationCount, benchmark.stats.fragmentation * 100.0f);
+		}
+
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("Memory"))
+	{
+		std::vector<MemoryStats> memoryStats;
+		GetMemoryStats(memoryStats);
+		for (u32 i = 0; i < memoryStats.size(); ++i)
+		{
+			const MemoryStats& stats = memoryStats[i];
+			if (stats.isPool)
+			{
+				ImGui::Text("%s pool: %llu / %llu elements (peak %llu), %llu allocations",
+					stats.name, stats.used, stats.reserved, stats.highWaterMark, stats.totalAllocationCount);
+			}
+			else
+			{
+				ImGui::Text("%s arena: %.1f / %.1f KB in %u blocks (peak %.1f KB)",
+					stats.name, stats.used / 1024.0f, stats.reserved / 1024.0f, stats.blockCount, stats.highWaterMark / 1024.0f);
+				ImGui::Text("    last reset: %.1f KB in %llu allocations, %llu allocations total",
+					stats.lastFrameUsed / 1024.0f, stats.lastFrameAllocationCount, stats.totalAllocationCount);
+			}
+		}
+
+		ImGui::TreePop();
+	}
+	if (ImGui::TreeNode("OpenGL extensions:"))
+	{
+		for (u32 i = 0; i < app->glExtensions.size(); ++i)
+		{
+			ImGui::Text("%s", app->glExtensions[i].c_str());
+		}
+
+		ImGui::TreePop();
+	}
+
+	ImGui::End();
+
+	ImGui::Begin("Editor");
+
+	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+
+	ImGui::Text("Camera");
+
+	float cameraPosition[3] = { app->camera.position.x, app->camera.position.y, app->camera.position.z };
+	ImGui::DragFloat3("Camera position", cameraPosition, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
+	app->camera.position = vec3(cameraPosition[0], cameraPosition[1], cameraPosition[2]);
+
+	ImGui::DragFloat("Movement speed", &app->camera.movementSpeed, 0.05f, 0.0f, 200.0f, "%.2f", 1.0f);
+	ImGui::DragFloat("Mouse Sensitivity", &app->camera.mouseSensitivity, 0.02f, 0.0f, 1.0f, "%.2f", 1.0f);
+
+
+	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+	ImGui::Separator();
+	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+
+	ImGui::Checkbox("Show Skybox", &app->showSkybox);
+	ImGui::Checkbox("PBR", &app->PBR);
+	ImGui::Checkbox("LODs", &app->useLods);
+	ImGui::Checkbox("Meshlet culling", &app->useMeshletCulling);
+	ImGui::Checkbox("Meshlet cone culling", &app->useMeshletConeCulling);
+	ImGui::Checkbox("BVH frustum culling", &app->useBvhCulling);
+	ImGui::Checkbox("Software occlusion culling", &app->useSoftwareOcclusion);
+	ImGui::Checkbox("PVS culling (static interiors)", &app->usePvs);
+	ImGui::Checkbox("Instancing", &app->useInstancing);
+	ImGui::Checkbox("Static batching", &app->useStaticBatching);
+	ImGui::Checkbox("GPU occlusion culling", &app->useOcclusionCulling);
+
+	i32 uploadBudgetKilobytes = (i32)(app->uploadBudgetBytes / KB(1));
+	if (ImGui::SliderInt("Upload budget (KB/frame)", &uploadBudgetKilobytes, 64, 64 * 1024))
+		app->uploadBudgetBytes = (u32)uploadBudgetKilobytes * KB(1);
+	ImGui::SliderFloat("Upload budget (ms/frame)", &app->uploadBudgetMilliseconds, 0.1f, 8.0f, "%.1f");
+
+	const char* renderModeBuffers[] = { "FORWARD", "DEFERRED" };
+	if (ImGui::BeginCombo("Render Mode", renderModeBuffers[(u32)app->currentRenderMode]))
+	{
+		for (u64 i = 0; i < IM_ARRAYSIZE(renderModeBuffers); ++i)
+		{
+			bool isSelected = (i == (u32)app->currentRenderMode);
+			if (ImGui::Selectable(renderModeBuffers[i], isSelected))
+			{
+				app->currentRenderMode = (RenderMode)i;
+			}
+		}
+
+		ImGui::EndCombo();
+	}
+
+	const char* renderTargetBuffers[] = { "ALBEDO", "NORMALS", "POSITION", "DEPTH", "METALLIC", "ROUGHNESS", "FINAL RENDER" };
+	if (ImGui::BeginCombo("Render Targets", renderTargetBuffers[(u32)app->currentRenderTargetMode]))
+	{
+		for (u64 i = 0; i < IM_ARRAYSIZE(renderTargetBuffers); ++i)
+		{
+			bool isSelected = (i == (u32)app->currentRenderTargetMode);
+			if (ImGui::Selectable(renderTargetBuffers[i], isSelected))
+			{
+				app->currentRenderTargetMode = (RenderTargetsMode)i;
+			}
+		}
+
+		ImGui::EndCombo();
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+	ImGui::Separator();
+	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+
+	if (app->pickedEntity != BVH_NULL)
+		ImGui::Text("Picked entity: %u", app->pickedEntity);
+	else
+		ImGui::Text("Picked entity: none (click one in the viewport)");
+
+	if (ImGui::TreeNode("Entities"))
+	{
+		for (u32 i = 0; i < app->entityStore.count; ++i)
+		{
+			ImGui::PushID(i);
+			std::string entityName = "Entity: " + std::to_string(i);
+
+			ImGui::Text(entityName.c_str());
+
+			Entity& entity = app->entityStore.entities[i];
+			vec3 entityPosition = GetEntityPosition(&app->entityStore, i);
+			float position[3] = { entityPosition.x, entityPosition.y, entityPosition.z };
+			if (ImGui::DragFloat3("Position", position, 0.1f, -20000000000000000.0f, 200000000000000000000.0f))
+				SetEntityPosition(&app->entityStore, i, vec3(position[0], position[1], position[2]));
+
+			ImGui::DragFloat("Metallic", &entity.metallic, 0.05f, 0.0f, 1.0f, "%.2f");
+			ImGui::DragFloat("Roughness", &entity.roughness, 0.05f, 0.0f, 1.0f, "%.2f");
+			ImGui::Checkbox("Static", &entity.isStatic);
+
+			ImGui::PopID();
+		}
+		ImGui::TreePop();
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+
+	if (ImGui::Button("Create Entity"))
+	{
+		CreateEntity(app, app->model, vec3(0.0f));
+	}
+
+	if (ImGui::Button("Benchmark entity transforms"))
+	{
+		app->entityBenchmarks.clear();
+		const u32 entityCounts[] = { 10000, 100000, 1000000 };
+		for (u32 i = 0; i < ARRAY_COUNT(entityCounts); ++i)
+		{
+			EntityTransformBenchmark benchmark = BenchmarkEntityTransforms(entityCounts[i]);
+			ILOG("Entity transforms x%u: AoS %.3f ms, SoA scalar %.3f ms, SoA SSE %.3f ms, static SoA SSE %.3f ms (max error %g)", benchmark.entityCount,
+				benchmark.aosMilliseconds, benchmark.soaScalarMilliseconds, benchmark.soaSimdMilliseconds, benchmark.soaStaticMilliseconds, benchmark.maxError);
+			app->entityBenchmarks.push_back(benchmark);
+		}
+	}
+	for (const EntityTransformBenchmark& benchmark : app->entityBenchmarks)
+	{
+		ImGui::Text("x%u: AoS %.3f ms, SoA scalar %.3f ms, SoA SSE %.3f ms, static SoA SSE %.3f ms", benchmark.entityCount,
+			benchmark.aosMilliseconds, benchmark.soaScalarMilliseconds, benchmark.soaSimdMilliseconds, benchmark.soaStaticMilliseconds);
+	}
+
+	if (ImGui::Button("Benchmark job system scaling"))
+	{
+		const u32 entityCount = 100000;
+		BenchmarkEntityScaling(entityCount, std::thread::hardware_concurrency(), Align(2 * sizeof(mat4), app->uniformBufferAlignment), app->entityScalingBenchmarks);
+		for (const EntityScalingBenchmark& benchmark : app->entityScalingBenchmarks)
+		{
+			ILOG("Entity scaling x%u, %u threads: transforms %.3f ms (%.2fx), params %.3f ms (%.2fx)", entityCount, benchmark.threadCount,
+				benchmark.transformMilliseconds, app->entityScalingBenchmarks[0].transformMilliseconds / benchmark.transformMilliseconds,
+				benchmark.paramsMilliseconds, app->entityScalingBenchmarks[0].paramsMilliseconds / benchmark.paramsMilliseconds);
+		}
+	}
+	for (const EntityScalingBenchmark& benchmark : app->entityScalingBenchmarks)
+	{
+		ImGui::Text("%u threads: transforms %.3f ms (%.2fx), params %.3f ms (%.2fx)", benchmark.threadCount,
+			benchmark.transformMilliseconds, app->entityScalingBenchmarks[0].transformMilliseconds / benchmark.transformMilliseconds,
+			benchmark.paramsMilliseconds, app->entityScalingBenchmarks[0].paramsMilliseconds / benchmark.paramsMilliseconds);
+	}
+
+	if (ImGui::Button("Benchmark BVH"))
+	{
+		BvhBenchmark benchmark = BenchmarkBvh(100000);
+		ILOG("BVH x%u: insert %.3f ms, refit %.3f ms, reinsert %.3f ms, %u frustums %.3f ms (linear %.3f ms), %u spheres %.3f ms (linear %.3f ms), %u rays %.3f ms (linear %.3f ms), depth %u, SAH cost %.1f",
+			benchmark.entityCount, benchmark.insertMilliseconds, benchmark.refitMilliseconds, benchmark.reinsertMilliseconds,
+			benchmark.frustumQueryCount, benchmark.frustumBvhMilliseconds, benchmark.frustumLinearMilliseconds,
+			benchmark.sphereQueryCount, benchmark.sphereBvhMilliseconds, benchmark.sphereLinearMilliseconds,
+			benchmark.rayCount, benchmark.rayBvhMilliseconds, benchmark.rayLinearMilliseconds, benchmark.stats.maxDepth, benchmark.stats.sahCost);
+		app->bvhBenchmarks.push_back(benchmark);
+	}
+	for (const BvhBenchmark& benchmark : app->bvhBenchmarks)
+	{
+		ImGui::Text("x%u: insert %.3f ms, refit %.3f ms, reinsert %.3f ms", benchmark.entityCount, benchmark.insertMilliseconds, benchmark.refitMilliseconds, benchmark.reinsertMilliseconds);
+		ImGui::Text("  %u frustums %.3f ms (linear %.3f ms), %u spheres %.3f ms (linear %.3f ms), %u rays %.3f ms (linear %.3f ms)",
+			benchmark.frustumQueryCount, benchmark.frustumBvhMilliseconds, benchmark.frustumLinearMilliseconds,
+			benchmark.sphereQueryCount, benchmark.sphereBvhMilliseconds, benchmark.sphereLinearMilliseconds,
+			benchmark.rayCount, benchmark.rayBvhMilliseconds, benchmark.rayLinearMilliseconds);
+	}
+
+	if (ImGui::Button("Benchmark software occlusion"))
+	{
+		// The occluders of the scene in world space
+		std::vector<OccluderMesh> occluders;
+		for (u32 i = 0; i < app->entityStore.count; ++i)
+		{
+			const Mesh& mesh = app->meshes[app->models[app->entityStore.entities[i].modelIndex].meshIdx];
+			for (const OccluderMesh& occluder : mesh.occluders)
+			{
+				occluders.push_back(occluder);
+				for (vec3& position : occluders.back().positions)
+					position = vec3(app->entityStore.worldMatrices[i] * vec4(position, 1.0f));
+			}
+		}
+
+		if (occluders.empty())
+			ELOG("No occluders to benchmark, load a model with MeshLoad_Occluders (e.g. the room)");
+		BenchmarkSoftwareOcclusion(occluders.data(), (u32)occluders.size(), std::thread::hardware_concurrency(), app->softwareOcclusionBenchmarks);
+		for (const SoftwareOcclusionBenchmark& benchmark : app->softwareOcclusionBenchmarks)
+		{
+			ILOG("Software occlusion, %u threads: %u occluder triangles %.3f ms, %u boxes %.3f ms, %.1f%% occluded", benchmark.threadCount,
+				benchmark.occluderTriangles, benchmark.rasterMilliseconds, benchmark.objectCount, benchmark.testMilliseconds, benchmark.occludedRatio * 100.0f);
+		}
+	}
+	for (const SoftwareOcclusionBenchmark& benchmark : app->softwareOcclusionBenchmarks)
+	{
+		ImGui::Text("%u threads: raster %.3f ms, test %.3f ms, %.1f%% occluded", benchmark.threadCount,
+			benchmark.rasterMilliseconds, benchmark.testMilliseconds, benchmark.occludedRatio * 100.0f);
+	}
+
+	if (ImGui::Button("Benchmark instancing") && !app->toggleBenchmark.running)
+	{
+		// Fill the scene up to the benchmark count with spheres on a grid below the model
+		u32 sphereCount = 0;
+		for (u32 i = 0; i < app->entityStore.count; ++i)
+			sphereCount += app->entityStore.entities[i].modelIndex == app->sphereModel ? 1 : 0;
+
+		const u32 gridSide = 100;
+		for (u32 i = sphereCount; i < INSTANCING_BENCHMARK_ENTITIES; ++i)
+		{
+			f32 x = ((i % gridSide) - gridSide * 0.5f) * 2.5f;
+			f32 z = ((i / gridSide % gridSide) - gridSide * 0.5f) * 2.5f;
+			Entity& sphereEntity = app->entityStore.entities[CreateEntity(app, app->sphereModel, vec3(x, -5.0f, z))];
+			sphereEntity.metallic = (i % 10) * 0.1f;
+			sphereEntity.roughness = 1.0f - (i % 10) * 0.1f;
+		}
+
+		StartRenderToggleBenchmark(app, "Instancing", &app->useInstancing);
+	}
+	if (ImGui::Button("Reload textures"))
+	{
+		for (u32 i = 0; i < app->textures.size(); ++i)
+			ReloadTexture(app, i, app->useTextureLoader);
+	}
+	ImGui::SameLine();
+	ImGui::Checkbox("Texture loader thread", &app->useTextureLoader);
+	ImGui::SameLine();
+	ImGui::Checkbox("Texture streaming", &app->useTextureStreaming);
+	i32 textureBudgetMegabytes = (i32)(app->textureBudgetBytes / MB(1));
+	if (ImGui::SliderInt("Texture budget (MB)", &textureBudgetMegabytes, 16, 4096))
+		app->textureBudgetBytes = (u64)textureBudgetMegabytes * MB(1);
+	const char* compressions[TextureCompression_Count] = { "Off", "BC1", "BC7" };
+	i32 compression = (i32)app->textureCompression;
+	if (ImGui::Combo("Texture compression", &compression, compressions, TextureCompression_Count))
+	{
+		// Cooked again where the format changed, on the loader thread when it is on
+		app->textureCompression = (TextureCompression)compression;
+		for (u32 i = 0; i < app->textures.size(); ++i)
+			ReloadTexture(app, i, app->useTextureLoader);
+	}
+	const char* qualityTiers[TEXTURE_QUALITY_TIER_COUNT] = { "Full", "Half", "Quarter" };
+	i32 qualityTier = (i32)app->textureQualityTier;
+	if (ImGui::Combo("Texture quality", &qualityTier, qualityTiers, TEXTURE_QUALITY_TIER_COUNT))
+	{
+		// Applied at load, so every texture is loaded again
+		app->textureQualityTier = (u32)qualityTier;
+		for (u32 i = 0; i < app->textures.size(); ++i)
+			ReloadTexture(app, i, app->useTextureLoader);
+	}
+	if (ImGui::Button("Benchmark texture compression"))
+		BenchmarkTextureCompression(app);
+	if (!app->textureCompressionBenchmarks.empty())
+	{
+		u64 uncompressedBytes = 0, compressedBytes = 0;
+		for (const TextureCompressionBenchmark& benchmark : app->textureCompressionBenchmarks)
+		{
+			ImGui::Text("%s %dx%d %s: %.1f MPixels/s, PSNR %.1f dB, %.0f KB instead of %.0f KB", benchmark.filepath.c_str(), benchmark.size.x,
+				benchmark.size.y, GetBlockFormatName(benchmark.format), benchmark.megapixelsPerSecond, benchmark.psnr,
+				benchmark.compressedBytes / 1024.0f, benchmark.uncompressedBytes / 1024.0f);
+			uncompressedBytes += benchmark.uncompressedBytes;
+			compressedBytes += benchmark.compressedBytes;
+		}
+		ImGui::Text("%u textures: %.1f MB instead of %.1f MB, %.1f MB saved", (u32)app->textureCompressionBenchmarks.size(),
+			compressedBytes / (1024.0f * 1024.0f), uncompressedBytes / (1024.0f * 1024.0f), (uncompressedBytes - compressedBytes) / (1024.0f * 1024.0f));
+	}
+	if (ImGui::Button("Benchmark texture loading") && !app->textureLoadBenchmark.running)
+		StartTextureLoadBenchmark(app);
+	if (app->textureLoadBenchmark.running)
+		ImGui::Text("Loading...");
+	for (const TextureLoadBenchmark& benchmark : app->textureLoadBenchmarks)
+	{
+		ImGui::Text("Loader thread %s: %u textures, %u / %u frames over %.0f ms, worst %.1f ms", benchmark.loaderThread ? "on" : "off",
+			benchmark.textureCount, benchmark.hitchCount, benchmark.frameCount, LOAD_HITCH_MILLISECONDS, benchmark.worstFrameMilliseconds);
+	}
+
+	if (ImGui::Button("Benchmark static batching") && !app->toggleBenchmark.running)
+	{
+		if (!app->staticBatches || app->staticBatches->entities.empty())
+			ELOG("No static entities to batch, load a model with MeshLoad_StaticBatch (e.g. the room) and mark its entities static");
+		StartRenderToggleBenchmark(app, "Static batching", &app->useStaticBatching);
+	}
+	// Move the camera away from the scene first, close up every entity draws its full resolution
+	if (ImGui::Button("Benchmark LODs") && !app->toggleBenchmark.running)
+		StartRenderToggleBenchmark(app, "LODs", &app->useLods);
+	if (app->toggleBenchmark.running)
+		ImGui::Text("Benchmarking...");
+	for (const RenderToggleBenchmark& benchmark : app->toggleBenchmarks)
+	{
+		ImGui::Text("%s %s, %u entities: %.0f draw calls, %.0f triangles, frame %.3f ms, geometry %.3f ms, render %.3f ms", benchmark.name, benchmark.enabled ? "on" : "off",
+			benchmark.entityCount, benchmark.drawCalls, benchmark.trianglesDrawn, benchmark.frameMilliseconds, benchmark.geometryMilliseconds, benchmark.renderMilliseconds);
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 7.5f));
+	ImGui::Separator();
+	ImGui::Dummy(ImVec2(0.0f, 7.5f));
+
+	if (ImGui::TreeNode("Lights"))
+	{
+		for (int i = 0; i < app->lights.size(); i++)
+		{
+			Light& light = *app->lights[i];
+
+			ImGui::PushID(i * 1000);
+
+			std::string lightName = "Light: " + std::to_string(i);
+			lightName += light.type == LightType::LightType_Directional ? " - Directional Light" : " - Point Light";
+			ImGui::Text(lightName.c_str());
+
+			ImGui::Dummy(ImVec2(0.0f, 10.0f));
+
+			float position[3] = { light.position.x, light.position.y, light.position.z };
+			ImGui::DragFloat3("Position", position, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
+			light.position = vec3(position[0], position[1], position[2]);
+
+			if (light.type == LightType::LightType_Directional)
+			{
+				float direction[3] = { light.direction.x, light.direction.y, light.direction.z };
+				ImGui::DragFloat3("Direction", direction, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
+				light.direction = vec3(direction[0], direction[1], direction[2]);
+			}
+			else
+			{
+				std::vector<u32> litEntities;
+				f32 radius = GetLightInfluenceRadius(light);
+				QueryBvhSphere(&app->entityBvh, light.position, radius, litEntities);
+				ImGui::Text("Range %.2f, entities in range: %u", radius, (u32)litEntities.size());
+			}
+
+			float color[3] = { light.color.r, light.color.g, light.color.b };
+			ImGui::ColorPicker3("Color", color);
+			light.color = vec3(color[0], color[1], color[2]);
+			ImGui::PopID();
+
+			ImGui::Dummy(ImVec2(0.0f, 10.0f));
+			ImGui::Separator();
+			ImGui::Dummy(ImVec2(0.0f, 15.0f));
+		}
+		ImGui::TreePop();
+	}
+
+	ImGui::Dummy(ImVec2(0.0f, 7.5f));
+
+	if (ImGui::Button("Create Directional Light"))
+	{
+		app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f)));
+	}
+
+	if (ImGui::Button("Create Point Light"))
+	{
+		app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(0.0f, 1.5f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f)));
+	}
+
+	ImGui::End();
+}
+
+void Update(App* app, FrameSnapshot* snapshot)
+{
+	// You can handle app->input keyboard/mouse here
+	HandleInput(app);
+	UpdateRenderToggleBenchmark(app);
+	UpdateTextureLoadBenchmark(app);
+
+	if (app->textureLoader.pending > 0)
+	{
+		app->loadFrames++;
+		app->loadHitches += app->deltaTime * 1000.0 > LOAD_HITCH_MILLISECONDS ? 1 : 0;
+	}
+
+	float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
+	float znear = 0.1f;
+	float zfar = 1000.0f;
+
+	mat4 projection = glm::perspective(glm::radians(app->camera.zoom), aspectRatio, znear, zfar);
+	mat4 view = app->camera.GetViewMatrix();
+
+	snapshot->frameIndex = app->frameIndex++;
+	snapshot->displaySize = app->displaySize;
+	snapshot->cameraPosition = app->camera.position;
+	snapshot->view = view;
+	snapshot->projection = projection;
+	snapshot->renderMode = app->currentRenderMode;
+	snapshot->renderTargetMode = app->currentRenderTargetMode;
+	snapshot->showSkybox = app->showSkybox;
+	snapshot->PBR = app->PBR;
+	snapshot->useMeshletCulling = app->useMeshletCulling;
+	snapshot->useMeshletConeCulling = app->useMeshletConeCulling;
+	snapshot->useOcclusionCulling = app->useOcclusionCulling;
+	snapshot->useTextureStreaming = app->useTextureStreaming;
+	snapshot->textureBudgetBytes = app->textureBudgetBytes;
+	snapshot->textureSkippedLevels = app->textureQualityTier;
+	snapshot->textureCompression = app->textureCompression;
+	snapshot->uploadBudgetBytes = app->uploadBudgetBytes;
+	snapshot->uploadBudgetMilliseconds = app->uploadBudgetMilliseconds;
+	snapshot->stats = {};
+	snapshot->geometryFrees.swap(app->pendingGeometryFrees);
+	app->pendingGeometryFrees.clear();
+	snapshot->textureReloads.swap(app->pendingTextureReloads);
+	app->pendingTextureReloads.clear();
+
+	//Global params, written with the same Push helpers as a mapped buffer
+	snapshot->globalParams.resize(GLOBAL_PARAMS_MAX_SIZE);
+	Buffer globalParams = {};
+	globalParams.data = snapshot->globalParams.data();
+	globalParams.size = GLOBAL_PARAMS_MAX_SIZE;
+
+	// Directional lights go first so the shaders can loop over each type
+	// without branching on uLight[i].type
+	u32 directionalLightCount = 0;
+	snapshot->lightTypes = 0;
+	for (u32 i = 0; i < app->lights.size(); ++i)
+	{
+		if (app->lights[i]->type == LightType::LightType_Directional)
+			directionalLightCount++;
+		snapshot->lightTypes |= app->lights[i]->type == LightType::LightType_Directional ? LIGHT_TYPES_DIRECTIONAL : LIGHT_TYPES_POINT;
+	}
+	u32 lightCount = glm::min((u32)app->lights.size(), (u32)MAX_LIGHTS);
+	directionalLightCount = glm::min(directionalLightCount, lightCount);
+	snapshot->lightCount = lightCount;
+
+	PushUInt(globalParams, directionalLightCount);
+	PushVec3(globalParams, app->camera.position);
+	PushUInt(globalParams, lightCount);
+
+	u32 pushedLights = 0;
+	for (u32 pass = 0; pass < 2; ++pass)
+	{
+		LightType passType = pass == 0 ? LightType::LightType_Directional : LightType::LightType_Point;
+		for (u32 i = 0; i < app->lights.size() && pushedLights < lightCount; ++i)
+		{
+			Light& light = *app->lights[i];
+			if (light.type != passType)
+				continue;
+
+			AlignHead(globalParams, sizeof(vec4));
+
+			PushUInt(globalParams, (u32)light.type);
+			PushVec3(globalParams, light.color);
+			PushVec3(globalParams, light.direction);
+			PushVec3(globalParams, light.position);
+			pushedLights++;
+		}
+	}
+
+	snapshot->globalParams.resize(globalParams.head);
+
+	//Normal entities
+	EntityStore& store = app->entityStore;
+	UpdateEntityTransforms(&store, projection * view);
+	UpdateEntityBvh(app);
+	UpdateStaticBatches(app, snapshot);
+	WriteEntityParamsSnapshot(app, snapshot);
+
+	if (app->input.mouseButtons[LEFT] == BUTTON_PRESS)
+		app->pickedEntity = PickEntity(app, app->input.mousePos, view, projection);
+
+	app->trianglesFullDetail = 0;
+	for (u32 i = 0; i < store.count; ++i)
+	{
+		const Mesh& mesh = app->meshes[app->models[store.entities[i].modelIndex].meshIdx];
+		for (const Submesh& submesh : mesh.submeshes)
+			app->trianglesFullDetail += submesh.lods[0].indexCount / 3;
+	}
+
+	// Sorted so the draws keep the entity order
+	app->visibleEntities.clear();
+	if (app->useBvhCulling)
+	{
+		QueryBvhFrustum(&app->entityBvh, ExtractFrustum(projection * view), app->visibleEntities);
+		std::sort(app->visibleEntities.begin(), app->visibleEntities.end());
+	}
+	else
+	{
+		for (u32 i = 0; i < store.count; ++i)
+			app->visibleEntities.push_back(i);
+	}
+
+	if (app->useSoftwareOcclusion)
+		CullOccludedEntities(app, projection * view);
+
+	// Batches are drawn with the instancing path, which GPU occlusion culling does not use
+	bool useStaticBatches = app->useStaticBatching && !app->useOcclusionCulling && app->staticBatches;
+
+	snapshot->draws.clear();
+	snapshot->submeshMasks.clear();
+	app->pvsTestedSubmeshes = 0;
+	app->pvsCulledSubmeshes = 0;
+	for (u32 i : app->visibleEntities)
+	{
+		if (useStaticBatches && app->staticBatched[i])
+			continue;
+
+		Entity& entity = store.entities[i];
+		SelectEntityLod(app, entity, store.worldMatrices[i]);
+		if (entity.culled)
+			continue;
+
+		SnapshotDraw draw;
+		draw.modelIndex = entity.modelIndex;
+		draw.lodIndex = entity.lodIndex;
+		draw.metallic = entity.metallic;
+		draw.roughness = entity.roughness;
+		draw.localParamsOffset = entity.localParamsOffset;
+		draw.localParamsSize = entity.localParamsSize;
+		draw.worldMatrix = store.worldMatrices[i];
+		draw.worldViewProjection = store.worldViewProjections[i];
+		draw.submeshMaskOffset = SUBMESH_MASK_ALL;
+
+		// Static interiors draw the submeshes in the set of the cell the camera is in
+		const Pvs& pvs = app->meshes[app->models[entity.modelIndex].meshIdx].pvs;
+		if (app->usePvs && pvs.objectCount > 0)
+		{
+			u32 offset = (u32)snapshot->submeshMasks.size();
+			snapshot->submeshMasks.resize(offset + (pvs.objectCount + 31) / 32);
+			vec3 cameraPosition = vec3(glm::inverse(draw.worldMatrix) * vec4(app->camera.position, 1.0f));
+			if (GetPvsVisibleObjects(&pvs, cameraPosition, &snapshot->submeshMasks[offset]))
+			{
+				draw.submeshMaskOffset = offset;
+				app->pvsTestedSubmeshes += pvs.objectCount;
+				for (u32 j = 0; j < pvs.objectCount; ++j)
+					app->pvsCulledSubmeshes += (snapshot->submeshMasks[offset + j / 32] >> (j % 32)) & 1 ? 0 : 1;
+			}
+			else
+			{
+				snapshot->submeshMasks.resize(offset);
+			}
+		}
+		snapshot->draws.push_back(draw);
+	}
+	RequestTextureLevels(app, snapshot);
+
+	snapshot->instanceGroups.clear();
+	snapshot->instances.clear();
+	if (app->useInstancing && !app->useOcclusionCulling)
+		BuildInstanceGroups(snapshot);
+
+	snapshot->staticBatchDraws.clear();
+	app->staticBatchesVisible = 0;
+	if (useStaticBatches)
+		CullStaticBatches(app, snapshot, projection * view);
+}
+
+void BuildInstanceGroups(FrameSnapshot* snapshot)
+{
+	// Draws that skip submeshes keep their own draw calls
+	std::vector<u32> candidates;
+	for (u32 i = 0; i < snapshot->draws.size(); ++i)
+	{
+		if (snapshot->draws[i].submeshMaskOffset == SUBMESH_MASK_ALL)
+			candidates.push_back(i);
+	}
+
+	// Stable so the instances of a group keep the entity order
+	std::stable_sort(candidates.begin(), candidates.end(), [snapshot](u32 a, u32 b)
+	{
+		const SnapshotDraw& drawA = snapshot->draws[a];
+		const SnapshotDraw& drawB = snapshot->draws[b];
+		if (drawA.modelIndex != drawB.modelIndex)
+			return drawA.modelIndex < drawB.modelIndex;
+		return drawA.lodIndex < drawB.lodIndex;
+	});
+
+	std::vector<bool> instanced(snapshot->draws.size(), false);
+	for (u32 begin = 0; begin < candidates.size(); )
+	{
+		const SnapshotDraw& first = snapshot->draws[candidates[begin]];
+		u32 end = begin + 1;
+		while (end < candidates.size() && snapshot->draws[candidates[end]].modelIndex == first.modelIndex &&
+			snapshot->draws[candidates[end]].lodIndex == first.lodIndex)
+			end++;
+
+		if (end - begin >= INSTANCING_MIN_GROUP_SIZE)
+		{
+			SnapshotInstanceGroup group;
+			group.modelIndex = first.modelIndex;
+			group.lodIndex = first.lodIndex;
+			group.firstInstance = (u32)snapshot->instances.size();
+			group.instanceCount = end - begin;
+			snapshot->instanceGroups.push_back(group);
+
+			for (u32 i = begin; i < end; ++i)
+			{
+				const SnapshotDraw& draw = snapshot->draws[candidates[i]];
+				InstanceParams instance;
+				instance.worldMatrix = draw.worldMatrix;
+				instance.worldViewProjection = draw.worldViewProjection;
+				instance.material = vec4(draw.metallic, draw.roughness, 0.0f, 0.0f);
+				snapshot->instances.push_back(instance);
+				instanced[candidates[i]] = true;
+			}
+		}
+		begin = end;
+	}
+
+	if (snapshot->instances.empty())
+		return;
+
+	u32 remaining = 0;
+	for (u32 i = 0; i < snapshot->draws.size(); ++i)
+	{
+		if (!instanced[i])
+			snapshot->draws[remaining++] = snapshot->draws[i];
+	}
+	snapshot->draws.resize(remaining);
+}
+
+void StartRenderToggleBenchmark(App* app, const char* name, bool* setting)
+{
+	RenderToggleBenchmarkState& state = app->toggleBenchmark;
+	state.running = true;
+	state.setting = setting;
+	state.previousValue = *setting;
+	state.framesLeft = RENDER_TOGGLE_BENCHMARK_FRAMES;
+	state.warmupFrames = app->frameQueueDepth + 2;
+	state.current = {};
+	state.current.name = name;
+	state.current.enabled = false;
+	*setting = false;
+	app->toggleBenchmarks.clear();
+}
+
+void UpdateRenderToggleBenchmark(App* app)
+{
+	RenderToggleBenchmarkState& state = app->toggleBenchmark;
+	if (!state.running)
+		return;
+
+	if (state.warmupFrames > 0)
+	{
+		state.warmupFrames--;
+		return;
+	}
+
+	RenderToggleBenchmark& benchmark = state.current;
+	benchmark.drawCalls += app->renderStats.drawCalls;
+	benchmark.trianglesDrawn += app->renderStats.trianglesDrawn;
+	benchmark.frameMilliseconds += app->deltaTime * 1000.0;
+	benchmark.geometryMilliseconds += app->renderStats.geometryMilliseconds;
+	benchmark.renderMilliseconds += app->renderStats.renderMilliseconds;
+	benchmark.frameCount++;
+	if (--state.framesLeft > 0)
+		return;
+
+	benchmark.entityCount = app->entityStore.count;
+	benchmark.drawCalls /= benchmark.frameCount;
+	benchmark.trianglesDrawn /= benchmark.frameCount;
+	benchmark.frameMilliseconds /= benchmark.frameCount;
+	benchmark.geometryMilliseconds /= benchmark.frameCount;
+	benchmark.renderMilliseconds /= benchmark.frameCount;
+	ILOG("%s %s, %u entities: %.0f draw calls, %.0f triangles, frame %.3f ms, geometry %.3f ms, render %.3f ms", benchmark.name, benchmark.enabled ? "on" : "off",
+		benchmark.entityCount, benchmark.drawCalls, benchmark.trianglesDrawn, benchmark.frameMilliseconds, benchmark.geometryMilliseconds, benchmark.renderMilliseconds);
+	app->toggleBenchmarks.push_back(benchmark);
+
+	if (!benchmark.enabled)
+	{
+		const char* name = benchmark.name;
+		state.current = {};
+		state.current.name = name;
+		state.current.enabled = true;
+		state.framesLeft = RENDER_TOGGLE_BENCHMARK_FRAMES;
+		state.warmupFrames = app->frameQueueDepth + 2;
+		*state.setting = true;
+	}
+	else
+	{
+		state.running = false;
+		*state.setting = state.previousValue;
+	}
+}
+
+u32 ReloadChangedPrograms(App* app)
+{
+	u32 compilingPrograms = 0;
+	for (u64 i = 0; i < app->programs.size(); i++)
+	{
+		Program& program = app->programs[i];
+		u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
+		if (currentTimestamp > program.lastWriteTimestamp)
+		{
+			program.lastWriteTimestamp = currentTimestamp;
+
+			// Programs with permutations have no handle, their variants reload themselves
+			if (!program.permutationAxes.empty())
+				continue;
+
+			// The current handle stays in use until the new one links successfully
+			BeginProgramReload(program);
+		}
+
+		FinishProgramReload(app, program, false);
+		if (program.pendingCompile.handle != 0)
+			compilingPrograms++;
+	}
+	return compilingPrograms;
+}
+
+
+void Render(App* app, FrameSnapshot* snapshot)
+{
+	snapshot->stats.programsCompiling = ReloadChangedPrograms(app);
+
+	MapBuffer(app->cbuffer, GL_WRITE_ONLY);
+	app->globalParamsOffset = app->cbuffer.head;
+	PushData(app->cbuffer, snapshot->globalParams.data(), (u32)snapshot->globalParams.size());
+	app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
+	UnmapBuffer(app->cbuffer);
+
+	UploadEntityParams(app, snapshot);
+
+	ProcessUploads(app, snapshot->uploadBudgetBytes, snapshot->uploadBudgetMilliseconds, &snapshot->stats);
+	CompleteTextureLoads(app);
+	for (u32 textureIdx : snapshot->textureReloads)
+		ReloadTextureNow(app, textureIdx, snapshot->textureSkippedLevels, snapshot->textureCompression);
+	StreamTextures(app, snapshot);
+
+	for (const GeometryAllocation& allocation : snapshot->geometryFrees)
+		FreeGeometryAllocation(app, allocation);
+	if (snapshot->staticBatchUpload)
+		UploadStaticBatches(app, snapshot->staticBatchUpload);
+	snapshot->stats.geometryArena = GetGeometryArenaStats(app);
+
+	//Render on this framebuffer render targets
+	glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
+
+	//Select on which render targets to draw
+	GLuint drawBuffers[] = { app->albedoAttachmentHandle, app->normalsAttachmentHandle,
+		app->positionAttachmentHandle, app->metallicAttachmentHandle, app->roughnessAttachmentHandle,
+		app->finalRenderAttachmentHandle };
+
+	glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
+
+	//Clear color and depth
+	glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+
+	//Model Rendering ================================================================================================================
+	u32 geometryProgramIdx = app->deferredGeometryProgramIdx;
+	if (snapshot->renderMode == RenderMode::FORWARD)
+	{
+		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Forward Shaded model");
+		geometryProgramIdx = snapshot->PBR ? app->forwardPBRGeometryProgramIdx : app->forwardGeometryProgramIdx;
+	}
+	else { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Deferred Shaded model"); }
+
+	auto geometryStart = std::chrono::high_resolution_clock::now();
+	Program modelProgram = app->programs[GetProgramPermutation(app, snapshot, geometryProgramIdx)];
+
+	glUseProgram(modelProgram.handle);
+
+	// Cone culling removes meshlets seen from behind, the rasterizer must do the same
+	// with the triangles of the visible ones or the image would depend on the meshlets
+	bool cullBackfaces = snapshot->useMeshletCulling && snapshot->useMeshletConeCulling;
+	if (cullBackfaces)
+		glEnable(GL_CULL_FACE);
+
+	if (snapshot->useOcclusionCulling)
+	{
+		RenderModelsOcclusionCulled(app, snapshot, modelProgram);
+	}
+	else
+	{
+		for (u32 i = 0; i < snapshot->draws.size(); ++i)
+		{
+			RenderModel(app, snapshot, snapshot->draws[i], modelProgram);
+		}
+
+		// Instance groups and static batches read their LocalParams from the instance buffer
+		if (!snapshot->instances.empty())
+		{
+			Program instancedProgram = app->programs[GetProgramPermutation(app, snapshot, geometryProgramIdx, true)];
+			glUseProgram(instancedProgram.handle);
+			UploadInstances(app, snapshot);
+			RenderInstanceGroups(app, snapshot, instancedProgram);
+			RenderStaticBatches(app, snapshot, instancedProgram);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, 0);
+		}
+
+		// The pyramid is stale once frames are drawn without it
+		app->hiZValid = false;
+	}
+	snapshot->stats.geometryMilliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - geometryStart).count();
+
+	if (cullBackfaces)
+		glDisable(GL_CULL_FACE);
+
+	glPopDebugGroup();
+
+	// ==================================================================================================================================
+	//Cubemap Rendering =================================================================================================================
+	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Cubemap");
+
+	mat4 view = glm::mat4(glm::mat3(snapshot->view));
+
+	if (snapshot->showSkybox)
+	{
+		DrawCube(app, app->cubemapProgramIdx, app->cubemapAttachmentHandle, true, view, snapshot->projection);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glPopDebugGroup();
+
+	// ==================================================================================================================================
+	//Quad Rendering ====================================================================================================================
+	if (snapshot->renderMode == RenderMode::FORWARD) { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Forward Textured quad"); }
+	else { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Deferred Textured quad"); }
+
+	DrawFinalQuad(app, snapshot);
+
+	glPopDebugGroup();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void WriteEntityParamsSnapshot(App* app, FrameSnapshot* snapshot)
+{
+	EntityStore& store = app->entityStore;
+	const u32 blockSize = 2 * sizeof(mat4);
+	app->entityParamsStride = Align(blockSize, app->uniformBufferAlignment);
+	app->uploadedEntityParams = 0;
+
+	// A new buffer starts empty, every block has to be written
+	bool uploadAll = store.viewProjectionChanged;
+	if (store.count > app->entityParamsCapacity)
+	{
+		app->entityParamsCapacity = glm::max(store.count * 2, 256u);
+		uploadAll = true;
+	}
+	snapshot->entityParamsCapacity = app->entityParamsCapacity;
+	snapshot->entityParamsStride = app->entityParamsStride;
+	snapshot->entityParamsRuns.clear();
+
+	// Runs of consecutive changed entities are copied together
+	u32 dataSize = 0;
+	u32 i = 0;
+	while (i < store.count)
+	{
+		if (!uploadAll && !store.worldChanged[i])
+		{
+			i++;
+			continue;
+		}
+
+		u32 runStart = i;
+		while (i < store.count && (uploadAll || store.worldChanged[i]))
+			i++;
+
+		snapshot->entityParamsRuns.push_back(SnapshotParamsRun{ runStart, i - runStart, dataSize });
+		dataSize += (i - runStart) * app->entityParamsStride;
+		app->uploadedEntityParams += i - runStart;
+	}
+
+	snapshot->entityParamsData.resize(dataSize);
+	for (const SnapshotParamsRun& run : snapshot->entityParamsRuns)
+		WriteEntityParams(&store, run.firstEntity, run.count, app->entityParamsStride, snapshot->entityParamsData.data() + run.dataOffset);
+
+	for (u32 e = 0; e < store.count; ++e)
+	{
+		store.entities[e].localParamsOffset = e * app->entityParamsStride;
+		store.entities[e].localParamsSize = blockSize;
+	}
+}
+
+void UploadEntityParams(App* app, const FrameSnapshot* snapshot)
+{
+	u32 size = snapshot->entityParamsCapacity * snapshot->entityParamsStride;
+	if (size != app->entityParams.size)
+	{
+		if (app->entityParams.handle)
+			glDeleteBuffers(1, &app->entityParams.handle);
+		app->entityParams = CreateBuffer(size, GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, app->entityParams.handle);
+	for (const SnapshotParamsRun& run : snapshot->entityParamsRuns)
+	{
+		glBufferSubData(GL_UNIFORM_BUFFER, run.firstEntity * snapshot->entityParamsStride,
+			run.count * snapshot->entityParamsStride, snapshot->entityParamsData.data() + run.dataOffset);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Coarsest LOD whose error stays under errorPixels once projected
+static u32 FindLodForError(const Mesh& mesh, f32 pixelsPerUnit, f32 errorPixels)
+{
+	u32 lod = 0;
+	while (lod + 1 < mesh.lodErrors.size() && mesh.lodErrors[lod + 1] * pixelsPerUnit <= errorPixels)
+		lod++;
+	return lod;
+}
+
+void SelectEntityLod(App* app, Entity& entity, const mat4& world)
+{
+	const Mesh& mesh = app->meshes[app->models[entity.modelIndex].meshIdx];
+
+	// Bounding sphere around the model bounds, in world space
+	f32 scale = glm::max(glm::length(vec3(world[0])), glm::max(glm::length(vec3(world[1])), glm::length(vec3(world[2]))));
+	vec3 center = vec3(world * vec4((mesh.boundsMin + mesh.boundsMax) * 0.5f, 1.0f));
+	f32 radius = glm::length(mesh.boundsMax - mesh.boundsMin) * 0.5f * scale;
+
+	// Pixels covered by a model space unit at the sphere distance
+	f32 distance = glm::max(glm::length(center - app->camera.position) - radius, 1e-4f);
+	f32 pixelsPerWorldUnit = app->displaySize.y / (2.0f * tanf(glm::radians(app->camera.zoom) * 0.5f) * distance);
+	f32 pixelsPerUnit = pixelsPerWorldUnit * scale;
+
+	entity.culled = false;
+	if (!app->useLods)
+	{
+		entity.lodIndex = 0;
+	}
+	else if (2.0f * radius * pixelsPerWorldUnit < SMALL_OBJECT_CULL_PIXELS)
+	{
+		entity.culled = true;
+	}
+	else
+	{
+		// Finer LODs are taken as soon as they are needed, coarser ones only with some margin
+		u32 lod = FindLodForError(mesh, pixelsPerUnit, LOD_ERROR_PIXELS);
+		if (lod > entity.lodIndex)
+			lod = glm::max(entity.lodIndex, FindLodForError(mesh, pixelsPerUnit, LOD_ERROR_PIXELS * (1.0f - LOD_HYSTERESIS)));
+		entity.lodIndex = lod;
+	}
+}
+
+static Aabb GetEntityBounds(App* app, u32 entityIndex)
+{
+	const EntityStore& store = app->entityStore;
+	const Mesh& mesh = app->meshes[app->models[store.entities[entityIndex].modelIndex].meshIdx];
+	return TransformAabb(Aabb{ mesh.boundsMin, mesh.boundsMax }, store.worldMatrices[entityIndex]);
+}
+
+void UpdateEntityBvh(App* app)
+{
+	for (u32 i : app->entityStore.changedEntities)
+	{
+		if (IsInBvh(&app->entityBvh, i))
+			UpdateBvhEntity(&app->entityBvh, i, GetEntityBounds(app, i));
+		else
+			InsertBvhEntity(&app->entityBvh, i, GetEntityBounds(app, i));
+	}
+}
+
+void CullOccludedEntities(App* app, const mat4& viewProjection)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	const EntityStore& store = app->entityStore;
+	app->softwareOcclusionTested = 0;
+	app->softwareOcclusionCulled = 0;
+	app->softwareOcclusionBuffer.rasterizedTriangles = 0;
+
+	// Occluders out of the frustum cannot hide anything in it
+	app->occluderInstances.clear();
+	for (u32 i : app->visibleEntities)
+	{
+		const Mesh& mesh = app->meshes[app->models[store.entities[i].modelIndex].meshIdx];
+		for (const OccluderMesh& occluder : mesh.occluders)
+			app->occluderInstances.push_back(OccluderInstance{ &occluder, store.worldViewProjections[i] });
+	}
+	if (app->occluderInstances.empty())
+	{
+		app->softwareOcclusionMilliseconds = 0.0;
+		return;
+	}
+
+	ClearMaskedOcclusionBuffer(&app->softwareOcclusionBuffer);
+	RasterizeOccluders(&app->softwareOcclusionBuffer, app->occluderInstances.data(), (u32)app->occluderInstances.size());
+
+	// Entities with occluders are kept, they are what hides the rest
+	ScopedTemporaryMemory temp(GetTempArena());
+	const u32 visibleCount = (u32)app->visibleEntities.size();
+	Aabb* bounds = PushArray(temp.temp.arena, Aabb, visibleCount);
+	u8* occluded = PushArray(temp.temp.arena, u8, visibleCount);
+	u32 testedCount = 0;
+	for (u32 i : app->visibleEntities)
+	{
+		if (app->meshes[app->models[store.entities[i].modelIndex].meshIdx].occluders.empty())
+			bounds[testedCount++] = GetEntityBounds(app, i);
+	}
+	app->softwareOcclusionTested = testedCount;
+	app->softwareOcclusionCulled = TestOccludedAabbs(&app->softwareOcclusionBuffer, bounds, testedCount, viewProjection, occluded);
+
+	u32 tested = 0;
+	u32 kept = 0;
+	for (u32 i : app->visibleEntities)
+	{
+		bool isOccluder = !app->meshes[app->models[store.entities[i].modelIndex].meshIdx].occluders.empty();
+		if (isOccluder || !occluded[tested++])
+			app->visibleEntities[kept++] = i;
+	}
+	app->visibleEntities.resize(kept);
+
+	app->softwareOcclusionMilliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Model space position of a vertex, dequantized when the submesh is compressed
+static vec3 ReadVertexPosition(const Submesh& submesh, const VertexBufferAttribute& position, u32 vertex)
+{
+	const u8* data = submesh.vertices.data() + vertex * submesh.vertexBufferLayout.stride + position.offset;
+	if (position.type == GL_UNSIGNED_SHORT)
+	{
+		const u16* q = (const u16*)data;
+		return vec3(q[0], q[1], q[2]) * (1.0f / 65535.0f) * submesh.positionScale + submesh.positionOffset;
+	}
+	const f32* p = (const f32*)data;
+	return vec3(p[0], p[1], p[2]);
+}
+
+// Ray against the full resolution triangles of the entity, in model space so the
+// distance along the ray does not change
+static f32 IntersectRayEntity(void* data, u32 entityIndex, vec3 origin, vec3 direction, f32 maxDistance)
+{
+	App* app = (App*)data;
+	const EntityStore& store = app->entityStore;
+	const Mesh& mesh = app->meshes[app->models[store.entities[entityIndex].modelIndex].meshIdx];
+	if (!(mesh.loadFlags & MeshLoad_KeepCpuData))
+	{
+		f32 distance = IntersectRayAabb(origin, direction, GetEntityBounds(app, entityIndex));
+		return distance <= maxDistance ? distance : -1.0f;
+	}
+
+	mat4 worldToModel = glm::inverse(store.worldMatrices[entityIndex]);
+	vec3 modelOrigin = vec3(worldToModel * vec4(origin, 1.0f));
+	vec3 modelDirection = vec3(worldToModel * vec4(direction, 0.0f));
+	f32 boundsDistance = IntersectRayAabb(modelOrigin, modelDirection, Aabb{ mesh.boundsMin, mesh.boundsMax });
+	if (boundsDistance < 0.0f || boundsDistance > maxDistance)
+		return -1.0f;
+
+	f32 closest = -1.0f;
+	for (const Submesh& submesh : mesh.submeshes)
+	{
+		const VertexBufferAttribute* position = NULL;
+		for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+			if (attribute.location == 0)
+				position = &attribute;
+		if (!position)
+			continue;
+
+		const MeshLod& lod = submesh.lods[0];
+		for (u32 i = lod.firstIndex; i + 2 < lod.firstIndex + lod.indexCount; i += 3)
+		{
+			vec3 a = ReadVertexPosition(submesh, *position, submesh.indices[i + 0]);
+			vec3 b = ReadVertexPosition(submesh, *position, submesh.indices[i + 1]);
+			vec3 c = ReadVertexPosition(submesh, *position, submesh.indices[i + 2]);
+			f32 distance = IntersectRayTriangle(modelOrigin, modelDirection, a, b, c);
+			if (distance >= 0.0f && distance < maxDistance && (closest < 0.0f || distance < closest))
+				closest = distance;
+		}
+	}
+	return closest;
+}
+
+u32 PickEntity(App* app, vec2 windowPosition, const mat4& view, const mat4& projection)
+{
+	// Near and far plane points under the cursor
+	vec2 ndc = vec2(windowPosition.x / app->displaySize.x, 1.0f - windowPosition.y / app->displaySize.y) * 2.0f - 1.0f;
+	mat4 inverseViewProjection = glm::inverse(projection * view);
+	vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+	vec3 origin = vec3(nearPoint) / nearPoint.w;
+	vec3 direction = vec3(farPoint) / farPoint.w - origin;
+
+	f32 distance;
+	return RaycastBvh(&app->entityBvh, origin, direction, 1.0f, IntersectRayEntity, app, &distance);
+}
+
+f32 GetLightInfluenceRadius(const Light& light)
+{
+	f32 intensity = glm::max(light.color.r, glm::max(light.color.g, light.color.b));
+	return sqrtf(intensity / LIGHT_INFLUENCE_THRESHOLD);
+}
+
+// Binds the vertex arrays, textures and uniforms to draw submesh j of a mesh
+static void BindMeshDrawState(App* app, const FrameSnapshot* snapshot, Mesh& mesh, u32 j, u32 submeshMaterialIdx, f32 metallic, f32 roughness, const Program& program)
+{
+	GLuint vao = FindVAO(app, mesh.submeshes[j], program);
+	glBindVertexArray(vao);
+
+	Material& submeshMaterial = app->materials[submeshMaterialIdx];
+
+	if (submeshMaterial.albedoTextureIdx < app->textures.size())
+	{
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
+		GLuint textureLocation = glGetUniformLocation(program.handle, "uTexture");
+		glUniform1i(textureLocation, 0);
+	}
+
+	GLuint metallicLocation = glGetUniformLocation(program.handle, "uMetallic");
+	glUniform1f(metallicLocation, metallic);
+
+	GLuint roughnessLocation = glGetUniformLocation(program.handle, "uRoughness");
+	glUniform1f(roughnessLocation, roughness);
+
+	if (snapshot->renderMode == RenderMode::FORWARD && snapshot->showSkybox && snapshot->PBR)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, app->irradianceMapAttachmentHandle);
+		GLuint cubemapLocation = glGetUniformLocation(program.handle, "irradianceMap");
+		glUniform1i(cubemapLocation, 1);
+
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, app->prefilterMapAttachmentHandle);
+		GLuint prefilterLocation = glGetUniformLocation(program.handle, "prefilterMap");
+		glUniform1i(prefilterLocation, 2);
+
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, app->brdfAttachmentHandle);
+		GLuint brdfLocation = glGetUniformLocation(program.handle, "brdfLUT");
+		glUniform1i(brdfLocation, 3);
+	}
+
+	Submesh& submesh = mesh.submeshes[j];
+	glUniform3fv(glGetUniformLocation(program.handle, "uPositionScale"), 1, value_ptr(submesh.positionScale));
+	glUniform3fv(glGetUniformLocation(program.handle, "uPositionOffset"), 1, value_ptr(submesh.positionOffset));
+}
+
+// Same for submesh j of the model of a draw
+static void BindSubmeshDrawState(App* app, const FrameSnapshot* snapshot, const SnapshotDraw& draw, const Program& program, u32 j)
+{
+	Model& model = app->models[draw.modelIndex];
+	BindMeshDrawState(app, snapshot, app->meshes[model.meshIdx], j, model.materialIdx[j], draw.metallic, draw.roughness, program);
+}
+
+// Index ranges (relative to the submesh indices) to draw for the LOD of a draw. With
+// meshlet culling they are the runs of visible meshlets, otherwise the whole LOD.
+// counts and firstIndices need room for lod.meshletCount ranges, and at least one.
+static u32 GetSubmeshIndexRanges(const FrameSnapshot* snapshot, const Submesh& submesh, const MeshLod& lod, const Frustum& frustum, vec3 cameraPosition,
+	GLsizei* counts, u32* firstIndices, FrameStats& stats)
+{
+	if (!snapshot->useMeshletCulling || lod.meshletCount == 0)
+	{
+		counts[0] = lod.indexCount;
+		firstIndices[0] = lod.firstIndex;
+		stats.trianglesDrawn += lod.indexCount / 3;
+		return 1;
+	}
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	u8* visible = PushArray(temp.temp.arena, u8, lod.meshletCount);
+	u32 visibleCount = CullMeshlets(submesh.meshletCullData, lod.firstMeshlet, lod.meshletCount,
+		frustum, cameraPosition, snapshot->useMeshletConeCulling, visible);
+
+	// The meshlets of a LOD follow each other in the index buffer, so each run of
+	// visible ones becomes a single range
+	u32 rangeCount = 0;
+	for (u32 m = 0; m < lod.meshletCount; ++m)
+	{
+		if (!visible[m])
+			continue;
+
+		const Meshlet& meshlet = submesh.meshlets[lod.firstMeshlet + m];
+		if (m > 0 && visible[m - 1])
+		{
+			counts[rangeCount - 1] += meshlet.indexCount;
+		}
+		else
+		{
+			counts[rangeCount] = meshlet.indexCount;
+			firstIndices[rangeCount] = meshlet.firstIndex;
+			rangeCount++;
+		}
+		stats.trianglesDrawn += meshlet.indexCount / 3;
+	}
+
+	stats.meshletsTested += lod.meshletCount;
+	stats.meshletsVisible += visibleCount;
+	return rangeCount;
+}
+
+static bool IsSubmeshDrawn(const FrameSnapshot* snapshot, const SnapshotDraw& draw, u32 submesh)
+{
+	if (draw.submeshMaskOffset == SUBMESH_MASK_ALL)
+		return true;
+	return ((snapshot->submeshMasks[draw.submeshMaskOffset + submesh / 32] >> (submesh % 32)) & 1) != 0;
+}
+
+void RenderModel(App* app, FrameSnapshot* snapshot, const SnapshotDraw& draw, Program program)
+{
+	Model& model = app->models[draw.modelIndex];
+	Mesh& mesh = app->meshes[model.meshIdx];
+
+	// Meshlets are culled in model space
+	Frustum frustum = ExtractFrustum(draw.worldViewProjection);
+	vec3 cameraPosition = vec3(glm::inverse(draw.worldMatrix) * vec4(snapshot->cameraPosition, 1.0f));
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParams.handle, draw.localParamsOffset, draw.localParamsSize);
+
+	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+	{
+		if (!IsSubmeshDrawn(snapshot, draw, j))
+			continue;
+
+		BindSubmeshDrawState(app, snapshot, draw, program, j);
+
+		Submesh& submesh = mesh.submeshes[j];
+		const MeshLod& lod = submesh.lods[glm::min(draw.lodIndex, (u32)submesh.lods.size() - 1)];
+		const u32 indexSize = submesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+		const u8* indexBase = (const u8*)(u64)submesh.indexOffset;
+
+		ScopedTemporaryMemory temp(GetTempArena());
+		u32          maxRanges = glm::max(lod.meshletCount, 1u);
+		GLsizei*     counts = PushArray(temp.temp.arena, GLsizei, maxRanges);
+		u32*         firstIndices = PushArray(temp.temp.arena, u32, maxRanges);
+		const void** offsets = PushArray(temp.temp.arena, const void*, maxRanges);
+		GLint*       baseVertices = PushArray(temp.temp.arena, GLint, maxRanges);
+
+		u32 rangeCount = GetSubmeshIndexRanges(snapshot, submesh, lod, frustum, cameraPosition, counts, firstIndices, snapshot->stats);
+		for (u32 r = 0; r < rangeCount; ++r)
+		{
+			offsets[r] = indexBase + firstIndices[r] * indexSize;
+			baseVertices[r] = (GLint)submesh.baseVertex;
+		}
+
+		if (rangeCount == 1)
+			glDrawElementsBaseVertex(GL_TRIANGLES, counts[0], submesh.indexType, (void*)offsets[0], submesh.baseVertex);
+		else if (rangeCount > 1)
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts, submesh.indexType, (void**)offsets, rangeCount, baseVertices);
+		if (rangeCount > 0)
+			snapshot->stats.drawCalls++;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void BuildHiZ(App* app)
+{
+	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Hi-Z pyramid");
+
+	Program& program = app->programs[app->hiZBuildProgramIdx];
+	glUseProgram(program.handle);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+	glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 0);
+
+	ivec2 size = app->displaySize;
+	ivec2 sourceSize = size;
+	for (u32 level = 0; level < app->hiZLevelCount; ++level)
+	{
+		if (level > 0)
+			glBindImageTexture(0, app->hiZTextureHandle, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, app->hiZTextureHandle, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glUniform1i(glGetUniformLocation(program.handle, "uLevel"), level);
+		glUniform2i(glGetUniformLocation(program.handle, "uSourceSize"), sourceSize.x, sourceSize.y);
+
+		glDispatchCompute((size.x + HIZ_BUILD_GROUP_SIZE - 1) / HIZ_BUILD_GROUP_SIZE, (size.y + HIZ_BUILD_GROUP_SIZE - 1) / HIZ_BUILD_GROUP_SIZE, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		sourceSize = size;
+		size = glm::max(size / 2, ivec2(1));
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glPopDebugGroup();
+}
+
+// Runs one pass of occlusion_cull.glsl over the objects of the frame
+static void DispatchOcclusionCull(App* app, u32 pass, const mat4& viewProjection, bool hiZValid)
+{
+	Program& program = app->programs[app->occlusionCullProgramIdx];
+	glUseProgram(program.handle);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, app->hiZTextureHandle);
+	glUniform1i(glGetUniformLocation(program.handle, "uHiZ"), 0);
+	glUniformMatrix4fv(glGetUniformLocation(program.handle, "uViewProjection"), 1, GL_FALSE, value_ptr(viewProjection));
+	glUniform1ui(glGetUniformLocation(program.handle, "uObjectCount"), (u32)app->occlusionObjects.size());
+	glUniform1ui(glGetUniformLocation(program.handle, "uCommandCount"), (u32)app->occlusionCommands.size());
+	glUniform1i(glGetUniformLocation(program.handle, "uPass"), pass);
+	glUniform1i(glGetUniformLocation(program.handle, "uHiZValid"), hiZValid ? 1 : 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, app->occlusionObjectBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, app->occlusionCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, app->occlusionVisibilityBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, app->occlusionStatsBuffers[app->occlusionStatsIndex]);
+
+	u32 objectCount = (u32)app->occlusionObjects.size();
+	glDispatchCompute((objectCount + OCCLUSION_CULL_GROUP_SIZE - 1) / OCCLUSION_CULL_GROUP_SIZE, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+// Makes room for size bytes in a buffer rewritten every frame. The old storage is
+// orphaned so the GPU can keep reading it while the new one is filled.
+static void ReserveDynamicBuffer(GLenum target, GLuint handle, u32& capacity, u32 size)
+{
+	if (size > capacity)
+		capacity = glm::max(size, capacity * 2);
+
+	glBindBuffer(target, handle);
+	glBufferData(target, capacity, NULL, GL_DYNAMIC_DRAW);
+}
+
+void UploadInstances(App* app, const FrameSnapshot* snapshot)
+{
+	u32 instancesSize = (u32)(snapshot->instances.size() * sizeof(InstanceParams));
+	ReserveDynamicBuffer(GL_SHADER_STORAGE_BUFFER, app->instanceBuffer, app->instanceBufferCapacity, instancesSize);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, instancesSize, snapshot->instances.data());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INSTANCE_BUFFER_BINDING, app->instanceBuffer);
+}
+
+void RenderInstanceGroups(App* app, FrameSnapshot* snapshot, Program program)
+{
+	FrameStats& stats = snapshot->stats;
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	GLint firstInstanceLocation = glGetUniformLocation(program.handle, "uFirstInstance");
+
+	for (const SnapshotInstanceGroup& group : snapshot->instanceGroups)
+	{
+		Model& model = app->models[group.modelIndex];
+		Mesh& mesh = app->meshes[model.meshIdx];
+
+		// The per entity values of the draw come from the instance buffer
+		SnapshotDraw draw = {};
+		draw.modelIndex = group.modelIndex;
+		draw.lodIndex = group.lodIndex;
+		draw.submeshMaskOffset = SUBMESH_MASK_ALL;
+
+		glUniform1ui(firstInstanceLocation, group.firstInstance);
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+		{
+			BindSubmeshDrawState(app, snapshot, draw, program, j);
+
+			// No meshlet culling, the meshlets would differ by instance
+			Submesh& submesh = mesh.submeshes[j];
+			const MeshLod& lod = submesh.lods[glm::min(group.lodIndex, (u32)submesh.lods.size() - 1)];
+			const u32 indexSize = submesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+			const void* offset = (const u8*)(u64)submesh.indexOffset + lod.firstIndex * indexSize;
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, lod.indexCount, submesh.indexType, offset, group.instanceCount, submesh.baseVertex);
+
+			stats.drawCalls++;
+			stats.trianglesDrawn += (u64)lod.indexCount / 3 * group.instanceCount;
+		}
+		stats.instancedDraws += group.instanceCount;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void RenderStaticBatches(App* app, FrameSnapshot* snapshot, Program program)
+{
+	// Draws culled against an older set are dropped, the next snapshot has the new one
+	StaticBatchSet* batches = app->renderStaticBatches.get();
+	if (!batches || batches->generation != snapshot->staticBatchGeneration)
+		return;
+
+	FrameStats& stats = snapshot->stats;
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	GLint firstInstanceLocation = glGetUniformLocation(program.handle, "uFirstInstance");
+
+	Mesh& mesh = batches->mesh;
+	for (u32 i = 0; i < snapshot->staticBatchDraws.size(); ++i)
+	{
+		u32 batch = snapshot->staticBatchDraws[i];
+		BindMeshDrawState(app, snapshot, mesh, batch, batches->materialIdx[batch], batches->materialParams[batch].x, batches->materialParams[batch].y, program);
+		glUniform1ui(firstInstanceLocation, snapshot->staticBatchFirstInstance + i);
 
-	//Load Textures
-	app->diceTexIdx = LoadTexture2D(app, "dice.png");
-	app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-	app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-	app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
-	app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
+		const Submesh& submesh = mesh.submeshes[batch];
+		glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset, submesh.baseVertex);
+
+		stats.drawCalls++;
+		stats.trianglesDrawn += submesh.indexCount / 3;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+}
+
+void RenderModelsOcclusionCulled(App* app, FrameSnapshot* snapshot, Program program)
+{
+	FrameStats& stats = snapshot->stats;
+
+	// Results of the previous frame: reading them now does not wait for the GPU
+	OcclusionStats results = {};
+	u32 previousStats = app->occlusionStatsIndex ^ 1;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->occlusionStatsBuffers[previousStats]);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(results), &results);
+	stats.occlusionObjectsTested = results.objectsTested;
+	stats.occlusionObjectsVisible = results.objectsVisible[0] + results.objectsVisible[1];
+	stats.occlusionSecondPassObjects = results.objectsVisible[1];
+	stats.occlusionTrianglesVisible = results.trianglesVisible[0] + results.trianglesVisible[1];
+	stats.occlusionTrianglesTested = app->occlusionTrianglesSubmitted;
+
+	OcclusionStats zero = {};
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->occlusionStatsBuffers[app->occlusionStatsIndex]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// One object per submesh of each draw, owning the indirect commands of its index ranges
+	app->occlusionObjects.clear();
+	app->occlusionCommands.clear();
+	app->occlusionTrianglesSubmitted = 0;
+	for (const SnapshotDraw& draw : snapshot->draws)
+	{
+		Mesh& mesh = app->meshes[app->models[draw.modelIndex].meshIdx];
+		Frustum frustum = ExtractFrustum(draw.worldViewProjection);
+		vec3 cameraPosition = vec3(glm::inverse(draw.worldMatrix) * vec4(snapshot->cameraPosition, 1.0f));
+
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+		{
+			const Submesh& submesh = mesh.submeshes[j];
+			const MeshLod& lod = submesh.lods[glm::min(draw.lodIndex, (u32)submesh.lods.size() - 1)];
+			const u32 indexSize = submesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+
+			// Submeshes hidden by the PVS keep an empty object so the indices still line up
+			ScopedTemporaryMemory temp(GetTempArena());
+			u32      maxRanges = glm::max(lod.meshletCount, 1u);
+			GLsizei* counts = PushArray(temp.temp.arena, GLsizei, maxRanges);
+			u32*     firstIndices = PushArray(temp.temp.arena, u32, maxRanges);
+			u32 rangeCount = IsSubmeshDrawn(snapshot, draw, j) ? GetSubmeshIndexRanges(snapshot, submesh, lod, frustum, cameraPosition, counts, firstIndices, stats) : 0;
+
+			Aabb bounds = TransformAabb(Aabb{ submesh.boundsMin, submesh.boundsMax }, draw.worldMatrix);
+			OcclusionObject object = {};
+			object.boundsMin = vec4(bounds.min, 0.0f);
+			object.boundsMax = vec4(bounds.max, 0.0f);
+			object.firstCommand = (u32)app->occlusionCommands.size();
+			object.commandCount = rangeCount;
+			for (u32 r = 0; r < rangeCount; ++r)
+			{
+				DrawElementsIndirectCommand command = {};
+				command.count = counts[r];
+				command.firstIndex = submesh.indexOffset / indexSize + firstIndices[r];
+				command.baseVertex = (i32)submesh.baseVertex;
+				app->occlusionCommands.push_back(command);
+				object.triangleCount += counts[r] / 3;
+			}
+			app->occlusionTrianglesSubmitted += object.triangleCount;
+			app->occlusionObjects.push_back(object);
+		}
+	}
+
+	const u32 objectCount = (u32)app->occlusionObjects.size();
+	const u32 commandCount = (u32)app->occlusionCommands.size();
+	if (objectCount == 0)
+		return;
+
+	// Both passes get their own copy of the commands, the culling only writes instanceCount
+	const u32 commandsSize = commandCount * sizeof(DrawElementsIndirectCommand);
+	ReserveDynamicBuffer(GL_DRAW_INDIRECT_BUFFER, app->occlusionCommandBuffer, app->occlusionCommandCapacity, 2 * commandsSize);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commandsSize, app->occlusionCommands.data());
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, commandsSize, commandsSize, app->occlusionCommands.data());
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	ReserveDynamicBuffer(GL_SHADER_STORAGE_BUFFER, app->occlusionObjectBuffer, app->occlusionObjectCapacity, objectCount * sizeof(OcclusionObject));
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(OcclusionObject), app->occlusionObjects.data());
+	ReserveDynamicBuffer(GL_SHADER_STORAGE_BUFFER, app->occlusionVisibilityBuffer, app->occlusionVisibilityCapacity, objectCount * sizeof(u32));
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	mat4 viewProjection = snapshot->projection * snapshot->view;
+	for (u32 pass = 0; pass < 2; ++pass)
+	{
+		if (pass == 0)
+		{
+			// What the previous frame ended up drawing
+			DispatchOcclusionCull(app, 0, app->hiZViewProjection, app->hiZValid);
+		}
+		else
+		{
+			// What pass 0 drew, for the objects that were hidden last frame or just appeared
+			BuildHiZ(app);
+			DispatchOcclusionCull(app, 1, viewProjection, true);
+		}
+
+		glUseProgram(program.handle);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->occlusionCommandBuffer);
+
+		u32 objectIndex = 0;
+		for (const SnapshotDraw& draw : snapshot->draws)
+		{
+			Mesh& mesh = app->meshes[app->models[draw.modelIndex].meshIdx];
+			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+			glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->entityParams.handle, draw.localParamsOffset, draw.localParamsSize);
+
+			for (u32 j = 0; j < mesh.submeshes.size(); ++j, ++objectIndex)
+			{
+				const OcclusionObject& object = app->occlusionObjects[objectIndex];
+				if (object.commandCount == 0)
+					continue;
+
+				BindSubmeshDrawState(app, snapshot, draw, program, j);
+				const u8* firstCommand = (const u8*)(u64)((pass * commandCount + object.firstCommand) * sizeof(DrawElementsIndirectCommand));
+				glMultiDrawElementsIndirect(GL_TRIANGLES, mesh.submeshes[j].indexType, firstCommand, object.commandCount, 0);
+				stats.drawCalls++;
+			}
+		}
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	// The complete depth of the frame is what the next one tests against first
+	BuildHiZ(app);
+	app->hiZViewProjection = viewProjection;
+	app->hiZValid = true;
+	app->occlusionStatsIndex ^= 1;
+
+	glUseProgram(program.handle);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void RenderLight(App* app, Light light, Program program)
+{
+	Model& model = app->models[light.entity.modelIndex];
+	Mesh& mesh = app->meshes[model.meshIdx];
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, light.entity.localParamsOffset, light.entity.localParamsSize);
+
+	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+	{
+		Submesh& submesh = mesh.submeshes[j];
+		GLuint vao = FindVAO(app, submesh, program);
+		glBindVertexArray(vao);
+
+		GLuint lightColorLocation = glGetUniformLocation(program.handle, "uLightColor");
+		glUniform3f(lightColorLocation, light.color.r, light.color.g, light.color.b);
+
+		glUniform3fv(glGetUniformLocation(program.handle, "uPositionScale"), 1, value_ptr(submesh.positionScale));
+		glUniform3fv(glGetUniformLocation(program.handle, "uPositionOffset"), 1, value_ptr(submesh.positionOffset));
+		glDrawElementsBaseVertex(GL_TRIANGLES, submesh.lods[0].indexCount, submesh.indexType, (void*)(u64)submesh.indexOffset, submesh.baseVertex);
+	}
+
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+{
+	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) {
+		return;
+	}
+
+	ELOG("OpenGL debug message: %s", message);
+
+	switch (source)
+	{
+	case GL_DEBUG_SOURCE_API:				ELOG(" - source: GL_DEBUG_SOURCE_API"); break;
+	case GL_DEBUG_SOURCE_WINDOW_SYSTEM:		ELOG(" - source: GL_DEBUG_SOURCE_WINDOW_SYSTEM"); break;
+	case GL_DEBUG_SOURCE_SHADER_COMPILER:	ELOG(" - source: GL_DEBUG_SOURCE_SHADER_COMPILER"); break;
+	case GL_DEBUG_SOURCE_THIRD_PARTY:		ELOG(" - source: GL_DEBUG_SOURCE_THIRD_PARTY"); break;
+	case GL_DEBUG_SOURCE_APPLICATION:		ELOG(" - source: GL_DEBUG_SOURCE_APPLICATION"); break;
+	case GL_DEBUG_SOURCE_OTHER:				ELOG(" - source: GL_DEBUG_SOURCE_OTHER");  break;
+	}
+
+	switch (source)
+	{
+	case GL_DEBUG_TYPE_ERROR:				ELOG(" - source: GL_DEBUG_TYPE_ERROR"); break;
+	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:	ELOG(" - source: GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR"); break;
+	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:	ELOG(" - source: GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR"); break;
+	case GL_DEBUG_TYPE_PORTABILITY:			ELOG(" - source: GL_DEBUG_TYPE_PORTABILITY"); break;
+	case GL_DEBUG_TYPE_PERFORMANCE:			ELOG(" - source: GL_DEBUG_TYPE_PERFORMANCE"); break;
+	case GL_DEBUG_TYPE_MARKER:				ELOG(" - source: GL_DEBUG_TYPE_MARKER"); break;
+	case GL_DEBUG_TYPE_PUSH_GROUP:			ELOG(" - source: GL_DEBUG_TYPE_PUSH_GROUP"); break;
+	case GL_DEBUG_TYPE_POP_GROUP:			ELOG(" - source: GL_DEBUG_TYPE_POP_GROUP"); break;
+	case GL_DEBUG_TYPE_OTHER:				ELOG(" - source: GL_DEBUG_TYPE_OTHER"); break;
+	}
+
+	switch (source)
+	{
+	case GL_DEBUG_SEVERITY_HIGH:			ELOG(" - source: GL_DEBUG_SEVERITY_HIGH"); break;
+	case GL_DEBUG_SEVERITY_MEDIUM:			ELOG(" - source: GL_DEBUG_SEVERITY_MEDIUM"); break;
+	case GL_DEBUG_SEVERITY_LOW:				ELOG(" - source: GL_DEBUG_SEVERITY_LOW"); break;
+	case GL_DEBUG_SEVERITY_NOTIFICATION:	ELOG(" - source: GL_DEBUG_SEVERITY_NOTIFICATION"); break;
+	}
+}
+
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program)
+{
+	GeometryVertexPool& pool = app->geometryArena.vertexPools[submesh.vertexPool];
+
+	//Try finding a vao for this vertex format/program
+	for (u32 i = 0; i < (u32)pool.vaos.size(); ++i)
+	{
+		if (pool.vaos[i].programHandle == program.handle)
+		{
+			return pool.vaos[i].handle;
+		}
+	}
+
+	GLuint vaoHandle = 0;
+
+	//Create a new vao for this vertex format/program
+	glGenVertexArrays(1, &vaoHandle);
+	glBindVertexArray(vaoHandle);
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool.bufferHandle);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->geometryArena.indexBufferHandle);
+
+	for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+	{
+		bool attributeWasLinked = false;
+
+		for (u32 j = 0; j < pool.layout.attributes.size(); ++j)
+		{
+			if (program.vertexInputLayout.attributes[i].location == pool.layout.attributes[j].location)
+			{
+				// The draws add the base vertex of the submesh
+				const u32 index = pool.layout.attributes[j].location;
+				const u32 ncomp = pool.layout.attributes[j].componentCount;
+				const u32 offset = pool.layout.attributes[j].offset;
+				const u32 stride = pool.layout.stride;
+				const GLenum type = pool.layout.attributes[j].type;
+				const GLboolean normalized = pool.layout.attributes[j].normalized;
+				glVertexAttribPointer(index, ncomp, type, normalized, stride, (void*)(u64)offset);
+				glEnableVertexAttribArray(index);
+
+				attributeWasLinked = true;
+				break;
+			}
+		}
+
+		//assert(attributeWasLinked); //The submesh should provide an attribute for each vertex input
+	}
+
+	glBindVertexArray(0);
+
+	//Store it in the list of vaos for this pool
+	Vao vao = { vaoHandle, program.handle };
+	pool.vaos.push_back(vao);
+
+	return vaoHandle;
+}
+
+void OnScreenResize(App* app)
+{
+	GenerateColorTexture(app->albedoAttachmentHandle, app->displaySize, GL_RGBA8);
+	GenerateColorTexture(app->normalsAttachmentHandle, app->displaySize, GL_RGBA16F);
+	GenerateColorTexture(app->positionAttachmentHandle, app->displaySize, GL_RGBA16F);
+	GenerateColorTexture(app->metallicAttachmentHandle, app->displaySize, GL_RGBA16F);
+	GenerateColorTexture(app->roughnessAttachmentHandle, app->displaySize, GL_RGBA16F);
+	GenerateColorTexture(app->finalRenderAttachmentHandle, app->displaySize, GL_RGBA16F);
+
+	glGenTextures(1, &app->depthAttachmentHandle);
+	glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Hierarchical Z pyramid, down to 1x1
+	if (app->hiZTextureHandle != 0)
+		glDeleteTextures(1, &app->hiZTextureHandle);
+	app->hiZLevelCount = 1 + (u32)floorf(log2f((f32)glm::max(app->displaySize.x, app->displaySize.y)));
+	glGenTextures(1, &app->hiZTextureHandle);
+	glBindTexture(GL_TEXTURE_2D, app->hiZTextureHandle);
+	glTexStorage2D(GL_TEXTURE_2D, app->hiZLevelCount, GL_R32F, app->displaySize.x, app->displaySize.y);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	app->hiZValid = false;
+
+
+	glGenFramebuffers(1, &app->framebufferHandle);
+	glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->albedoAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, app->normalsAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, app->positionAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, app->metallicAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, app->roughnessAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT5, app->finalRenderAttachmentHandle, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->depthAttachmentHandle, 0);
+
+	GLenum buffers[] = { GL_COLOR_ATTACHMENT0,  GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
+		GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5 };
+	glDrawBuffers(6, buffers);
+
+	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		switch (framebufferStatus)
+		{
+		case GL_FRAMEBUFFER_UNDEFINED:						ELOG("GL_FRAMEBUFFER_UNDEFINED"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:	ELOG("GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"); break;
+		case GL_FRAMEBUFFER_UNSUPPORTED:					ELOG("GL_FRAMEBUFFER_UNSUPPORTED"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"); break;
+		case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:		ELOG("GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"); break;
+		default:											ELOG("Unknown framebuffer status error") break;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	CreateIrradianceMap(app);
+	CreatePrefilterMap(app);
+	CreateBRDF(app);
+}
+
+void HandleInput(App* app)
+{
+	if (app->input.keys[K_W] == BUTTON_PRESSED) {
+		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_FORWARD, app->deltaTime);
+	}
+	if (app->input.keys[K_A] == BUTTON_PRESSED) {
+		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_LEFT, app->deltaTime);
+	}
+	if (app->input.keys[K_S] == BUTTON_PRESSED) {
+		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_BACKWARD, app->deltaTime);
+	}
+	if (app->input.keys[K_D] == BUTTON_PRESSED) {
+		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_RIGHT, app->deltaTime);
+	}
+
+	if (app->input.mouseButtons[LEFT] == BUTTON_PRESSED || app->input.mouseButtons[RIGHT] == BUTTON_PRESSED)
+	{
+		app->camera.ProcessMouseMovement(app->input.mouseDelta.x, -app->input.mouseDelta.y);
+	}
+
+	//app->camera.ProcessMouseScroll(app->input.mouseDelta);
+}
+
+static void PushVertexData(std::vector<u8>& vertices, const void* data, u32 size)
+{
+	const u8* bytes = (const u8*)data;
+	vertices.insert(vertices.end(), bytes, bytes + size);
+}
+
+// Signed normalized 10 bit xyz plus a 2 bit w, as read by GL_INT_2_10_10_10_REV
+static u32 PackSnorm1010102(vec4 v)
+{
+	i32 x = (i32)glm::round(glm::clamp(v.x, -1.0f, 1.0f) * 511.0f);
+	i32 y = (i32)glm::round(glm::clamp(v.y, -1.0f, 1.0f) * 511.0f);
+	i32 z = (i32)glm::round(glm::clamp(v.z, -1.0f, 1.0f) * 511.0f);
+	i32 w = (i32)glm::round(glm::clamp(v.w, -1.0f, 1.0f));
+	return (u32)(x & 0x3FF) | ((u32)(y & 0x3FF) << 10) | ((u32)(z & 0x3FF) << 20) | ((u32)(w & 0x3) << 30);
+}
+
+void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+{
+	std::vector<u8> vertices;
+	std::vector<u32> indices;
+
+	const bool compress = (myMesh->loadFlags & MeshLoad_CompressVertices) != 0;
+	const bool hasTexCoords = mesh->mTextureCoords[0] != nullptr;
+	const bool hasTangentSpace = mesh->mTangents != nullptr && mesh->mBitangents != nullptr;
+
+	// create the vertex format
+	VertexBufferLayout vertexBufferLayout = {};
+	u32 uncompressedStride = 6 * sizeof(float);
+	if (hasTexCoords)    uncompressedStride += 2 * sizeof(float);
+	if (hasTangentSpace) uncompressedStride += 6 * sizeof(float);
+
+	if (compress)
+	{
+		// 20 bytes at most: unorm16 position (padded to 8), packed normal, half UV and packed
+		// tangent with the bitangent sign in w (the bitangent is rebuilt as cross(N, T) * w)
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_UNSIGNED_SHORT, GL_TRUE });
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 4, 8, GL_INT_2_10_10_10_REV, GL_TRUE });
+		vertexBufferLayout.stride = 12;
+		if (hasTexCoords)
+		{
+			vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride, GL_HALF_FLOAT, GL_FALSE });
+			vertexBufferLayout.stride += 2 * sizeof(u16);
+		}
+		if (hasTangentSpace)
+		{
+			vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 4, vertexBufferLayout.stride, GL_INT_2_10_10_10_REV, GL_TRUE });
+			vertexBufferLayout.stride += sizeof(u32);
+		}
+	}
+	else
+	{
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_FLOAT, GL_FALSE });
+		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float), GL_FLOAT, GL_FALSE });
+		vertexBufferLayout.stride = 6 * sizeof(float);
+		if (hasTexCoords)
+		{
+			vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE });
+			vertexBufferLayout.stride += 2 * sizeof(float);
+		}
+		if (hasTangentSpace)
+		{
+			vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE });
+			vertexBufferLayout.stride += 3 * sizeof(float);
 
-	//Engine models
-	app->directionalLightModel = LoadModel(app, "Primitives/Quad/quad.obj");
-	app->sphereModel = LoadModel(app, "Primitives/Sphere/sphere.obj");
+			vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride, GL_FLOAT, GL_FALSE });
+			vertexBufferLayout.stride += 3 * sizeof(float);
+		}
+	}
 
-	//Entitiy
-	Entity entity;
-	entity.position = vec3(0.0f, 0.0f, 0.0f);
-	app->model = LoadModel(app, "Patrick/Patrick.obj");
-	entity.metallic = 1.0f;
-	entity.roughness = 0.75f;
-	//app->model = LoadModel(app, "Room/Room #1.obj");
-	entity.modelIndex = app->model;
-	app->entities.push_back(entity);
+	// process indices
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+		{
+			indices.push_back(face.mIndices[j]);
+		}
+	}
 
-	Entity sphereEntity;
-	sphereEntity.modelIndex = app->sphereModel;
-	//u32 materialIdx = app->models[app->sphereModel].materialIdx[0];
-	//app->materials[materialIdx].albedoTextureIdx = app->whiteTexIdx;
-	for (int i = 0; i < 10; ++i)
+	// quantized positions are relative to the submesh bounds
+	std::vector<vec3> positions(mesh->mNumVertices);
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 	{
-		float x = cos(i * 0.1f * 6.28f) * 2.5f;
-		float z = sin(i * 0.1f * 6.28f) * 2.5f;
-		sphereEntity.position = vec3(x, 0.0f, z);
-		sphereEntity.metallic = i * 0.1f;
-		sphereEntity.roughness = 1.0f - (i * 0.1f);
-		app->entities.push_back(sphereEntity);
+		positions[i] = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+		boundsMin = glm::min(boundsMin, positions[i]);
+		boundsMax = glm::max(boundsMax, positions[i]);
+	}
+	vec3 boundsExtent = glm::max(boundsMax - boundsMin, vec3(1e-6f));
+
+	// reorder triangles for the vertex cache and overdraw, and vertices in fetch order
+	std::vector<u32> remap;
+	u32 vertexCount = OptimizeMesh(indices, positions.data(), mesh->mNumVertices, remap, &myMesh->optimizationStats);
+
+	// simplified versions of the triangles are appended to the same indices
+	std::vector<vec3> optimizedPositions(vertexCount);
+	for (u32 v = 0; v < vertexCount; v++)
+		optimizedPositions[v] = positions[remap[v]];
+	std::vector<MeshLod> lods;
+	GenerateLodChain(indices, optimizedPositions.data(), vertexCount, lods);
+
+	// and every LOD is split in meshlets for culling
+	std::vector<Meshlet> meshlets;
+	for (MeshLod& lod : lods)
+	{
+		lod.firstMeshlet = (u32)meshlets.size();
+		BuildMeshlets(indices.data(), lod.firstIndex, lod.indexCount, optimizedPositions.data(), vertexCount, meshlets);
+		lod.meshletCount = (u32)meshlets.size() - lod.firstMeshlet;
 	}
 
-	//Lights
-	//Directional
-	app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(2.5f, 3.0f, 0.0f), vec3(0.2f, 0.250f, 0.8f), vec3(0.9f, 0.0f, 0.0f)));
-	app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(-2.9f, 2.75f, -2.0f), vec3(1.0f, 0.0f, 1.0f), vec3(0.0f, 0.0f, 0.9f)));
+	// process vertices
+	vertices.reserve(vertexCount * vertexBufferLayout.stride);
+	for (u32 v = 0; v < vertexCount; v++)
+	{
+		const u32 i = remap[v];
+		vec3 position = positions[i];
+		vec3 normal = vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+
+		// For some reason ASSIMP gives me the bitangents flipped.
+		// Maybe it's my fault, but when I generate my own geometry
+		// in other files (see the generation of standard assets)
+		// and all the bitangents have the orientation I expect,
+		// everything works ok.
+		// I think that (even if the documentation says the opposite)
+		// it returns a left-handed tangent space matrix.
+		// SOLUTION: I invert the components of the bitangent here.
+		vec3 tangent = hasTangentSpace ? vec3(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z) : vec3(0.0f);
+		vec3 bitangent = hasTangentSpace ? -vec3(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z) : vec3(0.0f);
+
+		if (compress)
+		{
+			vec3 normalizedPosition = (position - boundsMin) / boundsExtent;
+			u16 quantizedPosition[4] = {
+				(u16)glm::round(normalizedPosition.x * 65535.0f),
+				(u16)glm::round(normalizedPosition.y * 65535.0f),
+				(u16)glm::round(normalizedPosition.z * 65535.0f),
+				0 };
+			PushVertexData(vertices, quantizedPosition, sizeof(quantizedPosition));
+
+			u32 packedNormal = PackSnorm1010102(vec4(glm::normalize(normal), 0.0f));
+			PushVertexData(vertices, &packedNormal, sizeof(packedNormal));
+
+			if (hasTexCoords)
+			{
+				u32 packedTexCoord = glm::packHalf2x16(vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y));
+				PushVertexData(vertices, &packedTexCoord, sizeof(packedTexCoord));
+			}
 
-	//Point
-	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(-1.0f, 2.75, 2.2f), vec3(1.0f), vec3(0.0f, 1.0f, 0.0f)));
-	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(1.0f, 2.75, 2.2f), vec3(1.0f), vec3(0.5f, 0.2f, 0.5f)));
-	app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(0.1f, 1.55, -0.2f), vec3(1.0f), vec3(0.33f, 0.2f, 0.05f)));
-	//app->lights.push_back(pointLight);
+			if (hasTangentSpace)
+			{
+				float bitangentSign = glm::dot(glm::cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+				u32 packedTangent = PackSnorm1010102(vec4(glm::normalize(tangent), bitangentSign));
+				PushVertexData(vertices, &packedTangent, sizeof(packedTangent));
+			}
+		}
+		else
+		{
+			PushVertexData(vertices, &position, sizeof(position));
+			PushVertexData(vertices, &normal, sizeof(normal));
 
-	// ====================================================================================================================================================
+			if (hasTexCoords) // does the mesh contain texture coordinates?
+			{
+				vec2 texCoord = vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
+				PushVertexData(vertices, &texCoord, sizeof(texCoord));
+			}
 
-	//Rendering
-	app->currentRenderMode = RenderMode::DEFERRED;
-	app->currentRenderTargetMode = RenderTargetsMode::FINAL_RENDER;
+			if (hasTangentSpace)
+			{
+				PushVertexData(vertices, &tangent, sizeof(tangent));
+				PushVertexData(vertices, &bitangent, sizeof(bitangent));
+			}
+		}
+	}
 
-	app->forwardGeometryProgramIdx = LoadProgram(app, "shaders/forward_geometry.glsl", "FORWARD_GEOMETRY");
-	Program& forwardGeometryProgram = app->programs[app->forwardGeometryProgramIdx];
-	LoadProgramAttributes(forwardGeometryProgram);
+	// store the proper (previously proceessed) material for this mesh
+	submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
 
-	//Geometry
-	app->deferredGeometryProgramIdx = LoadProgram(app, "shaders/deferred_geometry.glsl", "DEFERRED_GEOMETRY");
-	Program& deferredGeometryProgram = app->programs[app->deferredGeometryProgramIdx];
-	LoadProgramAttributes(deferredGeometryProgram);
+	// add the submesh into the mesh
+	Submesh submesh = {};
+	submesh.vertexBufferLayout = vertexBufferLayout;
+	submesh.vertexCount = vertexCount;
+	submesh.indexCount = (u32)indices.size();
+	submesh.indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	submesh.positionScale = compress ? boundsExtent : vec3(1.0f);
+	submesh.positionOffset = compress ? boundsMin : vec3(0.0f);
+	submesh.boundsMin = boundsMin;
+	submesh.boundsMax = boundsMax;
+	submesh.vertices.swap(vertices);
+	submesh.indices.swap(indices);
+	submesh.lods.swap(lods);
+	submesh.meshlets.swap(meshlets);
 
-	app->lightsProgramIdx = LoadProgram(app, "shaders/lights.glsl", "SHOW_LIGHTS");
-	Program& lightsProgram = app->programs[app->lightsProgramIdx];
-	LoadProgramAttributes(lightsProgram);
+	myMesh->boundsMin = myMesh->submeshes.empty() ? boundsMin : glm::min(myMesh->boundsMin, boundsMin);
+	myMesh->boundsMax = myMesh->submeshes.empty() ? boundsMax : glm::max(myMesh->boundsMax, boundsMax);
+	myMesh->submeshes.push_back(submesh);
 
-	//Quad
-	app->forwardQuadProgramIdx = LoadProgram(app, "shaders/forward_quad.glsl", "FORWARD_QUAD");
-	Program& forwardQuadProgram = app->programs[app->forwardQuadProgramIdx];
-	LoadProgramAttributes(forwardQuadProgram);
-	app->programUniformTexture = glGetUniformLocation(forwardQuadProgram.handle, "uTexture");
+	myMesh->uncompressedVertexBufferSize += submesh.vertexCount * uncompressedStride;
+	myMesh->uncompressedIndexBufferSize += submesh.indexCount * sizeof(u32);
+}
 
-	app->deferredQuadProgramIdx = LoadProgram(app, "shaders/deferred_quad .glsl", "DEFERRED_QUAD");
-	Program& deferredQuadProgram = app->programs[app->deferredQuadProgramIdx];
-	LoadProgramAttributes(deferredQuadProgram);
-	app->programUniformTexture = glGetUniformLocation(deferredQuadProgram.handle, "uTexture");
+// Only the paths of the textures, the loader decides what to do with them
+static void GetAssimpTexturePath(aiMaterial* material, aiTextureType type, String directory, std::string& path)
+{
+	aiString aiFilename;
+	if (material->GetTextureCount(type) > 0)
+	{
+		material->GetTexture(type, 0, &aiFilename);
+		String filename = MakeString(aiFilename.C_Str());
+		String filepath = MakePath(directory, filename);
+		path = filepath.str;
+	}
+}
 
-	app->deferredPBRQuadProgramIdx = LoadProgram(app, "shaders/pbr_deferred_quad.glsl", "DEFERRED_PBR_QUAD");
-	Program& deferredPBRQuadProgram = app->programs[app->deferredPBRQuadProgramIdx];
-	LoadProgramAttributes(deferredPBRQuadProgram);
+void ProcessAssimpMaterial(aiMaterial* material, CookedMaterial& myMaterial, String directory)
+{
+	aiString name;
+	aiColor3D diffuseColor;
+	aiColor3D emissiveColor;
+	aiColor3D specularColor;
+	ai_real shininess;
+	material->Get(AI_MATKEY_NAME, name);
+	material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
+	material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
+	material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
+	material->Get(AI_MATKEY_SHININESS, shininess);
 
-	app->forwardPBRGeometryProgramIdx = LoadProgram(app, "shaders/pbr_forward_geometry .glsl", "FORWARD_PBR_GEOMETRY");
-	Program& forwardPBRGeometryProgram = app->programs[app->forwardPBRGeometryProgramIdx];
-	LoadProgramAttributes(forwardPBRGeometryProgram);
+	myMaterial.material.name = name.C_Str();
+	myMaterial.material.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
+	myMaterial.material.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
+	myMaterial.material.smoothness = shininess / 256.0f;
 
-	app->depthProgramIdx = LoadProgram(app, "shaders/depth.glsl", "SHOW_DEPTH");
-	Program& depthProgram = app->programs[app->depthProgramIdx];
-	LoadProgramAttributes(depthProgram);
+	GetAssimpTexturePath(material, aiTextureType_DIFFUSE, directory, myMaterial.texturePaths[MaterialTexture_Albedo]);
+	GetAssimpTexturePath(material, aiTextureType_EMISSIVE, directory, myMaterial.texturePaths[MaterialTexture_Emissive]);
+	GetAssimpTexturePath(material, aiTextureType_SPECULAR, directory, myMaterial.texturePaths[MaterialTexture_Specular]);
+	GetAssimpTexturePath(material, aiTextureType_NORMALS, directory, myMaterial.texturePaths[MaterialTexture_Normals]);
+	GetAssimpTexturePath(material, aiTextureType_HEIGHT, directory, myMaterial.texturePaths[MaterialTexture_Bump]);
 
-	//Cubemap
-	app->cubemapProgramIdx = LoadProgram(app, "shaders/cubemap.glsl", "CUBEMAP");
-	Program& cubemapProgram = app->programs[app->cubemapProgramIdx];
-	LoadProgramAttributes(cubemapProgram);
+	//myMaterial.createNormalFromBump();
+}
 
-	app->irradianceMapProgramIdx = LoadProgram(app, "shaders/irradiance_map.glsl", "IRRADIANCE_MAP");
-	Program& irradianceMapProgram = app->programs[app->irradianceMapProgramIdx];
-	LoadProgramAttributes(irradianceMapProgram);
+void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+{
+	// process all the node's meshes (if any)
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	{
+		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+		ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+	}
 
-	app->prefilterMapProgramIdx = LoadProgram(app, "shaders/prefilter_map.glsl", "PREFILTER_MAP");
-	Program& prefilterMapProgram = app->programs[app->prefilterMapProgramIdx];
-	LoadProgramAttributes(prefilterMapProgram);
+	// then do the same for each of its children
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	{
+		ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+	}
+}
 
-	app->brdfProgramIdx = LoadProgram(app, "shaders/brdf.glsl", "BRDF");
-	Program& brdfMapProgram = app->programs[app->brdfProgramIdx];
-	LoadProgramAttributes(brdfMapProgram);
+// Adds the full resolution triangles of the submesh to the occluders of the mesh when
+// it is big enough to hide something
+void BuildSubmeshOccluder(Mesh& mesh, const Submesh& submesh)
+{
+	f32 meshSize = glm::length(mesh.boundsMax - mesh.boundsMin);
+	if (glm::length(submesh.boundsMax - submesh.boundsMin) < OCCLUDER_MIN_RELATIVE_SIZE * meshSize)
+		return;
 
-	OnScreenResize(app);
+	const VertexBufferAttribute* position = NULL;
+	for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+		if (attribute.location == 0)
+			position = &attribute;
+	if (!position || submesh.lods.empty())
+		return;
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	vec3* positions = PushArray(temp.temp.arena, vec3, submesh.vertexCount);
+	for (u32 i = 0; i < submesh.vertexCount; ++i)
+		positions[i] = ReadVertexPosition(submesh, *position, i);
+
+	const MeshLod& lod = submesh.lods[0];
+	mesh.occluders.push_back(OccluderMesh{});
+	BuildOccluderMesh(positions, submesh.vertexCount, &submesh.indices[lod.firstIndex], lod.indexCount, mesh.occluders.back());
 }
 
-void Gui(App* app)
+// One object per submesh, made of its full resolution triangles
+void BuildMeshPvs(const Mesh& mesh, Pvs* pvs)
 {
-	//Info window
-	ImGui::Begin("Info");
-	ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
-	ImGui::Text("OpenGL version: %s", glGetString(GL_VERSION));
-	ImGui::Text("OpenGL Renderer: %s", glGetString(GL_RENDERER));
-	ImGui::Text("OpenGL Vendor: %s", glGetString(GL_VENDOR));
-	ImGui::Text("OpenGL GLSL version: %s", glGetString(GL_SHADING_LANGUAGE_VERSION));
-	if (ImGui::TreeNode("OpenGL extensions:"))
+	std::vector<vec3> positions;
+	std::vector<u32> indices;
+	std::vector<u32> triangleObjects;
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		int numExtensions = 0;
-		glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
-		for (int i = 0; i < numExtensions; ++i)
-		{
-			const u8* str = glGetStringi(GL_EXTENSIONS, GLuint(i));
-			ImGui::Text("%s", str);
-		}
-
-		ImGui::TreePop();
+		const Submesh& submesh = mesh.submeshes[i];
+		const VertexBufferAttribute* position = NULL;
+		for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+			if (attribute.location == 0)
+				position = &attribute;
+		if (!position || submesh.lods.empty())
+			continue;
+
+		u32 firstVertex = (u32)positions.size();
+		for (u32 v = 0; v < submesh.vertexCount; ++v)
+			positions.push_back(ReadVertexPosition(submesh, *position, v));
+
+		const MeshLod& lod = submesh.lods[0];
+		for (u32 j = lod.firstIndex; j < lod.firstIndex + lod.indexCount; ++j)
+			indices.push_back(firstVertex + submesh.indices[j]);
+		triangleObjects.insert(triangleObjects.end(), lod.indexCount / 3, i);
 	}
 
-	ImGui::End();
+	PvsScene scene = {};
+	scene.positions = positions.data();
+	scene.vertexCount = (u32)positions.size();
+	scene.indices = indices.data();
+	scene.indexCount = (u32)indices.size();
+	scene.triangleObjects = triangleObjects.data();
+	scene.objectCount = (u32)mesh.submeshes.size();
+	BuildPvs(scene, pvs);
+}
 
-	ImGui::Begin("Editor");
+// Signed normalized xyz and w of a GL_INT_2_10_10_10_REV value
+static vec4 UnpackSnorm1010102(u32 packed)
+{
+	i32 x = (i32)(packed << 22) >> 22;
+	i32 y = (i32)(packed << 12) >> 22;
+	i32 z = (i32)(packed << 2) >> 22;
+	i32 w = (i32)packed >> 30;
+	return glm::max(vec4(x / 511.0f, y / 511.0f, z / 511.0f, (f32)w), vec4(-1.0f));
+}
 
-	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+static bool IsSameVertexFormat(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+	if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+		return false;
 
-	ImGui::Text("Camera");
+	for (u32 i = 0; i < a.attributes.size(); ++i)
+	{
+		const VertexBufferAttribute& attributeA = a.attributes[i];
+		const VertexBufferAttribute& attributeB = b.attributes[i];
+		if (attributeA.location != attributeB.location || attributeA.componentCount != attributeB.componentCount ||
+			attributeA.offset != attributeB.offset || attributeA.type != attributeB.type || attributeA.normalized != attributeB.normalized)
+			return false;
+	}
+	return true;
+}
 
-	float cameraPosition[3] = { app->camera.position.x, app->camera.position.y, app->camera.position.z };
-	ImGui::DragFloat3("Camera position", cameraPosition, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
-	app->camera.position = vec3(cameraPosition[0], cameraPosition[1], cameraPosition[2]);
+struct StaticBatchKey
+{
+	i32 cell[3];
+	u32 format;
+	u32 material;
+	f32 metallic;
+	f32 roughness;
 
-	ImGui::DragFloat("Movement speed", &app->camera.movementSpeed, 0.05f, 0.0f, 200.0f, "%.2f", 1.0f);
-	ImGui::DragFloat("Mouse Sensitivity", &app->camera.mouseSensitivity, 0.02f, 0.0f, 1.0f, "%.2f", 1.0f);
+	bool operator<(const StaticBatchKey& other) const
+	{
+		return std::tie(cell[0], cell[1], cell[2], format, material, metallic, roughness) <
+			std::tie(other.cell[0], other.cell[1], other.cell[2], other.format, other.material, other.metallic, other.roughness);
+	}
+};
+
+struct StaticBatchBuilder
+{
+	StaticBatchKey    key;
+	Submesh           submesh;
+	std::vector<vec3> positions;	// World space, quantized at the end when the format needs it
+	std::vector<StaticBatchSource> sources;
+};
+
+// Copies a vertex of a static entity to a batch, with its directions moved to world space
+static void AppendStaticBatchVertex(StaticBatchBuilder& batch, const Submesh& submesh, u32 vertex, vec3 worldPosition, const mat4& world, const mat3& normalMatrix)
+{
+	const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+	const u8* source = submesh.vertices.data() + vertex * layout.stride;
+	u32 offset = (u32)batch.submesh.vertices.size();
+	batch.submesh.vertices.insert(batch.submesh.vertices.end(), source, source + layout.stride);
+	batch.submesh.vertexCount++;
+	batch.positions.push_back(worldPosition);
+
+	u8* destination = batch.submesh.vertices.data() + offset;
+	for (const VertexBufferAttribute& attribute : layout.attributes)
+	{
+		u8* data = destination + attribute.offset;
+		if (attribute.location == 0)
+		{
+			if (attribute.type == GL_FLOAT)
+				memcpy(data, &worldPosition, sizeof(vec3));
+			continue;
+		}
 
+		// Texture coordinates stay as they are, normals, tangents and bitangents rotate
+		if (attribute.location == 2)
+			continue;
 
-	ImGui::Dummy(ImVec2(0.0f, 10.0f));
-	ImGui::Separator();
-	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+		mat3 matrix = attribute.location == 1 ? normalMatrix : mat3(world);
+		if (attribute.type == GL_INT_2_10_10_10_REV)
+		{
+			u32 packed;
+			memcpy(&packed, data, sizeof(u32));
+			vec4 direction = UnpackSnorm1010102(packed);
+			vec3 transformed = matrix * vec3(direction);
+			if (glm::dot(transformed, transformed) > 0.0f)
+				transformed = glm::normalize(transformed);
+			packed = PackSnorm1010102(vec4(transformed, direction.w));
+			memcpy(data, &packed, sizeof(u32));
+		}
+		else if (attribute.type == GL_FLOAT)
+		{
+			vec3 direction;
+			memcpy(&direction, data, sizeof(vec3));
+			direction = matrix * direction;
+			if (glm::dot(direction, direction) > 0.0f)
+				direction = glm::normalize(direction);
+			memcpy(data, &direction, sizeof(vec3));
+		}
+	}
+}
 
-	ImGui::Checkbox("Show Skybox", &app->showSkybox);
-	ImGui::Checkbox("PBR", &app->PBR);
+std::shared_ptr<StaticBatchSet> BuildStaticBatches(App* app)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	std::shared_ptr<StaticBatchSet> batches = std::make_shared<StaticBatchSet>();
+	const EntityStore& store = app->entityStore;
 
-	const char* renderModeBuffers[] = { "FORWARD", "DEFERRED" };
-	if (ImGui::BeginCombo("Render Mode", renderModeBuffers[(u32)app->currentRenderMode]))
+	std::vector<const VertexBufferLayout*> formats;
+	std::map<StaticBatchKey, u32> batchIndices;
+	std::vector<StaticBatchBuilder> builders;
+
+	for (u32 i = 0; i < store.count; ++i)
 	{
-		for (u64 i = 0; i < IM_ARRAYSIZE(renderModeBuffers); ++i)
+		const Entity& entity = store.entities[i];
+		if (!entity.isStatic)
+			continue;
+
+		// Without CPU geometry the entity keeps being drawn on its own
+		const Model& model = app->models[entity.modelIndex];
+		const Mesh& mesh = app->meshes[model.meshIdx];
+		StaticBatchEntity batchEntity = { i, entity.modelIndex, entity.metallic, entity.roughness, false };
+		batchEntity.batched = (mesh.loadFlags & (MeshLoad_StaticBatch | MeshLoad_KeepCpuData)) != 0;
+		batches->entities.push_back(batchEntity);
+		if (!batchEntity.batched)
+			continue;
+
+		const u32 entityIdx = (u32)batches->entities.size() - 1;
+		const mat4& world = store.worldMatrices[i];
+		const mat3 normalMatrix = glm::transpose(glm::inverse(mat3(world)));
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
 		{
-			bool isSelected = (i == (u32)app->currentRenderMode);
-			if (ImGui::Selectable(renderModeBuffers[i], isSelected))
+			const Submesh& submesh = mesh.submeshes[j];
+			const VertexBufferAttribute* position = NULL;
+			for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+				if (attribute.location == 0)
+					position = &attribute;
+			if (!position || submesh.vertices.empty())
+				continue;
+
+			u32 format = 0;
+			while (format < formats.size() && !IsSameVertexFormat(*formats[format], submesh.vertexBufferLayout))
+				format++;
+			if (format == formats.size())
+				formats.push_back(&submesh.vertexBufferLayout);
+
+			std::vector<vec3> worldPositions(submesh.vertexCount);
+			for (u32 v = 0; v < submesh.vertexCount; ++v)
+				worldPositions[v] = vec3(world * vec4(ReadVertexPosition(submesh, *position, v), 1.0f));
+
+			// Each triangle goes to the chunk of its centroid, then they are sorted so the
+			// triangles of a batch are appended in one run and share their vertices
+			const MeshLod& lod = submesh.lods[0];
+			const u32* indices = submesh.indices.data() + lod.firstIndex;
+			const u32 triangleCount = lod.indexCount / 3;
+			std::vector<std::pair<u32, u32>> triangles(triangleCount);	// Batch, triangle
+			for (u32 t = 0; t < triangleCount; ++t)
 			{
-				app->currentRenderMode = (RenderMode)i;
+				vec3 centroid = (worldPositions[indices[t * 3]] + worldPositions[indices[t * 3 + 1]] + worldPositions[indices[t * 3 + 2]]) / 3.0f;
+				vec3 cell = glm::floor(centroid / STATIC_BATCH_CHUNK_SIZE);
+
+				StaticBatchKey key = { { (i32)cell.x, (i32)cell.y, (i32)cell.z }, format, model.materialIdx[j], entity.metallic, entity.roughness };
+				auto it = batchIndices.find(key);
+				if (it == batchIndices.end())
+				{
+					it = batchIndices.insert(std::make_pair(key, (u32)builders.size())).first;
+					builders.push_back(StaticBatchBuilder{});
+					builders.back().key = key;
+					builders.back().submesh.vertexBufferLayout = submesh.vertexBufferLayout;
+				}
+				triangles[t] = std::make_pair(it->second, t);
 			}
-		}
+			std::stable_sort(triangles.begin(), triangles.end(), [](const std::pair<u32, u32>& a, const std::pair<u32, u32>& b) { return a.first < b.first; });
 
-		ImGui::EndCombo();
+			std::vector<u32> remap(submesh.vertexCount);
+			std::vector<u32> remapBatch(submesh.vertexCount, UINT32_MAX);
+			for (const std::pair<u32, u32>& triangle : triangles)
+			{
+				StaticBatchBuilder& batch = builders[triangle.first];
+				if (batch.sources.empty() || batch.sources.back().entity != entityIdx || batch.sources.back().submesh != j)
+					batch.sources.push_back(StaticBatchSource{ entityIdx, j });
+
+				for (u32 k = 0; k < 3; ++k)
+				{
+					u32 v = indices[triangle.second * 3 + k];
+					if (remapBatch[v] != triangle.first)
+					{
+						remapBatch[v] = triangle.first;
+						remap[v] = batch.submesh.vertexCount;
+						AppendStaticBatchVertex(batch, submesh, v, worldPositions[v], world, normalMatrix);
+					}
+					batch.submesh.indices.push_back(remap[v]);
+				}
+			}
+			batches->sourceSubmeshCount++;
+		}
 	}
 
-	const char* renderTargetBuffers[] = { "ALBEDO", "NORMALS", "POSITION", "DEPTH", "METALLIC", "ROUGHNESS", "FINAL RENDER" };
-	if (ImGui::BeginCombo("Render Targets", renderTargetBuffers[(u32)app->currentRenderTargetMode]))
+	Mesh& mesh = batches->mesh;
+	mesh.boundsMin = vec3(FLT_MAX);
+	mesh.boundsMax = vec3(-FLT_MAX);
+	for (StaticBatchBuilder& batch : builders)
 	{
-		for (u64 i = 0; i < IM_ARRAYSIZE(renderTargetBuffers); ++i)
+		Submesh& submesh = batch.submesh;
+		submesh.indexCount = (u32)submesh.indices.size();
+		submesh.indexType = submesh.vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		submesh.lods.push_back(MeshLod{ 0, submesh.indexCount, 0.0f, 0, 0 });
+
+		submesh.boundsMin = vec3(FLT_MAX);
+		submesh.boundsMax = vec3(-FLT_MAX);
+		for (vec3 position : batch.positions)
 		{
-			bool isSelected = (i == (u32)app->currentRenderTargetMode);
-			if (ImGui::Selectable(renderTargetBuffers[i], isSelected))
+			submesh.boundsMin = glm::min(submesh.boundsMin, position);
+			submesh.boundsMax = glm::max(submesh.boundsMax, position);
+		}
+		mesh.boundsMin = glm::min(mesh.boundsMin, submesh.boundsMin);
+		mesh.boundsMax = glm::max(mesh.boundsMax, submesh.boundsMax);
+
+		// Quantized positions are relative to the bounds of the batch
+		submesh.positionScale = vec3(1.0f);
+		submesh.positionOffset = vec3(0.0f);
+		for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+		{
+			if (attribute.location != 0 || attribute.type != GL_UNSIGNED_SHORT)
+				continue;
+
+			submesh.positionOffset = submesh.boundsMin;
+			submesh.positionScale = glm::max(submesh.boundsMax - submesh.boundsMin, vec3(1e-6f));
+			for (u32 v = 0; v < submesh.vertexCount; ++v)
 			{
-				app->currentRenderTargetMode = (RenderTargetsMode)i;
+				vec3 normalizedPosition = (batch.positions[v] - submesh.positionOffset) / submesh.positionScale;
+				u16* quantizedPosition = (u16*)(submesh.vertices.data() + v * submesh.vertexBufferLayout.stride + attribute.offset);
+				for (u32 axis = 0; axis < 3; ++axis)
+					quantizedPosition[axis] = (u16)glm::round(glm::clamp(normalizedPosition[axis], 0.0f, 1.0f) * 65535.0f);
 			}
 		}
 
-		ImGui::EndCombo();
+		mesh.vertexBufferSize += (u32)submesh.vertices.size();
+		mesh.indexBufferSize = Align(mesh.indexBufferSize, sizeof(u32));
+		mesh.indexBufferSize += submesh.indexCount * (submesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32));
+
+		batches->materialIdx.push_back(batch.key.material);
+		batches->materialParams.push_back(vec2(batch.key.metallic, batch.key.roughness));
+		batches->sourceOffsets.push_back((u32)batches->sources.size());
+		batches->sources.insert(batches->sources.end(), batch.sources.begin(), batch.sources.end());
+		mesh.submeshes.push_back(std::move(submesh));
 	}
+	batches->sourceOffsets.push_back((u32)batches->sources.size());
 
-	ImGui::Dummy(ImVec2(0.0f, 10.0f));
-	ImGui::Separator();
-	ImGui::Dummy(ImVec2(0.0f, 10.0f));
+	batches->buildMilliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return batches;
+}
 
-	if (ImGui::TreeNode("Entities"))
+void UpdateStaticBatches(App* app, FrameSnapshot* snapshot)
+{
+	const EntityStore& store = app->entityStore;
+	snapshot->staticBatchUpload.reset();
+	app->staticBatched.resize(store.count, 0);
+
+	// Any static entity added, edited or moved since the batches were built, even while
+	// static batching is off, so turning it back on does not draw stale batches
+	static const std::vector<StaticBatchEntity> noEntities;
+	const std::vector<StaticBatchEntity>& built = app->staticBatches ? app->staticBatches->entities : noEntities;
+	u32 builtIdx = 0;
+	for (u32 i = 0; i < store.count && !app->staticBatchesOutdated; ++i)
 	{
-		for (u64 i = 0; i < app->entities.size(); ++i)
+		const Entity& entity = store.entities[i];
+		if (!entity.isStatic)
+			continue;
+
+		if (builtIdx >= built.size())
 		{
-			ImGui::PushID(i);
-			std::string entityName = "Entity: " + std::to_string(i);
+			app->staticBatchesOutdated = true;
+			break;
+		}
+		const StaticBatchEntity& batchEntity = built[builtIdx++];
+		if (batchEntity.entity != i || batchEntity.modelIndex != entity.modelIndex || batchEntity.metallic != entity.metallic ||
+			batchEntity.roughness != entity.roughness || store.worldChanged[i])
+			app->staticBatchesOutdated = true;
+	}
+	if (builtIdx != built.size())
+		app->staticBatchesOutdated = true;
 
-			ImGui::Text(entityName.c_str());
+	if (app->staticBatchesOutdated && app->useStaticBatching)
+	{
+		app->staticBatches = BuildStaticBatches(app);
+		app->staticBatches->generation = ++app->staticBatchGeneration;
+		app->staticBatchesOutdated = false;
+		snapshot->staticBatchUpload = app->staticBatches;
 
-			Entity& entity = app->entities[i];
-			float position[3] = { entity.position.x, entity.position.y, entity.position.z };
-			ImGui::DragFloat3("Position", position, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
-			entity.position = vec3(position[0], position[1], position[2]);
+		const StaticBatchSet& batches = *app->staticBatches;
+		std::fill(app->staticBatched.begin(), app->staticBatched.end(), 0);
+		for (const StaticBatchEntity& batchEntity : batches.entities)
+			app->staticBatched[batchEntity.entity] = batchEntity.batched ? 1 : 0;
 
-			ImGui::DragFloat("Metallic", &entity.metallic, 0.05f, 0.0f, 1.0f, "%.2f");
-			ImGui::DragFloat("Roughness", &entity.roughness, 0.05f, 0.0f, 1.0f, "%.2f");
+		InitBvh(&app->staticBatchBvh, (u32)batches.mesh.submeshes.size());
+		for (u32 i = 0; i < batches.mesh.submeshes.size(); ++i)
+			InsertBvhEntity(&app->staticBatchBvh, i, Aabb{ batches.mesh.submeshes[i].boundsMin, batches.mesh.submeshes[i].boundsMax });
 
-			ImGui::PopID();
+		if (!batches.entities.empty())
+		{
+			ILOG("Static batching: %u submeshes of %u static entities merged into %u batches (%u KB) in %.1f ms", batches.sourceSubmeshCount,
+				(u32)batches.entities.size(), (u32)batches.mesh.submeshes.size(), (batches.mesh.vertexBufferSize + batches.mesh.indexBufferSize) / 1024,
+				batches.buildMilliseconds);
 		}
-		ImGui::TreePop();
 	}
 
-	ImGui::Dummy(ImVec2(0.0f, 5.0f));
+	snapshot->staticBatchGeneration = app->staticBatches ? app->staticBatches->generation : 0;
+}
 
-	if (ImGui::Button("Create Entity"))
-	{
-		Entity newEntity;
-		newEntity.position = vec3(0.0f);
-		newEntity.modelIndex = app->model;
-		app->entities.push_back(newEntity);
-	}
+void CullStaticBatches(App* app, FrameSnapshot* snapshot, const mat4& viewProjection)
+{
+	const StaticBatchSet& batches = *app->staticBatches;
+	const EntityStore& store = app->entityStore;
 
-	ImGui::Dummy(ImVec2(0.0f, 7.5f));
-	ImGui::Separator();
-	ImGui::Dummy(ImVec2(0.0f, 7.5f));
+	std::vector<u32>& visible = snapshot->staticBatchDraws;
+	QueryBvhFrustum(&app->staticBatchBvh, ExtractFrustum(viewProjection), visible);
+	std::sort(visible.begin(), visible.end());
 
-	if (ImGui::TreeNode("Lights"))
+	// In interiors with a PVS a batch is drawn when one of its submeshes is in the set of
+	// the cell of the camera
+	if (app->usePvs)
 	{
-		for (int i = 0; i < app->lights.size(); i++)
+		std::vector<u32> masks;
+		std::vector<u32> maskOffsets(batches.entities.size(), SUBMESH_MASK_ALL);
+		for (u32 k = 0; k < batches.entities.size(); ++k)
 		{
-			Light& light = app->lights[i];
-
-			ImGui::PushID(i * 1000);
-
-			std::string lightName = "Light: " + std::to_string(i);
-			lightName += light.type == LightType::LightType_Directional ? " - Directional Light" : " - Point Light";
-			ImGui::Text(lightName.c_str());
-
-			ImGui::Dummy(ImVec2(0.0f, 10.0f));
-
-			float position[3] = { light.position.x, light.position.y, light.position.z };
-			ImGui::DragFloat3("Position", position, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
-			light.position = vec3(position[0], position[1], position[2]);
+			const StaticBatchEntity& batchEntity = batches.entities[k];
+			const Pvs& pvs = app->meshes[app->models[batchEntity.modelIndex].meshIdx].pvs;
+			if (!batchEntity.batched || pvs.objectCount == 0)
+				continue;
+
+			u32 offset = (u32)masks.size();
+			masks.resize(offset + (pvs.objectCount + 31) / 32);
+			vec3 cameraPosition = vec3(glm::inverse(store.worldMatrices[batchEntity.entity]) * vec4(app->camera.position, 1.0f));
+			if (GetPvsVisibleObjects(&pvs, cameraPosition, &masks[offset]))
+				maskOffsets[k] = offset;
+			else
+				masks.resize(offset);
+		}
 
-			if (light.type == LightType::LightType_Directional)
+		u32 kept = 0;
+		for (u32 batch : visible)
+		{
+			bool drawn = false;
+			for (u32 s = batches.sourceOffsets[batch]; s < batches.sourceOffsets[batch + 1] && !drawn; ++s)
 			{
-				float direction[3] = { light.direction.x, light.direction.y, light.direction.z };
-				ImGui::DragFloat3("Direction", direction, 0.1f, -20000000000000000.0f, 200000000000000000000.0f);
-				light.direction = vec3(direction[0], direction[1], direction[2]);
+				const StaticBatchSource& source = batches.sources[s];
+				u32 offset = maskOffsets[source.entity];
+				drawn = offset == SUBMESH_MASK_ALL || ((masks[offset + source.submesh / 32] >> (source.submesh % 32)) & 1) != 0;
 			}
+			if (drawn)
+				visible[kept++] = batch;
+		}
+		visible.resize(kept);
+	}
 
-			float color[3] = { light.color.r, light.color.g, light.color.b };
-			ImGui::ColorPicker3("Color", color);
-			light.color = vec3(color[0], color[1], color[2]);
-			ImGui::PopID();
+	// Already in world space
+	snapshot->staticBatchFirstInstance = (u32)snapshot->instances.size();
+	for (u32 batch : visible)
+	{
+		InstanceParams instance;
+		instance.worldMatrix = mat4(1.0f);
+		instance.worldViewProjection = viewProjection;
+		instance.material = vec4(batches.materialParams[batch], 0.0f, 0.0f);
+		snapshot->instances.push_back(instance);
+	}
+	app->staticBatchesVisible = (u32)visible.size();
+}
 
-			ImGui::Dummy(ImVec2(0.0f, 10.0f));
-			ImGui::Separator();
-			ImGui::Dummy(ImVec2(0.0f, 15.0f));
-		}
-		ImGui::TreePop();
+void UploadStaticBatches(App* app, const std::shared_ptr<StaticBatchSet>& batches)
+{
+	if (app->renderStaticBatches)
+		FreeMeshGeometry(app, app->renderStaticBatches->mesh);
+
+	app->renderStaticBatches = batches;
+	Mesh& mesh = batches->mesh;
+	UploadMeshGeometry(app, mesh);
+	for (Submesh& submesh : mesh.submeshes)
+	{
+		std::vector<u8>().swap(submesh.vertices);
+		std::vector<u32>().swap(submesh.indices);
 	}
+}
 
-	ImGui::Dummy(ImVec2(0.0f, 7.5f));
+static GLuint CreateArenaBuffer(GLenum target, u32 size)
+{
+	GLuint handle;
+	glGenBuffers(1, &handle);
+	glBindBuffer(target, handle);
+	glBufferData(target, size, NULL, GL_STATIC_DRAW);
+	glBindBuffer(target, 0);
+	return handle;
+}
+
+void InitGeometryArena(App* app)
+{
+	GeometryArena& arena = app->geometryArena;
+	arena.indexBufferHandle = CreateArenaBuffer(GL_ELEMENT_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_INDEX_BYTES);
+	InitRangeAllocator(&arena.indexAllocator, GEOMETRY_ARENA_INITIAL_INDEX_BYTES);
+}
+
+static void DeleteVertexPoolVAOs(GeometryVertexPool& pool)
+{
+	for (Vao& vao : pool.vaos)
+		glDeleteVertexArrays(1, &vao.handle);
+	pool.vaos.clear();
+}
 
-	if (ImGui::Button("Create Directional Light"))
+static u32 FindVertexPool(App* app, const VertexBufferLayout& layout)
+{
+	GeometryArena& arena = app->geometryArena;
+	for (u32 i = 0; i < arena.vertexPools.size(); ++i)
 	{
-		app->lights.push_back(CreateLight(app, LightType::LightType_Directional, vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f)));
+		if (IsSameVertexFormat(arena.vertexPools[i].layout, layout))
+			return i;
 	}
 
-	if (ImGui::Button("Create Point Light"))
+	GeometryVertexPool pool;
+	pool.layout = layout;
+	pool.bufferHandle = CreateArenaBuffer(GL_ARRAY_BUFFER, GEOMETRY_ARENA_INITIAL_VERTICES * layout.stride);
+	InitRangeAllocator(&pool.allocator, GEOMETRY_ARENA_INITIAL_VERTICES);
+	arena.vertexPools.push_back(std::move(pool));
+	return (u32)arena.vertexPools.size() - 1;
+}
+
+// Doubles the buffer until the range fits, copying what it held. The vertex arrays
+// pointing at it must be recreated when *grew is set.
+static RangeAllocation AllocateArenaRange(App* app, RangeAllocator* allocator, GLuint& bufferHandle, u32 unitSize, u32 size, bool* grew)
+{
+	RangeAllocation allocation = AllocateRange(allocator, size);
+	while (allocation.block == RANGE_NONE)
 	{
-		app->lights.push_back(CreateLight(app, LightType::LightType_Point, vec3(0.0f, 1.5f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(1.0f, 1.0f, 1.0f)));
+		u64 capacity = (u64)allocator->capacity * 2;
+		ASSERT(capacity * unitSize <= UINT32_MAX, "The geometry arena does not fit 32 bit offsets");
+
+		// Copies still queued for the old buffer must land before it is copied
+		FlushUploads(app);
+
+		GLuint newHandle;
+		glGenBuffers(1, &newHandle);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * unitSize, NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_READ_BUFFER, bufferHandle);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, (u64)allocator->capacity * unitSize);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glDeleteBuffers(1, &bufferHandle);
+		bufferHandle = newHandle;
+
+		ILOG("Geometry arena buffer grown to %.1f MB", capacity * unitSize / (1024.0f * 1024.0f));
+		GrowRangeAllocator(allocator, (u32)capacity);
+		app->geometryArena.growCount++;
+		*grew = true;
+
+		allocation = AllocateRange(allocator, size);
 	}
-
-	ImGui::End();
+	return allocation;
 }
 
-void Update(App* app)
+void UploadMeshGeometry(App* app, Mesh& mesh)
 {
-	// You can handle app->input keyboard/mouse here
-	HandleInput(app);
+	GeometryArena& arena = app->geometryArena;
 
-	for (u64 i = 0; i < app->programs.size(); i++)
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		Program& program = app->programs[i];
-		u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
-		if (currentTimestamp > program.lastWriteTimestamp)
+		Submesh& submesh = mesh.submeshes[i];
+		ASSERT(submesh.vertices.size() == submesh.vertexCount * submesh.vertexBufferLayout.stride, "Uploading a submesh without its CPU geometry");
+
+		submesh.vertexPool = FindVertexPool(app, submesh.vertexBufferLayout);
+		GeometryVertexPool& pool = arena.vertexPools[submesh.vertexPool];
+		bool grew = false;
+		RangeAllocation vertices = AllocateArenaRange(app, &pool.allocator, pool.bufferHandle, pool.layout.stride, submesh.vertexCount, &grew);
+		if (grew)
+			DeleteVertexPoolVAOs(pool);
+
+		StageBufferData(app, pool.bufferHandle, vertices.offset * pool.layout.stride, submesh.vertices.data(), (u32)submesh.vertices.size());
+		submesh.baseVertex = vertices.offset;
+		submesh.vertexBlock = vertices.block;
+
+		// 16 bit indices are narrowed in temp memory, the CPU copy stays u32
+		ScopedTemporaryMemory temp(GetTempArena());
+		const void* indicesData = submesh.indices.data();
+		u32         indicesSize = submesh.indexCount * sizeof(u32);
+		if (submesh.indexType == GL_UNSIGNED_SHORT)
 		{
-			glDeleteProgram(program.handle);
-			String programSource = ReadTextFile(program.filepath.c_str());
-			const char* programName = program.programName.c_str();
-			program.handle = CreateProgramFromSource(programSource, programName);
-			program.lastWriteTimestamp = currentTimestamp;
+			u16* shortIndices = PushArray(temp.temp.arena, u16, submesh.indexCount);
+			for (u32 j = 0; j < submesh.indexCount; ++j)
+				shortIndices[j] = (u16)submesh.indices[j];
+			indicesData = shortIndices;
+			indicesSize = submesh.indexCount * sizeof(u16);
 		}
-	}
-
-	float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
-	float znear = 0.1f;
-	float zfar = 1000.0f;
 
-	mat4 projection = glm::perspective(glm::radians(app->camera.zoom), aspectRatio, znear, zfar);
-	mat4 view = app->camera.GetViewMatrix();
+		// Every vertex array has the index buffer bound
+		grew = false;
+		RangeAllocation indices = AllocateArenaRange(app, &arena.indexAllocator, arena.indexBufferHandle, 1, Align(indicesSize, GEOMETRY_ARENA_INDEX_ALIGNMENT), &grew);
+		if (grew)
+		{
+			for (GeometryVertexPool& grownPool : arena.vertexPools)
+				DeleteVertexPoolVAOs(grownPool);
+		}
 
-	MapBuffer(app->cbuffer, GL_WRITE_ONLY);
+		StageBufferData(app, arena.indexBufferHandle, indices.offset, indicesData, indicesSize);
+		submesh.indexOffset = indices.offset;
+		submesh.indexBlock = indices.block;
+	}
 
-	//Global params
-	app->globalParamsOffset = app->cbuffer.head;
+	// Drawable right away, the copies of all the submeshes go in one batch
+	FlushUploads(app);
+}
 
-	PushUInt(app->cbuffer, (u32)app->currentRenderTargetMode);
-	PushVec3(app->cbuffer, app->camera.position);
-	PushUInt(app->cbuffer, app->lights.size());
+void FreeGeometryAllocation(App* app, const GeometryAllocation& allocation)
+{
+	GeometryArena& arena = app->geometryArena;
+	FreeRange(&arena.vertexPools[allocation.vertexPool].allocator, allocation.vertexBlock);
+	FreeRange(&arena.indexAllocator, allocation.indexBlock);
+}
 
-	for (u32 i = 0; i < app->lights.size(); ++i)
+void FreeMeshGeometry(App* app, Mesh& mesh)
+{
+	for (Submesh& submesh : mesh.submeshes)
 	{
-		AlignHead(app->cbuffer, sizeof(vec4));
+		if (submesh.vertexBlock == RANGE_NONE)
+			continue;
 
-		Light& light = app->lights[i];
-		PushUInt(app->cbuffer, (u32)light.type);
-		PushVec3(app->cbuffer, light.color);
-		PushVec3(app->cbuffer, light.direction);
-		PushVec3(app->cbuffer, light.position);
+		FreeGeometryAllocation(app, GeometryAllocation{ submesh.vertexPool, submesh.vertexBlock, submesh.indexBlock });
+		submesh.vertexBlock = RANGE_NONE;
+		submesh.indexBlock = RANGE_NONE;
 	}
+}
 
-	app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
-
-	//Normal entities
-	for (u64 i = 0; i < app->entities.size(); ++i)
+bool UnloadModel(App* app, u32 modelIndex)
+{
+	Mesh& mesh = app->meshes[app->models[modelIndex].meshIdx];
+	if (mesh.unloaded)
+		return true;
+
+	u32 users = 0;
+	for (u32 i = 0; i < app->entityStore.count; ++i)
+		users += app->entityStore.entities[i].modelIndex == modelIndex ? 1 : 0;
+	for (const Light* light : app->lights)
+		users += light->entity.modelIndex == modelIndex ? 1 : 0;
+	if (users > 0)
 	{
-		AlignHead(app->cbuffer, app->uniformBufferAlignment);
-
-		Entity& entity = app->entities[i];
-		mat4 world = entity.worldMatrix;
-		world = TransformPositionScale(entity.position, vec3(0.45f));
-		mat4 worldViewProjection = projection * view * world;
-
-		entity.localParamsOffset = app->cbuffer.head;
-		PushMat4(app->cbuffer, world);
-		PushMat4(app->cbuffer, worldViewProjection);
-		entity.localParamsSize = app->cbuffer.head - entity.localParamsOffset;
+		ELOG("Model %u is still used by %u entities and lights, it stays loaded", modelIndex, users);
+		return false;
 	}
 
-	////Light entities
-	//for (u64 i = 0; i < app->lights.size(); i++)
-	//{
-	//	AlignHead(app->cbuffer, app->uniformBufferAlignment);
-
-	//	Light& light = app->lights[i];
-	//	Entity& entity = light.entity;
-	//	entity.position = light.position;
-
-	//	mat4 world = entity.worldMatrix;
-	//	world = TransformPositionRotationScale(light.position, light.direction, light.type == LightType::LightType_Directional ? vec3(0.45f) : vec3(0.25f));
-	//	mat4 worldViewProjection = projection * view * world;
-
-	//	entity.localParamsOffset = app->cbuffer.head;
-	//	PushMat4(app->cbuffer, world);
-	//	PushMat4(app->cbuffer, worldViewProjection);
-	//	entity.localParamsSize = app->cbuffer.head - entity.localParamsOffset;
-	//}
+	// Entities are never removed, so no snapshot in flight draws it and the render
+	// thread does not read its submeshes anymore: only the ranges must wait for it
+	for (const Submesh& submesh : mesh.submeshes)
+	{
+		if (submesh.vertexBlock != RANGE_NONE)
+			app->pendingGeometryFrees.push_back(GeometryAllocation{ submesh.vertexPool, submesh.vertexBlock, submesh.indexBlock });
+	}
 
-	UnmapBuffer(app->cbuffer);
+	std::vector<Submesh>().swap(mesh.submeshes);
+	std::vector<OccluderMesh>().swap(mesh.occluders);
+	mesh.pvs = Pvs{};
+	mesh.vertexBufferSize = 0;
+	mesh.indexBufferSize = 0;
+	mesh.uncompressedVertexBufferSize = 0;
+	mesh.uncompressedIndexBufferSize = 0;
+	mesh.optimizationStats = {};
+	mesh.unloaded = true;
+	return true;
 }
 
-
-void Render(App* app)
+GeometryArenaStats GetGeometryArenaStats(App* app)
 {
-	//Render on this framebuffer render targets
-	glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
-
-	//Select on which render targets to draw
-	GLuint drawBuffers[] = { app->albedoAttachmentHandle, app->normalsAttachmentHandle,
-		app->positionAttachmentHandle, app->metallicAttachmentHandle, app->roughnessAttachmentHandle,
-		app->finalRenderAttachmentHandle };
-
-	glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
-
-	//Clear color and depth
-	glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	glEnable(GL_DEPTH_TEST);
+	const GeometryArena& arena = app->geometryArena;
 
-	//Model Rendering ================================================================================================================
-	Program modelProgram = app->programs[app->deferredGeometryProgramIdx];
-	if (app->currentRenderMode == RenderMode::FORWARD)
+	GeometryArenaStats stats = {};
+	stats.vertexPoolCount = (u32)arena.vertexPools.size();
+	for (u32 i = 0; i < stats.vertexPoolCount && i < GEOMETRY_ARENA_MAX_STATS_POOLS; ++i)
 	{
-		glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Forward Shaded model");
-		modelProgram = app->PBR ? app->programs[app->forwardPBRGeometryProgramIdx] : app->programs[app->forwardGeometryProgramIdx];
+		stats.vertexStrides[i] = arena.vertexPools[i].layout.stride;
+		stats.vertices[i] = GetRangeAllocatorStats(&arena.vertexPools[i].allocator);
 	}
-	else { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Deferred Shaded model"); }
+	stats.indices = GetRangeAllocatorStats(&arena.indexAllocator);
+	stats.growCount = arena.growCount;
+	return stats;
+}
 
-	glUseProgram(modelProgram.handle);
+bool ImportModel(const char* filename, Mesh& mesh, std::vector<CookedMaterial>& materials, std::vector<u32>& submeshMaterials)
+{
+	const aiScene* scene = aiImportFile(filename,
+		aiProcess_Triangulate |
+		aiProcess_GenSmoothNormals |
+		aiProcess_CalcTangentSpace |
+		aiProcess_JoinIdenticalVertices |
+		aiProcess_PreTransformVertices |
+		aiProcess_OptimizeMeshes |
+		aiProcess_SortByPType);
 
-	for (u64 i = 0; i < app->entities.size(); ++i)
+	if (!scene)
 	{
-		Entity& entity = app->entities[i];
-		RenderModel(app, entity, modelProgram);
+		ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
+		return false;
 	}
 
-	glPopDebugGroup();
+	String directory = GetDirectoryPart(MakeString(filename));
 
-	// ==================================================================================================================================
-	//Cubemap Rendering =================================================================================================================
-	glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Cubemap");
+	// Create a list of materials
+	materials.resize(scene->mNumMaterials);
+	for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
+		ProcessAssimpMaterial(scene->mMaterials[i], materials[i], directory);
 
-	float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
-	float znear = 0.1f;
-	float zfar = 1000.0f;
-	mat4 projection = glm::perspective(glm::radians(app->camera.zoom), aspectRatio, znear, zfar);
-	mat4 view = glm::mat4(glm::mat3(app->camera.GetViewMatrix()));
+	ProcessAssimpNode(scene, scene->mRootNode, &mesh, 0, submeshMaterials);
 
-	if (app->showSkybox)
+	aiReleaseImport(scene);
+
+	const MeshOptimizationStats& stats = mesh.optimizationStats;
+	if (stats.triangleCount > 0)
 	{
-		DrawCube(app, app->cubemapProgramIdx, app->cubemapAttachmentHandle, true, view, projection);
+		ILOG("Optimized %s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f", filename,
+			(f32)stats.cacheMissesBefore / stats.triangleCount, (f32)stats.cacheMissesAfter / stats.triangleCount,
+			(f32)stats.cacheMissesBefore / glm::max(stats.vertexCountBefore, 1ull), (f32)stats.cacheMissesAfter / glm::max(stats.vertexCountAfter, 1ull),
+			(f32)stats.pixelsShadedBefore / glm::max(stats.pixelsCovered, 1ull), (f32)stats.pixelsShadedAfter / glm::max(stats.pixelsCovered, 1ull));
 	}
+	return true;
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glPopDebugGroup();
-
-	// ==================================================================================================================================
-	//Quad Rendering ====================================================================================================================
-	if (app->currentRenderMode == RenderMode::FORWARD) { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Forward Textured quad"); }
-	else { glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 1, -1, "Deferred Textured quad"); }
-
-	DrawFinalQuad(app);
+static u32 LoadMaterialTexture(App* app, const std::string& filepath, TextureUsage usage = TextureUsage_Color)
+{
+	return filepath.empty() ? UINT32_MAX : LoadTexture2D(app, filepath.c_str(), usage);
+}
 
-	glPopDebugGroup();
+// Only now the materials are created and their textures loaded
+static void CreateModelMaterials(App* app, const std::vector<CookedMaterial>& materials, const std::vector<u32>& submeshMaterials, Model& model)
+{
+	u32 baseMaterialIndex = (u32)app->materials.size();
+	for (u32 i = 0; i < materials.size(); ++i)
+	{
+		const std::string* paths = materials[i].texturePaths;
+		Material material = materials[i].material;
+		material.albedoTextureIdx = paths[MaterialTexture_Albedo].empty() ? app->whiteTexIdx : LoadMaterialTexture(app, paths[MaterialTexture_Albedo]);
+		material.emissiveTextureIdx = LoadMaterialTexture(app, paths[MaterialTexture_Emissive]);
+		material.specularTextureIdx = LoadMaterialTexture(app, paths[MaterialTexture_Specular]);
+		material.normalsTextureIdx = LoadMaterialTexture(app, paths[MaterialTexture_Normals], TextureUsage_Normals);
+		material.bumpTextureIdx = LoadMaterialTexture(app, paths[MaterialTexture_Bump]);
+		app->materials.push_back(material);
+	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for (u32 i = 0; i < submeshMaterials.size(); ++i)
+		model.materialIdx.push_back(baseMaterialIndex + submeshMaterials[i]);
 }
 
-void RenderModel(App* app, Entity entity, Program program)
+u32 LoadModel(App* app, const char* filename, u32 loadFlags)
 {
-	Model& model = app->models[entity.modelIndex];
-	Mesh& mesh = app->meshes[model.meshIdx];
-
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
+	app->meshes.push_back(Mesh{});
+	Mesh& mesh = app->meshes.back();
+	mesh.loadFlags = loadFlags;
+	u32 meshIdx = (u32)app->meshes.size() - 1u;
 
-	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
-	{
-		GLuint vao = FindVAO(mesh, j, program);
-		glBindVertexArray(vao);
+	app->models.push_back(Model{});
+	Model& model = app->models.back();
+	model.meshIdx = meshIdx;
+	u32 modelIdx = (u32)app->models.size() - 1u;
 
-		u32 submeshMaterialIdx = model.materialIdx[j];
-		Material& submeshMaterial = app->materials[submeshMaterialIdx];
+	// The optimization passes are slow, their output is reused until the source changes
+	std::string cookedPath = std::string(filename) + ".cooked";
+	u64 sourceTimestamp = GetFileLastWriteTimestamp(filename);
+	std::vector<CookedMaterial> materials;
+	std::vector<u32> submeshMaterials;
+	bool loadedCooked = ReadCookedModel(cookedPath.c_str(), sourceTimestamp, mesh, materials, submeshMaterials);
 
-		if (submeshMaterial.albedoTextureIdx < app->textures.size())
+	if (!loadedCooked)
+	{
+		if (!ImportModel(filename, mesh, materials, submeshMaterials))
 		{
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-			GLuint textureLocation = glGetUniformLocation(program.handle, "uTexture");
-			glUniform1i(textureLocation, 0);
+			app->models.pop_back();
+			app->meshes.pop_back();
+			return UINT32_MAX;
 		}
 
-		GLuint metallicLocation = glGetUniformLocation(program.handle, "uMetallic");
-		glUniform1f(metallicLocation, entity.metallic);
+		if (!WriteCookedModel(cookedPath.c_str(), sourceTimestamp, mesh, materials, submeshMaterials))
+			ELOG("Could not write the cooked model %s", cookedPath.c_str());
+	}
 
-		GLuint roughnessLocation = glGetUniformLocation(program.handle, "uRoughness");
-		glUniform1f(roughnessLocation, entity.roughness);
+	CreateModelMaterials(app, materials, submeshMaterials, model);
 
-		if (app->currentRenderMode == RenderMode::FORWARD && app->showSkybox && app->PBR)
-		{
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, app->irradianceMapAttachmentHandle);
-			GLuint cubemapLocation = glGetUniformLocation(program.handle, "irradianceMap");
-			glUniform1i(cubemapLocation, 1);
+	u32 vertexBufferSize = 0;
+	u32 indexBufferSize = 0;
 
-			glActiveTexture(GL_TEXTURE2);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, app->prefilterMapAttachmentHandle);
-			GLuint prefilterLocation = glGetUniformLocation(program.handle, "prefilterMap");
-			glUniform1i(prefilterLocation, 2);
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+	{
+		Submesh& submesh = mesh.submeshes[i];
+		BuildMeshletCullData(submesh.meshlets, submesh.meshletCullData);
 
-			glActiveTexture(GL_TEXTURE3);
-			glBindTexture(GL_TEXTURE_2D, app->brdfAttachmentHandle);
-			GLuint brdfLocation = glGetUniformLocation(program.handle, "brdfLUT");
-			glUniform1i(brdfLocation, 3);
+		for (u32 lod = 0; lod < submesh.lods.size(); ++lod)
+		{
+			if (mesh.lodErrors.size() <= lod)
+				mesh.lodErrors.push_back(0.0f);
+			mesh.lodErrors[lod] = glm::max(mesh.lodErrors[lod], submesh.lods[lod].error);
 		}
 
-		Submesh& submesh = mesh.submeshes[j];
-		glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+		vertexBufferSize += submesh.vertices.size();
+		indexBufferSize = Align(indexBufferSize, sizeof(u32));
+		indexBufferSize += submesh.indexCount * (submesh.indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32));
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	glUnmapBuffer(GL_UNIFORM_BUFFER);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-}
+	mesh.vertexBufferSize = vertexBufferSize;
+	mesh.indexBufferSize = indexBufferSize;
 
-void RenderLight(App* app, Light light, Program program)
-{
-	Model& model = app->models[light.entity.modelIndex];
-	Mesh& mesh = app->meshes[model.meshIdx];
+	// Built from the CPU geometry, before the upload frees it
+	if (loadFlags & MeshLoad_Pvs)
+	{
+		std::string pvsPath = std::string(filename) + ".pvs";
+		if (!ReadCookedPvs(pvsPath.c_str(), sourceTimestamp, mesh.pvs) || mesh.pvs.objectCount != mesh.submeshes.size())
+		{
+			BuildMeshPvs(mesh, &mesh.pvs);
+			ILOG("Built the PVS of %s in %.0f ms: %u x %u x %u cells (%u interior), %u distinct sets, %llu rays, %.1f KB", filename,
+				mesh.pvs.buildMilliseconds, mesh.pvs.cellCounts[0], mesh.pvs.cellCounts[1], mesh.pvs.cellCounts[2], mesh.pvs.interiorCellCount,
+				(u32)mesh.pvs.setOffsets.size() - 1, mesh.pvs.rayCount, GetPvsSize(&mesh.pvs) / 1024.0f);
+			if (!WriteCookedPvs(pvsPath.c_str(), sourceTimestamp, mesh.pvs))
+				ELOG("Could not write the PVS %s", pvsPath.c_str());
+		}
+	}
 
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
-	glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, light.entity.localParamsOffset, light.entity.localParamsSize);
+	UploadMeshGeometry(app, mesh);
 
-	for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		GLuint vao = FindVAO(mesh, j, program);
-		glBindVertexArray(vao);
+		Submesh& submesh = mesh.submeshes[i];
 
-		GLuint lightColorLocation = glGetUniformLocation(program.handle, "uLightColor");
-		glUniform3f(lightColorLocation, light.color.r, light.color.g, light.color.b);
+		// Big submeshes become occluders while the CPU geometry is still here
+		if (loadFlags & MeshLoad_Occluders)
+			BuildSubmeshOccluder(mesh, submesh);
 
-		Submesh& submesh = mesh.submeshes[j];
-		glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+		// Drawing only needs the counts and offsets from now on
+		if (!(loadFlags & (MeshLoad_KeepCpuData | MeshLoad_StaticBatch)))
+		{
+			std::vector<u8>().swap(submesh.vertices);
+			std::vector<u32>().swap(submesh.indices);
+		}
 	}
 
-	glUnmapBuffer(GL_UNIFORM_BUFFER);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	ILOG("Loaded %s: %u KB of geometry uploaded (%u KB uncompressed), %u KB kept on the CPU", filename,
+		(vertexBufferSize + indexBufferSize) / 1024,
+		(mesh.uncompressedVertexBufferSize + mesh.uncompressedIndexBufferSize) / 1024,
+		(u32)(GetResidentMeshBytes(app) / 1024));
+
+	return modelIdx;
 }
 
-void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam)
+void WriteCookedString(std::vector<u8>& data, const std::string& str)
 {
-	if (severity == GL_DEBUG_SEVERITY_NOTIFICATION) {
-		return;
-	}
-
-	ELOG("OpenGL debug message: %s", message);
+	WriteCookedValue(data, (u32)str.size());
+	data.insert(data.end(), str.begin(), str.end());
+}
 
-	switch (source)
+bool ReadCookedData(CookedReader& reader, void* destination, u64 size)
+{
+	if (!reader.valid || (u64)(reader.end - reader.cursor) < size)
 	{
-	case GL_DEBUG_SOURCE_API:				ELOG(" - source: GL_DEBUG_SOURCE_API"); break;
-	case GL_DEBUG_SOURCE_WINDOW_SYSTEM:		ELOG(" - source: GL_DEBUG_SOURCE_WINDOW_SYSTEM"); break;
-	case GL_DEBUG_SOURCE_SHADER_COMPILER:	ELOG(" - source: GL_DEBUG_SOURCE_SHADER_COMPILER"); break;
-	case GL_DEBUG_SOURCE_THIRD_PARTY:		ELOG(" - source: GL_DEBUG_SOURCE_THIRD_PARTY"); break;
-	case GL_DEBUG_SOURCE_APPLICATION:		ELOG(" - source: GL_DEBUG_SOURCE_APPLICATION"); break;
-	case GL_DEBUG_SOURCE_OTHER:				ELOG(" - source: GL_DEBUG_SOURCE_OTHER");  break;
+		reader.valid = false;
+		return false;
 	}
 
-	switch (source)
-	{
-	case GL_DEBUG_TYPE_ERROR:				ELOG(" - source: GL_DEBUG_TYPE_ERROR"); break;
-	case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:	ELOG(" - source: GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR"); break;
-	case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:	ELOG(" - source: GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR"); break;
-	case GL_DEBUG_TYPE_PORTABILITY:			ELOG(" - source: GL_DEBUG_TYPE_PORTABILITY"); break;
-	case GL_DEBUG_TYPE_PERFORMANCE:			ELOG(" - source: GL_DEBUG_TYPE_PERFORMANCE"); break;
-	case GL_DEBUG_TYPE_MARKER:				ELOG(" - source: GL_DEBUG_TYPE_MARKER"); break;
-	case GL_DEBUG_TYPE_PUSH_GROUP:			ELOG(" - source: GL_DEBUG_TYPE_PUSH_GROUP"); break;
-	case GL_DEBUG_TYPE_POP_GROUP:			ELOG(" - source: GL_DEBUG_TYPE_POP_GROUP"); break;
-	case GL_DEBUG_TYPE_OTHER:				ELOG(" - source: GL_DEBUG_TYPE_OTHER"); break;
-	}
+	memcpy(destination, reader.cursor, size);
+	reader.cursor += size;
+	return true;
+}
 
-	switch (source)
+std::string ReadCookedString(CookedReader& reader)
+{
+	u32 len = ReadCookedValue<u32>(reader);
+	if (!reader.valid || (u64)(reader.end - reader.cursor) < len)
 	{
-	case GL_DEBUG_SEVERITY_HIGH:			ELOG(" - source: GL_DEBUG_SEVERITY_HIGH"); break;
-	case GL_DEBUG_SEVERITY_MEDIUM:			ELOG(" - source: GL_DEBUG_SEVERITY_MEDIUM"); break;
-	case GL_DEBUG_SEVERITY_LOW:				ELOG(" - source: GL_DEBUG_SEVERITY_LOW"); break;
-	case GL_DEBUG_SEVERITY_NOTIFICATION:	ELOG(" - source: GL_DEBUG_SEVERITY_NOTIFICATION"); break;
+		reader.valid = false;
+		return std::string();
 	}
+
+	std::string str((const char*)reader.cursor, len);
+	reader.cursor += len;
+	return str;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+bool WriteCookedModel(const char* cookedPath, u64 sourceTimestamp, const Mesh& mesh, const std::vector<CookedMaterial>& materials, const std::vector<u32>& submeshMaterials)
 {
-	Submesh& submesh = mesh.submeshes[submeshIndex];
-
-	//Try finding a vao for this submesh/program
-	for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
+	std::vector<u8> data;
+	WriteCookedValue(data, (u32)COOKED_MODEL_MAGIC);
+	WriteCookedValue(data, (u32)COOKED_MODEL_VERSION);
+	WriteCookedValue(data, sourceTimestamp);
+	WriteCookedValue(data, mesh.loadFlags & ~MESH_LOAD_RUNTIME_FLAGS);
+	WriteCookedValue(data, mesh.uncompressedVertexBufferSize);
+	WriteCookedValue(data, mesh.uncompressedIndexBufferSize);
+	WriteCookedValue(data, mesh.optimizationStats);
+	WriteCookedValue(data, mesh.boundsMin);
+	WriteCookedValue(data, mesh.boundsMax);
+	WriteCookedValue(data, (u32)materials.size());
+	WriteCookedValue(data, (u32)mesh.submeshes.size());
+
+	for (u32 i = 0; i < materials.size(); ++i)
 	{
-		if (submesh.vaos[i].programHandle == program.handle)
-		{
-			return submesh.vaos[i].handle;
-		}
+		const Material& material = materials[i].material;
+		WriteCookedString(data, material.name);
+		WriteCookedValue(data, material.albedo);
+		WriteCookedValue(data, material.emissive);
+		WriteCookedValue(data, material.smoothness);
+		for (u32 j = 0; j < MaterialTexture_Count; ++j)
+			WriteCookedString(data, materials[i].texturePaths[j]);
 	}
 
-	GLuint vaoHandle = 0;
-
-	//Create a new vao for this submesh/program
-	glGenVertexArrays(1, &vaoHandle);
-	glBindVertexArray(vaoHandle);
-
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-
-	for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
 	{
-		bool attributeWasLinked = false;
-
-		for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+		const Submesh& submesh = mesh.submeshes[i];
+		WriteCookedValue(data, submeshMaterials[i]);
+		WriteCookedValue(data, submesh.vertexBufferLayout.stride);
+		WriteCookedValue(data, (u32)submesh.vertexBufferLayout.attributes.size());
+		for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
 		{
-			if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
-			{
-				const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-				const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-				const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;  //attribute offset + vertex offset
-				const u32 stride = submesh.vertexBufferLayout.stride;
-				glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-				glEnableVertexAttribArray(index);
-
-				attributeWasLinked = true;
-				break;
-			}
+			WriteCookedValue(data, attribute.location);
+			WriteCookedValue(data, attribute.componentCount);
+			WriteCookedValue(data, attribute.offset);
+			WriteCookedValue(data, (u32)attribute.type);
+			WriteCookedValue(data, (u8)attribute.normalized);
 		}
-
-		//assert(attributeWasLinked); //The submesh should provide an attribute for each vertex input
+		WriteCookedValue(data, submesh.vertexCount);
+		WriteCookedValue(data, submesh.indexCount);
+		WriteCookedValue(data, (u32)submesh.indexType);
+		WriteCookedValue(data, submesh.positionScale);
+		WriteCookedValue(data, submesh.positionOffset);
+		WriteCookedValue(data, submesh.boundsMin);
+		WriteCookedValue(data, submesh.boundsMax);
+		WriteCookedValue(data, (u32)submesh.lods.size());
+		for (const MeshLod& lod : submesh.lods)
+			WriteCookedValue(data, lod);
+		WriteCookedValue(data, (u32)submesh.meshlets.size());
+		for (const Meshlet& meshlet : submesh.meshlets)
+			WriteCookedValue(data, meshlet);
+		data.insert(data.end(), submesh.vertices.begin(), submesh.vertices.end());
+		const u8* indices = (const u8*)submesh.indices.data();
+		data.insert(data.end(), indices, indices + submesh.indices.size() * sizeof(u32));
 	}
 
-	glBindVertexArray(0);
-
-	//Store it in the list of vas for this submesh
-	Vao vao = { vaoHandle, program.handle };
-	submesh.vaos.push_back(vao);
-
-	return vaoHandle;
+	return WriteBinaryFile(cookedPath, data.data(), data.size());
 }
 
-void OnScreenResize(App* app)
+bool ReadCookedModel(const char* cookedPath, u64 sourceTimestamp, Mesh& mesh, std::vector<CookedMaterial>& materials, std::vector<u32>& submeshMaterials)
 {
-	GenerateColorTexture(app->albedoAttachmentHandle, app->displaySize, GL_RGBA8);
-	GenerateColorTexture(app->normalsAttachmentHandle, app->displaySize, GL_RGBA16F);
-	GenerateColorTexture(app->positionAttachmentHandle, app->displaySize, GL_RGBA16F);
-	GenerateColorTexture(app->metallicAttachmentHandle, app->displaySize, GL_RGBA16F);
-	GenerateColorTexture(app->roughnessAttachmentHandle, app->displaySize, GL_RGBA16F);
-	GenerateColorTexture(app->finalRenderAttachmentHandle, app->displaySize, GL_RGBA16F);
+	if (GetFileLastWriteTimestamp(cookedPath) == 0)
+		return false;
 
-	glGenTextures(1, &app->depthAttachmentHandle);
-	glBindTexture(GL_TEXTURE_2D, app->depthAttachmentHandle);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, app->displaySize.x, app->displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(cookedPath);
+	CookedReader reader = { (const u8*)file.str, (const u8*)file.str + file.len, file.str != NULL };
+
+	if (ReadCookedValue<u32>(reader) != COOKED_MODEL_MAGIC ||
+		ReadCookedValue<u32>(reader) != COOKED_MODEL_VERSION ||
+		ReadCookedValue<u64>(reader) != sourceTimestamp ||
+		ReadCookedValue<u32>(reader) != (mesh.loadFlags & ~MESH_LOAD_RUNTIME_FLAGS))
+	{
+		return false;
+	}
 
+	Mesh cookedMesh = {};
+	cookedMesh.loadFlags = mesh.loadFlags;
+	cookedMesh.uncompressedVertexBufferSize = ReadCookedValue<u32>(reader);
+	cookedMesh.uncompressedIndexBufferSize = ReadCookedValue<u32>(reader);
+	cookedMesh.optimizationStats = ReadCookedValue<MeshOptimizationStats>(reader);
+	cookedMesh.boundsMin = ReadCookedValue<vec3>(reader);
+	cookedMesh.boundsMax = ReadCookedValue<vec3>(reader);
+	u32 materialCount = ReadCookedValue<u32>(reader);
+	u32 submeshCount = ReadCookedValue<u32>(reader);
+
+	std::vector<CookedMaterial> cookedMaterials(reader.valid ? materialCount : 0);
+	for (u32 i = 0; i < cookedMaterials.size() && reader.valid; ++i)
+	{
+		Material& material = cookedMaterials[i].material;
+		material.name = ReadCookedString(reader);
+		material.albedo = ReadCookedValue<vec3>(reader);
+		material.emissive = ReadCookedValue<vec3>(reader);
+		material.smoothness = ReadCookedValue<f32>(reader);
+		for (u32 j = 0; j < MaterialTexture_Count; ++j)
+			cookedMaterials[i].texturePaths[j] = ReadCookedString(reader);
+	}
 
-	glGenFramebuffers(1, &app->framebufferHandle);
-	glBindFramebuffer(GL_FRAMEBUFFER, app->framebufferHandle);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, app->albedoAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, app->normalsAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, app->positionAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, app->metallicAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, app->roughnessAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT5, app->finalRenderAttachmentHandle, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, app->depthAttachmentHandle, 0);
+	std::vector<u32> cookedSubmeshMaterials;
+	for (u32 i = 0; i < submeshCount && reader.valid; ++i)
+	{
+		Submesh submesh = {};
+		cookedSubmeshMaterials.push_back(ReadCookedValue<u32>(reader));
+		submesh.vertexBufferLayout.stride = ReadCookedValue<u8>(reader);
+		u32 attributeCount = ReadCookedValue<u32>(reader);
+		for (u32 j = 0; j < attributeCount && reader.valid; ++j)
+		{
+			VertexBufferAttribute attribute = {};
+			attribute.location = ReadCookedValue<u8>(reader);
+			attribute.componentCount = ReadCookedValue<u8>(reader);
+			attribute.offset = ReadCookedValue<u8>(reader);
+			attribute.type = (GLenum)ReadCookedValue<u32>(reader);
+			attribute.normalized = (GLboolean)ReadCookedValue<u8>(reader);
+			submesh.vertexBufferLayout.attributes.push_back(attribute);
+		}
+		submesh.vertexCount = ReadCookedValue<u32>(reader);
+		submesh.indexCount = ReadCookedValue<u32>(reader);
+		submesh.indexType = (GLenum)ReadCookedValue<u32>(reader);
+		submesh.positionScale = ReadCookedValue<vec3>(reader);
+		submesh.positionOffset = ReadCookedValue<vec3>(reader);
+		submesh.boundsMin = ReadCookedValue<vec3>(reader);
+		submesh.boundsMax = ReadCookedValue<vec3>(reader);
+		u32 lodCount = ReadCookedValue<u32>(reader);
+		for (u32 j = 0; j < lodCount && j < MAX_MESH_LODS && reader.valid; ++j)
+		{
+			MeshLod lod = ReadCookedValue<MeshLod>(reader);
+			if ((u64)lod.firstIndex + lod.indexCount > submesh.indexCount)
+				reader.valid = false;
+			submesh.lods.push_back(lod);
+		}
+		if (lodCount == 0 || lodCount > MAX_MESH_LODS)
+			reader.valid = false;
 
-	GLenum buffers[] = { GL_COLOR_ATTACHMENT0,  GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3,
-		GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5 };
-	glDrawBuffers(6, buffers);
+		u32 meshletCount = ReadCookedValue<u32>(reader);
+		if ((u64)(reader.end - reader.cursor) < (u64)meshletCount * sizeof(Meshlet))
+			reader.valid = false;
+		for (u32 j = 0; j < meshletCount && reader.valid; ++j)
+		{
+			Meshlet meshlet = ReadCookedValue<Meshlet>(reader);
+			if ((u64)meshlet.firstIndex + meshlet.indexCount > submesh.indexCount)
+				reader.valid = false;
+			submesh.meshlets.push_back(meshlet);
+		}
+		for (const MeshLod& lod : submesh.lods)
+		{
+			if ((u64)lod.firstMeshlet + lod.meshletCount > submesh.meshlets.size())
+				reader.valid = false;
+		}
 
-	GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-	{
-		switch (framebufferStatus)
+		u64 verticesSize = (u64)submesh.vertexCount * submesh.vertexBufferLayout.stride;
+		u64 indicesSize = (u64)submesh.indexCount * sizeof(u32);
+		if (!reader.valid || (u64)(reader.end - reader.cursor) < verticesSize + indicesSize || cookedSubmeshMaterials.back() >= materialCount)
 		{
-		case GL_FRAMEBUFFER_UNDEFINED:						ELOG("GL_FRAMEBUFFER_UNDEFINED"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:	ELOG("GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER"); break;
-		case GL_FRAMEBUFFER_UNSUPPORTED:					ELOG("GL_FRAMEBUFFER_UNSUPPORTED"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:			ELOG("GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE"); break;
-		case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:		ELOG("GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS"); break;
-		default:											ELOG("Unknown framebuffer status error") break;
+			reader.valid = false;
+			break;
 		}
+		submesh.vertices.resize(verticesSize);
+		submesh.indices.resize(submesh.indexCount);
+		ReadCookedData(reader, submesh.vertices.data(), verticesSize);
+		ReadCookedData(reader, submesh.indices.data(), indicesSize);
+		cookedMesh.submeshes.push_back(submesh);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!reader.valid)
+	{
+		ELOG("Cooked model %s is corrupted, importing the source again", cookedPath);
+		return false;
+	}
 
-	CreateIrradianceMap(app);
-	CreatePrefilterMap(app);
-	CreateBRDF(app);
+	mesh = cookedMesh;
+	materials = std::move(cookedMaterials);
+	submeshMaterials = std::move(cookedSubmeshMaterials);
+	return true;
 }
 
-void HandleInput(App* app)
+bool WriteCookedPvs(const char* pvsPath, u64 sourceTimestamp, const Pvs& pvs)
 {
-	if (app->input.keys[K_W] == BUTTON_PRESSED) {
-		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_FORWARD, app->deltaTime);
-	}
-	if (app->input.keys[K_A] == BUTTON_PRESSED) {
-		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_LEFT, app->deltaTime);
+	std::vector<u8> data;
+	WriteCookedValue(data, (u32)COOKED_PVS_MAGIC);
+	WriteCookedValue(data, (u32)COOKED_PVS_VERSION);
+	WriteCookedValue(data, sourceTimestamp);
+	WriteCookedValue(data, pvs.bounds);
+	WriteCookedValue(data, pvs.cellSize);
+	WriteCookedValue(data, pvs.cellCounts);
+	WriteCookedValue(data, pvs.objectCount);
+	WriteCookedValue(data, pvs.interiorCellCount);
+	WriteCookedValue(data, pvs.rayCount);
+	WriteCookedValue(data, pvs.buildMilliseconds);
+	WriteCookedValue(data, (u32)pvs.cellSets.size());
+	WriteCookedValue(data, (u32)pvs.setOffsets.size());
+	WriteCookedValue(data, (u32)pvs.data.size());
+	data.insert(data.end(), (const u8*)pvs.cellSets.data(), (const u8*)(pvs.cellSets.data() + pvs.cellSets.size()));
+	data.insert(data.end(), (const u8*)pvs.setOffsets.data(), (const u8*)(pvs.setOffsets.data() + pvs.setOffsets.size()));
+	data.insert(data.end(), pvs.data.begin(), pvs.data.end());
+
+	return WriteBinaryFile(pvsPath, data.data(), data.size());
+}
+
+bool ReadCookedPvs(const char* pvsPath, u64 sourceTimestamp, Pvs& pvs)
+{
+	if (GetFileLastWriteTimestamp(pvsPath) == 0)
+		return false;
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(pvsPath);
+	CookedReader reader = { (const u8*)file.str, (const u8*)file.str + file.len, file.str != NULL };
+
+	if (ReadCookedValue<u32>(reader) != COOKED_PVS_MAGIC ||
+		ReadCookedValue<u32>(reader) != COOKED_PVS_VERSION ||
+		ReadCookedValue<u64>(reader) != sourceTimestamp)
+	{
+		return false;
 	}
-	if (app->input.keys[K_S] == BUTTON_PRESSED) {
-		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_BACKWARD, app->deltaTime);
+
+	Pvs cookedPvs = {};
+	cookedPvs.bounds = ReadCookedValue<Aabb>(reader);
+	cookedPvs.cellSize = ReadCookedValue<f32>(reader);
+	ReadCookedData(reader, cookedPvs.cellCounts, sizeof(cookedPvs.cellCounts));
+	cookedPvs.objectCount = ReadCookedValue<u32>(reader);
+	cookedPvs.interiorCellCount = ReadCookedValue<u32>(reader);
+	cookedPvs.rayCount = ReadCookedValue<u64>(reader);
+	cookedPvs.buildMilliseconds = ReadCookedValue<f64>(reader);
+	u32 cellCount = ReadCookedValue<u32>(reader);
+	u32 setOffsetCount = ReadCookedValue<u32>(reader);
+	u32 dataSize = ReadCookedValue<u32>(reader);
+
+	u64 expectedCellCount = (u64)cookedPvs.cellCounts[0] * cookedPvs.cellCounts[1] * cookedPvs.cellCounts[2];
+	u64 payloadSize = ((u64)cellCount + setOffsetCount) * sizeof(u32) + dataSize;
+	if (!reader.valid || cellCount != expectedCellCount || setOffsetCount == 0 || (u64)(reader.end - reader.cursor) < payloadSize)
+	{
+		ELOG("PVS %s is corrupted, building it again", pvsPath);
+		return false;
 	}
-	if (app->input.keys[K_D] == BUTTON_PRESSED) {
-		app->camera.ProcessKeyboard(Camera_Movement::CAMERA_RIGHT, app->deltaTime);
+
+	cookedPvs.cellSets.resize(cellCount);
+	cookedPvs.setOffsets.resize(setOffsetCount);
+	cookedPvs.data.resize(dataSize);
+	ReadCookedData(reader, cookedPvs.cellSets.data(), cellCount * sizeof(u32));
+	ReadCookedData(reader, cookedPvs.setOffsets.data(), setOffsetCount * sizeof(u32));
+	ReadCookedData(reader, cookedPvs.data.data(), dataSize);
+
+	for (u32 set : cookedPvs.cellSets)
+		reader.valid = reader.valid && (set == PVS_NO_SET || set + 1 < setOffsetCount);
+	for (u32 i = 0; i < setOffsetCount; ++i)
+		reader.valid = reader.valid && cookedPvs.setOffsets[i] <= dataSize && (i == 0 || cookedPvs.setOffsets[i - 1] <= cookedPvs.setOffsets[i]);
+	if (!reader.valid)
+	{
+		ELOG("PVS %s is corrupted, building it again", pvsPath);
+		return false;
 	}
 
-	if (app->input.mouseButtons[LEFT] == BUTTON_PRESSED || app->input.mouseButtons[RIGHT] == BUTTON_PRESSED)
+	pvs = cookedPvs;
+	return true;
+}
+
+bool WriteCookedTexture(const char* cookedPath, u64 sourceTimestamp, bool hasAlpha, const TextureMipChain& mips)
+{
+	std::vector<u8> data;
+	WriteCookedValue(data, (u32)COOKED_TEXTURE_MAGIC);
+	WriteCookedValue(data, (u32)COOKED_TEXTURE_VERSION);
+	WriteCookedValue(data, sourceTimestamp);
+	WriteCookedValue(data, (u32)hasAlpha);
+	WriteCookedValue(data, (u32)mips.blockFormat);
+	WriteCookedValue(data, mips.bytesPerPixel);
+	WriteCookedValue(data, (u32)mips.levels.size());
+	for (u32 level = 0; level < mips.levels.size(); ++level)
 	{
-		app->camera.ProcessMouseMovement(app->input.mouseDelta.x, -app->input.mouseDelta.y);
+		WriteCookedValue(data, mips.sizes[level]);
+		WriteCookedValue(data, (u32)mips.levels[level].size());
+		data.insert(data.end(), mips.levels[level].begin(), mips.levels[level].end());
 	}
 
-	//app->camera.ProcessMouseScroll(app->input.mouseDelta);
+	return WriteBinaryFile(cookedPath, data.data(), data.size());
 }
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+bool ReadCookedTexture(const char* cookedPath, u64 sourceTimestamp, TextureUsage usage, TextureCompression compression, TextureMipChain& mips)
 {
-	std::vector<float> vertices;
-	std::vector<u32> indices;
+	if (GetFileLastWriteTimestamp(cookedPath) == 0)
+		return false;
 
-	bool hasTexCoords = false;
-	bool hasTangentSpace = false;
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(cookedPath);
+	CookedReader reader = { (const u8*)file.str, (const u8*)file.str + file.len, file.str != NULL };
 
-	// process vertices
-	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	if (ReadCookedValue<u32>(reader) != COOKED_TEXTURE_MAGIC ||
+		ReadCookedValue<u32>(reader) != COOKED_TEXTURE_VERSION ||
+		ReadCookedValue<u64>(reader) != sourceTimestamp)
 	{
-		vertices.push_back(mesh->mVertices[i].x);
-		vertices.push_back(mesh->mVertices[i].y);
-		vertices.push_back(mesh->mVertices[i].z);
-		vertices.push_back(mesh->mNormals[i].x);
-		vertices.push_back(mesh->mNormals[i].y);
-		vertices.push_back(mesh->mNormals[i].z);
+		return false;
+	}
 
-		if (mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
-		{
-			hasTexCoords = true;
-			vertices.push_back(mesh->mTextureCoords[0][i].x);
-			vertices.push_back(mesh->mTextureCoords[0][i].y);
-		}
+	bool hasAlpha = ReadCookedValue<u32>(reader) != 0;
+	u32 blockFormat = ReadCookedValue<u32>(reader);
+	if (!reader.valid || blockFormat != (u32)ChooseBlockFormat(usage, hasAlpha, compression))
+		return false;
+
+	TextureMipChain cookedMips = {};
+	cookedMips.compressed = true;
+	cookedMips.blockFormat = (BlockFormat)blockFormat;
+	cookedMips.internalFormat = GetBlockFormatInternalFormat(cookedMips.blockFormat);
+	cookedMips.bytesPerPixel = ReadCookedValue<u32>(reader);
+	u32 levelCount = ReadCookedValue<u32>(reader);
+	for (u32 level = 0; level < levelCount && reader.valid; ++level)
+	{
+		ivec2 size = ReadCookedValue<ivec2>(reader);
+		u32 levelSize = ReadCookedValue<u32>(reader);
 
-		if (mesh->mTangents != nullptr && mesh->mBitangents)
+		// Each level half the one before, down to 1x1
+		ivec2 expectedSize = level == 0 ? size : glm::max(cookedMips.sizes.back() / 2, ivec2(1));
+		if (!reader.valid || size.x <= 0 || size.y <= 0 || size != expectedSize || levelSize != GetCompressedImageSize(cookedMips.blockFormat, size))
 		{
-			hasTangentSpace = true;
-			vertices.push_back(mesh->mTangents[i].x);
-			vertices.push_back(mesh->mTangents[i].y);
-			vertices.push_back(mesh->mTangents[i].z);
-
-			// For some reason ASSIMP gives me the bitangents flipped.
-			// Maybe it's my fault, but when I generate my own geometry
-			// in other files (see the generation of standard assets)
-			// and all the bitangents have the orientation I expect,
-			// everything works ok.
-			// I think that (even if the documentation says the opposite)
-			// it returns a left-handed tangent space matrix.
-			// SOLUTION: I invert the components of the bitangent here.
-			vertices.push_back(-mesh->mBitangents[i].x);
-			vertices.push_back(-mesh->mBitangents[i].y);
-			vertices.push_back(-mesh->mBitangents[i].z);
+			reader.valid = false;
+			break;
 		}
+
+		std::vector<u8> blocks(levelSize);
+		ReadCookedData(reader, blocks.data(), levelSize);
+		cookedMips.sizes.push_back(size);
+		cookedMips.levels.push_back(std::move(blocks));
 	}
 
-	// process indices
-	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	if (!reader.valid || cookedMips.levels.empty() || cookedMips.sizes.back() != ivec2(1))
 	{
-		aiFace face = mesh->mFaces[i];
-		for (unsigned int j = 0; j < face.mNumIndices; j++)
-		{
-			indices.push_back(face.mIndices[j]);
-		}
+		ELOG("Cooked texture %s is corrupted, compressing the source again", cookedPath);
+		return false;
 	}
 
-	// store the proper (previously proceessed) material for this mesh
-	submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+	mips = std::move(cookedMips);
+	return true;
+}
 
-	// create the vertex format
-	VertexBufferLayout vertexBufferLayout = {};
-	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
-	vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
-	vertexBufferLayout.stride = 6 * sizeof(float);
-	if (hasTexCoords)
+std::string GetCubemapFacePath(const char* directory, u32 face)
+{
+	static const char* faceNames[6] = { "right", "left", "top", "bottom", "front", "back" };
+	return std::string(directory) + "/" + faceNames[face] + ".jpg";
+}
+
+std::string GetCookedCubemapPath(const char* directory)
+{
+	return std::string(directory) + "/cubemap.ccube";
+}
+
+u64 GetCubemapSourceTimestamp(const char* directory)
+{
+	u64 timestamp = 0;
+	for (u32 face = 0; face < 6; ++face)
 	{
-		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 2 * sizeof(float);
+		u64 faceTimestamp = GetFileLastWriteTimestamp(GetCubemapFacePath(directory, face).c_str());
+		if (faceTimestamp == 0)
+			return 0;
+		timestamp = glm::max(timestamp, faceTimestamp);
 	}
-	if (hasTangentSpace)
+	return timestamp;
+}
+
+static bool DecodeCubemap(const char* directory, CubemapFaces& cubemap)
+{
+	for (u32 face = 0; face < 6; ++face)
 	{
-		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 3 * sizeof(float);
+		Image image = LoadImage(GetCubemapFacePath(directory, face).c_str());
+		if (!image.pixels)
+			return false;
+
+		if (face == 0)
+		{
+			cubemap.size = image.size;
+			cubemap.bytesPerPixel = image.nchannels;
+		}
+		if (image.size != cubemap.size || (u32)image.nchannels != cubemap.bytesPerPixel || image.nchannels < 3)
+		{
+			ELOG("The faces of the cubemap %s differ in size or are not RGB", directory);
+			FreeImage(image);
+			return false;
+		}
 
-		vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, vertexBufferLayout.stride });
-		vertexBufferLayout.stride += 3 * sizeof(float);
+		// LoadImage flips them bottom row first, cubemaps are sampled the other way round
+		cubemap.faces[face].resize((u64)image.stride * image.size.y);
+		for (i32 y = 0; y < image.size.y; ++y)
+			memcpy(&cubemap.faces[face][(u64)y * image.stride], (const u8*)image.pixels + (u64)(image.size.y - 1 - y) * image.stride, image.stride);
+		FreeImage(image);
 	}
+	return true;
+}
 
-	// add the submesh into the mesh
-	Submesh submesh = {};
-	submesh.vertexBufferLayout = vertexBufferLayout;
-	submesh.vertices.swap(vertices);
-	submesh.indices.swap(indices);
-	myMesh->submeshes.push_back(submesh);
+static bool WriteCookedCubemap(const char* cookedPath, u64 sourceTimestamp, const CubemapFaces& cubemap)
+{
+	std::vector<u8> data;
+	WriteCookedValue(data, (u32)COOKED_CUBEMAP_MAGIC);
+	WriteCookedValue(data, (u32)COOKED_CUBEMAP_VERSION);
+	WriteCookedValue(data, sourceTimestamp);
+	WriteCookedValue(data, cubemap.size);
+	WriteCookedValue(data, cubemap.bytesPerPixel);
+	for (u32 face = 0; face < 6; ++face)
+		data.insert(data.end(), cubemap.faces[face].begin(), cubemap.faces[face].end());
+
+	return WriteBinaryFile(cookedPath, data.data(), data.size());
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory)
+bool CookCubemap(const char* directory)
 {
-	aiString name;
-	aiColor3D diffuseColor;
-	aiColor3D emissiveColor;
-	aiColor3D specularColor;
-	ai_real shininess;
-	material->Get(AI_MATKEY_NAME, name);
-	material->Get(AI_MATKEY_COLOR_DIFFUSE, diffuseColor);
-	material->Get(AI_MATKEY_COLOR_EMISSIVE, emissiveColor);
-	material->Get(AI_MATKEY_COLOR_SPECULAR, specularColor);
-	material->Get(AI_MATKEY_SHININESS, shininess);
+	CubemapFaces cubemap = {};
+	const u64 sourceTimestamp = GetCubemapSourceTimestamp(directory);
+	const std::string cookedPath = GetCookedCubemapPath(directory);
+	return DecodeCubemap(directory, cubemap) && WriteCookedCubemap(cookedPath.c_str(), sourceTimestamp, cubemap);
+}
 
-	myMaterial.name = name.C_Str();
-	myMaterial.albedo = vec3(diffuseColor.r, diffuseColor.g, diffuseColor.b);
-	myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
-	myMaterial.smoothness = shininess / 256.0f;
+bool ReadCookedCubemap(const char* cookedPath, u64 sourceTimestamp, CubemapFaces& cubemap)
+{
+	if (GetFileLastWriteTimestamp(cookedPath) == 0)
+		return false;
 
-	aiString aiFilename;
-	if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
+	ScopedTemporaryMemory temp(GetTempArena());
+	String file = ReadTextFile(cookedPath);
+	CookedReader reader = { (const u8*)file.str, (const u8*)file.str + file.len, file.str != NULL };
+
+	if (ReadCookedValue<u32>(reader) != COOKED_CUBEMAP_MAGIC ||
+		ReadCookedValue<u32>(reader) != COOKED_CUBEMAP_VERSION ||
+		ReadCookedValue<u64>(reader) != sourceTimestamp)
 	{
-		material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
+		return false;
 	}
-	else
+
+	CubemapFaces cookedCubemap = {};
+	cookedCubemap.size = ReadCookedValue<ivec2>(reader);
+	cookedCubemap.bytesPerPixel = ReadCookedValue<u32>(reader);
+	u64 faceSize = (u64)cookedCubemap.size.x * cookedCubemap.size.y * cookedCubemap.bytesPerPixel;
+	if (!reader.valid || cookedCubemap.size.x <= 0 || cookedCubemap.size.y <= 0 || (cookedCubemap.bytesPerPixel != 3 && cookedCubemap.bytesPerPixel != 4) ||
+		(u64)(reader.end - reader.cursor) != faceSize * 6)
 	{
-		myMaterial.albedoTextureIdx = app->whiteTexIdx;
+		ELOG("Cooked cubemap %s is corrupted, decoding the faces again", cookedPath);
+		return false;
 	}
 
-	if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
+	for (u32 face = 0; face < 6; ++face)
 	{
-		material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
+		cookedCubemap.faces[face].resize(faceSize);
+		ReadCookedData(reader, cookedCubemap.faces[face].data(), faceSize);
 	}
-	if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
+
+	cubemap = std::move(cookedCubemap);
+	return true;
+}
+
+void InitUploadManager(App* app)
+{
+	UploadManager& uploads = app->uploads;
+	uploads.nextTicket = 1;	// Ticket 0 is always issued
+
+	PFNGLBUFFERSTORAGEPROC glBufferStorage = NULL;
+	if (GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 4) || IsExtensionSupported("GL_ARB_buffer_storage"))
+		glBufferStorage = (PFNGLBUFFERSTORAGEPROC)GetOpenGLProcAddress("glBufferStorage");
+
+	glGenBuffers(1, &uploads.ringHandle);
+	glBindBuffer(GL_COPY_READ_BUFFER, uploads.ringHandle);
+	if (glBufferStorage)
 	{
-		material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
+		// Coherent, so the writes need no explicit flush before the copies
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_READ_BUFFER, STAGING_RING_SIZE, NULL, flags);
+		uploads.ringMemory = (u8*)glMapBufferRange(GL_COPY_READ_BUFFER, 0, STAGING_RING_SIZE, flags);
 	}
-	if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
+
+	uploads.persistent = uploads.ringMemory != NULL;
+	if (!uploads.persistent)
 	{
-		material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
+		// Buffer storage is immutable, start over with a plain buffer if mapping failed
+		if (glBufferStorage)
+		{
+			glDeleteBuffers(1, &uploads.ringHandle);
+			glGenBuffers(1, &uploads.ringHandle);
+			glBindBuffer(GL_COPY_READ_BUFFER, uploads.ringHandle);
+		}
+		glBufferData(GL_COPY_READ_BUFFER, STAGING_RING_SIZE, NULL, GL_STREAM_DRAW);
+		uploads.ringShadow.resize(STAGING_RING_SIZE);
+		uploads.ringMemory = uploads.ringShadow.data();
 	}
-	if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	ILOG("Staging ring: %u MB, %s", STAGING_RING_SIZE / MB(1), uploads.persistent ? "persistently mapped" : "copied through unsynchronized maps");
+}
+
+// Takes room for the command at the head of the ring, false while the GPU may still
+// read it. Must be called with the upload mutex held.
+static bool TryReserveUpload(UploadManager& uploads, UploadCommand& command)
+{
+	u64 position = (uploads.head + STAGING_RING_ALIGNMENT - 1) & ~(u64)(STAGING_RING_ALIGNMENT - 1);
+
+	// The copies read a single range, so the data never wraps around the end
+	if (position % STAGING_RING_SIZE + command.size > STAGING_RING_SIZE)
+		position += STAGING_RING_SIZE - position % STAGING_RING_SIZE;
+	if (position + command.size - uploads.tail > STAGING_RING_SIZE)
+		return false;
+
+	command.stagingPosition = position;
+	command.ticket = uploads.nextTicket++;
+	command.ready = false;
+	uploads.head = position + command.size;
+	uploads.commands.push_back(command);
+	return true;
+}
+
+static UploadWrite GetUploadWrite(UploadManager& uploads, const UploadCommand& command)
+{
+	return UploadWrite{ uploads.ringMemory + command.stagingPosition % STAGING_RING_SIZE, command.ticket };
+}
+
+// Loader threads wait for the render thread to free space
+static UploadWrite BeginUpload(App* app, UploadCommand command)
+{
+	ASSERT(command.size <= STAGING_MAX_CHUNK_SIZE, "Uploads must be split in staging chunks");
+	UploadManager& uploads = app->uploads;
+
+	std::unique_lock<std::mutex> lock(uploads.mutex);
+	uploads.spaceFreed.wait(lock, [&]() { return TryReserveUpload(uploads, command); });
+	return GetUploadWrite(uploads, command);
+}
+
+UploadWrite BeginBufferUpload(App* app, GLuint bufferHandle, u32 offset, u32 size)
+{
+	UploadCommand command = {};
+	command.target = UploadTarget_Buffer;
+	command.handle = bufferHandle;
+	command.offset = offset;
+	command.size = size;
+	return BeginUpload(app, command);
+}
+
+UploadWrite BeginTextureUpload(App* app, GLuint textureHandle, u32 level, u32 y, ivec2 extent, GLenum format, GLenum type, u32 size, bool generateMipmaps)
+{
+	UploadCommand command = {};
+	command.target = UploadTarget_Texture2D;
+	command.handle = textureHandle;
+	command.offset = y;
+	command.level = level;
+	command.extent = extent;
+	command.format = format;
+	command.type = type;
+	command.size = size;
+	command.generateMipmaps = generateMipmaps;
+	return BeginUpload(app, command);
+}
+
+void EndUpload(App* app, const UploadWrite& write)
+{
+	UploadManager& uploads = app->uploads;
+	std::lock_guard<std::mutex> lock(uploads.mutex);
+
+	// Not ready means not issued, so it is still in the queue
+	UploadCommand& command = uploads.commands[write.ticket - uploads.commands.front().ticket];
+	ASSERT(command.ticket == write.ticket && !command.ready, "Ending an upload twice");
+	command.ready = true;
+}
+
+// Gives back the ring space of the copies the GPU is done with, waiting for the oldest
+// ones when asked to
+static void RetireUploadFences(App* app, bool waitForOldest)
+{
+	UploadManager& uploads = app->uploads;
+
+	u64 tail = 0;
+	bool retired = false;
+	while (!uploads.fences.empty())
 	{
-		material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-		String filename = MakeString(aiFilename.C_Str());
-		String filepath = MakePath(directory, filename);
-		myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+		UploadFence& fence = uploads.fences.front();
+		GLuint64 timeout = waitForOldest && !retired ? 1000000000ull : 0;
+		GLenum result = glClientWaitSync(fence.sync, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			break;
+
+		tail = fence.end;
+		glDeleteSync(fence.sync);
+		uploads.fences.pop_front();
+		retired = true;
 	}
 
-	//myMaterial.createNormalFromBump();
+	if (retired)
+	{
+		{
+			std::lock_guard<std::mutex> lock(uploads.mutex);
+			uploads.tail = tail;
+		}
+		uploads.spaceFreed.notify_all();
+	}
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+static void IssueUpload(UploadManager& uploads, const UploadCommand& command)
 {
-	// process all the node's meshes (if any)
-	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	const u32 ringOffset = (u32)(command.stagingPosition % STAGING_RING_SIZE);
+	if (!uploads.persistent)
 	{
-		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+		// The fences already keep the GPU off this range
+		void* staging = glMapBufferRange(GL_COPY_READ_BUFFER, ringOffset, command.size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		memcpy(staging, uploads.ringShadow.data() + ringOffset, command.size);
+		glUnmapBuffer(GL_COPY_READ_BUFFER);
 	}
 
-	// then do the same for each of its children
-	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	switch (command.target)
 	{
-		ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+	case UploadTarget_Buffer:
+		glBindBuffer(GL_COPY_WRITE_BUFFER, command.handle);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, ringOffset, command.offset, command.size);
+		break;
+	case UploadTarget_Texture2D:
+		glBindTexture(GL_TEXTURE_2D, command.handle);
+		if (command.compressed)
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.offset, command.extent.x, command.extent.y, command.format, command.size, (const void*)(u64)ringOffset);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.offset, command.extent.x, command.extent.y, command.format, command.type, (const void*)(u64)ringOffset);
+		if (command.generateMipmaps)
+			glGenerateMipmap(GL_TEXTURE_2D);
+		break;
 	}
 }
 
-u32 LoadModel(App* app, const char* filename)
+void ProcessUploads(App* app, u32 budgetBytes, f32 budgetMilliseconds, FrameStats* stats)
 {
-	const aiScene* scene = aiImportFile(filename,
-		aiProcess_Triangulate |
-		aiProcess_GenSmoothNormals |
-		aiProcess_CalcTangentSpace |
-		aiProcess_JoinIdenticalVertices |
-		aiProcess_PreTransformVertices |
-		aiProcess_ImproveCacheLocality |
-		aiProcess_OptimizeMeshes |
-		aiProcess_SortByPType);
+	UploadManager& uploads = app->uploads;
+	auto start = std::chrono::high_resolution_clock::now();
 
-	if (!scene)
+	RetireUploadFences(app, false);
+
+	u64 bytes = 0;
+	u32 count = 0;
+	u64 end = 0;
+	for (;;)
 	{
-		ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-		return UINT32_MAX;
-	}
+		f64 milliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-	app->meshes.push_back(Mesh{});
-	Mesh& mesh = app->meshes.back();
-	u32 meshIdx = (u32)app->meshes.size() - 1u;
+		UploadCommand command;
+		{
+			std::lock_guard<std::mutex> lock(uploads.mutex);
+			if (uploads.commands.empty() || !uploads.commands.front().ready)
+				break;
+			if (count > 0 && (bytes + uploads.commands.front().size > budgetBytes || milliseconds >= budgetMilliseconds))
+				break;
 
-	app->models.push_back(Model{});
-	Model& model = app->models.back();
-	model.meshIdx = meshIdx;
-	u32 modelIdx = (u32)app->models.size() - 1u;
+			command = uploads.commands.front();
+			uploads.commands.pop_front();
+		}
 
-	String directory = GetDirectoryPart(MakeString(filename));
+		if (count == 0)
+		{
+			// Texture rows are tightly packed
+			glBindBuffer(GL_COPY_READ_BUFFER, uploads.ringHandle);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploads.ringHandle);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		}
+		IssueUpload(uploads, command);
+		uploads.issuedTicket = command.ticket;
 
-	// Create a list of materials
-	u32 baseMeshMaterialIndex = (u32)app->materials.size();
-	for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
-	{
-		app->materials.push_back(Material{});
-		Material& material = app->materials.back();
-		ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+		bytes += command.size;
+		count++;
+		end = command.stagingPosition + command.size;
 	}
 
-	ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+	// One fence for the whole batch
+	if (count > 0)
+	{
+		uploads.fences.push_back(UploadFence{ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), end });
 
-	aiReleaseImport(scene);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
 
-	u32 vertexBufferSize = 0;
-	u32 indexBufferSize = 0;
+	if (stats)
+	{
+		stats->uploadCommands += count;
+		stats->uploadBytes += bytes;
+		stats->uploadMilliseconds += std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::lock_guard<std::mutex> lock(uploads.mutex);
+		stats->uploadsPending = (u32)uploads.commands.size();
+		stats->uploadBytesPending = 0;
+		for (const UploadCommand& command : uploads.commands)
+			stats->uploadBytesPending += command.size;
+	}
+}
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+void FlushUploads(App* app)
+{
+	UploadManager& uploads = app->uploads;
+	u64 lastTicket;
 	{
-		vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-		indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
+		std::lock_guard<std::mutex> lock(uploads.mutex);
+		lastTicket = uploads.nextTicket - 1;
 	}
 
-	glGenBuffers(1, &mesh.vertexBufferHandle);
-	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-	glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+	// A loader thread may still be writing one of them
+	while (uploads.issuedTicket < lastTicket)
+	{
+		ProcessUploads(app, UINT32_MAX, FLT_MAX);
+		if (uploads.issuedTicket < lastTicket)
+			std::this_thread::yield();
+	}
+}
 
-	glGenBuffers(1, &mesh.indexBufferHandle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+bool IsUploadIssued(App* app, u64 ticket)
+{
+	return app->uploads.issuedTicket >= ticket;
+}
 
-	u32 indicesOffset = 0;
-	u32 verticesOffset = 0;
+// The render thread frees space itself instead of waiting for it
+static UploadWrite BeginRenderThreadUpload(App* app, UploadCommand command)
+{
+	UploadManager& uploads = app->uploads;
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(uploads.mutex);
+			if (TryReserveUpload(uploads, command))
+				return GetUploadWrite(uploads, command);
+		}
 
-	for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+		FlushUploads(app);
+		RetireUploadFences(app, true);
+	}
+}
+
+u64 StageBufferData(App* app, GLuint bufferHandle, u32 offset, const void* data, u32 size)
+{
+	const u8* bytes = (const u8*)data;
+	u64 ticket = 0;
+	for (u32 staged = 0; staged < size; staged += STAGING_MAX_CHUNK_SIZE)
 	{
-		const void* verticesData = mesh.submeshes[i].vertices.data();
-		const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-		glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-		mesh.submeshes[i].vertexOffset = verticesOffset;
-		verticesOffset += verticesSize;
+		UploadCommand command = {};
+		command.target = UploadTarget_Buffer;
+		command.handle = bufferHandle;
+		command.offset = offset + staged;
+		command.size = glm::min(size - staged, (u32)STAGING_MAX_CHUNK_SIZE);
+
+		UploadWrite write = BeginRenderThreadUpload(app, command);
+		memcpy(write.memory, bytes + staged, command.size);
+		EndUpload(app, write);
+		ticket = write.ticket;
+	}
+	return ticket;
+}
 
-		const void* indicesData = mesh.submeshes[i].indices.data();
-		const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-		mesh.submeshes[i].indexOffset = indicesOffset;
-		indicesOffset += indicesSize;
+u64 StageTextureData(App* app, GLuint textureHandle, u32 level, ivec2 size, GLenum format, GLenum type, u32 bytesPerPixel, const void* pixels, bool generateMipmaps)
+{
+	const u32 rowSize = size.x * bytesPerPixel;
+	ASSERT(rowSize <= STAGING_MAX_CHUNK_SIZE, "Texture rows must fit a staging chunk");
+	const u32 bandRows = STAGING_MAX_CHUNK_SIZE / rowSize;
+
+	const u8* bytes = (const u8*)pixels;
+	u64 ticket = 0;
+	for (u32 y = 0; y < (u32)size.y; y += bandRows)
+	{
+		UploadCommand command = {};
+		command.target = UploadTarget_Texture2D;
+		command.handle = textureHandle;
+		command.offset = y;
+		command.level = level;
+		command.extent = ivec2(size.x, glm::min((u32)size.y - y, bandRows));
+		command.format = format;
+		command.type = type;
+		command.size = command.extent.y * rowSize;
+		command.generateMipmaps = generateMipmaps && y + command.extent.y == (u32)size.y;
+
+		UploadWrite write = BeginRenderThreadUpload(app, command);
+		memcpy(write.memory, bytes + (u64)y * rowSize, command.size);
+		EndUpload(app, write);
+		ticket = write.ticket;
 	}
+	return ticket;
+}
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+u64 StageCompressedTextureData(App* app, GLuint textureHandle, u32 level, ivec2 size, GLenum internalFormat, BlockFormat blockFormat, const void* blocks)
+{
+	const u32 rowSize = GetCompressedImageSize(blockFormat, ivec2(size.x, 1));
+	ASSERT(rowSize <= STAGING_MAX_CHUNK_SIZE, "Texture rows must fit a staging chunk");
+	const u32 bandRows = STAGING_MAX_CHUNK_SIZE / rowSize * 4;
 
-	return modelIdx;
+	const u8* bytes = (const u8*)blocks;
+	u64 ticket = 0;
+	for (u32 y = 0; y < (u32)size.y; y += bandRows)
+	{
+		UploadCommand command = {};
+		command.target = UploadTarget_Texture2D;
+		command.handle = textureHandle;
+		command.offset = y;
+		command.level = level;
+		command.extent = ivec2(size.x, glm::min((u32)size.y - y, bandRows));
+		command.format = internalFormat;
+		command.size = GetCompressedImageSize(blockFormat, command.extent);
+		command.compressed = true;
+
+		UploadWrite write = BeginRenderThreadUpload(app, command);
+		memcpy(write.memory, bytes + (u64)(y / 4) * rowSize, command.size);
+		EndUpload(app, write);
+		ticket = write.ticket;
+	}
+	return ticket;
+}
+
+u64 GetResidentMeshBytes(App* app)
+{
+	u64 bytes = 0;
+	for (u32 i = 0; i < app->meshes.size(); ++i)
+	{
+		const Mesh& mesh = app->meshes[i];
+		for (u32 j = 0; j < mesh.submeshes.size(); ++j)
+		{
+			bytes += mesh.submeshes[j].vertices.capacity();
+			bytes += mesh.submeshes[j].indices.capacity() * sizeof(u32);
+		}
+		for (const OccluderMesh& occluder : mesh.occluders)
+			bytes += occluder.positions.capacity() * sizeof(vec3) + occluder.indices.capacity() * sizeof(u32);
+		bytes += GetPvsSize(&mesh.pvs);
+	}
+	return bytes;
 }
 
 bool IsPowerOf2(u32 value)
@@ -1298,20 +5396,21 @@ void GenerateQuad(App* app)
 	glBindVertexArray(0);
 }
 
-void DrawFinalQuad(App* app)
+void DrawFinalQuad(App* app, const FrameSnapshot* snapshot)
 {
 	glClearColor(0.1f, 0.1f, 0.1f, 0.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+	glViewport(0, 0, snapshot->displaySize.x, snapshot->displaySize.y);
 
 	Program quadProgram = app->programs[app->forwardQuadProgramIdx];
-	if (app->currentRenderMode == RenderMode::DEFERRED)
+	if (snapshot->renderMode == RenderMode::DEFERRED)
 	{
-		quadProgram = app->PBR ? app->programs[app->deferredPBRQuadProgramIdx] : app->programs[app->deferredQuadProgramIdx];
+		u32 quadProgramIdx = GetProgramPermutation(app, snapshot, snapshot->PBR ? app->deferredPBRQuadProgramIdx : app->deferredQuadProgramIdx);
+		quadProgram = app->programs[quadProgramIdx];
 	}
 
-	if (app->currentRenderMode == RenderMode::FORWARD && app->currentRenderTargetMode == RenderTargetsMode::DEPTH)
+	if (snapshot->renderMode == RenderMode::FORWARD && snapshot->renderTargetMode == RenderTargetsMode::DEPTH)
 	{
 		quadProgram = app->programs[app->depthProgramIdx];
 	}
@@ -1320,10 +5419,10 @@ void DrawFinalQuad(App* app)
 	glBindVertexArray(app->quad.vao);
 
 	//FORWARD
-	if (app->currentRenderMode == RenderMode::FORWARD)
+	if (snapshot->renderMode == RenderMode::FORWARD)
 	{
 		glActiveTexture(GL_TEXTURE0);
-		switch (app->currentRenderTargetMode)
+		switch (snapshot->renderTargetMode)
 		{
 		case RenderTargetsMode::ALBEDO:		  glBindTexture(GL_TEXTURE_2D, app->albedoAttachmentHandle); break;
 		case RenderTargetsMode::NORMALS:	  glBindTexture(GL_TEXTURE_2D, app->normalsAttachmentHandle); break;
@@ -1371,7 +5470,7 @@ void DrawFinalQuad(App* app)
 		GLuint depthTextureLocation = glGetUniformLocation(quadProgram.handle, "uDepth");
 		glUniform1i(depthTextureLocation, 5);
 
-		if (app->showSkybox && app->PBR)
+		if (snapshot->showSkybox && snapshot->PBR)
 		{
 			glActiveTexture(GL_TEXTURE6);
 			glBindTexture(GL_TEXTURE_CUBE_MAP, app->irradianceMapAttachmentHandle);
@@ -1420,23 +5519,25 @@ void CreateCubemap(App* app)
 	glGenTextures(1, &app->cubemapAttachmentHandle);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapAttachmentHandle);
 
-	std::string path = "CubeMap/";
-	std::string directions[6] = { "right", "left", "top", "bottom", "front", "back" };
-
-	int width, height, nrChannels;
-	for (u32 i = 0; i < 6; i++)
+	// Decoded here only the first time and after a face changes, unless the cooker did it
+	const char* directory = "CubeMap";
+	const std::string cookedPath = GetCookedCubemapPath(directory);
+	const u64 sourceTimestamp = GetCubemapSourceTimestamp(directory);
+	CubemapFaces cubemap = {};
+	if (!ReadCookedCubemap(cookedPath.c_str(), sourceTimestamp, cubemap) && DecodeCubemap(directory, cubemap))
 	{
-		std::string texturePath = std::string(path + directions[i] + ".jpg");
-
-		unsigned char* data = stbi_load(texturePath.c_str(), &width, &height, &nrChannels, 0);
+		if (!WriteCookedCubemap(cookedPath.c_str(), sourceTimestamp, cubemap))
+			ELOG("Could not write the cooked cubemap %s", cookedPath.c_str());
+	}
 
-		if (data)
+	GLenum format = cubemap.bytesPerPixel == 4 ? GL_RGBA : GL_RGB;
+	for (u32 i = 0; i < ARRAY_COUNT(cubemap.faces); i++)
+	{
+		if (!cubemap.faces[i].empty())
 		{
 			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
+				0, format, cubemap.size.x, cubemap.size.y, 0, format, GL_UNSIGNED_BYTE, cubemap.faces[i].data()
 			);
-
-			stbi_image_free(data);
 		}
 	}
 
@@ -1677,21 +5778,28 @@ void CreateBRDF(App* app)
 	glPopDebugGroup();
 }
 
-Light CreateLight(App* app, LightType lightType, vec3 position, vec3 direction, vec3 color)
+u32 CreateEntity(App* app, u32 modelIndex, vec3 position)
+{
+	ASSERT(!app->meshes[app->models[modelIndex].meshIdx].unloaded, "Creating an entity of an unloaded model");
+	Entity entity;
+	entity.modelIndex = modelIndex;
+	return AddEntity(&app->entityStore, position, quat(1.0f, 0.0f, 0.0f, 0.0f), DEFAULT_ENTITY_SCALE, entity);
+}
+
+Light* CreateLight(App* app, LightType lightType, vec3 position, vec3 direction, vec3 color)
 {
-	Light light;
-	light.type = lightType;
-	light.position = position;
-	light.color = color;
-	light.direction = direction;
+	Light* light = PoolNew<Light>(&app->lightPool);
+	light->type = lightType;
+	light->position = position;
+	light->color = color;
+	light->direction = direction;
 
 	Entity entity;
-	entity.position = position;
 
 	if (lightType == LightType::LightType_Directional) { entity.modelIndex = app->directionalLightModel; }
 	else if (lightType == LightType::LightType_Point) { entity.modelIndex = app->sphereModel; }
 
-	light.entity = entity;
+	light->entity = entity;
 
 	return light;
 }
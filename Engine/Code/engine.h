@@ -5,6 +5,22 @@
 #pragma once
 
 #include "platform.h"
+#include "mesh_processing.h"
+#include "culling.h"
+#include "entity_store.h"
+#include "job_system.h"
+#include "bvh.h"
+#include "software_occlusion.h"
+#include "pvs.h"
+#include "range_allocator.h"
+#include "texture_compression.h"
+
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
 
 #ifdef _DEBUG
 #include <glad/glad.h>
@@ -24,6 +40,20 @@
 #define PushMat3(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 #define PushMat4(buffer, value) PushAlignedData(buffer, value_ptr(value), sizeof(value), sizeof(vec4))
 
+// GL_KHR_parallel_shader_compile is not part of the generated glad loader
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// Neither is GL_ARB_buffer_storage (core in 4.4)
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT   0x0080
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+// Nor GL_EXT_texture_compression_s3tc, which every desktop driver exposes
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+
 #define CreateConstantBuffer(size) CreateBuffer(size, GL_UNIFORM_BUFFER, GL_STREAM_DRAW)
 #define CreateStaticVertexBuffer(size) CreateBuffer(size, GL_ARRAY_BUFFER, GL_STATIC_DRAW)
 #define CreateStaticIndexBuffer(size) CreateBuffer(size, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW)
@@ -39,6 +69,7 @@ typedef glm::vec4  vec4;
 typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
+typedef glm::mat3  mat3;
 typedef glm::mat4  mat4;
 
 enum Camera_Movement {
@@ -90,9 +121,11 @@ struct VertexV3V2
 
 struct VertexBufferAttribute
 {
-	u8 location;
-	u8 componentCount;
-	u8 offset;
+	u8        location;
+	u8        componentCount;
+	u8        offset;
+	GLenum    type;			// GL_FLOAT, GL_HALF_FLOAT, GL_UNSIGNED_SHORT, GL_INT_2_10_10_10_REV...
+	GLboolean normalized;	// Integer types are read as [0,1] / [-1,1] floats
 };
 
 struct VertexBufferLayout
@@ -204,21 +237,164 @@ struct Buffer
 struct Submesh
 {
 	VertexBufferLayout  vertexBufferLayout;
-	std::vector<float>  vertices;
-	std::vector<u32>    indices;
-	u32                 vertexOffset;
-	u32                 indexOffset;
-
-	std::vector<Vao>    vaos;
+	std::vector<u8>     vertices;	// CPU copies in vertexBufferLayout, released after upload unless the mesh keeps them
+	std::vector<u32>    indices;	// Every LOD, one after the other
+	u32                 vertexCount;
+	u32                 indexCount;
+	std::vector<MeshLod> lods;		// lods[0] is the full resolution, they all index the same vertices
+	std::vector<Meshlet> meshlets;	// Those of every LOD, see MeshLod::firstMeshlet
+	MeshletCullData     meshletCullData;
+	GLenum              indexType;	// GL_UNSIGNED_SHORT when the vertex count allows it
+	u32                 vertexPool;		// Where the geometry lives in the GeometryArena...
+	u32                 baseVertex;		// ...in vertices of that pool, added to every index
+	u32                 indexOffset;	// In bytes of the index buffer
+	u32                 vertexBlock = RANGE_NONE;	// RangeAllocator blocks while uploaded
+	u32                 indexBlock = RANGE_NONE;
+	vec3                positionScale;	// Dequantization of the positions (uPositionScale/uPositionOffset)
+	vec3                positionOffset;
+	vec3                boundsMin;		// Model space
+	vec3                boundsMax;
 };
 
 struct Mesh
 {
 	std::vector<Submesh> submeshes;
-	GLuint               vertexBufferHandle;
-	GLuint               indexBufferHandle;
+	u32                  vertexBufferSize;
+	u32                  indexBufferSize;
+	u32                  uncompressedVertexBufferSize;	// What the buffers would take with float vertices and u32 indices
+	u32                  uncompressedIndexBufferSize;
+	u32                  loadFlags;
+	MeshOptimizationStats optimizationStats;
+	vec3                 boundsMin;		// Model space bounds of all the submeshes
+	vec3                 boundsMax;
+	std::vector<f32>     lodErrors;		// Largest error of any submesh at each LOD, in model units
+	std::vector<OccluderMesh> occluders;	// MeshLoad_Occluders only
+	Pvs                  pvs;			// MeshLoad_Pvs only, in model space with one object per submesh
+	bool                 unloaded;		// By UnloadModel, its arena ranges are freed by the next Render
+};
+
+// Geometry arena: the geometry of every mesh is suballocated from a few big buffers, a
+// vertex buffer per vertex format and one index buffer, so switching meshes only
+// changes the base vertex and first index of the draws, not the bound buffers. Full
+// buffers are replaced by ones twice as big.
+#define GEOMETRY_ARENA_INITIAL_VERTICES    (1 << 20)	// Per vertex format
+#define GEOMETRY_ARENA_INITIAL_INDEX_BYTES (16 << 20)
+#define GEOMETRY_ARENA_INDEX_ALIGNMENT     4			// Index ranges also start on u32 boundaries
+#define GEOMETRY_ARENA_MAX_STATS_POOLS     4
+
+struct GeometryVertexPool
+{
+	VertexBufferLayout layout;
+	GLuint             bufferHandle;
+	RangeAllocator     allocator;	// In vertices
+	std::vector<Vao>   vaos;		// A vertex array per program, see FindVAO
+};
+
+struct GeometryArena
+{
+	std::vector<GeometryVertexPool> vertexPools;
+	GLuint         indexBufferHandle;
+	RangeAllocator indexAllocator;	// In bytes
+	u32            growCount;
 };
 
+// The ranges of a submesh, to be freed
+struct GeometryAllocation
+{
+	u32 vertexPool;
+	u32 vertexBlock;
+	u32 indexBlock;
+};
+
+struct GeometryArenaStats
+{
+	u32                 vertexPoolCount;
+	u32                 vertexStrides[GEOMETRY_ARENA_MAX_STATS_POOLS];
+	RangeAllocatorStats vertices[GEOMETRY_ARENA_MAX_STATS_POOLS];	// The first pools only
+	RangeAllocatorStats indices;
+	u32                 growCount;
+};
+
+enum MeshLoadFlags
+{
+	MeshLoad_KeepCpuData      = 1 << 0,	// For picking, baking... anything reading the geometry after load
+	MeshLoad_CompressVertices = 1 << 1,	// Quantized positions, packed normals/tangents and half float UVs
+	MeshLoad_Occluders        = 1 << 2,	// Big submeshes (walls, floors...) hide entities from software occlusion culling
+	MeshLoad_Pvs              = 1 << 3,	// Static interiors: submeshes are culled with a precomputed visibility set
+	MeshLoad_StaticBatch      = 1 << 4,	// Static scenery: keeps the CPU geometry so static entities can be batched
+};
+
+// Flags that do not change the cooked geometry
+#define MESH_LOAD_RUNTIME_FLAGS (MeshLoad_KeepCpuData | MeshLoad_Occluders | MeshLoad_Pvs | MeshLoad_StaticBatch)
+
+// What LoadModel uses when not told otherwise
+#define MESH_LOAD_DEFAULT_FLAGS MeshLoad_CompressVertices
+
+// Models the engine loads, shared with the asset cooker to cook them with the same flags
+enum EngineModel
+{
+	EngineModel_Quad,
+	EngineModel_Sphere,
+	EngineModel_Patrick,
+	EngineModel_Room,
+	EngineModel_Count
+};
+
+struct ModelDesc
+{
+	const char* filepath;
+	u32         loadFlags;
+};
+
+// Cooked files are plain little endian dumps read back through a CookedReader, which
+// turns invalid (and stays so) on the first read past the end
+struct CookedReader
+{
+	const u8* cursor;
+	const u8* end;
+	bool      valid;
+};
+
+template <typename T>
+void WriteCookedValue(std::vector<u8>& data, const T& value)
+{
+	const u8* bytes = (const u8*)&value;
+	data.insert(data.end(), bytes, bytes + sizeof(T));
+}
+
+void WriteCookedString(std::vector<u8>& data, const std::string& str);
+
+bool ReadCookedData(CookedReader& reader, void* destination, u64 size);
+
+template <typename T>
+T ReadCookedValue(CookedReader& reader)
+{
+	T value = {};
+	ReadCookedData(reader, &value, sizeof(T));
+	return value;
+}
+
+std::string ReadCookedString(CookedReader& reader);
+
+// Imported models are cooked next to their source file ("<source>.cooked") with the
+// optimized geometry and material descriptions, so later loads skip Assimp entirely.
+// Bump the version whenever the import pipeline or the file layout changes.
+#define COOKED_MODEL_MAGIC   0x4C444D43 // "CMDL"
+#define COOKED_MODEL_VERSION 5
+
+// The PVS of a model is built on its first load and saved next to it ("<source>.pvs")
+#define COOKED_PVS_MAGIC   0x53565043 // "CPVS"
+#define COOKED_PVS_VERSION 2
+
+// The block compressed mips of a texture are cooked on its first load and saved next to
+// it ("<source>.ctex"), in the format its usage and the compression setting pick
+#define COOKED_TEXTURE_MAGIC   0x58455443 // "CTEX"
+#define COOKED_TEXTURE_VERSION 1
+
+// The faces of a cubemap are decoded once into "<directory>/cubemap.ccube", top row first
+#define COOKED_CUBEMAP_MAGIC   0x42554343 // "CCUB"
+#define COOKED_CUBEMAP_VERSION 1
+
 struct Material
 {
 	std::string name;
@@ -232,6 +408,24 @@ struct Material
 	u32			bumpTextureIdx;
 };
 
+enum MaterialTexture
+{
+	MaterialTexture_Albedo,
+	MaterialTexture_Emissive,
+	MaterialTexture_Specular,
+	MaterialTexture_Normals,
+	MaterialTexture_Bump,
+	MaterialTexture_Count
+};
+
+// A material as imported or cooked, before its textures are loaded. The paths are
+// relative to the working directory, empty for the slots it does not use.
+struct CookedMaterial
+{
+	Material    material;
+	std::string texturePaths[MaterialTexture_Count];
+};
+
 struct Model
 {
 	u32              meshIdx;
@@ -246,20 +440,139 @@ struct Image
 	i32   stride;
 };
 
+// Texture streaming: a texture is first made resident only down to its tail, the mips
+// of at most TEXTURE_STREAMING_TAIL_SIZE texels a side, with GL_TEXTURE_BASE_LEVEL
+// clamped to the finest of them. Finer mips are staged through the upload manager one
+// at a time as the visible draws get closer, and evicted again once unneeded for a while.
+#define TEXTURE_STREAMING_TAIL_SIZE        64
+#define TEXTURE_STREAMING_EVICT_FRAMES     120		// Unneeded for this long, finer mips are released
+#define TEXTURE_STREAMING_BUDGET_BYTES     MB(4)	// Staged per frame, the first level always goes
+
+// Memory budget of the streamed textures, levels counted from the moment they are allocated.
+// Finer levels only come in when they fit, evicting those of the least recently needed
+// textures first. Quality tiers drop the finest levels of every texture at load.
+#define TEXTURE_DEFAULT_BUDGET_BYTES       MB(512)
+#define TEXTURE_QUALITY_TIER_COUNT         3		// Full, half and quarter resolution
+
+enum TextureUsage
+{
+	TextureUsage_Color,		// BC1 or BC7 as chosen, BC3 with alpha
+	TextureUsage_Normals,	// BC5, only x and y are kept
+};
+
+// Format of the textures without alpha, when compressed
+enum TextureCompression
+{
+	TextureCompression_Off,
+	TextureCompression_BC1,
+	TextureCompression_BC7,
+	TextureCompression_Count
+};
+
+// Every level of an image, kept in memory to stream them in again after an eviction
+struct TextureMipChain
+{
+	GLenum             internalFormat;
+	GLenum             format;			// Of the pixels, uncompressed only
+	u32                bytesPerPixel;	// Of the source image
+	bool               compressed;
+	BlockFormat        blockFormat;
+	u32                tailLevel;		// Finest level that is always resident
+	std::vector<ivec2> sizes;
+	std::vector<std::vector<u8>> levels;	// Tightly packed rows
+};
+
 struct Texture
 {
 	GLuint      handle;
 	std::string filepath;
 	ivec2		size;
+	TextureUsage usage;
+
+	// Streaming, render thread only. Textures without mips are fully resident.
+	std::shared_ptr<TextureMipChain> mips;
+	u32 residentLevel;		// GL_TEXTURE_BASE_LEVEL...
+	u32 streamingLevel;		// ...and the one being uploaded, residentLevel when none
+	u64 streamingTicket;
+	u64 lastNeededFrame;	// Last frame the draws needed residentLevel, for the LRU eviction
+	u64 residentBytes;		// Of the levels allocated, the one on its way included
+};
+
+// Which values of an axis can stand in for the requested one while its permutation compiles
+enum PermutationMatch
+{
+	PermutationMatch_Exact,		// Only the same value
+	PermutationMatch_AtLeast,	// Any larger value, e.g. array sizes
+	PermutationMatch_Superset,	// Any value with the same bits set, e.g. feature masks
+};
+
+// A permutation axis is exposed to the shader as "#define <define> <value>".
+// Values must be sorted, a requested value picks the first entry that is >= to it.
+struct ProgramPermutationAxis
+{
+	std::string      define;
+	std::vector<u32> values;
+	PermutationMatch match = PermutationMatch_Exact;
+};
+
+// Programs the engine loads at startup, shared with the asset cooker to check them
+enum EngineProgram
+{
+	EngineProgram_ForwardGeometry,
+	EngineProgram_DeferredGeometry,
+	EngineProgram_Lights,
+	EngineProgram_ForwardQuad,
+	EngineProgram_DeferredQuad,
+	EngineProgram_DeferredPbrQuad,
+	EngineProgram_ForwardPbrGeometry,
+	EngineProgram_Depth,
+	EngineProgram_Cubemap,
+	EngineProgram_IrradianceMap,
+	EngineProgram_PrefilterMap,
+	EngineProgram_Brdf,
+	EngineProgram_HiZBuild,
+	EngineProgram_OcclusionCull,
+	EngineProgram_Count
+};
+
+struct ProgramDesc
+{
+	const char*                         filepath;
+	const char*                         programName;
+	bool                                compute;
+	std::vector<ProgramPermutationAxis> permutationAxes;
+};
+
+struct ProgramPermutation
+{
+	u32 key;
+	u32 programIdx;
+};
+
+// Shader objects of a program that may still be compiling in the driver
+struct ProgramCompile
+{
+	GLuint handle;
+	GLuint vertexShader;
+	GLuint fragmentShader;
+	GLuint computeShader;	// Compute programs only have this one
 };
 
 struct Program
 {
-	GLuint             handle;
+	GLuint             handle;             // Last program that linked successfully
+	ProgramCompile     pendingCompile;     // In-flight (re)compilation, handle is 0 if none
 	std::string        filepath;
 	std::string        programName;
+	std::string        defines;            // Permutation defines added to the preamble
 	u64                lastWriteTimestamp; // What is this for?
 	VertexShaderLayout vertexInputLayout;
+	bool               compute;            // Built from the COMPUTE section of the file
+
+	// Only set on programs loaded with permutation axes, the variants are
+	// compiled lazily and live in app->programs as regular programs
+	std::vector<ProgramPermutationAxis> permutationAxes;
+	std::vector<ProgramPermutation>     permutations;
 };
 
 struct Cubemap
@@ -267,6 +580,14 @@ struct Cubemap
 	u32 texture[6];
 };
 
+// Faces in +X -X +Y -Y +Z -Z order, as glTexImage2D takes them
+struct CubemapFaces
+{
+	ivec2           size;
+	u32             bytesPerPixel;
+	std::vector<u8> faces[6];
+};
+
 
 enum class RenderMode
 {
@@ -297,17 +618,25 @@ enum class LightType
 	LightType_Point
 };
 
-struct Entity
-{
-	mat4 worldMatrix;
-	mat4 worldViewProjection;
-	vec3 position;
-	float metallic = 0.5f;
-	float roughness = 0.5f;
-	u32 modelIndex;
-	u32 localParamsOffset;
-	u32 localParamsSize;
-};
+// Size of the uLight array in the GlobalParams block
+#define MAX_LIGHTS 16
+
+// Bits of the LIGHT_TYPES permutation define
+#define LIGHT_TYPES_DIRECTIONAL 1
+#define LIGHT_TYPES_POINT       2
+
+// LOD selection: the coarsest LOD whose simplification error projects under
+// LOD_ERROR_PIXELS is drawn. Switching to a coarser LOD needs the error to fall
+// LOD_HYSTERESIS (as a fraction) below the threshold, so entities near a boundary do
+// not pop back and forth. Entities whose bounding sphere covers less than
+// SMALL_OBJECT_CULL_PIXELS of diameter on screen are not drawn at all.
+#define LOD_ERROR_PIXELS          1.0f
+#define LOD_HYSTERESIS            0.25f
+#define SMALL_OBJECT_CULL_PIXELS  2.0f
+
+// Point lights fall off with the inverse square of the distance, past the distance where
+// their brightest channel drops under this they are considered to have no influence
+#define LIGHT_INFLUENCE_THRESHOLD (1.0f / 256.0f)
 
 struct Light
 {
@@ -318,6 +647,408 @@ struct Light
 	Entity	   entity;
 };
 
+// Frame pipeline: Update writes everything Render needs into a FrameSnapshot, so the
+// render thread can submit frame N from its snapshot while the main thread already
+// simulates frame N + 1 (see platform.cpp). Render never reads what the main thread
+// writes every frame, only the snapshot and the assets loaded at Init.
+
+// Upper bound of snapshots queued for the render thread
+#define MAX_FRAME_QUEUE_DEPTH 3
+
+// GlobalParams block: directional light count, camera position, light count, then the lights
+#define GLOBAL_PARAMS_MAX_SIZE (3 * sizeof(vec4) + MAX_LIGHTS * 4 * sizeof(vec4))
+
+struct SnapshotDraw
+{
+	u32  modelIndex;
+	u32  lodIndex;
+	f32  metallic;
+	f32  roughness;
+	u32  localParamsOffset;
+	u32  localParamsSize;
+	mat4 worldMatrix;
+	mat4 worldViewProjection;
+	u32  submeshMaskOffset;	// Into FrameSnapshot::submeshMasks, SUBMESH_MASK_ALL when every submesh is drawn
+};
+
+#define SUBMESH_MASK_ALL UINT32_MAX
+
+// Draws of the same model and LOD are drawn together with glDrawElementsInstanced once
+// there are at least this many, their LocalParams come from the instance buffer
+#define INSTANCING_MIN_GROUP_SIZE 2
+
+// Shader storage binding of the instance buffer in the geometry programs
+#define INSTANCE_BUFFER_BINDING 0
+
+// std430, see the INSTANCED geometry shaders
+struct InstanceParams
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjection;
+	vec4 material;	// Metallic, roughness
+};
+
+// Instances [firstInstance, firstInstance + instanceCount) of FrameSnapshot::instances
+struct SnapshotInstanceGroup
+{
+	u32 modelIndex;
+	u32 lodIndex;
+	u32 firstInstance;
+	u32 instanceCount;
+};
+
+// Entities [firstEntity, firstEntity + count) whose LocalParams blocks are at dataOffset
+// in entityParamsData
+struct SnapshotParamsRun
+{
+	u32 firstEntity;
+	u32 count;
+	u32 dataOffset;
+};
+
+// Static batching: the full resolution triangles of static entities (Entity::isStatic)
+// are merged in world space into batches sharing a material, metallic and roughness and
+// a vertex format, each drawn with a single call. Triangles are also split by the cells
+// of a grid of this size, so the batches stay small enough to be frustum culled.
+#define STATIC_BATCH_CHUNK_SIZE 8.0f
+
+// Static entity that was merged, or skipped because its model has no CPU geometry
+struct StaticBatchEntity
+{
+	u32 entity;
+	u32 modelIndex;
+	f32 metallic;
+	f32 roughness;
+	bool batched;
+};
+
+// Submesh of a static entity with triangles in a batch
+struct StaticBatchSource
+{
+	u32 entity;		// Into StaticBatchSet::entities
+	u32 submesh;
+};
+
+/**
+ * Built by the main thread when a static entity changes and handed to the render thread
+ * through a snapshot. From then on the main thread only reads the batch descriptions,
+ * and the render thread owns the GPU side of the mesh.
+ */
+struct StaticBatchSet
+{
+	u32  generation;
+	Mesh mesh;		// A submesh per batch, in world space with a single LOD
+
+	// Per batch
+	std::vector<u32>  materialIdx;
+	std::vector<vec2> materialParams;	// Metallic, roughness
+	std::vector<u32>  sourceOffsets;	// Into sources, plus the end of the last batch
+	std::vector<StaticBatchSource> sources;
+
+	std::vector<StaticBatchEntity> entities;
+	u32 sourceSubmeshCount;		// Entity submeshes merged, i.e. draws saved
+	f64 buildMilliseconds;
+};
+
+// Upload manager: data for buffers and textures is written into a staging ring, a
+// persistently mapped buffer when GL_ARB_buffer_storage is there, from any thread.
+// The render thread then issues the copies in order, as many per frame as the budget
+// allows, and fences them so the ring space is only reused once the GPU read it.
+#define STAGING_RING_SIZE                  MB(32)
+#define STAGING_RING_ALIGNMENT             16
+#define STAGING_MAX_CHUNK_SIZE             (STAGING_RING_SIZE / 4)	// Bigger uploads are split
+#define UPLOAD_DEFAULT_BUDGET_BYTES        MB(8)
+#define UPLOAD_DEFAULT_BUDGET_MILLISECONDS 1.0f
+
+enum UploadTarget
+{
+	UploadTarget_Buffer,
+	UploadTarget_Texture2D,
+};
+
+struct UploadCommand
+{
+	UploadTarget target;
+	u64    ticket;
+	u64    stagingPosition;	// In the ring, see UploadManager::head
+	u32    size;
+	bool   ready;			// Set by EndUpload once the data is written
+	GLuint handle;			// Destination buffer or texture
+	u32    offset;			// Buffers: in bytes, textures: first row
+	u32    level;			// Textures only
+	ivec2  extent;			// Width and rows
+	GLenum format;
+	GLenum type;
+	bool   generateMipmaps;	// After the copy, for the last rows of the texture
+	bool   compressed;		// Rows of blocks, format is then the internal format
+};
+
+struct UploadFence
+{
+	GLsync sync;
+	u64    end;		// The ring is free up to here once it signals
+};
+
+struct UploadManager
+{
+	GLuint ringHandle;
+	u8*    ringMemory;			// Persistent mapping, or ringShadow...
+	std::vector<u8> ringShadow;	// ...copied through unsynchronized maps without buffer storage
+	bool   persistent;
+
+	// Ring positions only grow, the byte is at position % STAGING_RING_SIZE
+	u64 head;		// Reserved up to here...
+	u64 tail;		// ...and maybe read by the GPU from here
+	u64 nextTicket;
+	std::atomic<u64> issuedTicket;	// Every command up to it has been issued, later GL commands see the data
+
+	std::deque<UploadCommand> commands;	// In ring order, issued from the front once ready
+	std::deque<UploadFence>   fences;
+	std::mutex              mutex;
+	std::condition_variable spaceFreed;
+};
+
+struct UploadWrite
+{
+	void* memory;	// size bytes to fill before EndUpload
+	u64   ticket;
+};
+
+/**
+ * Written by Render while it submits a snapshot and handed back to the main thread with it.
+ */
+struct FrameStats
+{
+	u64 trianglesDrawn;
+	u64 meshletsTested;
+	u64 meshletsVisible;
+	u32 programsCompiling;
+	u32 drawCalls;
+	u32 instancedDraws;			// Of the entities, those drawn through instance groups
+	f64 geometryMilliseconds;	// CPU time submitting the models
+	GeometryArenaStats geometryArena;
+
+	// Upload manager
+	u32 uploadCommands;			// Issued this frame...
+	u64 uploadBytes;
+	f64 uploadMilliseconds;		// ...and the CPU time it took
+	u32 uploadsPending;			// Left for the next frames
+	u64 uploadBytesPending;
+
+	// Texture streaming
+	u32 textureLevelsStreamed;	// Staged this frame...
+	u32 textureLevelsEvicted;	// ...and released
+	u32 texturesStreaming;		// With a level on its way
+	u64 textureResidentBytes;	// Of the streamed textures, against...
+	u64 textureFullBytes;		// ...what they take with every level resident
+	u32 textureBudgetEvictions;	// Levels evicted this frame to stay within the budget...
+	u32 textureLevelsOverBudget;	// ...and needed levels left out because nothing could go
+	u64 textureEvictionsTotal;	// Since startup, unneeded...
+	u64 textureBudgetEvictionsTotal;	// ...and for the budget
+
+	// GPU occlusion culling, read back one frame late
+	u32 occlusionObjectsTested;
+	u32 occlusionObjectsVisible;
+	u32 occlusionSecondPassObjects;	// Of the visible ones, drawn after the pyramid of the frame was built
+	u64 occlusionTrianglesTested;
+	u64 occlusionTrianglesVisible;
+
+	f64 renderMilliseconds;		// Render, the GUI and the swap
+	f64 latencyMilliseconds;	// From the input poll of the frame to its swap
+};
+
+struct FrameSnapshot
+{
+	u64 frameIndex;
+	f64 inputTime;		// When the input of the frame was polled, in glfwGetTime seconds
+
+	ivec2 displaySize;
+	vec3  cameraPosition;
+	mat4  view;
+	mat4  projection;
+
+	// Settings read by Render
+	RenderMode        renderMode;
+	RenderTargetsMode renderTargetMode;
+	bool              showSkybox;
+	bool              PBR;
+	bool              useMeshletCulling;
+	bool              useMeshletConeCulling;
+	bool              useOcclusionCulling;
+	bool              useTextureStreaming;
+	u64               textureBudgetBytes;
+	u32               textureSkippedLevels;	// Of the quality tier, for the reloads without the loader thread
+	TextureCompression textureCompression;
+	u32               uploadBudgetBytes;	// Per frame, for the queued uploads
+	f32               uploadBudgetMilliseconds;
+	u32               lightTypes;	// LIGHT_TYPES_* bits of the lights in globalParams
+	u32               lightCount;
+
+	std::vector<u8> globalParams;
+
+	// LocalParams blocks to upload to app->entityParams, which must hold entityParamsCapacity blocks
+	u32 entityParamsCapacity;
+	u32 entityParamsStride;
+	std::vector<SnapshotParamsRun> entityParamsRuns;
+	std::vector<u8>                entityParamsData;
+
+	std::vector<SnapshotDraw> draws;
+	std::vector<u32>          submeshMasks;	// A bit per submesh of the draws that skip some
+
+	// Draws taken out of draws to be instanced
+	std::vector<SnapshotInstanceGroup> instanceGroups;
+	std::vector<InstanceParams>        instances;
+
+	// Static batches, set on the frame they were rebuilt so Render uploads them first
+	std::shared_ptr<StaticBatchSet> staticBatchUpload;
+	std::vector<GeometryAllocation> geometryFrees;		// Of unloaded models, Render frees them first
+	std::vector<u32>                textureReloads;		// Loaded again by Render, when the loader thread is off
+	std::vector<f32>                textureScreenSizes;	// Per texture, the largest size in pixels of the draws sampling it
+	u32                             staticBatchGeneration;
+	std::vector<u32>                staticBatchDraws;			// Visible batches...
+	u32                             staticBatchFirstInstance;	// ...whose InstanceParams follow each other from here
+
+	FrameStats stats;
+};
+
+// GPU occlusion culling: every submesh of the frame's draws is tested against a
+// hierarchical Z pyramid, a mip chain of the depth buffer where each texel holds the
+// farthest depth under it. The first pass tests against the pyramid of the previous
+// frame and draws what passes, the pyramid is then rebuilt from that depth and a
+// second pass draws the objects the first one rejected but are actually visible.
+#define HIZ_BUILD_GROUP_SIZE      8
+#define OCCLUSION_CULL_GROUP_SIZE 64
+
+// Layout of the buffers shared with occlusion_cull.glsl (std430)
+struct DrawElementsIndirectCommand
+{
+	u32 count;
+	u32 instanceCount;	// Written by the culling, 0 or 1
+	u32 firstIndex;
+	i32 baseVertex;
+	u32 baseInstance;
+};
+
+struct OcclusionObject
+{
+	vec4 boundsMin;		// World space, w unused
+	vec4 boundsMax;
+	u32  firstCommand;
+	u32  commandCount;	// One per range of visible meshlets
+	u32  triangleCount;
+	u32  padding;
+};
+
+struct OcclusionStats
+{
+	u32 objectsTested;
+	u32 objectsVisible[2];		// By pass
+	u32 trianglesVisible[2];
+};
+
+// A/B benchmark of a render setting: frames rendered with it off, then on
+#define RENDER_TOGGLE_BENCHMARK_FRAMES 120
+
+// Entities "Benchmark instancing" fills the scene with
+#define INSTANCING_BENCHMARK_ENTITIES 10000
+
+struct RenderToggleBenchmark
+{
+	const char* name;
+	bool enabled;
+	u32  entityCount;
+	u32  frameCount;
+	f64  drawCalls;				// Per frame
+	f64  trianglesDrawn;
+	f64  frameMilliseconds;
+	f64  geometryMilliseconds;
+	f64  renderMilliseconds;
+};
+
+/**
+ * Runs across frames, since the GL calls happen on the render thread.
+ */
+struct RenderToggleBenchmarkState
+{
+	bool  running;
+	bool* setting;
+	bool  previousValue;
+	u32   framesLeft;
+	u32   warmupFrames;		// Skipped after each switch, the snapshots in flight use the old value
+	RenderToggleBenchmark current;
+};
+
+// Texture loader: images are decoded and uploaded by a thread of its own, with an
+// OpenGL context shared with the main one, into immutable textures filled through a
+// pixel buffer. Render swaps a texture in once the fence behind its upload signals,
+// until then its slot shows a 1x1 placeholder.
+#define LOAD_HITCH_MILLISECONDS             16.0
+#define TEXTURE_LOAD_BENCHMARK_SETTLE_FRAMES 30	// At least, after the last load
+
+struct TextureLoadRequest
+{
+	u32         textureIdx;
+	std::string filepath;
+	u32         skippedLevels;	// Finest levels dropped by the quality tier
+	TextureUsage       usage;
+	TextureCompression compression;
+};
+
+struct TextureLoadResult
+{
+	u32    textureIdx;
+	GLuint handle;			// 0 when the image could not be loaded
+	GLsync fence;
+	std::shared_ptr<TextureMipChain> mips;
+	f64    milliseconds;	// Decoding and uploading on the loader thread
+};
+
+struct TextureLoader
+{
+	void*       context;		// NULL when it could not be created, textures then load synchronously
+	std::thread thread;
+	GLuint      pixelBuffer;	// Loader context only
+	GLuint      placeholderHandle;
+
+	std::mutex                     mutex;
+	std::condition_variable        requestQueued;
+	std::deque<TextureLoadRequest> requests;
+	std::vector<TextureLoadResult> results;		// Done by the loader...
+	std::vector<TextureLoadResult> fenced;		// ...and waiting for their fence, render thread only
+	bool                           stopping;
+
+	std::atomic<u32> pending;	// Loads requested and not swapped in, either way
+	f64              lastLoadMilliseconds;
+};
+
+struct TextureCompressionBenchmark
+{
+	std::string filepath;
+	BlockFormat format;
+	ivec2       size;
+	f64         megapixelsPerSecond;	// Level 0, encoded on every job thread
+	f64         psnr;					// Of level 0, in dB
+	u64         uncompressedBytes;		// Every level, RGB8 or RGBA8...
+	u64         compressedBytes;		// ...against the blocks
+};
+
+struct TextureLoadBenchmark
+{
+	bool loaderThread;
+	u32  textureCount;
+	u32  frameCount;
+	u32  hitchCount;		// Frames over LOAD_HITCH_MILLISECONDS
+	f64  worstFrameMilliseconds;
+	f64  totalMilliseconds;	// Until the last texture was swapped in and the frames settled
+};
+
+struct TextureLoadBenchmarkState
+{
+	bool running;
+	u32  frame;
+	TextureLoadBenchmark current;
+};
+
 struct App
 {
 	// Loop
@@ -327,9 +1058,13 @@ struct App
 	// Input
 	Input input;
 
-	// Graphics
+	// Graphics, queried at Init so the GUI does not need the GL context
 	char gpuName[64];
+	char gpuVendor[64];
 	char openGlVersion[64];
+	char glslVersion[64];
+	std::vector<std::string> glExtensions;
+	bool parallelShaderCompile;
 
 	Camera camera;
 
@@ -352,6 +1087,9 @@ struct App
 	u32 prefilterMapProgramIdx;
 	u32 brdfProgramIdx;
 
+	u32 hiZBuildProgramIdx;
+	u32 occlusionCullProgramIdx;
+
 	// texture indices
 	u32 diceTexIdx;
 	u32 whiteTexIdx;
@@ -366,6 +1104,27 @@ struct App
 	u32 globalParamsOffset;
 	u32 globalParamsSize;
 
+	// Textures load on a thread with a shared context unless turned off
+	TextureLoader textureLoader;
+	bool useTextureLoader = true;
+	std::vector<u32> pendingTextureReloads;	// Main thread, handed to the next snapshot
+	u32 loadFrames;							// Frames while textures were loading...
+	u32 loadHitches;						// ...and those over LOAD_HITCH_MILLISECONDS
+	TextureLoadBenchmarkState         textureLoadBenchmark;
+	std::vector<TextureLoadBenchmark> textureLoadBenchmarks;
+	bool useTextureStreaming = true;		// Off, every level is streamed in
+	u64  textureBudgetBytes = TEXTURE_DEFAULT_BUDGET_BYTES;
+	u32  textureQualityTier;				// Levels skipped at load
+	u64  textureEvictions;					// Render thread, since startup
+	u64  textureBudgetEvictions;
+	TextureCompression textureCompression = TextureCompression_BC7;
+	std::vector<TextureCompressionBenchmark> textureCompressionBenchmarks;
+
+	// Everything uploaded goes through its staging ring
+	UploadManager uploads;
+	u32 uploadBudgetBytes = UPLOAD_DEFAULT_BUDGET_BYTES;
+	f32 uploadBudgetMilliseconds = UPLOAD_DEFAULT_BUDGET_MILLISECONDS;
+
 	// Embedded geometry (in-editor simple meshes such as
 	// a screen filling quad, a cube, a sphere...)
 	//GLuint embeddedVertices;
@@ -406,6 +1165,30 @@ struct App
 	GLuint prefilterMapAttachmentHandle;
 	GLuint brdfAttachmentHandle;
 
+	// Occlusion culling, render thread
+	GLuint hiZTextureHandle;		// R32F, full resolution with every mip
+	u32    hiZLevelCount;
+	bool   hiZValid;				// The pyramid holds the depth of the last frame
+	mat4   hiZViewProjection;		// That frame's
+	GLuint occlusionObjectBuffer;
+	GLuint occlusionCommandBuffer;
+	GLuint occlusionVisibilityBuffer;
+	GLuint occlusionStatsBuffers[2];	// Written and read back on alternate frames
+	u32    occlusionStatsIndex;
+	u32    occlusionObjectCapacity;	// Bytes
+	u32    occlusionCommandCapacity;
+	u32    occlusionVisibilityCapacity;
+	u64    occlusionTrianglesSubmitted;
+	std::vector<OcclusionObject>             occlusionObjects;
+	std::vector<DrawElementsIndirectCommand> occlusionCommands;
+
+	// Instancing, render thread
+	GLuint instanceBuffer;
+	u32    instanceBufferCapacity;	// Bytes
+
+	// Static batches uploaded by the render thread
+	std::shared_ptr<StaticBatchSet> renderStaticBatches;
+
 	Buffer cbuffer;
 
 	Quad quad;
@@ -416,33 +1199,293 @@ struct App
 	std::vector<Mesh>	  meshes;
 	std::vector<Model>	  models;
 	std::vector<Program>  programs;
-	std::vector<Light>    lights;
-
-	std::vector<Entity> entities;
+	// Light records live in a pool so their addresses stay stable
+	Pool lightPool;
+	std::vector<Light*>   lights;
+
+	EntityStore entityStore;
+
+	// LocalParams of every entity at a fixed slot, only rewritten when they change
+	Buffer entityParams;			// Render thread
+	u32    entityParamsStride;
+	u32    entityParamsCapacity;	// Blocks, decided by the main thread
+	u32    uploadedEntityParams;	// This frame
+	std::vector<EntityTransformBenchmark> entityBenchmarks;
+	std::vector<EntityScalingBenchmark> entityScalingBenchmarks;
+
+	// World bounds of the entities, kept in sync with their transforms in Update
+	Bvh entityBvh;
+	bool useBvhCulling = true;
+	std::vector<u32> visibleEntities;	// In the frustum this frame, by entity index
+	u32 pickedEntity = BVH_NULL;		// Last entity clicked in the viewport
+	std::vector<BvhBenchmark> bvhBenchmarks;
+
+	// Entities in the frustum hidden behind the occluders of the visible entities are
+	// dropped before LOD selection, see CullOccludedEntities
+	bool useSoftwareOcclusion = true;
+	MaskedOcclusionBuffer softwareOcclusionBuffer;
+	std::vector<OccluderInstance> occluderInstances;
+	u32 softwareOcclusionTested;		// This frame
+	u32 softwareOcclusionCulled;
+	f64 softwareOcclusionMilliseconds;
+	std::vector<SoftwareOcclusionBenchmark> softwareOcclusionBenchmarks;
+
+	bool usePvs = true;
+	u32 pvsTestedSubmeshes;		// This frame, submeshes of draws whose model has a PVS...
+	u32 pvsCulledSubmeshes;		// ...and those it hid
+
+	// Draws sharing a model and LOD are grouped into instanced draws (not with GPU
+	// occlusion culling, which has its own path)
+	bool useInstancing = true;
+
+	// Static entities are drawn through merged batches (not with GPU occlusion culling)
+	bool useStaticBatching = true;
+	std::shared_ptr<StaticBatchSet> staticBatches;
+	Bvh              staticBatchBvh;	// Of the batches, in world space
+	std::vector<u8>  staticBatched;		// Per entity, whether the batches draw it
+	u32              staticBatchGeneration;
+	bool             staticBatchesOutdated;
+	u32              staticBatchesVisible;
+
+	// Render thread once the frame pipeline runs, the GUI reads renderStats.geometryArena
+	GeometryArena geometryArena;
+	std::vector<GeometryAllocation> pendingGeometryFrees;	// Main thread, handed to the next snapshot
+	std::vector<RangeAllocatorBenchmark> rangeAllocatorBenchmarks;
+
+	RenderToggleBenchmarkState         toggleBenchmark;
+	std::vector<RenderToggleBenchmark> toggleBenchmarks;
 	std::vector<Program> changeableShaders;
 	Cubemap cubemap;
 
 	bool showSkybox = true;
 	bool PBR = true;
+	bool useLods = true;
+	bool useMeshletCulling = true;
+	bool useMeshletConeCulling = true;	// Also enables backface culling for models
+	bool useOcclusionCulling = false;
+
+	// Triangles it would take to draw every entity at full detail this frame, to compare
+	// with renderStats.trianglesDrawn
+	u64 trianglesFullDetail;
+
+	// Frame pipeline, both settings are read once at startup from the command line
+	// ("-renderthread" and "-queuedepth N", see ParseCommandLine in platform.cpp)
+	bool useRenderThread = false;
+	u32  frameQueueDepth = 1;		// Snapshots the render thread may be behind, 1 to MAX_FRAME_QUEUE_DEPTH
+	u64  frameIndex;
+	FrameStats renderStats;			// Of the last snapshot handed back by Render
+	f64  simulationMilliseconds;	// Main thread: input, GUI and Update
+	f64  averageLatencyMilliseconds;
 };
 
 
 void Init(App* app);
 
-void Gui(App* app);
+/**
+ * Stops the threads Init started, with the GL context current on the main thread again.
+ */
+void Shutdown(App* app);
 
-void Update(App* app);
+void Gui(App* app);
 
-void Render(App* app);
+/**
+ * Simulates a frame and fills the snapshot Render will draw it from. Main thread only,
+ * does not touch the GL context.
+ */
+void Update(App* app, FrameSnapshot* snapshot);
+
+/**
+ * Submits a snapshot. Only needs the GL context, the assets loaded at Init and the
+ * GPU state owned by the render side (programs, cbuffer, entityParams); fills
+ * snapshot->stats.
+ */
+void Render(App* app, FrameSnapshot* snapshot);
 void ForwardRender(App* app);
 void DeferredRender(App* app);
 
-void RenderModel(App* app, Entity entity, Program program);
+void RenderModel(App* app, FrameSnapshot* snapshot, const SnapshotDraw& draw, Program program);
+
+/**
+ * Draws the snapshot with GPU occlusion culling (see OcclusionObject): the meshlet
+ * culling still runs on the CPU, each submesh becomes an object whose index ranges are
+ * indirect draws the culling passes switch on or off.
+ */
+void RenderModelsOcclusionCulled(App* app, FrameSnapshot* snapshot, Program program);
+
+/**
+ * Copies snapshot->instances to app->instanceBuffer and binds it at INSTANCE_BUFFER_BINDING.
+ */
+void UploadInstances(App* app, const FrameSnapshot* snapshot);
+
+/**
+ * Draws each instance group with glDrawElementsInstanced, program being an INSTANCED
+ * variant and snapshot->instances already in the instance buffer.
+ */
+void RenderInstanceGroups(App* app, FrameSnapshot* snapshot, Program program);
+
+/**
+ * Draws snapshot->staticBatchDraws, program being an INSTANCED variant and the instance
+ * buffer already uploaded.
+ */
+void RenderStaticBatches(App* app, FrameSnapshot* snapshot, Program program);
+
+/**
+ * Rebuilds every level of app->hiZTextureHandle from the depth attachment.
+ */
+void BuildHiZ(App* app);
+
+/**
+ * Copies the LocalParams block of the entities whose matrices changed in the last
+ * transform update into the snapshot (all of them when the view projection changed
+ * or the buffer has to grow).
+ */
+void WriteEntityParamsSnapshot(App* app, FrameSnapshot* snapshot);
+
+/**
+ * Uploads the blocks of the snapshot into app->entityParams, recreating it first when
+ * the snapshot asks for another capacity.
+ */
+void UploadEntityParams(App* app, const FrameSnapshot* snapshot);
+
+/**
+ * Checks the shader files for changes and finishes the reloads in flight. Needs the
+ * GL context, so it runs on the render side.
+ */
+u32 ReloadChangedPrograms(App* app);
 void RenderLight(App* app, Light light, Program program);
 
+/**
+ * Picks the LOD of an entity from the projected size of its bounding sphere and
+ * decides if it is too small to be drawn (see LOD_ERROR_PIXELS).
+ */
+void SelectEntityLod(App* app, Entity& entity, const mat4& world);
+
+/**
+ * Inserts the entities whose transform changed in the last UpdateEntityTransforms into
+ * app->entityBvh, or moves their leaves.
+ */
+void UpdateEntityBvh(App* app);
+
+/**
+ * Rasterizes the occluders of the entities in app->visibleEntities and removes from it
+ * the other entities whose bounds are completely behind them.
+ */
+void CullOccludedEntities(App* app, const mat4& viewProjection);
+
+/**
+ * Moves the draws sharing a model and LOD, at least INSTANCING_MIN_GROUP_SIZE of them,
+ * from snapshot->draws to instance groups. Draws masked by a PVS are left alone.
+ */
+void BuildInstanceGroups(FrameSnapshot* snapshot);
+
+/**
+ * Rebuilds app->staticBatches when a static entity was added, edited or moved, and hands
+ * the new set to the render thread through the snapshot.
+ */
+void UpdateStaticBatches(App* app, FrameSnapshot* snapshot);
+
+/**
+ * Merges the static entities of models with CPU geometry (MeshLoad_StaticBatch or
+ * MeshLoad_KeepCpuData). Does not touch the GPU.
+ */
+std::shared_ptr<StaticBatchSet> BuildStaticBatches(App* app);
+
+/**
+ * Adds the batches in the frustum (and in the PVS of their entities) to the snapshot,
+ * with their instance parameters.
+ */
+void CullStaticBatches(App* app, FrameSnapshot* snapshot, const mat4& viewProjection);
+
+/**
+ * Render thread: replaces the arena ranges of the previous set with those of batches and
+ * releases its CPU geometry.
+ */
+void UploadStaticBatches(App* app, const std::shared_ptr<StaticBatchSet>& batches);
+
+/**
+ * Creates the placeholder texture and starts the loader thread with its shared context.
+ */
+void InitTextureLoader(App* app);
+void ShutdownTextureLoader(App* app);
+
+/**
+ * Loads the image of the texture again, on the loader thread when there is one and
+ * useLoaderThread is set, by the next Render otherwise. Main thread.
+ */
+void ReloadTexture(App* app, u32 textureIdx, bool useLoaderThread);
+
+/**
+ * Render thread: swaps in the textures whose upload finished.
+ */
+void CompleteTextureLoads(App* app);
+
+/**
+ * Main thread: fills snapshot->textureScreenSizes from the visible entities, each
+ * texture of their materials gets the projected size of their bounding sphere.
+ */
+void RequestTextureLevels(App* app, FrameSnapshot* snapshot);
+
+/**
+ * Render thread: brings the resident levels of the streamed textures towards those the
+ * screen sizes of the snapshot need, within TEXTURE_STREAMING_BUDGET_BYTES.
+ */
+void StreamTextures(App* app, FrameSnapshot* snapshot);
+
+/**
+ * Reloads every texture with the loader thread off then on, counting the frames over
+ * LOAD_HITCH_MILLISECONDS until all are back. Results go to app->textureLoadBenchmarks.
+ */
+void StartTextureLoadBenchmark(App* app);
+void UpdateTextureLoadBenchmark(App* app);
+
+/**
+ * Starts timing RENDER_TOGGLE_BENCHMARK_FRAMES frames with the setting off, then as many
+ * with it on, after which it gets its value back. Results go to app->toggleBenchmarks.
+ */
+void StartRenderToggleBenchmark(App* app, const char* name, bool* setting);
+
+/**
+ * Steps the running toggle benchmark, once per frame from the main thread with the stats
+ * of the last rendered frame.
+ */
+void UpdateRenderToggleBenchmark(App* app);
+
+/**
+ * Entity under the window position (in pixels, origin at the top left), BVH_NULL for
+ * none. Tests the triangles of models loaded with MeshLoad_KeepCpuData and the bounds
+ * of the others.
+ */
+u32 PickEntity(App* app, vec2 windowPosition, const mat4& view, const mat4& projection);
+
+/**
+ * Distance past which a point light of this color is under LIGHT_INFLUENCE_THRESHOLD.
+ */
+f32 GetLightInfluenceRadius(const Light& light);
+
 void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+bool IsExtensionSupported(const char* extensionName);
+
+ProgramCompile BeginProgramCompile(String programSource, const char* shaderName, const char* permutationDefines, bool compute);
+bool IsProgramCompileComplete(App* app, const ProgramCompile& compile);
+GLuint EndProgramCompile(ProgramCompile& compile, const char* shaderName);
+void CancelProgramCompile(ProgramCompile& compile);
+void BeginProgramReload(Program& program);
+bool FinishProgramReload(App* app, Program& program, bool wait);
+void DeleteProgramVAOs(App* app, GLuint programHandle);
+
+/**
+ * instanced selects the INSTANCED variant of the geometry programs.
+ */
+u32 GetPermutationDefineValue(const FrameSnapshot* snapshot, const std::string& define, bool instanced = false);
+u32 GetProgramPermutation(App* app, const FrameSnapshot* snapshot, u32 programIdx, bool instanced = false);
+
+/**
+ * The programs of the engine indexed by EngineProgram, with their permutation axes.
+ */
+const std::vector<ProgramDesc>& GetEngineProgramDescs();
+
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program);
 
 void OnScreenResize(App* app);
 
@@ -450,9 +1493,151 @@ void HandleInput(App* app);
 
 //Assimp
 void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
-void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
+void ProcessAssimpMaterial(aiMaterial* material, CookedMaterial& myMaterial, String directory);
 void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
-u32 LoadModel(App* app, const char* filename);
+
+/**
+ * Imports and optimizes a model with the load flags already set on the mesh. Touches
+ * neither the App nor GL, so the asset cooker runs it on any thread. submeshMaterials
+ * indexes materials, one per submesh.
+ */
+bool ImportModel(const char* filename, Mesh& mesh, std::vector<CookedMaterial>& materials, std::vector<u32>& submeshMaterials);
+u32 LoadModel(App* app, const char* filename, u32 loadFlags = MESH_LOAD_DEFAULT_FLAGS);
+
+/**
+ * Adds the submesh to mesh.occluders when it is big enough (OCCLUDER_MIN_RELATIVE_SIZE).
+ * Needs the CPU geometry and no GL, LoadModel calls it for MeshLoad_Occluders.
+ */
+void BuildSubmeshOccluder(Mesh& mesh, const Submesh& submesh);
+
+/**
+ * Builds the PVS of the mesh with one object per submesh, from the LOD 0 triangles of
+ * its CPU geometry. No GL, LoadModel calls it for MeshLoad_Pvs.
+ */
+void BuildMeshPvs(const Mesh& mesh, Pvs* pvs);
+
+/**
+ * The models of the engine indexed by EngineModel, with the flags they are loaded with.
+ */
+const std::vector<ModelDesc>& GetEngineModelDescs();
+
+/**
+ * Creates the staging ring, persistently mapped when the driver has buffer storage.
+ */
+void InitUploadManager(App* app);
+
+/**
+ * Any thread: reserves size bytes (at most STAGING_MAX_CHUNK_SIZE) of the ring for an
+ * upload to a buffer or to rows [y, y + extent.y) of a texture level, waiting for the
+ * render thread to free space if needed. The data must be written to the returned
+ * memory before EndUpload, and commands are issued in the order they were begun.
+ */
+UploadWrite BeginBufferUpload(App* app, GLuint bufferHandle, u32 offset, u32 size);
+UploadWrite BeginTextureUpload(App* app, GLuint textureHandle, u32 level, u32 y, ivec2 extent, GLenum format, GLenum type, u32 size, bool generateMipmaps);
+void EndUpload(App* app, const UploadWrite& write);
+
+/**
+ * Render thread: frees the ring space of the copies the GPU is done with and issues
+ * the ready ones, stopping once budgetBytes or budgetMilliseconds are spent (the first
+ * always goes). Fills the upload counters of stats when given.
+ */
+void ProcessUploads(App* app, u32 budgetBytes, f32 budgetMilliseconds, FrameStats* stats = NULL);
+
+/**
+ * Render thread: issues every queued upload, for data the next GL commands need.
+ */
+void FlushUploads(App* app);
+
+/**
+ * Whether the upload of the ticket has been issued, so draws after it see the data.
+ */
+bool IsUploadIssued(App* app, u64 ticket);
+
+/**
+ * Render thread: queues the upload in chunks of at most STAGING_MAX_CHUNK_SIZE, flushing
+ * the queue itself when the ring is full. Returns the ticket of the last chunk.
+ */
+u64 StageBufferData(App* app, GLuint bufferHandle, u32 offset, const void* data, u32 size);
+
+/**
+ * Render thread: the same for a level of a texture, split in bands of rows. The mip
+ * chain is generated after the last band when asked to.
+ */
+u64 StageTextureData(App* app, GLuint textureHandle, u32 level, ivec2 size, GLenum format, GLenum type, u32 bytesPerPixel, const void* pixels, bool generateMipmaps);
+
+/**
+ * Render thread: the same for a level of a block compressed texture, in bands of rows of
+ * blocks.
+ */
+u64 StageCompressedTextureData(App* app, GLuint textureHandle, u32 level, ivec2 size, GLenum internalFormat, BlockFormat blockFormat, const void* blocks);
+
+/**
+ * Creates the arena buffers, GEOMETRY_ARENA_INITIAL_INDEX_BYTES of indices, vertex
+ * pools are created as formats show up.
+ */
+void InitGeometryArena(App* app);
+
+/**
+ * Allocates the ranges of every submesh from the geometry arena, growing its buffers
+ * when full, and uploads their CPU geometry.
+ */
+void UploadMeshGeometry(App* app, Mesh& mesh);
+
+void FreeGeometryAllocation(App* app, const GeometryAllocation& allocation);
+
+/**
+ * Gives the arena ranges of the mesh back, the render thread's job while it runs.
+ */
+void FreeMeshGeometry(App* app, Mesh& mesh);
+
+/**
+ * Main thread: frees the geometry of a model no entity or light uses (false otherwise).
+ * The CPU side goes at once, the arena ranges with the next snapshot.
+ */
+bool UnloadModel(App* app, u32 modelIndex);
+
+GeometryArenaStats GetGeometryArenaStats(App* app);
+
+u64 GetResidentMeshBytes(App* app);
+
+bool WriteCookedModel(const char* cookedPath, u64 sourceTimestamp, const Mesh& mesh, const std::vector<CookedMaterial>& materials, const std::vector<u32>& submeshMaterials);
+bool ReadCookedModel(const char* cookedPath, u64 sourceTimestamp, Mesh& mesh, std::vector<CookedMaterial>& materials, std::vector<u32>& submeshMaterials);
+bool WriteCookedPvs(const char* pvsPath, u64 sourceTimestamp, const Pvs& pvs);
+bool ReadCookedPvs(const char* pvsPath, u64 sourceTimestamp, Pvs& pvs);
+bool WriteCookedTexture(const char* cookedPath, u64 sourceTimestamp, bool hasAlpha, const TextureMipChain& mips);
+
+/**
+ * Fails when the cooked texture is out of date, or in another format than the one its
+ * usage, its alpha and the compression setting pick.
+ */
+bool ReadCookedTexture(const char* cookedPath, u64 sourceTimestamp, TextureUsage usage, TextureCompression compression, TextureMipChain& mips);
+
+/**
+ * Decodes, mips and compresses the texture into its cooked file whether or not it is
+ * up to date. Any thread.
+ */
+bool CookTexture(const char* filepath, TextureUsage usage, TextureCompression compression);
+
+std::string GetCubemapFacePath(const char* directory, u32 face);
+std::string GetCookedCubemapPath(const char* directory);
+
+/**
+ * Newest of the face timestamps, 0 when a face is missing.
+ */
+u64 GetCubemapSourceTimestamp(const char* directory);
+
+/**
+ * Decodes the faces of the cubemap in the directory into its cooked file. Fails when
+ * a face is missing or they differ in size or channels. Any thread.
+ */
+bool CookCubemap(const char* directory);
+bool ReadCookedCubemap(const char* cookedPath, u64 sourceTimestamp, CubemapFaces& cubemap);
+
+/**
+ * Encodes level 0 of every loaded texture in the format it is given with the current
+ * compression setting (BC7 when off), decodes it back and logs the results.
+ */
+void BenchmarkTextureCompression(App* app);
 
 u32 Align(u32 value, u32 alignment);
 Buffer CreateBuffer(u32 size, GLenum type, GLenum usage);
@@ -464,7 +1649,7 @@ void PushAlignedData(Buffer& buffer, const void* data, u32 size, u32 alignment);
 void GenerateColorTexture(GLuint& colorAttachmentHandle, vec2 displaySize, GLint internalFormat);
 
 void GenerateQuad(App* app);
-void DrawFinalQuad(App* app);
+void DrawFinalQuad(App* app, const FrameSnapshot* snapshot);
 void DrawQuad(App* app, u32 programIdx, u32 programHandle);
 
 void CreateCubemap(App* app);
@@ -474,4 +1659,9 @@ void CreateIrradianceMap(App* app);
 void CreatePrefilterMap(App* app);
 void CreateBRDF(App* app);
 
-Light CreateLight(App* app, LightType lightType, vec3 position, vec3 direction, vec3 color = vec3(1.0f, 1.0f, 1.0f));
\ No newline at end of file
+// Entities are drawn at this scale unless told otherwise
+#define DEFAULT_ENTITY_SCALE 0.45f
+
+u32 CreateEntity(App* app, u32 modelIndex, vec3 position);
+
+Light* CreateLight(App* app, LightType lightType, vec3 position, vec3 direction, vec3 color = vec3(1.0f, 1.0f, 1.0f));
\ No newline at end of file
@@ -0,0 +1,438 @@
+//
+// entity_store.cpp : Structure of arrays entity storage, see entity_store.h.
+//
+
+#include "entity_store.h"
+#include "job_system.h"
+
+#include <xmmintrin.h>
+#include <chrono>
+#include <algorithm>
+#include <string.h>
+
+void InitEntityStore(EntityStore* store, u32 capacity)
+{
+	*store = EntityStore{};
+	std::vector<f32>* columns[] = { &store->positionX, &store->positionY, &store->positionZ,
+		&store->rotationX, &store->rotationY, &store->rotationZ, &store->rotationW, &store->scale };
+	for (std::vector<f32>* column : columns)
+		column->reserve(capacity);
+	store->parents.reserve(capacity);
+	store->dirty.reserve(capacity);
+	store->worldMatrices.reserve(capacity);
+	store->worldViewProjections.reserve(capacity);
+	store->worldChanged.reserve(capacity);
+	store->entities.reserve(capacity);
+}
+
+u32 AddEntity(EntityStore* store, vec3 position, quat rotation, f32 scale, const Entity& entity, u32 parent)
+{
+	ASSERT(parent == ENTITY_NO_PARENT || parent < store->count, "The parent must be added before its children");
+
+	store->positionX.push_back(position.x);
+	store->positionY.push_back(position.y);
+	store->positionZ.push_back(position.z);
+	store->rotationX.push_back(rotation.x);
+	store->rotationY.push_back(rotation.y);
+	store->rotationZ.push_back(rotation.z);
+	store->rotationW.push_back(rotation.w);
+	store->scale.push_back(scale);
+	store->parents.push_back(parent);
+	store->dirty.push_back(1);
+	store->worldMatrices.push_back(mat4(1.0f));
+	store->worldViewProjections.push_back(mat4(1.0f));
+	store->worldChanged.push_back(0);
+	store->entities.push_back(entity);
+	return store->count++;
+}
+
+vec3 GetEntityPosition(const EntityStore* store, u32 index)
+{
+	return vec3(store->positionX[index], store->positionY[index], store->positionZ[index]);
+}
+
+void SetEntityPosition(EntityStore* store, u32 index, vec3 position)
+{
+	store->positionX[index] = position.x;
+	store->positionY[index] = position.y;
+	store->positionZ[index] = position.z;
+	store->dirty[index] = 1;
+}
+
+void SetEntityRotation(EntityStore* store, u32 index, quat rotation)
+{
+	store->rotationX[index] = rotation.x;
+	store->rotationY[index] = rotation.y;
+	store->rotationZ[index] = rotation.z;
+	store->rotationW[index] = rotation.w;
+	store->dirty[index] = 1;
+}
+
+void SetEntityScale(EntityStore* store, u32 index, f32 scale)
+{
+	store->scale[index] = scale;
+	store->dirty[index] = 1;
+}
+
+void MarkAllEntitiesDirty(EntityStore* store)
+{
+	std::fill(store->dirty.begin(), store->dirty.end(), (u8)1);
+}
+
+// Lists the entities whose world matrix must be recomputed: the dirty ones and,
+// since parents come first, everything under an entity that changed
+static void CollectChangedEntities(EntityStore* store)
+{
+	store->changedEntities.clear();
+	for (u32 i = 0; i < store->count; ++i)
+	{
+		u32 parent = store->parents[i];
+		u8 changed = store->dirty[i] | (parent != ENTITY_NO_PARENT ? store->worldChanged[parent] : 0);
+		store->worldChanged[i] = changed;
+		store->dirty[i] = 0;
+		if (changed)
+			store->changedEntities.push_back(i);
+	}
+}
+
+static mat4 ComputeLocalMatrix(const EntityStore* store, u32 i)
+{
+	quat rotation = quat(store->rotationW[i], store->rotationX[i], store->rotationY[i], store->rotationZ[i]);
+	return glm::translate(GetEntityPosition(store, i)) * glm::mat4_cast(rotation) * glm::scale(vec3(store->scale[i]));
+}
+
+// Transposes the four rows of one matrix column (one register per row, one lane per
+// entity) and stores that column in each of the four entities' matrices
+static void StoreMatrixColumn(mat4* const matrices[4], u32 column, __m128 row0, __m128 row1, __m128 row2, __m128 row3)
+{
+	_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+	_mm_storeu_ps(&(*matrices[0])[column][0], row0);
+	_mm_storeu_ps(&(*matrices[1])[column][0], row1);
+	_mm_storeu_ps(&(*matrices[2])[column][0], row2);
+	_mm_storeu_ps(&(*matrices[3])[column][0], row3);
+}
+
+// One lane per entity; consecutive entities (the common case when everything moves)
+// are a plain load, anything else is gathered
+static __m128 LoadColumn(const std::vector<f32>& column, const u32* indices, bool consecutive)
+{
+	if (consecutive)
+		return _mm_loadu_ps(&column[indices[0]]);
+	return _mm_setr_ps(column[indices[0]], column[indices[1]], column[indices[2]], column[indices[3]]);
+}
+
+// Local matrices of the changed entities, written to their world matrices, and
+// viewProjection * local, which is the final result for the entities without parent
+// for the batches of four changed entities [batchBegin, batchEnd)
+static void ComputeLocalMatricesSimd(EntityStore* store, const mat4& viewProjection, u32 batchBegin, u32 batchEnd)
+{
+	const u32* changed = store->changedEntities.data();
+
+	// Every element of the view projection broadcast once, vp[column][row]
+	__m128 vp[4][4];
+	for (u32 c = 0; c < 4; ++c)
+		for (u32 r = 0; r < 4; ++r)
+			vp[c][r] = _mm_set1_ps(viewProjection[c][r]);
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (u32 batch = batchBegin; batch < batchEnd; ++batch)
+	{
+		const u32* indices = &changed[batch * 4];
+		const bool consecutive = indices[3] - indices[0] == 3;
+		__m128 qx = LoadColumn(store->rotationX, indices, consecutive);
+		__m128 qy = LoadColumn(store->rotationY, indices, consecutive);
+		__m128 qz = LoadColumn(store->rotationZ, indices, consecutive);
+		__m128 qw = LoadColumn(store->rotationW, indices, consecutive);
+		__m128 s = LoadColumn(store->scale, indices, consecutive);
+
+		// Rotation matrix of the quaternions (same terms as glm::mat3_cast), scaled
+		__m128 xx = _mm_mul_ps(qx, qx), yy = _mm_mul_ps(qy, qy), zz = _mm_mul_ps(qz, qz);
+		__m128 xy = _mm_mul_ps(qx, qy), xz = _mm_mul_ps(qx, qz), yz = _mm_mul_ps(qy, qz);
+		__m128 wx = _mm_mul_ps(qw, qx), wy = _mm_mul_ps(qw, qy), wz = _mm_mul_ps(qw, qz);
+		__m128 s2 = _mm_mul_ps(two, s);
+
+		// local[column][row], the last row is (0, 0, 0, 1)
+		__m128 local[4][3];
+		local[0][0] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))));
+		local[0][1] = _mm_mul_ps(s2, _mm_add_ps(xy, wz));
+		local[0][2] = _mm_mul_ps(s2, _mm_sub_ps(xz, wy));
+		local[1][0] = _mm_mul_ps(s2, _mm_sub_ps(xy, wz));
+		local[1][1] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))));
+		local[1][2] = _mm_mul_ps(s2, _mm_add_ps(yz, wx));
+		local[2][0] = _mm_mul_ps(s2, _mm_add_ps(xz, wy));
+		local[2][1] = _mm_mul_ps(s2, _mm_sub_ps(yz, wx));
+		local[2][2] = _mm_mul_ps(s, _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))));
+		local[3][0] = LoadColumn(store->positionX, indices, consecutive);
+		local[3][1] = LoadColumn(store->positionY, indices, consecutive);
+		local[3][2] = LoadColumn(store->positionZ, indices, consecutive);
+
+		mat4* const worldMatrices[4] = { &store->worldMatrices[indices[0]], &store->worldMatrices[indices[1]],
+			&store->worldMatrices[indices[2]], &store->worldMatrices[indices[3]] };
+		mat4* const worldViewProjections[4] = { &store->worldViewProjections[indices[0]], &store->worldViewProjections[indices[1]],
+			&store->worldViewProjections[indices[2]], &store->worldViewProjections[indices[3]] };
+		for (u32 c = 0; c < 4; ++c)
+		{
+			StoreMatrixColumn(worldMatrices, c, local[c][0], local[c][1], local[c][2], c == 3 ? one : zero);
+
+			// (viewProjection * local)[c][r] = sum over k of vp[k][r] * local[c][k]
+			__m128 rows[4];
+			for (u32 r = 0; r < 4; ++r)
+			{
+				__m128 sum = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(vp[0][r], local[c][0]), _mm_mul_ps(vp[1][r], local[c][1])),
+					_mm_mul_ps(vp[2][r], local[c][2]));
+				rows[r] = c == 3 ? _mm_add_ps(sum, vp[3][r]) : sum;
+			}
+			StoreMatrixColumn(worldViewProjections, c, rows[0], rows[1], rows[2], rows[3]);
+		}
+	}
+}
+
+static void ComputeLocalMatricesSimd(EntityStore* store, const mat4& viewProjection)
+{
+	const u32* changed = store->changedEntities.data();
+	const u32 changedCount = (u32)store->changedEntities.size();
+	const u32 batchCount = changedCount / 4;
+
+	// Batches write disjoint matrices, so they split freely across threads
+	ParallelFor(batchCount, ENTITY_TRANSFORM_GRAIN / 4, [store, &viewProjection](u32 begin, u32 end)
+	{
+		ComputeLocalMatricesSimd(store, viewProjection, begin, end);
+	});
+
+	for (u32 i = batchCount * 4; i < changedCount; ++i)
+	{
+		store->worldMatrices[changed[i]] = ComputeLocalMatrix(store, changed[i]);
+		store->worldViewProjections[changed[i]] = viewProjection * store->worldMatrices[changed[i]];
+	}
+}
+
+// result = a * b, a given as its four columns
+static void MultiplyMatrixSimd(const __m128 a[4], const mat4& b, mat4& result)
+{
+	for (u32 c = 0; c < 4; ++c)
+	{
+		__m128 column = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(a[0], _mm_set1_ps(b[c][0])), _mm_mul_ps(a[1], _mm_set1_ps(b[c][1]))),
+			_mm_add_ps(_mm_mul_ps(a[2], _mm_set1_ps(b[c][2])), _mm_mul_ps(a[3], _mm_set1_ps(b[c][3]))));
+		_mm_storeu_ps(&result[c][0], column);
+	}
+}
+
+// Expects the changed entities to hold their local matrix, and viewProjection * local
+// for those without parent. Parents are applied in index order, so a parent is final
+// before its children.
+static void FinishEntityTransforms(EntityStore* store, const mat4& viewProjection, bool simd)
+{
+	__m128 viewProjectionColumns[4];
+	for (u32 c = 0; c < 4; ++c)
+		viewProjectionColumns[c] = _mm_loadu_ps(&viewProjection[c][0]);
+
+	// Serial, a child can only start once its parent is done
+	for (u32 i : store->changedEntities)
+	{
+		u32 parent = store->parents[i];
+		if (parent == ENTITY_NO_PARENT)
+			continue;
+
+		store->worldMatrices[i] = store->worldMatrices[parent] * store->worldMatrices[i];
+		if (simd)
+			MultiplyMatrixSimd(viewProjectionColumns, store->worldMatrices[i], store->worldViewProjections[i]);
+		else
+			store->worldViewProjections[i] = viewProjection * store->worldMatrices[i];
+	}
+	const u32 changedCount = (u32)store->changedEntities.size();
+
+	// A new view projection invalidates the entities that did not change too
+	store->viewProjectionChanged = memcmp(&viewProjection, &store->viewProjection, sizeof(mat4)) != 0;
+	if (store->viewProjectionChanged)
+	{
+		ParallelFor(store->count, ENTITY_TRANSFORM_GRAIN, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+			{
+				if (store->worldChanged[i])
+					continue;
+
+				if (simd)
+					MultiplyMatrixSimd(viewProjectionColumns, store->worldMatrices[i], store->worldViewProjections[i]);
+				else
+					store->worldViewProjections[i] = viewProjection * store->worldMatrices[i];
+			}
+		});
+	}
+	store->viewProjection = viewProjection;
+
+	store->recomputedWorldCount = changedCount;
+	store->recomputedWorldViewProjectionCount = store->viewProjectionChanged ? store->count : changedCount;
+}
+
+void UpdateEntityTransforms(EntityStore* store, const mat4& viewProjection)
+{
+	CollectChangedEntities(store);
+	ComputeLocalMatricesSimd(store, viewProjection);
+	FinishEntityTransforms(store, viewProjection, true);
+}
+
+void WriteEntityParams(const EntityStore* store, u32 first, u32 count, u32 stride, u8* dst)
+{
+	ParallelFor(count, ENTITY_TRANSFORM_GRAIN, [store, first, stride, dst](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			u8* block = dst + (u64)i * stride;
+			memcpy(block, &store->worldMatrices[first + i], sizeof(mat4));
+			memcpy(block + sizeof(mat4), &store->worldViewProjections[first + i], sizeof(mat4));
+		}
+	});
+}
+
+void UpdateEntityTransformsScalar(EntityStore* store, const mat4& viewProjection)
+{
+	CollectChangedEntities(store);
+	for (u32 i : store->changedEntities)
+	{
+		store->worldMatrices[i] = ComputeLocalMatrix(store, i);
+		store->worldViewProjections[i] = viewProjection * store->worldMatrices[i];
+	}
+	FinishEntityTransforms(store, viewProjection, false);
+}
+
+// Layout of the entity records before the store, kept to measure against
+struct AosEntity
+{
+	mat4 worldMatrix;
+	mat4 worldViewProjection;
+	vec3 position;
+	float metallic;
+	float roughness;
+	u32 modelIndex;
+	u32 localParamsOffset;
+	u32 localParamsSize;
+	u32 lodIndex;
+	bool culled;
+};
+
+template <typename Function>
+static f64 MeasureBestMilliseconds(u32 runs, Function function)
+{
+	f64 best = 1e30;
+	for (u32 run = 0; run < runs; ++run)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		function();
+		auto end = std::chrono::high_resolution_clock::now();
+		best = glm::min(best, std::chrono::duration<f64, std::milli>(end - start).count());
+	}
+	return best;
+}
+
+EntityTransformBenchmark BenchmarkEntityTransforms(u32 entityCount)
+{
+	EntityTransformBenchmark result = {};
+	result.entityCount = entityCount;
+
+	const mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+	const mat4 view = glm::lookAt(vec3(0.0f, 5.0f, 20.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+	const u32 runs = glm::max(3u, 2000000u / entityCount);
+
+	std::vector<AosEntity> aosEntities(entityCount);
+	EntityStore store;
+	InitEntityStore(&store, entityCount);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 position = vec3((f32)(i % 100), (f32)((i / 100) % 100), (f32)(i / 10000));
+		aosEntities[i].position = position;
+		quat rotation = glm::angleAxis((f32)i * 0.01f, glm::normalize(vec3(1.0f, 2.0f, 3.0f)));
+		AddEntity(&store, position, rotation, 0.45f, Entity{});
+	}
+
+	result.aosMilliseconds = MeasureBestMilliseconds(runs, [&]()
+	{
+		for (u64 i = 0; i < aosEntities.size(); ++i)
+		{
+			AosEntity& entity = aosEntities[i];
+			mat4 world = entity.worldMatrix;
+			world = glm::scale(glm::translate(entity.position), vec3(0.45f));
+			entity.worldViewProjection = projection * view * world;
+			entity.worldMatrix = world;
+		}
+	});
+
+	const mat4 viewProjection = projection * view;
+	result.soaScalarMilliseconds = MeasureBestMilliseconds(runs, [&]()
+	{
+		MarkAllEntitiesDirty(&store);
+		UpdateEntityTransformsScalar(&store, viewProjection);
+	});
+
+	std::vector<mat4> reference = store.worldViewProjections;
+	result.soaSimdMilliseconds = MeasureBestMilliseconds(runs, [&]()
+	{
+		MarkAllEntitiesDirty(&store);
+		UpdateEntityTransforms(&store, viewProjection);
+	});
+
+	// The camera moves a little every run so the view projection always changes
+	f32 cameraOffset = 0.0f;
+	result.soaStaticMilliseconds = MeasureBestMilliseconds(runs, [&]()
+	{
+		cameraOffset += 0.01f;
+		UpdateEntityTransforms(&store, glm::translate(viewProjection, vec3(cameraOffset, 0.0f, 0.0f)));
+	});
+	UpdateEntityTransforms(&store, viewProjection);
+
+	for (u32 i = 0; i < entityCount; ++i)
+		for (u32 c = 0; c < 4; ++c)
+			for (u32 r = 0; r < 4; ++r)
+				result.maxError = glm::max(result.maxError, fabsf(reference[i][c][r] - store.worldViewProjections[i][c][r]));
+
+	return result;
+}
+
+void BenchmarkEntityScaling(u32 entityCount, u32 maxThreadCount, u32 paramsStride, std::vector<EntityScalingBenchmark>& results)
+{
+	const mat4 viewProjection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f) *
+		glm::lookAt(vec3(0.0f, 5.0f, 20.0f), vec3(0.0f), vec3(0.0f, 1.0f, 0.0f));
+	const u32 runs = glm::max(3u, 2000000u / entityCount);
+
+	EntityStore store;
+	InitEntityStore(&store, entityCount);
+	for (u32 i = 0; i < entityCount; ++i)
+	{
+		vec3 position = vec3((f32)(i % 100), (f32)((i / 100) % 100), (f32)(i / 10000));
+		quat rotation = glm::angleAxis((f32)i * 0.01f, glm::normalize(vec3(1.0f, 2.0f, 3.0f)));
+		AddEntity(&store, position, rotation, 0.45f, Entity{});
+	}
+	std::vector<u8> params((u64)entityCount * paramsStride);
+
+	const u32 previousThreadCount = GetJobThreadCount();
+	results.clear();
+	for (u32 threadCount = 1; ; threadCount = glm::min(threadCount * 2, maxThreadCount))
+	{
+		ShutdownJobSystem();
+		InitJobSystem(threadCount);
+
+		EntityScalingBenchmark result = {};
+		result.threadCount = GetJobThreadCount();
+		result.transformMilliseconds = MeasureBestMilliseconds(runs, [&]()
+		{
+			MarkAllEntitiesDirty(&store);
+			UpdateEntityTransforms(&store, viewProjection);
+		});
+		result.paramsMilliseconds = MeasureBestMilliseconds(runs, [&]()
+		{
+			WriteEntityParams(&store, 0, entityCount, paramsStride, params.data());
+		});
+		results.push_back(result);
+
+		if (threadCount >= maxThreadCount)
+			break;
+	}
+
+	ShutdownJobSystem();
+	InitJobSystem(previousThreadCount);
+}
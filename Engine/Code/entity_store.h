@@ -0,0 +1,145 @@
+//
+// entity_store.h : Entities stored as structure of arrays. Transform inputs live in
+// separate columns so the per frame matrix update streams through exactly the data
+// it needs, several entities per SIMD instruction. Does not depend on the graphics API.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#ifdef _DEBUG
+#include <glm/gtc/quaternion.hpp>
+#endif // _DEBUG
+
+#ifndef _DEBUG
+#include "../ThirdParty/glm/include/glm/gtc/quaternion.hpp"
+#endif // !_DEBUG
+
+typedef glm::vec3 vec3;
+typedef glm::vec4 vec4;
+typedef glm::quat quat;
+typedef glm::mat4 mat4;
+
+/**
+ * What the renderer needs to draw an entity, besides its matrices.
+ */
+struct Entity
+{
+	float metallic = 0.5f;
+	float roughness = 0.5f;
+	u32 modelIndex;
+	u32 localParamsOffset;
+	u32 localParamsSize;
+	u32 lodIndex = 0;	// Kept between frames for the hysteresis
+	bool culled = false;	// Too small on screen to be drawn this frame
+	bool isStatic = false;	// Never moves: merged into the static batches of the renderer
+};
+
+#define ENTITY_NO_PARENT UINT32_MAX
+
+// Entities per job when the update is spread across the job system threads
+#define ENTITY_TRANSFORM_GRAIN 1024
+
+/**
+ * All columns have one element per entity and the entity index is its handle.
+ * Transforms are relative to the parent entity, which always has a lower index than
+ * its children so a single pass in index order sees every parent before its children.
+ * worldMatrices and worldViewProjections are outputs of UpdateEntityTransforms, which
+ * only recomputes the entities whose transform (or an ancestor's) changed.
+ */
+struct EntityStore
+{
+	u32 count;
+
+	// Transform
+	std::vector<f32> positionX, positionY, positionZ;
+	std::vector<f32> rotationX, rotationY, rotationZ, rotationW;	// Unit quaternions
+	std::vector<f32> scale;											// Uniform
+	std::vector<u32> parents;
+	std::vector<u8>  dirty;			// Set by the setters, cleared by the update
+
+	// Cached matrices
+	std::vector<mat4> worldMatrices;
+	std::vector<mat4> worldViewProjections;
+	std::vector<u8>   worldChanged;	// Whether the last update recomputed the world matrix
+	mat4              viewProjection;	// The one worldViewProjections were computed with
+	bool              viewProjectionChanged;	// In the last update, so every worldViewProjection changed
+
+	// Counters of the last update
+	u32 recomputedWorldCount;
+	u32 recomputedWorldViewProjectionCount;
+	std::vector<u32> changedEntities;	// Scratch list of the update
+
+	// Render data
+	std::vector<Entity> entities;
+};
+
+void InitEntityStore(EntityStore* store, u32 capacity);
+
+/**
+ * Appends an entity with the given transform (relative to parent, if any) and returns
+ * its index. The parent must already be in the store.
+ */
+u32  AddEntity(EntityStore* store, vec3 position, quat rotation, f32 scale, const Entity& entity, u32 parent = ENTITY_NO_PARENT);
+
+vec3 GetEntityPosition(const EntityStore* store, u32 index);
+void SetEntityPosition(EntityStore* store, u32 index, vec3 position);
+void SetEntityRotation(EntityStore* store, u32 index, quat rotation);
+void SetEntityScale(EntityStore* store, u32 index, f32 scale);
+
+/**
+ * Recomputes world = parentWorld * translate * rotate * scale for the dirty entities
+ * and their descendants, and viewProjection * world for those plus every entity when
+ * viewProjection differs from the previous update. The local matrices go through an
+ * SSE kernel four entities at a time (gathering their transform columns), and the
+ * matrices are transposed on the way out. Independent entities are split across the
+ * job system threads; parented ones are finished serially in index order.
+ */
+void UpdateEntityTransforms(EntityStore* store, const mat4& viewProjection);
+
+/**
+ * Same result with plain glm, one entity at a time, as a reference.
+ */
+void UpdateEntityTransformsScalar(EntityStore* store, const mat4& viewProjection);
+
+/**
+ * Writes the shader parameters (world matrix, then world view projection) of entities
+ * [first, first + count) as blocks of stride bytes, the first one at dst.
+ */
+void WriteEntityParams(const EntityStore* store, u32 first, u32 count, u32 stride, u8* dst);
+
+/**
+ * Forces the next update to recompute every entity (e.g. to measure the worst case).
+ */
+void MarkAllEntitiesDirty(EntityStore* store);
+
+struct EntityTransformBenchmark
+{
+	u32 entityCount;
+	f64 aosMilliseconds;		// The former loop: an array of entity records, projection * view * world each
+	f64 soaScalarMilliseconds;
+	f64 soaSimdMilliseconds;		// Every entity moving
+	f64 soaStaticMilliseconds;		// Nothing moving but the camera
+	f32 maxError;				// Largest difference between the SIMD and scalar matrices
+};
+
+/**
+ * Times one transform update of entityCount entities with each approach (best of a
+ * few runs). Allocates everything it needs and frees it before returning.
+ */
+EntityTransformBenchmark BenchmarkEntityTransforms(u32 entityCount);
+
+struct EntityScalingBenchmark
+{
+	u32 threadCount;
+	f64 transformMilliseconds;	// Every entity moving
+	f64 paramsMilliseconds;		// Filling the parameter blocks of every entity
+};
+
+/**
+ * Times the transform update and the parameter fill of entityCount entities with the
+ * job system restarted at 1, 2, 4... up to maxThreadCount threads, then restarts it with
+ * the thread count it had. Must not be called while jobs are running.
+ */
+void BenchmarkEntityScaling(u32 entityCount, u32 maxThreadCount, u32 paramsStride, std::vector<EntityScalingBenchmark>& results);
@@ -0,0 +1,249 @@
+//
+// job_system.cpp : Work-stealing job system, see job_system.h.
+//
+
+#include "job_system.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Chase-Lev deque with a fixed size buffer ("Correct and Efficient Work-Stealing for
+// Weak Memory Models", Lê et al. 2013). Only the owner calls Push and Pop; any thread
+// can Steal.
+struct JobDeque
+{
+	std::atomic<i64>  top;
+	std::atomic<i64>  bottom;
+	std::atomic<Job*> buffer[JOB_DEQUE_CAPACITY];
+};
+
+static void PushJob(JobDeque* deque, Job* job)
+{
+	i64 b = deque->bottom.load(std::memory_order_relaxed);
+	i64 t = deque->top.load(std::memory_order_acquire);
+	ASSERT(b - t < JOB_DEQUE_CAPACITY, "Job deque full");
+
+	deque->buffer[b & (JOB_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	deque->bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+static Job* PopJob(JobDeque* deque)
+{
+	i64 b = deque->bottom.load(std::memory_order_relaxed) - 1;
+	deque->bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	i64 t = deque->top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty
+		deque->bottom.store(b + 1, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	Job* job = deque->buffer[b & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// Last job, a thief may be taking it at the same time
+		if (!deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = NULL;
+		deque->bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+static Job* StealJob(JobDeque* deque)
+{
+	i64 t = deque->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	i64 b = deque->bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return NULL;
+
+	Job* job = deque->buffer[t & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+	if (!deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return NULL;
+	return job;
+}
+
+// Each thread copies queued jobs into its own ring, a slot is reused once the ring
+// wraps around, which is safe as long as fewer than JOB_DEQUE_CAPACITY are in flight
+struct JobThread
+{
+	JobDeque    deque;
+	Job         jobs[JOB_DEQUE_CAPACITY];
+	u32         nextJob;
+	std::thread thread;
+};
+
+struct JobSystem
+{
+	JobThread*              threads;
+	u32                     threadCount;
+	std::atomic<bool>       running;
+
+	// Idle workers sleep until jobs are queued
+	std::atomic<i32>        queuedJobs;
+	std::mutex              sleepMutex;
+	std::condition_variable wakeUp;
+};
+
+static JobSystem GlobalJobSystem;
+
+// Threads outside the pool (e.g. the render thread) keep JOB_NO_THREAD
+#define JOB_NO_THREAD UINT32_MAX
+static thread_local u32 JobThreadIndex = JOB_NO_THREAD;
+
+static Job* GetJob(u32 threadIndex)
+{
+	JobSystem& system = GlobalJobSystem;
+	Job* job = PopJob(&system.threads[threadIndex].deque);
+
+	// Steal, starting with the next thread so thieves do not all hit the same one
+	for (u32 i = 1; !job && i < system.threadCount; ++i)
+		job = StealJob(&system.threads[(threadIndex + i) % system.threadCount].deque);
+
+	if (job)
+		system.queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+static void ExecuteJob(Job* job)
+{
+	job->function(job->data, job->begin, job->end);
+	if (job->counter)
+		job->counter->value.fetch_sub(1, std::memory_order_release);
+}
+
+static void WorkerThreadMain(u32 threadIndex)
+{
+	JobSystem& system = GlobalJobSystem;
+	JobThreadIndex = threadIndex;
+
+	while (system.running.load(std::memory_order_relaxed))
+	{
+		Job* job = GetJob(threadIndex);
+		if (job)
+		{
+			ExecuteJob(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(system.sleepMutex);
+		system.wakeUp.wait(lock, [&system]() { return system.queuedJobs.load() > 0 || !system.running.load(); });
+	}
+}
+
+void InitJobSystem(u32 threadCount)
+{
+	JobSystem& system = GlobalJobSystem;
+	if (threadCount == 0)
+		threadCount = glm::max(std::thread::hardware_concurrency(), 1u);
+	threadCount = glm::min(threadCount, (u32)MAX_JOB_THREADS);
+
+	system.threads = new JobThread[threadCount];
+	system.threadCount = threadCount;
+	system.running = true;
+	system.queuedJobs = 0;
+	for (u32 i = 0; i < threadCount; ++i)
+	{
+		system.threads[i].deque.top = 0;
+		system.threads[i].deque.bottom = 0;
+		system.threads[i].nextJob = 0;
+	}
+
+	JobThreadIndex = 0;
+	for (u32 i = 1; i < threadCount; ++i)
+		system.threads[i].thread = std::thread(WorkerThreadMain, i);
+
+	ILOG("Job system started with %u threads", threadCount);
+}
+
+void ShutdownJobSystem()
+{
+	JobSystem& system = GlobalJobSystem;
+	{
+		std::lock_guard<std::mutex> lock(system.sleepMutex);
+		system.running = false;
+	}
+	system.wakeUp.notify_all();
+
+	for (u32 i = 1; i < system.threadCount; ++i)
+		system.threads[i].thread.join();
+
+	delete[] system.threads;
+	system.threads = NULL;
+	system.threadCount = 0;
+}
+
+u32 GetJobThreadCount()
+{
+	return GlobalJobSystem.threadCount;
+}
+
+void RunJobs(const Job* jobs, u32 count, JobCounter* counter)
+{
+	JobSystem& system = GlobalJobSystem;
+	ASSERT(JobThreadIndex < system.threadCount, "RunJobs called from a thread outside the job system");
+	JobThread& thread = system.threads[JobThreadIndex];
+
+	if (counter)
+		counter->value.fetch_add(count, std::memory_order_relaxed);
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		Job* job = &thread.jobs[thread.nextJob++ & (JOB_DEQUE_CAPACITY - 1)];
+		*job = jobs[i];
+		job->counter = counter;
+		system.queuedJobs.fetch_add(1, std::memory_order_relaxed);
+		PushJob(&thread.deque, job);
+	}
+
+	// Taking the lock orders this with a worker that checked queuedJobs and is about to sleep
+	{
+		std::lock_guard<std::mutex> lock(system.sleepMutex);
+	}
+	system.wakeUp.notify_all();
+}
+
+void WaitForCounter(JobCounter* counter)
+{
+	while (counter->value.load(std::memory_order_acquire) > 0)
+	{
+		Job* job = JobThreadIndex != JOB_NO_THREAD ? GetJob(JobThreadIndex) : NULL;
+		if (job)
+			ExecuteJob(job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void ParallelFor(u32 count, u32 grain, JobFunction function, void* data)
+{
+	grain = glm::max(grain, 1u);
+	if (count <= grain || GlobalJobSystem.threadCount <= 1 || JobThreadIndex == JOB_NO_THREAD)
+	{
+		if (count > 0)
+			function(data, 0, count);
+		return;
+	}
+
+	ScopedTemporaryMemory temp(GetTempArena());
+	u32 jobCount = (count + grain - 1) / grain;
+	ASSERT(jobCount <= JOB_DEQUE_CAPACITY / 2, "ParallelFor grain too small for the job deque");
+
+	Job* jobs = PushArray(temp.temp.arena, Job, jobCount);
+	for (u32 i = 0; i < jobCount; ++i)
+	{
+		jobs[i].function = function;
+		jobs[i].data = data;
+		jobs[i].begin = i * grain;
+		jobs[i].end = glm::min(count, (i + 1) * grain);
+	}
+
+	JobCounter counter;
+	RunJobs(jobs, jobCount, &counter);
+	WaitForCounter(&counter);
+}
@@ -0,0 +1,75 @@
+//
+// job_system.h : Fixed pool of worker threads running small jobs. Each thread owns a
+// Chase-Lev work-stealing deque: it pushes and pops jobs at the bottom of its own and,
+// when it runs out, steals from the top of the others'. The main thread is thread 0
+// and works like any worker while it waits.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#include <atomic>
+
+// Upper bound of threads in the pool, the main thread included
+#define MAX_JOB_THREADS 32
+
+// Jobs each thread can have queued or in flight at once (power of two)
+#define JOB_DEQUE_CAPACITY 4096
+
+typedef void (*JobFunction)(void* data, u32 begin, u32 end);
+
+/**
+ * Counts unfinished jobs: RunJobs adds the jobs it queues and each one decrements it
+ * when done. Jobs that depend on others are simply queued after waiting on their counter.
+ */
+struct JobCounter
+{
+	std::atomic<u32> value;
+
+	JobCounter() : value(0) {}
+};
+
+struct Job
+{
+	JobFunction function;
+	void*       data;
+	u32         begin;	// Range for the function, free to use for anything else
+	u32         end;
+	JobCounter* counter;
+};
+
+/**
+ * Starts the worker threads. threadCount includes the main thread (the one calling
+ * this), 0 means one per hardware thread.
+ */
+void InitJobSystem(u32 threadCount);
+void ShutdownJobSystem();
+
+u32  GetJobThreadCount();
+
+/**
+ * Queues jobs on the calling thread's deque. The calling thread must be the main
+ * thread or a worker (i.e. it can be called from inside a job).
+ */
+void RunJobs(const Job* jobs, u32 count, JobCounter* counter);
+
+/**
+ * Runs queued jobs (its own or stolen) until the counter reaches zero, so waiting
+ * never leaves a thread idle while there is work.
+ */
+void WaitForCounter(JobCounter* counter);
+
+/**
+ * Calls function(data, begin, end) over [0, count) in chunks of grain elements spread
+ * across the threads, and returns when all of them are done. Ranges that fit in a
+ * single chunk, and calls from threads outside the pool, run directly on the calling
+ * thread.
+ */
+void ParallelFor(u32 count, u32 grain, JobFunction function, void* data);
+
+template <typename Function>
+void ParallelFor(u32 count, u32 grain, const Function& function)
+{
+	ParallelFor(count, grain, [](void* data, u32 begin, u32 end) { (*(const Function*)data)(begin, end); }, (void*)&function);
+}
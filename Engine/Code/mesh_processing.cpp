@@ -0,0 +1,801 @@
+//
+// mesh_processing.cpp : Import time geometry processing, see mesh_processing.h.
+//
+
+#include "mesh_processing.h"
+
+#include <algorithm>
+#include <unordered_set>
+#include <float.h>
+
+// Forsyth's scoring parameters (https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html)
+#define FORSYTH_CACHE_SIZE          32
+#define FORSYTH_CACHE_DECAY_POWER   1.5f
+#define FORSYTH_LAST_TRIANGLE_SCORE 0.75f
+#define FORSYTH_VALENCE_BOOST_SCALE 2.0f
+#define FORSYTH_VALENCE_BOOST_POWER 0.5f
+
+#define OVERDRAW_CLUSTER_THRESHOLD 1.05f
+
+// LOD chain generation: each level targets half the triangles of the previous one
+#define LOD_REDUCTION_RATIO   0.5f
+#define LOD_MIN_REDUCTION     0.85f // A level keeping more than this fraction of the previous one is dropped
+#define LOD_MAX_ERROR         0.1f  // Relative to the submesh extent
+#define LOD_MIN_TRIANGLES     32
+
+static f32 ForsythVertexScore(i32 cachePosition, u32 liveTriangles)
+{
+	// No triangle left to draw with it
+	if (liveTriangles == 0)
+		return -1.0f;
+
+	f32 score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		// The three vertices of the last triangle get a fixed score so the next one
+		// does not just pick the most recent edge, which would make long thin strips
+		if (cachePosition < 3)
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		else
+			score = powf(1.0f - (f32)(cachePosition - 3) / (f32)(FORSYTH_CACHE_SIZE - 3), FORSYTH_CACHE_DECAY_POWER);
+	}
+
+	// Vertices with few triangles left go first so they do not become lonely stragglers
+	score += FORSYTH_VALENCE_BOOST_SCALE * powf((f32)liveTriangles, -FORSYTH_VALENCE_BOOST_POWER);
+	return score;
+}
+
+void OptimizeVertexCache(u32* destination, const u32* indices, u32 indexCount, u32 vertexCount)
+{
+	const u32 triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	// Triangles adjacent to each vertex, the live ones are kept at the front of each list
+	std::vector<u32> liveTriangles(vertexCount, 0);
+	for (u32 i = 0; i < indexCount; ++i)
+		liveTriangles[indices[i]]++;
+
+	std::vector<u32> adjacencyOffsets(vertexCount + 1, 0);
+	for (u32 v = 0; v < vertexCount; ++v)
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+
+	std::vector<u32> adjacency(indexCount);
+	{
+		std::vector<u32> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (u32 i = 0; i < indexCount; ++i)
+			adjacency[cursor[indices[i]]++] = i / 3;
+	}
+
+	std::vector<i32> cachePosition(vertexCount, -1);
+	std::vector<f32> vertexScore(vertexCount);
+	for (u32 v = 0; v < vertexCount; ++v)
+		vertexScore[v] = ForsythVertexScore(-1, liveTriangles[v]);
+
+	std::vector<f32>  triangleScore(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	u32 bestTriangle = 0;
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		triangleScore[t] = vertexScore[indices[t * 3 + 0]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+		if (triangleScore[t] > triangleScore[bestTriangle])
+			bestTriangle = t;
+	}
+
+	u32 cache[FORSYTH_CACHE_SIZE + 3];
+	u32 cacheCount = 0;
+	u32 scanCursor = 0;
+
+	for (u32 output = 0; output < triangleCount; ++output)
+	{
+		const u32* triangle = &indices[bestTriangle * 3];
+		emitted[bestTriangle] = true;
+		destination[output * 3 + 0] = triangle[0];
+		destination[output * 3 + 1] = triangle[1];
+		destination[output * 3 + 2] = triangle[2];
+
+		// Move the triangle out of the live part of its vertices' lists
+		for (u32 k = 0; k < 3; ++k)
+		{
+			u32 v = triangle[k];
+			u32* list = &adjacency[adjacencyOffsets[v]];
+			for (u32 i = 0; i < liveTriangles[v]; ++i)
+			{
+				if (list[i] == bestTriangle)
+				{
+					std::swap(list[i], list[liveTriangles[v] - 1]);
+					liveTriangles[v]--;
+					break;
+				}
+			}
+		}
+
+		// LRU update: the triangle vertices go to the front, the rest is shifted back
+		u32 newCache[FORSYTH_CACHE_SIZE + 3];
+		u32 newCacheCount = 0;
+		for (u32 k = 0; k < 3; ++k)
+		{
+			if (std::find(newCache, newCache + newCacheCount, triangle[k]) == newCache + newCacheCount)
+				newCache[newCacheCount++] = triangle[k];
+		}
+		const u32 triangleVertexCount = newCacheCount;
+		for (u32 i = 0; i < cacheCount; ++i)
+		{
+			if (std::find(newCache, newCache + triangleVertexCount, cache[i]) == newCache + triangleVertexCount)
+				newCache[newCacheCount++] = cache[i];
+		}
+
+		// Rescore everything that moved, including the vertices that just fell out
+		for (u32 i = 0; i < newCacheCount; ++i)
+		{
+			u32 v = newCache[i];
+			cachePosition[v] = i < FORSYTH_CACHE_SIZE ? (i32)i : -1;
+
+			f32 score = ForsythVertexScore(cachePosition[v], liveTriangles[v]);
+			f32 delta = score - vertexScore[v];
+			vertexScore[v] = score;
+
+			const u32* list = &adjacency[adjacencyOffsets[v]];
+			for (u32 j = 0; j < liveTriangles[v]; ++j)
+				triangleScore[list[j]] += delta;
+		}
+
+		cacheCount = glm::min(newCacheCount, (u32)FORSYTH_CACHE_SIZE);
+		std::copy(newCache, newCache + cacheCount, cache);
+
+		// The next triangle is the best one touching the cache...
+		f32 bestScore = -FLT_MAX;
+		bool found = false;
+		for (u32 i = 0; i < cacheCount; ++i)
+		{
+			u32 v = cache[i];
+			const u32* list = &adjacency[adjacencyOffsets[v]];
+			for (u32 j = 0; j < liveTriangles[v]; ++j)
+			{
+				if (triangleScore[list[j]] > bestScore)
+				{
+					bestScore = triangleScore[list[j]];
+					bestTriangle = list[j];
+					found = true;
+				}
+			}
+		}
+
+		// ...or, at a dead end, the next one in input order
+		if (!found)
+		{
+			while (scanCursor < triangleCount && emitted[scanCursor])
+				scanCursor++;
+			bestTriangle = scanCursor;
+		}
+	}
+}
+
+// Returns the number of misses of a triangle in a FIFO cache of cacheSize entries
+static u32 UpdateFifoCache(const u32* triangle, std::vector<u32>& timestamps, u32& timestamp, u32 cacheSize)
+{
+	u32 misses = 0;
+	for (u32 k = 0; k < 3; ++k)
+	{
+		u32 v = triangle[k];
+		if (timestamp - timestamps[v] > cacheSize)
+		{
+			timestamps[v] = timestamp++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+u32 AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize)
+{
+	std::vector<u32> timestamps(vertexCount, 0);
+	u32 timestamp = cacheSize + 1;
+	u32 misses = 0;
+
+	for (u32 i = 0; i + 2 < indexCount; i += 3)
+		misses += UpdateFifoCache(&indices[i], timestamps, timestamp, cacheSize);
+
+	return misses;
+}
+
+void OptimizeOverdraw(u32* destination, const u32* indices, u32 indexCount, const vec3* positions, u32 vertexCount, f32 threshold)
+{
+	const u32 triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+		return;
+
+	const u32 cacheSize = VERTEX_CACHE_ANALYSIS_SIZE;
+	std::vector<u32> timestamps(vertexCount, 0);
+	u32 timestamp = cacheSize + 1;
+
+	// Hard boundaries: the cache optimizer had to jump somewhere else (all three vertices miss)
+	std::vector<u32> hardClusters;
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		if (UpdateFifoCache(&indices[t * 3], timestamps, timestamp, cacheSize) == 3)
+			hardClusters.push_back(t);
+	}
+	if (hardClusters.empty() || hardClusters[0] != 0)
+		hardClusters.insert(hardClusters.begin(), 0);
+
+	// Soft boundaries: split a cluster again as soon as its ACMR is within threshold
+	// of the whole cluster's, flushing the cache at each cut (that is the cost we accept)
+	std::vector<u32> clusters;
+	for (u32 c = 0; c < hardClusters.size(); ++c)
+	{
+		u32 start = hardClusters[c];
+		u32 end = c + 1 < hardClusters.size() ? hardClusters[c + 1] : triangleCount;
+
+		timestamp += cacheSize + 1;
+		u32 clusterMisses = 0;
+		for (u32 t = start; t < end; ++t)
+			clusterMisses += UpdateFifoCache(&indices[t * 3], timestamps, timestamp, cacheSize);
+		f32 clusterThreshold = threshold * (f32)clusterMisses / (f32)(end - start);
+
+		clusters.push_back(start);
+		timestamp += cacheSize + 1;
+
+		u32 runningMisses = 0;
+		u32 runningTriangles = 0;
+		for (u32 t = start; t < end; ++t)
+		{
+			runningMisses += UpdateFifoCache(&indices[t * 3], timestamps, timestamp, cacheSize);
+			runningTriangles++;
+
+			if (t + 1 < end && (f32)runningMisses / (f32)runningTriangles <= clusterThreshold)
+			{
+				clusters.push_back(t + 1);
+				timestamp += cacheSize + 1;
+				runningMisses = 0;
+				runningTriangles = 0;
+			}
+		}
+	}
+
+	// Sort clusters by how much they face away from the mesh center
+	vec3 meshCentroid = vec3(0.0f);
+	for (u32 i = 0; i < indexCount; ++i)
+		meshCentroid += positions[indices[i]];
+	meshCentroid /= (f32)indexCount;
+
+	std::vector<f32> sortKeys(clusters.size());
+	for (u32 c = 0; c < clusters.size(); ++c)
+	{
+		u32 start = clusters[c];
+		u32 end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+
+		vec3 centroid = vec3(0.0f);
+		vec3 normal = vec3(0.0f);
+		f32 area = 0.0f;
+		for (u32 t = start; t < end; ++t)
+		{
+			vec3 p0 = positions[indices[t * 3 + 0]];
+			vec3 p1 = positions[indices[t * 3 + 1]];
+			vec3 p2 = positions[indices[t * 3 + 2]];
+			vec3 faceNormal = glm::cross(p1 - p0, p2 - p0);	// length is twice the area
+			f32 faceArea = glm::length(faceNormal);
+
+			centroid += (p0 + p1 + p2) * (faceArea / 3.0f);
+			normal += faceNormal;
+			area += faceArea;
+		}
+
+		centroid = area > 0.0f ? centroid / area : positions[indices[start * 3]];
+		f32 normalLength = glm::length(normal);
+		normal = normalLength > 0.0f ? normal / normalLength : vec3(0.0f);
+
+		sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+	}
+
+	std::vector<u32> order(clusters.size());
+	for (u32 c = 0; c < order.size(); ++c)
+		order[c] = c;
+	std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return sortKeys[a] > sortKeys[b]; });
+
+	u32 output = 0;
+	for (u32 i = 0; i < order.size(); ++i)
+	{
+		u32 c = order[i];
+		u32 start = clusters[c];
+		u32 end = c + 1 < clusters.size() ? clusters[c + 1] : triangleCount;
+		for (u32 t = start; t < end; ++t, ++output)
+		{
+			destination[output * 3 + 0] = indices[t * 3 + 0];
+			destination[output * 3 + 1] = indices[t * 3 + 1];
+			destination[output * 3 + 2] = indices[t * 3 + 2];
+		}
+	}
+}
+
+u32 OptimizeVertexFetchRemap(u32* remap, u32* indices, u32 indexCount, u32 vertexCount)
+{
+	std::fill(remap, remap + vertexCount, UINT32_MAX);
+
+	u32 nextVertex = 0;
+	for (u32 i = 0; i < indexCount; ++i)
+	{
+		u32& index = indices[i];
+		if (remap[index] == UINT32_MAX)
+			remap[index] = nextVertex++;
+		index = remap[index];
+	}
+
+	return nextVertex;
+}
+
+// Depth tests the front facing triangles from the six axis directions. A pixel is
+// covered once and shaded every time a triangle passes the depth test on it.
+void AnalyzeOverdraw(const u32* indices, u32 indexCount, const vec3* positions, u64* pixelsCovered, u64* pixelsShaded)
+{
+	const u32 resolution = OVERDRAW_ANALYSIS_RESOLUTION;
+
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < indexCount; ++i)
+	{
+		boundsMin = glm::min(boundsMin, positions[indices[i]]);
+		boundsMax = glm::max(boundsMax, positions[indices[i]]);
+	}
+	f32 extent = glm::max(glm::max(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y), glm::max(boundsMax.z - boundsMin.z, 1e-6f));
+
+	std::vector<f32> depthBuffer(resolution * resolution);
+
+	for (u32 view = 0; view < 6; ++view)
+	{
+		std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+
+		for (u32 i = 0; i + 2 < indexCount; i += 3)
+		{
+			vec3 screen[3];
+			for (u32 k = 0; k < 3; ++k)
+			{
+				// Normalized position, projected keeping a right-handed screen so the
+				// counter clockwise triangles facing the camera stay counter clockwise
+				vec3 p = (positions[indices[i + k]] - boundsMin) / extent;
+				switch (view)
+				{
+					case 0: screen[k] = vec3(p.x,        p.y,        1.0f - p.z); break; // From +Z
+					case 1: screen[k] = vec3(1.0f - p.x, p.y,        p.z);        break; // From -Z
+					case 2: screen[k] = vec3(1.0f - p.z, p.y,        1.0f - p.x); break; // From +X
+					case 3: screen[k] = vec3(p.z,        p.y,        p.x);        break; // From -X
+					case 4: screen[k] = vec3(p.x,        1.0f - p.z, 1.0f - p.y); break; // From +Y
+					default: screen[k] = vec3(p.x,       p.z,        p.y);        break; // From -Y
+				}
+				screen[k].x *= resolution;
+				screen[k].y *= resolution;
+			}
+
+			f32 area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+			if (area <= 0.0f)
+				continue;
+
+			i32 minX = glm::max((i32)glm::min(glm::min(screen[0].x, screen[1].x), screen[2].x), 0);
+			i32 minY = glm::max((i32)glm::min(glm::min(screen[0].y, screen[1].y), screen[2].y), 0);
+			i32 maxX = glm::min((i32)glm::max(glm::max(screen[0].x, screen[1].x), screen[2].x), (i32)resolution - 1);
+			i32 maxY = glm::min((i32)glm::max(glm::max(screen[0].y, screen[1].y), screen[2].y), (i32)resolution - 1);
+
+			for (i32 y = minY; y <= maxY; ++y)
+			{
+				for (i32 x = minX; x <= maxX; ++x)
+				{
+					f32 px = x + 0.5f;
+					f32 py = y + 0.5f;
+					f32 w0 = (screen[2].x - screen[1].x) * (py - screen[1].y) - (screen[2].y - screen[1].y) * (px - screen[1].x);
+					f32 w1 = (screen[0].x - screen[2].x) * (py - screen[2].y) - (screen[0].y - screen[2].y) * (px - screen[2].x);
+					f32 w2 = area - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					f32 depth = (w0 * screen[0].z + w1 * screen[1].z + w2 * screen[2].z) / area;
+					f32& stored = depthBuffer[y * resolution + x];
+					if (depth < stored)
+					{
+						if (stored == FLT_MAX)
+							(*pixelsCovered)++;
+						(*pixelsShaded)++;
+						stored = depth;
+					}
+				}
+			}
+		}
+	}
+}
+
+u32 OptimizeMesh(std::vector<u32>& indices, const vec3* positions, u32 vertexCount, std::vector<u32>& remap, MeshOptimizationStats* stats)
+{
+	const u32 indexCount = (u32)indices.size();
+
+	if (stats)
+	{
+		stats->triangleCount += indexCount / 3;
+		stats->vertexCountBefore += vertexCount;
+		stats->cacheMissesBefore += AnalyzeVertexCache(indices.data(), indexCount, vertexCount, VERTEX_CACHE_ANALYSIS_SIZE);
+		u64 pixelsCovered = 0;
+		AnalyzeOverdraw(indices.data(), indexCount, positions, &pixelsCovered, &stats->pixelsShadedBefore);
+		stats->pixelsCovered += pixelsCovered;
+	}
+
+	std::vector<u32> cacheOptimized(indexCount);
+	OptimizeVertexCache(cacheOptimized.data(), indices.data(), indexCount, vertexCount);
+	OptimizeOverdraw(indices.data(), cacheOptimized.data(), indexCount, positions, vertexCount, OVERDRAW_CLUSTER_THRESHOLD);
+
+	if (stats)
+	{
+		// Coverage does not depend on the order, only the shaded count is measured again
+		u64 pixelsCovered = 0;
+		AnalyzeOverdraw(indices.data(), indexCount, positions, &pixelsCovered, &stats->pixelsShadedAfter);
+	}
+
+	// Invert old -> new into new -> old for the caller to pack the vertices in order
+	std::vector<u32> oldToNew(vertexCount);
+	u32 usedVertexCount = OptimizeVertexFetchRemap(oldToNew.data(), indices.data(), indexCount, vertexCount);
+	remap.assign(usedVertexCount, 0);
+	for (u32 v = 0; v < vertexCount; ++v)
+	{
+		if (oldToNew[v] != UINT32_MAX)
+			remap[oldToNew[v]] = v;
+	}
+
+	if (stats)
+	{
+		stats->vertexCountAfter += usedVertexCount;
+		stats->cacheMissesAfter += AnalyzeVertexCache(indices.data(), indexCount, usedVertexCount, VERTEX_CACHE_ANALYSIS_SIZE);
+	}
+
+	return usedVertexCount;
+}
+
+// Symmetric 4x4 matrix of the squared distance to a set of planes, summed with
+// the weight of each plane so the error can be read back as a mean distance
+struct Quadric
+{
+	f64 a2, b2, c2, d2, ab, ac, ad, bc, bd, cd;
+	f64 weight;
+};
+
+static void AddPlaneQuadric(Quadric& q, vec3 n, f32 d, f32 weight)
+{
+	q.a2 += weight * n.x * n.x; q.b2 += weight * n.y * n.y; q.c2 += weight * n.z * n.z; q.d2 += weight * d * d;
+	q.ab += weight * n.x * n.y; q.ac += weight * n.x * n.z; q.ad += weight * n.x * d;
+	q.bc += weight * n.y * n.z; q.bd += weight * n.y * d;   q.cd += weight * n.z * d;
+	q.weight += weight;
+}
+
+static void AddQuadric(Quadric& q, const Quadric& other)
+{
+	q.a2 += other.a2; q.b2 += other.b2; q.c2 += other.c2; q.d2 += other.d2;
+	q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+	q.bc += other.bc; q.bd += other.bd; q.cd += other.cd;
+	q.weight += other.weight;
+}
+
+// Weighted mean of the squared distances, the raw sum scales with the area around the
+// vertex and is not comparable to targetError or to a screen space error
+static f64 QuadricError(const Quadric& q, vec3 v)
+{
+	if (q.weight <= 0.0)
+		return 0.0;
+
+	f64 x = v.x, y = v.y, z = v.z;
+	f64 error = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2
+		+ 2.0 * (q.ab * x * y + q.ac * x * z + q.ad * x + q.bc * y * z + q.bd * y + q.cd * z);
+	return glm::max(error / q.weight, 0.0);
+}
+
+struct Collapse
+{
+	u32 from;
+	u32 to;
+	f32 error;
+};
+
+// Moving a vertex must not turn any of its remaining triangles upside down
+static bool CollapseFlipsTriangles(const Collapse& collapse, const u32* indices, const u32* triangles, u32 triangleCount, const vec3* positions)
+{
+	for (u32 i = 0; i < triangleCount; ++i)
+	{
+		const u32* triangle = &indices[triangles[i] * 3];
+		if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+			continue;
+
+		vec3 before[3], after[3];
+		for (u32 k = 0; k < 3; ++k)
+		{
+			before[k] = positions[triangle[k]];
+			after[k] = triangle[k] == collapse.from ? positions[collapse.to] : before[k];
+		}
+
+		vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+		vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+		if (glm::dot(normalBefore, normalAfter) <= 0.0f)
+			return true;
+	}
+	return false;
+}
+
+u32 SimplifyMesh(u32* destination, const u32* indices, u32 indexCount, const vec3* positions, u32 vertexCount, u32 targetIndexCount, f32 targetError, f32* resultError)
+{
+	// Work on a unit sized copy so the error does not depend on the mesh scale
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < indexCount; ++i)
+	{
+		boundsMin = glm::min(boundsMin, positions[indices[i]]);
+		boundsMax = glm::max(boundsMax, positions[indices[i]]);
+	}
+	vec3 boundsExtent = boundsMax - boundsMin;
+	f32 extent = glm::max(glm::max(boundsExtent.x, boundsExtent.y), glm::max(boundsExtent.z, 1e-6f));
+
+	std::vector<vec3> normalized(vertexCount);
+	for (u32 v = 0; v < vertexCount; ++v)
+		normalized[v] = (positions[v] - boundsMin) / extent;
+
+	std::copy(indices, indices + indexCount, destination);
+	u32 count = indexCount;
+
+	// An edge without its opposite half is open: a border or an attribute seam
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::unordered_set<u64> edges;
+		for (u32 i = 0; i < count; i += 3)
+			for (u32 k = 0; k < 3; ++k)
+				edges.insert(((u64)destination[i + k] << 32) | destination[i + (k + 1) % 3]);
+
+		for (u32 i = 0; i < count; i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+			{
+				u32 a = destination[i + k];
+				u32 b = destination[i + (k + 1) % 3];
+				if (edges.find(((u64)b << 32) | a) == edges.end())
+					locked[a] = locked[b] = true;
+			}
+		}
+	}
+
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (u32 i = 0; i < count; i += 3)
+	{
+		vec3 p0 = normalized[destination[i + 0]];
+		vec3 p1 = normalized[destination[i + 1]];
+		vec3 p2 = normalized[destination[i + 2]];
+		vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		f32 area = glm::length(normal);
+		if (area <= 0.0f)
+			continue;
+
+		normal /= area;
+		f32 d = -glm::dot(normal, p0);
+		for (u32 k = 0; k < 3; ++k)
+			AddPlaneQuadric(quadrics[destination[i + k]], normal, d, area);
+	}
+
+	const f64 errorLimit = (f64)targetError * targetError;
+	f64 maxError = 0.0;
+
+	std::vector<u32> adjacencyOffsets(vertexCount + 1);
+	std::vector<u32> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<u32> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+
+	while (count > targetIndexCount)
+	{
+		// Triangles around each vertex
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (u32 i = 0; i < count; ++i)
+			adjacencyOffsets[destination[i] + 1]++;
+		for (u32 v = 0; v < vertexCount; ++v)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(count);
+		{
+			std::vector<u32> cursor(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (u32 i = 0; i < count; ++i)
+				adjacency[cursor[destination[i]]++] = i / 3;
+		}
+
+		// Every half edge from an unlocked vertex is a candidate, cheapest first
+		collapses.clear();
+		for (u32 i = 0; i < count; i += 3)
+		{
+			for (u32 k = 0; k < 3; ++k)
+			{
+				u32 from = destination[i + k];
+				u32 to = destination[i + (k + 1) % 3];
+				if (locked[from])
+					continue;
+
+				Quadric q = quadrics[from];
+				AddQuadric(q, quadrics[to]);
+				collapses.push_back(Collapse{ from, to, (f32)QuadricError(q, normalized[to]) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.error < b.error; });
+
+		for (u32 v = 0; v < vertexCount; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+
+		// Each collapse removes about two triangles, stop once the target is reached
+		const u32 triangleGoal = (count - targetIndexCount) / 3;
+		u32 collapsedTriangles = 0;
+		u32 collapseCount = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (collapse.error > errorLimit)
+				break;
+
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			const u32* triangles = &adjacency[adjacencyOffsets[collapse.from]];
+			const u32 triangleCount = adjacencyOffsets[collapse.from + 1] - adjacencyOffsets[collapse.from];
+			if (CollapseFlipsTriangles(collapse, destination, triangles, triangleCount, normalized.data()))
+				continue;
+
+			// The neighbourhood is frozen for the rest of the pass, the flip test
+			// above relies on it not moving
+			for (u32 i = 0; i < triangleCount; ++i)
+			{
+				const u32* triangle = &destination[triangles[i] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+				if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+					collapsedTriangles++;
+			}
+
+			remap[collapse.from] = collapse.to;
+			AddQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+			maxError = glm::max(maxError, (f64)collapse.error);
+			collapseCount++;
+
+			if (collapsedTriangles >= triangleGoal)
+				break;
+		}
+
+		if (collapseCount == 0)
+			break;
+
+		// Apply the pass and drop the triangles that collapsed
+		u32 newCount = 0;
+		for (u32 i = 0; i < count; i += 3)
+		{
+			u32 a = remap[destination[i + 0]];
+			u32 b = remap[destination[i + 1]];
+			u32 c = remap[destination[i + 2]];
+			if (a != b && b != c && c != a)
+			{
+				destination[newCount++] = a;
+				destination[newCount++] = b;
+				destination[newCount++] = c;
+			}
+		}
+		count = newCount;
+	}
+
+	if (resultError)
+		*resultError = (f32)sqrt(maxError);
+	return count;
+}
+
+void GenerateLodChain(std::vector<u32>& indices, const vec3* positions, u32 vertexCount, std::vector<MeshLod>& lods)
+{
+	const u32 indexCount = (u32)indices.size();
+	lods.clear();
+	lods.push_back(MeshLod{ 0, indexCount, 0.0f, 0, 0 });
+
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	for (u32 i = 0; i < indexCount; ++i)
+	{
+		boundsMin = glm::min(boundsMin, positions[indices[i]]);
+		boundsMax = glm::max(boundsMax, positions[indices[i]]);
+	}
+	vec3 boundsExtent = boundsMax - boundsMin;
+	f32 extent = glm::max(glm::max(boundsExtent.x, boundsExtent.y), boundsExtent.z);
+
+	// Every level is simplified from the full resolution triangles so errors do not stack
+	std::vector<u32> simplified(indexCount);
+	std::vector<u32> cacheOptimized(indexCount);
+	u32 previousCount = indexCount;
+	for (u32 lod = 1; lod < MAX_MESH_LODS; ++lod)
+	{
+		u32 targetCount = (u32)(previousCount * LOD_REDUCTION_RATIO) / 3 * 3;
+		if (targetCount < LOD_MIN_TRIANGLES * 3)
+			break;
+
+		f32 error = 0.0f;
+		u32 count = SimplifyMesh(simplified.data(), indices.data(), indexCount, positions, vertexCount, targetCount, LOD_MAX_ERROR, &error);
+		if (count == 0 || count > previousCount * LOD_MIN_REDUCTION)
+			break;
+
+		OptimizeVertexCache(cacheOptimized.data(), simplified.data(), count, vertexCount);
+		lods.push_back(MeshLod{ (u32)indices.size(), count, error * extent, 0, 0 });
+		indices.insert(indices.end(), cacheOptimized.begin(), cacheOptimized.begin() + count);
+		previousCount = count;
+	}
+}
+
+static Meshlet ComputeMeshletBounds(const u32* indices, u32 firstIndex, u32 indexCount, const vec3* positions)
+{
+	Meshlet meshlet = {};
+	meshlet.firstIndex = firstIndex;
+	meshlet.indexCount = indexCount;
+
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	vec3 normalSum = vec3(0.0f);
+	for (u32 i = firstIndex; i < firstIndex + indexCount; i += 3)
+	{
+		vec3 p0 = positions[indices[i + 0]];
+		vec3 p1 = positions[indices[i + 1]];
+		vec3 p2 = positions[indices[i + 2]];
+		boundsMin = glm::min(glm::min(boundsMin, p0), glm::min(p1, p2));
+		boundsMax = glm::max(glm::max(boundsMax, p0), glm::max(p1, p2));
+
+		vec3 normal = glm::cross(p1 - p0, p2 - p0);
+		f32 length = glm::length(normal);
+		if (length > 0.0f)
+			normalSum += normal / length;
+	}
+
+	meshlet.center = (boundsMin + boundsMax) * 0.5f;
+	for (u32 i = firstIndex; i < firstIndex + indexCount; ++i)
+		meshlet.radius = glm::max(meshlet.radius, glm::length(positions[indices[i]] - meshlet.center));
+
+	// The cone must contain every triangle normal, its cutoff comes from the widest one
+	f32 axisLength = glm::length(normalSum);
+	meshlet.coneAxis = axisLength > 0.0f ? normalSum / axisLength : vec3(0.0f, 0.0f, 1.0f);
+	f32 minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+	for (u32 i = firstIndex; i < firstIndex + indexCount && minDot > 0.0f; i += 3)
+	{
+		vec3 p0 = positions[indices[i + 0]];
+		vec3 normal = glm::cross(positions[indices[i + 1]] - p0, positions[indices[i + 2]] - p0);
+		f32 length = glm::length(normal);
+		if (length > 0.0f)
+			minDot = glm::min(minDot, glm::dot(normal / length, meshlet.coneAxis));
+	}
+
+	// Past ~85 degrees of spread the test would practically never cull anything
+	meshlet.coneCutoff = minDot <= 0.1f ? 1.0f : sqrtf(1.0f - minDot * minDot);
+	return meshlet;
+}
+
+void BuildMeshlets(const u32* indices, u32 firstIndex, u32 indexCount, const vec3* positions, u32 vertexCount, std::vector<Meshlet>& meshlets)
+{
+	// Stamp of the meshlet that last used each vertex, to count unique vertices
+	std::vector<u32> vertexStamp(vertexCount, UINT32_MAX);
+	u32 stamp = 0;
+
+	u32 meshletStart = firstIndex;
+	u32 meshletVertices = 0;
+	const u32 end = firstIndex + indexCount;
+	for (u32 i = firstIndex; i < end; i += 3)
+	{
+		u32 newVertices = 0;
+		for (u32 k = 0; k < 3; ++k)
+			newVertices += vertexStamp[indices[i + k]] != stamp ? 1 : 0;
+
+		u32 meshletTriangles = (i - meshletStart) / 3;
+		if (meshletVertices + newVertices > MESHLET_MAX_VERTICES || meshletTriangles + 1 > MESHLET_MAX_TRIANGLES)
+		{
+			meshlets.push_back(ComputeMeshletBounds(indices, meshletStart, i - meshletStart, positions));
+			meshletStart = i;
+			meshletVertices = 0;
+			stamp++;
+		}
+
+		for (u32 k = 0; k < 3; ++k)
+		{
+			u32 v = indices[i + k];
+			if (vertexStamp[v] != stamp)
+			{
+				vertexStamp[v] = stamp;
+				meshletVertices++;
+			}
+		}
+	}
+
+	if (meshletStart < end)
+		meshlets.push_back(ComputeMeshletBounds(indices, meshletStart, end - meshletStart, positions));
+}
@@ -0,0 +1,121 @@
+//
+// mesh_processing.h : CPU-only geometry processing run at import time (triangle and
+// vertex reordering, analysis...). It works on plain index/position arrays so it does
+// not depend on the graphics API.
+//
+
+#pragma once
+
+#include "platform.h"
+
+typedef glm::vec3 vec3;
+
+// Size of the FIFO post-transform cache simulated by the analysis functions
+#define VERTEX_CACHE_ANALYSIS_SIZE 16
+
+// Resolution of the software rasterizer used to estimate overdraw
+#define OVERDRAW_ANALYSIS_RESOLUTION 256
+
+/**
+ * Counters gathered while optimizing, summed over submeshes so the ratios can be
+ * computed for a whole model: ACMR = misses / triangles, ATVR = misses / vertices,
+ * overdraw = shaded pixels / covered pixels.
+ */
+struct MeshOptimizationStats
+{
+	u64 triangleCount;
+	u64 vertexCountBefore;
+	u64 vertexCountAfter;
+	u64 cacheMissesBefore;
+	u64 cacheMissesAfter;
+	u64 pixelsCovered;
+	u64 pixelsShadedBefore;
+	u64 pixelsShadedAfter;
+};
+
+/**
+ * Runs the whole pipeline on a triangle list: vertex cache reordering, overdraw
+ * aware cluster sorting and vertex fetch remapping. The indices are rewritten in
+ * place and remap receives, for each new vertex, the index of the source vertex it
+ * comes from. Returns the number of vertices referenced by the indices.
+ */
+u32 OptimizeMesh(std::vector<u32>& indices, const vec3* positions, u32 vertexCount, std::vector<u32>& remap, MeshOptimizationStats* stats);
+
+/**
+ * Reorders triangles for a post-transform vertex cache (Forsyth's linear speed
+ * algorithm with an LRU cache of 32 entries). destination must not alias indices.
+ */
+void OptimizeVertexCache(u32* destination, const u32* indices, u32 indexCount, u32 vertexCount);
+
+/**
+ * Splits a cache optimized triangle list into clusters and sorts them so the ones
+ * facing out of the mesh go first, which lets the depth test reject more of the rest.
+ * threshold is the ACMR degradation allowed to get smaller clusters (e.g. 1.05).
+ */
+void OptimizeOverdraw(u32* destination, const u32* indices, u32 indexCount, const vec3* positions, u32 vertexCount, f32 threshold);
+
+/**
+ * Renumbers vertices in the order the indices first reference them, so they are
+ * fetched linearly. Fills remap (old -> new, UINT32_MAX for unused vertices),
+ * rewrites the indices and returns the number of used vertices.
+ */
+u32 OptimizeVertexFetchRemap(u32* remap, u32* indices, u32 indexCount, u32 vertexCount);
+
+u32  AnalyzeVertexCache(const u32* indices, u32 indexCount, u32 vertexCount, u32 cacheSize);
+void AnalyzeOverdraw(const u32* indices, u32 indexCount, const vec3* positions, u64* pixelsCovered, u64* pixelsShaded);
+
+// Maximum number of levels of detail per submesh, the full resolution one included
+#define MAX_MESH_LODS 5
+
+struct MeshLod
+{
+	u32 firstIndex;	// Relative to the submesh indices
+	u32 indexCount;
+	f32 error;		// Largest deviation from the full resolution surface, in model units
+	u32 firstMeshlet;
+	u32 meshletCount;
+};
+
+/**
+ * Quadric error edge collapse (Garland-Heckbert) that only moves vertices onto other
+ * existing vertices, so every LOD can index the same vertex buffer. Vertices on open
+ * edges are locked, which keeps mesh borders and attribute seams (split vertices)
+ * from cracking. Stops at targetIndexCount or when the next collapse would exceed
+ * targetError (relative to the mesh extent). Returns the resulting index count and
+ * the relative error reached in resultError: the worst collapse's area weighted RMS
+ * distance to the planes of the source triangles it merged.
+ */
+u32 SimplifyMesh(u32* destination, const u32* indices, u32 indexCount, const vec3* positions, u32 vertexCount, u32 targetIndexCount, f32 targetError, f32* resultError);
+
+/**
+ * Appends up to MAX_MESH_LODS - 1 simplified versions of the triangle list to indices,
+ * halving the triangle count each time, and describes every level in lods (the
+ * original triangles are lods[0]). Levels that barely simplify are not generated.
+ */
+void GenerateLodChain(std::vector<u32>& indices, const vec3* positions, u32 vertexCount, std::vector<MeshLod>& lods);
+
+// Meshlets are cut so that they fit the usual mesh shader limits
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+/**
+ * A small cluster of triangles with the bounds needed to cull it: a bounding sphere
+ * and a normal cone. The cone test (see CullMeshlets) rejects the meshlet when the
+ * camera sees all of its triangles from behind.
+ */
+struct Meshlet
+{
+	vec3 center;
+	f32  radius;
+	vec3 coneAxis;
+	f32  coneCutoff;	// Sine of the cone spread, 1 when the triangles face too many directions
+	u32  firstIndex;	// Relative to the submesh indices
+	u32  indexCount;
+};
+
+/**
+ * Cuts indices[firstIndex, firstIndex + indexCount) into meshlets, appended to meshlets.
+ * Triangles are kept in order (they are expected to be cache optimized, which makes
+ * consecutive triangles close to each other), so a meshlet is just an index range.
+ */
+void BuildMeshlets(const u32* indices, u32 firstIndex, u32 indexCount, const vec3* positions, u32 vertexCount, std::vector<Meshlet>& meshlets);
@@ -13,6 +13,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <dirent.h>
 #endif
 
 #include "engine.h"
@@ -33,14 +34,36 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+#include <deque>
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  800
 #define WINDOW_HEIGHT 600
 
-#define GLOBAL_FRAME_ARENA_SIZE MB(16)
-u8* GlobalFrameArenaMemory = NULL;
-u32 GlobalFrameArenaHead = 0;
+#define GLOBAL_FRAME_ARENA_SIZE       MB(16)
+#define GLOBAL_PERSISTENT_ARENA_SIZE  MB(4)
+#define THREAD_SCRATCH_ARENA_SIZE     MB(1)
+
+Arena GlobalFrameArena = {};
+Arena GlobalPersistentArena = {};
+
+// Set on the main thread to the frame arena, NULL elsewhere (falls back to the scratch arena)
+thread_local Arena* ThreadTempArena = NULL;
+
+// Shared contexts are created from it
+static GLFWwindow* MainWindow = NULL;
+
+// Registry of live arenas and pools for the stats window
+std::mutex          GlobalMemoryRegistryMutex;
+std::vector<Arena*> GlobalArenas;
+std::vector<Pool*>  GlobalPools;
 
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
@@ -125,13 +148,222 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+// Frame pipeline ==============================================================================
+// The main thread polls input, runs the GUI and Update into a FrameSnapshot. Without the
+// render thread it then renders the snapshot itself; with it, the snapshot is queued and
+// the render thread, which owns the GL context, submits and presents it while the main
+// thread goes on with the next frame. The main thread blocks when app.frameQueueDepth
+// snapshots are already waiting or rendering.
+
+struct PipelineFrame
+{
+    FrameSnapshot            snapshot;
+
+    // Copy of the GUI draw data, ImGui reuses its own lists on the next NewFrame
+    ImDrawData               imguiDrawData;
+    std::vector<ImDrawList*> imguiDrawLists;
+};
+
+struct FramePipeline
+{
+    GLFWwindow*                 window;
+    App*                        app;
+    PipelineFrame               frames[MAX_FRAME_QUEUE_DEPTH + 1];
+
+    std::mutex                  mutex;
+    std::condition_variable     frameQueued;
+    std::condition_variable     frameReleased;
+    std::deque<PipelineFrame*>  freeFrames;
+    std::deque<PipelineFrame*>  queuedFrames;
+    bool                        stopping;
+
+    std::thread                 renderThread;
+};
+
+static void CopyImGuiDrawData(PipelineFrame* frame, ImDrawData* drawData)
+{
+    for (ImDrawList* list : frame->imguiDrawLists)
+        IM_DELETE(list);
+    frame->imguiDrawLists.clear();
+
+    for (int i = 0; i < drawData->CmdListsCount; ++i)
+        frame->imguiDrawLists.push_back(drawData->CmdLists[i]->CloneOutput());
+
+    frame->imguiDrawData = *drawData;
+    frame->imguiDrawData.CmdLists = frame->imguiDrawLists.data();
+}
+
+static void RenderPipelineFrame(FramePipeline* pipeline, PipelineFrame* frame)
+{
+    f64 renderStartTime = glfwGetTime();
+
+    Render(pipeline->app, &frame->snapshot);
+
+    ImGui_ImplOpenGL3_RenderDrawData(&frame->imguiDrawData);
+
+    // Platform windows are created and drawn by the main thread, they are turned off with the render thread
+    if (!pipeline->app->useRenderThread && (ImGui::GetIO().ConfigFlags & ImGuiConfigFlags_ViewportsEnable)) {
+        GLFWwindow* backup_current_context = glfwGetCurrentContext();
+        ImGui::UpdatePlatformWindows();
+        ImGui::RenderPlatformWindowsDefault();
+        glfwMakeContextCurrent(backup_current_context);
+    }
+
+    // Present image on screen
+    glfwSwapBuffers(pipeline->window);
+
+    f64 presentTime = glfwGetTime();
+    frame->snapshot.stats.renderMilliseconds = (presentTime - renderStartTime) * 1000.0;
+    frame->snapshot.stats.latencyMilliseconds = (presentTime - frame->snapshot.inputTime) * 1000.0;
+}
+
+static void RenderThreadMain(FramePipeline* pipeline)
+{
+    glfwMakeContextCurrent(pipeline->window);
+
+    for (;;)
+    {
+        PipelineFrame* frame = NULL;
+        {
+            std::unique_lock<std::mutex> lock(pipeline->mutex);
+            pipeline->frameQueued.wait(lock, [pipeline]() { return !pipeline->queuedFrames.empty() || pipeline->stopping; });
+            if (pipeline->queuedFrames.empty())
+                break;
+            frame = pipeline->queuedFrames.front();
+            pipeline->queuedFrames.pop_front();
+        }
+
+        RenderPipelineFrame(pipeline, frame);
+
+        {
+            std::lock_guard<std::mutex> lock(pipeline->mutex);
+            pipeline->freeFrames.push_back(frame);
+        }
+        pipeline->frameReleased.notify_one();
+    }
+
+    glfwMakeContextCurrent(NULL);
+}
+
+static void StartFramePipeline(FramePipeline* pipeline, GLFWwindow* window, App* app)
+{
+    pipeline->window = window;
+    pipeline->app = app;
+    pipeline->stopping = false;
+    app->frameQueueDepth = glm::clamp(app->frameQueueDepth, 1u, (u32)MAX_FRAME_QUEUE_DEPTH);
+
+    // One frame being filled by the main thread plus the ones queued or rendering
+    u32 frameCount = app->useRenderThread ? app->frameQueueDepth + 1 : 1;
+    for (u32 i = 0; i < frameCount; ++i)
+        pipeline->freeFrames.push_back(&pipeline->frames[i]);
+
+    if (app->useRenderThread)
+    {
+        // Creates the GUI font texture while the context is still current here
+        ImGui_ImplOpenGL3_NewFrame();
+
+        glfwMakeContextCurrent(NULL);
+        pipeline->renderThread = std::thread(RenderThreadMain, pipeline);
+    }
+}
+
+static void StopFramePipeline(FramePipeline* pipeline)
+{
+    if (pipeline->renderThread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(pipeline->mutex);
+            pipeline->stopping = true;
+        }
+        pipeline->frameQueued.notify_one();
+        pipeline->renderThread.join();
+
+        glfwMakeContextCurrent(pipeline->window);
+    }
+
+    for (PipelineFrame& frame : pipeline->frames)
+        for (ImDrawList* list : frame.imguiDrawLists)
+            IM_DELETE(list);
+}
+
+// Waits for a frame the render side is done with and hands its stats to the app
+static PipelineFrame* AcquirePipelineFrame(FramePipeline* pipeline)
+{
+    PipelineFrame* frame = NULL;
+    {
+        std::unique_lock<std::mutex> lock(pipeline->mutex);
+        pipeline->frameReleased.wait(lock, [pipeline]() { return !pipeline->freeFrames.empty(); });
+        frame = pipeline->freeFrames.front();
+        pipeline->freeFrames.pop_front();
+    }
+
+    App* app = pipeline->app;
+    if (frame->snapshot.inputTime > 0.0)
+    {
+        app->renderStats = frame->snapshot.stats;
+        app->averageLatencyMilliseconds = app->averageLatencyMilliseconds > 0.0 ?
+            glm::mix(app->averageLatencyMilliseconds, frame->snapshot.stats.latencyMilliseconds, 0.1) :
+            frame->snapshot.stats.latencyMilliseconds;
+    }
+    return frame;
+}
+
+static void SubmitPipelineFrame(FramePipeline* pipeline, PipelineFrame* frame)
+{
+    if (!pipeline->app->useRenderThread)
+    {
+        RenderPipelineFrame(pipeline, frame);
+        pipeline->freeFrames.push_back(frame);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pipeline->mutex);
+        pipeline->queuedFrames.push_back(frame);
+    }
+    pipeline->frameQueued.notify_one();
+}
+
+// The asset cooker has its own entry point, see cooker.cpp
+#ifndef ASSET_COOKER
+
+// Startup options that must be known before the window and the frame pipeline exist
+static bool ParseCommandLine(int argc, char** argv, App* app)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-renderthread") == 0)
+        {
+            app->useRenderThread = true;
+        }
+        else if (strcmp(argv[i], "-queuedepth") == 0 && i + 1 < argc)
+        {
+            int depth = atoi(argv[++i]);
+            if (depth < 1 || depth > MAX_FRAME_QUEUE_DEPTH)
+                return false;
+            app->frameQueueDepth = (u32)depth;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
 {
     App app = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    if (!ParseCommandLine(argc, argv, &app))
+    {
+        ELOG("Usage: Engine [-renderthread] [-queuedepth 1-%d]", MAX_FRAME_QUEUE_DEPTH);
+        return -1;
+    }
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
@@ -153,6 +385,7 @@ int main()
     }
 
     glfwSetWindowUserPointer(window, &app);
+    MainWindow = window;
 
     glfwSetMouseButtonCallback(window, OnGlfwMouseEvent);
     glfwSetCursorPosCallback(window, OnGlfwMouseMoveEvent);
@@ -178,7 +411,8 @@ int main()
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableKeyboard;       // Enable Keyboard Controls
     //io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;      // Enable Gamepad Controls
     io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;           // Enable Docking
-    io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;         // Enable Multi-Viewport / Platform Windows
+    if (!app.useRenderThread)
+        io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;     // Enable Multi-Viewport / Platform Windows
     //io.ConfigViewportsNoAutoMerge = true;
     //io.ConfigViewportsNoTaskBarIcon = true;
 
@@ -208,17 +442,27 @@ int main()
 
     f64 lastFrameTime = glfwGetTime();
 
-    GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
+    InitArena(&GlobalFrameArena, "Frame", GLOBAL_FRAME_ARENA_SIZE);
+    InitArena(&GlobalPersistentArena, "Persistent", GLOBAL_PERSISTENT_ARENA_SIZE);
+    ThreadTempArena = &GlobalFrameArena;
+
+    InitJobSystem(0);
 
     Init(&app);
 
+    FramePipeline* pipeline = new FramePipeline();
+    StartFramePipeline(pipeline, window, &app);
+
     while (app.isRunning)
     {
+        f64 inputTime = glfwGetTime();
+
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
 
         // ImGui
-        ImGui_ImplOpenGL3_NewFrame();
+        if (!app.useRenderThread)
+            ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         Gui(&app);
@@ -234,7 +478,10 @@ int main()
                 app.input.mouseButtons[i] = BUTTON_IDLE;
 
         // Update
-        Update(&app);
+        PipelineFrame* frame = AcquirePipelineFrame(pipeline);
+        frame->snapshot.inputTime = inputTime;
+        Update(&app, &frame->snapshot);
+        CopyImGuiDrawData(frame, ImGui::GetDrawData());
 
         // Transition input key/button states
         if (!ImGui::GetIO().WantCaptureKeyboard)
@@ -249,20 +496,10 @@ int main()
 
         app.input.mouseDelta = glm::vec2(0.0f, 0.0f);
 
-        // Render
-        Render(&app);
-
-        // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-        if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
-            GLFWwindow* backup_current_context = glfwGetCurrentContext();
-            ImGui::UpdatePlatformWindows();
-            ImGui::RenderPlatformWindowsDefault();
-            glfwMakeContextCurrent(backup_current_context);
-        }
+        app.simulationMilliseconds = (glfwGetTime() - inputTime) * 1000.0;
 
-        // Present image on screen
-        glfwSwapBuffers(window);
+        // Render, here or on the render thread
+        SubmitPipelineFrame(pipeline, frame);
 
         // Frame time
         f64 currentFrameTime = glfwGetTime();
@@ -270,10 +507,13 @@ int main()
         lastFrameTime = currentFrameTime;
 
         // Reset frame allocator
-        GlobalFrameArenaHead = 0;
+        ResetArena(&GlobalFrameArena);
     }
 
-    free(GlobalFrameArenaMemory);
+    StopFramePipeline(pipeline);
+    delete pipeline;
+
+    Shutdown(&app);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
@@ -282,8 +522,14 @@ int main()
 
     glfwTerminate();
 
+    ShutdownJobSystem();
+
+    FreeArena(&GlobalFrameArena);
+    FreeArena(&GlobalPersistentArena);
+
     return 0;
 }
+#endif // !ASSET_COOKER
 
 u32 Strlen(const char* string)
 {
@@ -292,45 +538,256 @@ u32 Strlen(const char* string)
     return len;
 }
 
-void* PushSize(u32 byteCount)
+static ArenaBlock* AllocateArenaBlock(Arena* arena, u64 size)
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-           "Trying to allocate more temp memory than available");
+    ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + size);
+    ASSERT(block, "Out of memory allocating an arena block");
+    block->prev = arena->block;
+    block->size = size;
+    block->used = 0;
+
+    arena->block = block;
+    arena->blockCount++;
+    arena->reserved += size;
+    return block;
+}
 
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    return curPtr;
+static void FreeLastArenaBlock(Arena* arena)
+{
+    ArenaBlock* block = arena->block;
+    arena->block = block->prev;
+    arena->blockCount--;
+    arena->reserved -= block->size;
+    free(block);
 }
 
-void* PushBytes(const void* bytes, u32 byteCount)
+static u64 GetAlignedOffset(ArenaBlock* block, u64 alignment)
 {
-    ASSERT(GlobalFrameArenaHead + byteCount <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
+    u64 address = (u64)(block + 1) + block->used;
+    u64 alignedAddress = (address + alignment - 1) & ~(alignment - 1);
+    return block->used + (alignedAddress - address);
+}
 
-    u8* srcPtr = (u8*)bytes;
-    u8* curPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    u8* dstPtr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead += byteCount;
-    while (byteCount--) *dstPtr++ = *srcPtr++;
-    return curPtr;
+void InitArena(Arena* arena, const char* name, u64 minBlockSize)
+{
+    *arena = {};
+    arena->name = name;
+    arena->minBlockSize = minBlockSize;
+    AllocateArenaBlock(arena, minBlockSize);
+
+    std::lock_guard<std::mutex> lock(GlobalMemoryRegistryMutex);
+    GlobalArenas.push_back(arena);
 }
 
-u8* PushChar(u8 c)
+void FreeArena(Arena* arena)
 {
-    ASSERT(GlobalFrameArenaHead + 1 <= GLOBAL_FRAME_ARENA_SIZE,
-            "Trying to allocate more temp memory than available");
-    u8* ptr = GlobalFrameArenaMemory + GlobalFrameArenaHead;
-    GlobalFrameArenaHead++;
-    *ptr = c;
+    {
+        std::lock_guard<std::mutex> lock(GlobalMemoryRegistryMutex);
+        GlobalArenas.erase(std::remove(GlobalArenas.begin(), GlobalArenas.end(), arena), GlobalArenas.end());
+    }
+
+    while (arena->block)
+        FreeLastArenaBlock(arena);
+    *arena = {};
+}
+
+void* PushSize(Arena* arena, u64 size, u64 alignment)
+{
+    ASSERT((alignment & (alignment - 1)) == 0, "Arena alignment must be a power of two");
+
+    ArenaBlock* block = arena->block;
+    u64 offset = block ? GetAlignedOffset(block, alignment) : 0;
+    if (!block || offset + size > block->size)
+    {
+        // Chain a new block big enough for this request, the old one keeps its contents
+        u64 blockSize = glm::max(arena->minBlockSize, size + alignment);
+        block = AllocateArenaBlock(arena, blockSize);
+        offset = GetAlignedOffset(block, alignment);
+    }
+
+    u8* ptr = (u8*)(block + 1) + offset;
+    arena->used += offset + size - block->used;
+    block->used = offset + size;
+
+    arena->highWaterMark = glm::max(arena->highWaterMark, arena->used);
+    arena->allocationCount++;
+    arena->totalAllocationCount++;
     return ptr;
 }
 
+void* PushBytes(Arena* arena, const void* bytes, u64 size)
+{
+    void* ptr = PushSize(arena, size, 1);
+    memcpy(ptr, bytes, size);
+    return ptr;
+}
+
+void ResetArena(Arena* arena)
+{
+    arena->usedAtLastReset = arena->used;
+    arena->allocationCountAtLastReset = arena->allocationCount;
+
+    if (arena->blockCount > 1)
+    {
+        // This round did not fit in one block: merge them so the next one does
+        u64 totalSize = arena->reserved;
+        while (arena->block)
+            FreeLastArenaBlock(arena);
+        AllocateArenaBlock(arena, totalSize);
+    }
+    else if (arena->block)
+    {
+        arena->block->used = 0;
+    }
+
+    arena->used = 0;
+    arena->allocationCount = 0;
+}
+
+TemporaryMemory BeginTemporaryMemory(Arena* arena)
+{
+    TemporaryMemory temp = {};
+    temp.arena = arena;
+    temp.block = arena->block;
+    temp.blockUsed = arena->block ? arena->block->used : 0;
+    temp.used = arena->used;
+    return temp;
+}
+
+void EndTemporaryMemory(TemporaryMemory temp)
+{
+    Arena* arena = temp.arena;
+    while (arena->block != temp.block)
+        FreeLastArenaBlock(arena);
+
+    if (arena->block)
+        arena->block->used = temp.blockUsed;
+    arena->used = temp.used;
+}
+
+Arena* GetFrameArena()
+{
+    return &GlobalFrameArena;
+}
+
+Arena* GetPersistentArena()
+{
+    return &GlobalPersistentArena;
+}
+
+struct ThreadScratchArena
+{
+    Arena arena;
+    char  name[32];
+
+    ThreadScratchArena()
+    {
+        static std::atomic<u32> threadCount(0);
+        sprintf(name, "Thread scratch %u", threadCount++);
+        InitArena(&arena, name, THREAD_SCRATCH_ARENA_SIZE);
+    }
+
+    ~ThreadScratchArena()
+    {
+        FreeArena(&arena);
+    }
+};
+
+Arena* GetThreadScratchArena()
+{
+    static thread_local ThreadScratchArena scratch;
+    return &scratch.arena;
+}
+
+Arena* GetTempArena()
+{
+    return ThreadTempArena ? ThreadTempArena : GetThreadScratchArena();
+}
+
+void InitPool(Pool* pool, const char* name, u32 elementSize, u32 elementsPerBlock)
+{
+    *pool = {};
+    pool->name = name;
+    // Free elements store the next pointer in place
+    pool->elementSize = (u32)glm::max((u64)elementSize, (u64)sizeof(void*));
+    pool->elementSize = (pool->elementSize + 15) & ~15u;
+    pool->elementsPerBlock = elementsPerBlock;
+
+    std::lock_guard<std::mutex> lock(GlobalMemoryRegistryMutex);
+    GlobalPools.push_back(pool);
+}
+
+void* PoolAlloc(Pool* pool)
+{
+    if (!pool->freeList)
+    {
+        u8* block = (u8*)PushSize(&GlobalPersistentArena, (u64)pool->elementSize * pool->elementsPerBlock, 16);
+        for (u32 i = pool->elementsPerBlock; i > 0; --i)
+        {
+            void* element = block + (u64)(i - 1) * pool->elementSize;
+            *(void**)element = pool->freeList;
+            pool->freeList = element;
+        }
+        pool->capacity += pool->elementsPerBlock;
+    }
+
+    void* element = pool->freeList;
+    pool->freeList = *(void**)element;
+
+    pool->liveCount++;
+    pool->highWaterMark = glm::max(pool->highWaterMark, pool->liveCount);
+    pool->totalAllocationCount++;
+    return element;
+}
+
+void PoolFree(Pool* pool, void* element)
+{
+    ASSERT(pool->liveCount > 0, "Freeing more elements than allocated from the pool");
+    *(void**)element = pool->freeList;
+    pool->freeList = element;
+    pool->liveCount--;
+}
+
+void GetMemoryStats(std::vector<MemoryStats>& stats)
+{
+    // NOTE: Other threads' arena counters are read unsynchronized, they are only meant for display
+    std::lock_guard<std::mutex> lock(GlobalMemoryRegistryMutex);
+
+    for (Arena* arena : GlobalArenas)
+    {
+        MemoryStats arenaStats = {};
+        arenaStats.name = arena->name;
+        arenaStats.used = arena->used;
+        arenaStats.reserved = arena->reserved;
+        arenaStats.highWaterMark = arena->highWaterMark;
+        arenaStats.lastFrameUsed = arena->usedAtLastReset;
+        arenaStats.lastFrameAllocationCount = arena->allocationCountAtLastReset;
+        arenaStats.totalAllocationCount = arena->totalAllocationCount;
+        arenaStats.blockCount = arena->blockCount;
+        stats.push_back(arenaStats);
+    }
+
+    for (Pool* pool : GlobalPools)
+    {
+        MemoryStats poolStats = {};
+        poolStats.name = pool->name;
+        poolStats.isPool = true;
+        poolStats.used = pool->liveCount;
+        poolStats.reserved = pool->capacity;
+        poolStats.highWaterMark = pool->highWaterMark;
+        poolStats.totalAllocationCount = pool->totalAllocationCount;
+        poolStats.blockCount = pool->capacity / glm::max(pool->elementsPerBlock, 1u);
+        stats.push_back(poolStats);
+    }
+}
+
 String MakeString(const char *cstr)
 {
     String str = {};
     str.len = Strlen(cstr);
-    str.str = (char*)PushBytes(cstr, str.len);
-              PushChar(0);
+    str.str = (char*)PushSize(GetTempArena(), str.len + 1, 1);
+    memcpy(str.str, cstr, str.len);
+    str.str[str.len] = 0;
     return str;
 }
 
@@ -338,10 +795,11 @@ String MakePath(String dir, String filename)
 {
     String str = {};
     str.len = dir.len + filename.len + 1;
-    str.str = (char*)PushBytes(dir.str, dir.len);
-              PushChar('/');
-              PushBytes(filename.str, filename.len);
-              PushChar(0);
+    str.str = (char*)PushSize(GetTempArena(), str.len + 1, 1);
+    memcpy(str.str, dir.str, dir.len);
+    str.str[dir.len] = '/';
+    memcpy(str.str + dir.len + 1, filename.str, filename.len);
+    str.str[str.len] = 0;
     return str;
 }
 
@@ -354,9 +812,10 @@ String GetDirectoryPart(String path)
         if (path.str[len] == '/' || path.str[len] == '\\')
             break;
     }
-    str.len = (u32)len;
-    str.str = (char*)PushBytes(path.str, str.len);
-              PushChar(0);
+    str.len = (u32)glm::max(len, 0);
+    str.str = (char*)PushSize(GetTempArena(), str.len + 1, 1);
+    memcpy(str.str, path.str, str.len);
+    str.str[str.len] = 0;
     return str;
 }
 
@@ -372,7 +831,7 @@ String ReadTextFile(const char* filepath)
         fileText.len = ftell(file);
         fseek(file, 0, SEEK_SET);
 
-        fileText.str = (char*)PushSize(fileText.len + 1);
+        fileText.str = (char*)PushSize(GetTempArena(), fileText.len + 1, 1);
         fread(fileText.str, sizeof(char), fileText.len, file);
         fileText.str[fileText.len] = '\0';
 
@@ -386,6 +845,20 @@ String ReadTextFile(const char* filepath)
     return fileText;
 }
 
+bool WriteBinaryFile(const char* filepath, const void* data, u64 size)
+{
+    FILE* file = fopen(filepath, "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing file %s", filepath);
+        return false;
+    }
+
+    bool written = fwrite(data, 1, size, file) == size;
+    fclose(file);
+    return written;
+}
+
 u64 GetFileLastWriteTimestamp(const char* filepath)
 {
 #ifdef _WIN32
@@ -410,6 +883,82 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+static void ListDirectoryFiles(const std::string& directory, const std::string& prefix, std::vector<std::string>& filepaths)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        if (strcmp(data.cFileName, ".") == 0 || strcmp(data.cFileName, "..") == 0)
+            continue;
+
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            ListDirectoryFiles(directory + "/" + data.cFileName, prefix + data.cFileName + "/", filepaths);
+        else
+            filepaths.push_back(prefix + data.cFileName);
+    } while (FindNextFileA(find, &data));
+
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir)
+        return;
+
+    while (dirent* entry = readdir(dir))
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        struct stat attrib;
+        std::string path = directory + "/" + entry->d_name;
+        if (stat(path.c_str(), &attrib) != 0)
+            continue;
+
+        if (S_ISDIR(attrib.st_mode))
+            ListDirectoryFiles(path, prefix + entry->d_name + "/", filepaths);
+        else
+            filepaths.push_back(prefix + entry->d_name);
+    }
+
+    closedir(dir);
+#endif
+}
+
+void ListDirectoryFiles(const char* directory, std::vector<std::string>& filepaths)
+{
+    ListDirectoryFiles(std::string(directory), std::string(), filepaths);
+}
+
+void* GetOpenGLProcAddress(const char* procName)
+{
+    return (void*)glfwGetProcAddress(procName);
+}
+
+void* CreateSharedOpenGLContext()
+{
+    // A hidden window, GLFW has no context without one
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = glfwCreateWindow(1, 1, "Shared context", NULL, MainWindow);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!window)
+        ELOG("glfwCreateWindow() failed for a shared context");
+    return window;
+}
+
+void MakeOpenGLContextCurrent(void* context)
+{
+    glfwMakeContextCurrent((GLFWwindow*)context);
+}
+
+void DestroySharedOpenGLContext(void* context)
+{
+    glfwDestroyWindow((GLFWwindow*)context);
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
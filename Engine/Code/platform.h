@@ -26,6 +26,7 @@
 
 #include <vector>
 #include <string>
+#include <new>
 
 #pragma warning(disable : 4267) // conversion from X to Y, possible loss of data
 
@@ -69,6 +70,143 @@ struct Input {
     ButtonState keys[KEY_COUNT];
 };
 
+/**
+ * Arenas are linear allocators made of a chain of malloc'ed blocks. Allocating is a
+ * pointer bump; when the current block is full a new one is chained instead of failing,
+ * so an unexpectedly large request (e.g. a big ReadTextFile) only costs an extra malloc.
+ * Memory is released all at once with ResetArena or back to a TemporaryMemory marker.
+ * An arena is not thread safe: each thread works on its own (see GetThreadScratchArena).
+ */
+struct ArenaBlock
+{
+    ArenaBlock* prev;
+    u64         size;
+    u64         used;
+    u64         padding; // Keeps the memory after the header 16 byte aligned
+};
+
+struct Arena
+{
+    const char* name;
+    ArenaBlock* block;          // Current block, older ones are reachable through prev
+    u64         minBlockSize;
+    u32         blockCount;
+
+    // Stats
+    u64 used;                   // Bytes handed out (alignment padding included)
+    u64 reserved;               // Bytes malloc'ed for the blocks
+    u64 highWaterMark;          // Peak of used since the arena was created
+    u64 usedAtLastReset;
+    u32 allocationCount;        // Since the last reset
+    u32 allocationCountAtLastReset;
+    u64 totalAllocationCount;
+};
+
+struct TemporaryMemory
+{
+    Arena*      arena;
+    ArenaBlock* block;
+    u64         blockUsed;
+    u64         used;
+};
+
+void  InitArena(Arena* arena, const char* name, u64 minBlockSize);
+void  FreeArena(Arena* arena);
+
+void* PushSize(Arena* arena, u64 size, u64 alignment = 8);
+void* PushBytes(Arena* arena, const void* bytes, u64 size);
+
+#define PushStruct(arena, type)       ((type*)PushSize(arena, sizeof(type), alignof(type)))
+#define PushArray(arena, type, count) ((type*)PushSize(arena, sizeof(type)*(count), alignof(type)))
+
+/**
+ * Frees everything allocated from the arena. If it had to chain blocks since the
+ * last reset they are merged into a single one, so the next round fits without chaining.
+ */
+void  ResetArena(Arena* arena);
+
+/**
+ * Markers for nested temporary use: everything pushed after BeginTemporaryMemory
+ * is released by the matching EndTemporaryMemory. They must be ended in LIFO order.
+ */
+TemporaryMemory BeginTemporaryMemory(Arena* arena);
+void            EndTemporaryMemory(TemporaryMemory temp);
+
+struct ScopedTemporaryMemory
+{
+    TemporaryMemory temp;
+
+    ScopedTemporaryMemory(Arena* arena) : temp(BeginTemporaryMemory(arena)) {}
+    ~ScopedTemporaryMemory() { EndTemporaryMemory(temp); }
+};
+
+/**
+ * The frame arena is owned by the main thread and reset at the end of every frame.
+ * The persistent arena is never reset and holds data that lives as long as the app.
+ * Both must only be used from the main thread.
+ */
+Arena* GetFrameArena();
+Arena* GetPersistentArena();
+
+/**
+ * Each thread (loaders, jobs...) gets its own scratch arena, created on first use.
+ * The owner is responsible for releasing it with markers or ResetArena.
+ */
+Arena* GetThreadScratchArena();
+
+/**
+ * Arena used by the temporary string functions below: the frame arena on the main
+ * thread and the thread scratch arena anywhere else.
+ */
+Arena* GetTempArena();
+
+/**
+ * Pools hand out fixed-size elements from blocks taken from the persistent arena.
+ * Freed elements go to a free list and are reused first, so their addresses are
+ * stable and allocating never moves the live ones. Main thread only.
+ */
+struct Pool
+{
+    const char* name;
+    u32         elementSize;
+    u32         elementsPerBlock;
+    void*       freeList;
+
+    // Stats
+    u32 capacity;
+    u32 liveCount;
+    u32 highWaterMark;
+    u64 totalAllocationCount;
+};
+
+void  InitPool(Pool* pool, const char* name, u32 elementSize, u32 elementsPerBlock);
+void* PoolAlloc(Pool* pool);
+void  PoolFree(Pool* pool, void* element);
+
+template <typename T>
+T* PoolNew(Pool* pool) { return new (PoolAlloc(pool)) T(); }
+
+template <typename T>
+void PoolDelete(Pool* pool, T* element) { element->~T(); PoolFree(pool, element); }
+
+struct MemoryStats
+{
+    const char* name;
+    bool        isPool;
+    u64         used;               // Bytes for arenas, live elements for pools
+    u64         reserved;           // Bytes for arenas, element capacity for pools
+    u64         highWaterMark;
+    u64         lastFrameUsed;
+    u64         lastFrameAllocationCount;
+    u64         totalAllocationCount;
+    u32         blockCount;
+};
+
+/**
+ * Snapshot of every live arena and pool, for debugging UIs.
+ */
+void GetMemoryStats(std::vector<MemoryStats>& stats);
+
 struct String
 {
     char* str;
@@ -87,12 +225,44 @@ String GetDirectoryPart(String path);
  */
 String ReadTextFile(const char *filepath);
 
+/**
+ * Writes a buffer to a file, replacing its previous contents. Returns false if the
+ * file could not be written.
+ */
+bool WriteBinaryFile(const char *filepath, const void* data, u64 size);
+
 /**
  * It retrieves a timestamp indicating the last time the file was modified.
  * Can be useful in order to check for file modifications to implement hot reloads.
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Appends the paths of every file under the directory, subdirectories included, relative
+ * to it and with '/' separators (e.g. "Patrick/Patrick.obj" under the working directory).
+ */
+void ListDirectoryFiles(const char* directory, std::vector<std::string>& filepaths);
+
+/**
+ * Retrieves the address of an OpenGL entry point that is not covered by the glad
+ * loader (e.g. extension functions). Returns NULL if the driver does not expose it.
+ */
+void* GetOpenGLProcAddress(const char* procName);
+
+/**
+ * Creates an OpenGL context sharing its objects (textures, buffers, syncs...) with the
+ * one of the main window, for a loader thread to make current. Main thread only,
+ * returns NULL if it could not be created.
+ */
+void* CreateSharedOpenGLContext();
+
+/**
+ * Makes the context current on the calling thread, NULL releases the current one.
+ */
+void MakeOpenGLContextCurrent(void* context);
+
+void DestroySharedOpenGLContext(void* context);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
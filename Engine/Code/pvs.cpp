@@ -0,0 +1,240 @@
+//
+// pvs.cpp : Potentially visible sets, see pvs.h.
+//
+
+#include "pvs.h"
+#include "job_system.h"
+
+#include <float.h>
+#include <chrono>
+#include <map>
+
+struct PvsRayScene
+{
+	const PvsScene* scene;
+	Bvh             triangles;
+};
+
+static f32 IntersectRayPvsTriangle(void* data, u32 triangle, vec3 origin, vec3 direction, f32 maxDistance)
+{
+	const PvsScene& scene = *((const PvsRayScene*)data)->scene;
+	const u32* indices = &scene.indices[triangle * 3];
+	f32 distance = IntersectRayTriangle(origin, direction, scene.positions[indices[0]], scene.positions[indices[1]], scene.positions[indices[2]]);
+	return distance <= maxDistance ? distance : -1.0f;
+}
+
+// Deterministic per cell, so builds are reproducible whatever the thread count
+static f32 NextPvsRandom(u32& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+static vec3 RandomPointInBox(u32& state, vec3 min, vec3 max)
+{
+	return min + vec3(NextPvsRandom(state), NextPvsRandom(state), NextPvsRandom(state)) * (max - min);
+}
+
+static vec3 RandomDirection(u32& state)
+{
+	f32 z = NextPvsRandom(state) * 2.0f - 1.0f;
+	f32 angle = NextPvsRandom(state) * 6.2831853f;
+	f32 r = sqrtf(glm::max(0.0f, 1.0f - z * z));
+	return vec3(r * cosf(angle), r * sinf(angle), z);
+}
+
+// Zero bytes become (0, run length)
+static void EncodePvsSet(const std::vector<u8>& bits, std::vector<u8>& data)
+{
+	for (u32 i = 0; i < bits.size(); )
+	{
+		if (bits[i] != 0)
+		{
+			data.push_back(bits[i++]);
+			continue;
+		}
+
+		u32 run = 0;
+		while (i < bits.size() && bits[i] == 0 && run < 255)
+		{
+			run++;
+			i++;
+		}
+		data.push_back(0);
+		data.push_back((u8)run);
+	}
+}
+
+void BuildPvs(const PvsScene& scene, Pvs* pvs)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	*pvs = Pvs{};
+
+	const u32 triangleCount = scene.indexCount / 3;
+	if (triangleCount == 0 || scene.objectCount == 0)
+		return;
+
+	PvsRayScene rayScene;
+	rayScene.scene = &scene;
+	InitBvh(&rayScene.triangles, triangleCount);
+
+	Aabb sceneBounds = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+	std::vector<Aabb> objectBounds(scene.objectCount, Aabb{ vec3(FLT_MAX), vec3(-FLT_MAX) });
+	for (u32 t = 0; t < triangleCount; ++t)
+	{
+		Aabb bounds = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+		for (u32 i = 0; i < 3; ++i)
+		{
+			vec3 position = scene.positions[scene.indices[t * 3 + i]];
+			bounds.min = glm::min(bounds.min, position);
+			bounds.max = glm::max(bounds.max, position);
+		}
+		InsertBvhEntity(&rayScene.triangles, t, bounds);
+
+		Aabb& object = objectBounds[scene.triangleObjects[t]];
+		object.min = glm::min(object.min, bounds.min);
+		object.max = glm::max(object.max, bounds.max);
+		sceneBounds.min = glm::min(sceneBounds.min, bounds.min);
+		sceneBounds.max = glm::max(sceneBounds.max, bounds.max);
+	}
+
+	// A small margin so cameras right at the edge still find a cell
+	vec3 size = sceneBounds.max - sceneBounds.min;
+	f32 sceneDiagonal = glm::length(size);
+	pvs->bounds.min = sceneBounds.min - vec3(sceneDiagonal * 0.01f);
+	pvs->cellSize = (glm::max(size.x, glm::max(size.y, size.z)) + sceneDiagonal * 0.02f) / PVS_MAX_CELLS_PER_AXIS;
+	for (u32 axis = 0; axis < 3; ++axis)
+		pvs->cellCounts[axis] = glm::max(1u, (u32)ceilf((size[axis] + sceneDiagonal * 0.02f) / pvs->cellSize));
+	pvs->bounds.max = pvs->bounds.min + vec3(pvs->cellCounts[0], pvs->cellCounts[1], pvs->cellCounts[2]) * pvs->cellSize;
+	pvs->objectCount = scene.objectCount;
+
+	const u32 cellCount = pvs->cellCounts[0] * pvs->cellCounts[1] * pvs->cellCounts[2];
+	const u32 setBytes = (scene.objectCount + 7) / 8;
+	std::vector<std::vector<u8>> cellBits(cellCount);
+	std::vector<u32> cellRays(cellCount);
+
+	ParallelFor(cellCount, glm::max(1u, cellCount / 1024), [&](u32 begin, u32 end)
+	{
+		for (u32 cell = begin; cell < end; ++cell)
+		{
+			u32 x = cell % pvs->cellCounts[0];
+			u32 y = (cell / pvs->cellCounts[0]) % pvs->cellCounts[1];
+			u32 z = cell / (pvs->cellCounts[0] * pvs->cellCounts[1]);
+			vec3 cellMin = pvs->bounds.min + vec3(x, y, z) * pvs->cellSize;
+			vec3 cellMax = cellMin + vec3(pvs->cellSize);
+
+			u32 random = 0x9E3779B9u ^ (cell * 0x85EBCA6Bu);
+			std::vector<u8> bits(setBytes, 0);
+			auto castRay = [&](vec3 origin, vec3 direction, f32 maxDistance)
+			{
+				f32 distance;
+				u32 triangle = RaycastBvh(&rayScene.triangles, origin, direction, maxDistance, IntersectRayPvsTriangle, &rayScene, &distance);
+				if (triangle == BVH_NULL)
+					return false;
+				u32 object = scene.triangleObjects[triangle];
+				bits[object / 8] |= 1 << (object % 8);
+				return true;
+			};
+
+			// Rays that leave the scene mean the cell is not enclosed
+			u32 escapedRays = 0;
+			for (u32 r = 0; r < PVS_RAYS_PER_CELL; ++r)
+			{
+				if (!castRay(RandomPointInBox(random, cellMin, cellMax), RandomDirection(random), sceneDiagonal * 2.0f))
+					escapedRays++;
+			}
+			cellRays[cell] = PVS_RAYS_PER_CELL;
+			if (escapedRays > PVS_EXTERIOR_RATIO * PVS_RAYS_PER_CELL)
+				continue;
+
+			// Slightly past the target point so a surface right on it still counts. Objects already
+			// hit need no more rays, so the budget goes to the ones only seen through small gaps.
+			for (u32 object = 0; object < scene.objectCount; ++object)
+			{
+				if (objectBounds[object].min.x > objectBounds[object].max.x)
+					continue;
+				for (u32 r = 0; r < PVS_RAYS_PER_OBJECT && !(bits[object / 8] & (1 << (object % 8))); ++r)
+				{
+					vec3 origin = RandomPointInBox(random, cellMin, cellMax);
+					vec3 target = RandomPointInBox(random, objectBounds[object].min, objectBounds[object].max);
+					castRay(origin, target - origin, 1.001f);
+					cellRays[cell]++;
+				}
+			}
+			cellBits[cell].swap(bits);
+		}
+	});
+
+	// Identical sets are stored once
+	std::map<std::vector<u8>, u32> sets;
+	pvs->cellSets.resize(cellCount);
+	for (u32 cell = 0; cell < cellCount; ++cell)
+	{
+		pvs->rayCount += cellRays[cell];
+		if (cellBits[cell].empty())
+		{
+			pvs->cellSets[cell] = PVS_NO_SET;
+			continue;
+		}
+
+		pvs->interiorCellCount++;
+		auto it = sets.find(cellBits[cell]);
+		if (it == sets.end())
+		{
+			it = sets.insert(std::make_pair(cellBits[cell], (u32)pvs->setOffsets.size())).first;
+			pvs->setOffsets.push_back((u32)pvs->data.size());
+			EncodePvsSet(cellBits[cell], pvs->data);
+		}
+		pvs->cellSets[cell] = it->second;
+	}
+	pvs->setOffsets.push_back((u32)pvs->data.size());
+
+	pvs->buildMilliseconds = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+u32 FindPvsCell(const Pvs* pvs, vec3 position)
+{
+	if (pvs->objectCount == 0)
+		return PVS_NO_CELL;
+
+	vec3 cell = glm::floor((position - pvs->bounds.min) / pvs->cellSize);
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		if (cell[axis] < 0.0f || cell[axis] >= (f32)pvs->cellCounts[axis])
+			return PVS_NO_CELL;
+	}
+	return (u32)cell.x + pvs->cellCounts[0] * ((u32)cell.y + pvs->cellCounts[1] * (u32)cell.z);
+}
+
+bool GetPvsVisibleObjects(const Pvs* pvs, vec3 position, u32* visible)
+{
+	u32 cell = FindPvsCell(pvs, position);
+	if (cell == PVS_NO_CELL || pvs->cellSets[cell] == PVS_NO_SET)
+		return false;
+
+	const u32 wordCount = (pvs->objectCount + 31) / 32;
+	for (u32 i = 0; i < wordCount; ++i)
+		visible[i] = 0;
+
+	u32 set = pvs->cellSets[cell];
+	u32 byteIndex = 0;
+	for (u32 i = pvs->setOffsets[set]; i < pvs->setOffsets[set + 1]; ++i)
+	{
+		u8 value = pvs->data[i];
+		if (value == 0)
+		{
+			byteIndex += pvs->data[++i];
+			continue;
+		}
+		visible[byteIndex / 4] |= (u32)value << (8 * (byteIndex % 4));
+		byteIndex++;
+	}
+	return true;
+}
+
+u64 GetPvsSize(const Pvs* pvs)
+{
+	return pvs->cellSets.size() * sizeof(u32) + pvs->setOffsets.size() * sizeof(u32) + pvs->data.size();
+}
@@ -0,0 +1,84 @@
+//
+// pvs.h : Precomputed potentially visible sets for static interiors. The bounds of the
+// scene are split into a grid of cubic cells and the objects seen from each cell are
+// found offline by casting rays from random points inside it; at runtime the cell of
+// the camera gives the objects worth drawing with a single lookup. Does not depend on
+// the graphics API.
+//
+
+#pragma once
+
+#include "bvh.h"
+
+#define PVS_NO_CELL UINT32_MAX
+#define PVS_NO_SET  UINT32_MAX
+
+// Cells along the longest side of the scene
+#define PVS_MAX_CELLS_PER_AXIS 16
+
+// Rays cast from each cell in random directions...
+#define PVS_RAYS_PER_CELL 256
+// ...and towards random points in the bounds of each object not hit yet, so small ones and
+// ones only seen through a doorway are not missed
+#define PVS_RAYS_PER_OBJECT 32
+
+// Cells where more than this fraction of the random rays leave the scene are outside of
+// the interior, they get no set and see everything
+#define PVS_EXTERIOR_RATIO 0.5f
+
+/**
+ * Triangles of the scene, each belonging to an object (e.g. a submesh).
+ */
+struct PvsScene
+{
+	const vec3* positions;
+	u32         vertexCount;
+	const u32*  indices;
+	u32         indexCount;
+	const u32*  triangleObjects;	// indexCount / 3 entries
+	u32         objectCount;
+};
+
+/**
+ * Cells that see the same objects share their set, and sets are stored as bitsets of
+ * objectCount bits with the runs of zero bytes compressed (a zero byte followed by the
+ * length of the run).
+ */
+struct Pvs
+{
+	Aabb bounds;					// Of the grid
+	f32  cellSize;
+	u32  cellCounts[3];
+	u32  objectCount;				// 0 when there is no PVS
+	std::vector<u32> cellSets;		// Set of each cell (x first, then y, then z), or PVS_NO_SET
+	std::vector<u32> setOffsets;	// Start of each set in data, plus the end of the last one
+	std::vector<u8>  data;
+
+	// Build stats
+	u32 interiorCellCount;
+	u64 rayCount;
+	f64 buildMilliseconds;
+};
+
+/**
+ * Casts the rays of every cell in parallel on the job system, against a BVH of the
+ * triangles. Takes seconds for big scenes, meant to run offline and be saved.
+ */
+void BuildPvs(const PvsScene& scene, Pvs* pvs);
+
+/**
+ * Cell containing the position, PVS_NO_CELL outside the grid.
+ */
+u32 FindPvsCell(const Pvs* pvs, vec3 position);
+
+/**
+ * Writes the bits of the objects visible from the position to visible, object i being
+ * bit i % 32 of visible[i / 32] ((objectCount + 31) / 32 words). Returns false, leaving
+ * visible untouched, when the position has no set and everything should be drawn.
+ */
+bool GetPvsVisibleObjects(const Pvs* pvs, vec3 position, u32* visible);
+
+/**
+ * Memory taken by the sets and the cell table.
+ */
+u64 GetPvsSize(const Pvs* pvs);
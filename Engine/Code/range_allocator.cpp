@@ -0,0 +1,338 @@
+//
+// range_allocator.cpp : TLSF range suballocator, see range_allocator.h.
+//
+
+#include "range_allocator.h"
+
+#include <chrono>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static u32 FindLowestBit(u32 mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (u32)index;
+#else
+	return (u32)__builtin_ctz(mask);
+#endif
+}
+
+static u32 FindHighestBit(u32 mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (u32)index;
+#else
+	return 31 - (u32)__builtin_clz(mask);
+#endif
+}
+
+// Size class of a block: sizes under RANGE_SECOND_LEVEL_COUNT get a list each in the
+// first level, bigger ones are split by their highest bit then the bits under it
+static void MapSize(u32 size, u32* firstLevel, u32* secondLevel)
+{
+	if (size < RANGE_SECOND_LEVEL_COUNT)
+	{
+		*firstLevel = 0;
+		*secondLevel = size;
+		return;
+	}
+
+	u32 top = FindHighestBit(size);
+	*firstLevel = top - RANGE_SECOND_LEVEL_BITS + 1;
+	*secondLevel = (size >> (top - RANGE_SECOND_LEVEL_BITS)) - RANGE_SECOND_LEVEL_COUNT;
+}
+
+// Rounds the size up to the next class, so any block found there fits
+static void MapSizeRoundedUp(u32 size, u32* firstLevel, u32* secondLevel)
+{
+	if (size >= RANGE_SECOND_LEVEL_COUNT)
+	{
+		u32 top = FindHighestBit(size);
+		u64 rounded = (u64)size + (1u << (top - RANGE_SECOND_LEVEL_BITS)) - 1;
+		size = (u32)glm::min(rounded, (u64)UINT32_MAX);
+	}
+	MapSize(size, firstLevel, secondLevel);
+}
+
+static u32 NewBlock(RangeAllocator* allocator)
+{
+	if (!allocator->unusedBlocks.empty())
+	{
+		u32 block = allocator->unusedBlocks.back();
+		allocator->unusedBlocks.pop_back();
+		return block;
+	}
+	allocator->blocks.push_back(RangeBlock{});
+	return (u32)allocator->blocks.size() - 1;
+}
+
+static void RecycleBlock(RangeAllocator* allocator, u32 block)
+{
+	allocator->blocks[block] = RangeBlock{};
+	allocator->unusedBlocks.push_back(block);
+}
+
+static void InsertFreeBlock(RangeAllocator* allocator, u32 block)
+{
+	RangeBlock& b = allocator->blocks[block];
+	u32 firstLevel, secondLevel;
+	MapSize(b.size, &firstLevel, &secondLevel);
+
+	u32& head = allocator->freeLists[firstLevel][secondLevel];
+	b.free = true;
+	b.previousFree = RANGE_NONE;
+	b.nextFree = head;
+	if (head != RANGE_NONE)
+		allocator->blocks[head].previousFree = block;
+	head = block;
+
+	allocator->firstLevelMask |= 1u << firstLevel;
+	allocator->secondLevelMasks[firstLevel] |= 1u << secondLevel;
+}
+
+static void RemoveFreeBlock(RangeAllocator* allocator, u32 block)
+{
+	RangeBlock& b = allocator->blocks[block];
+	u32 firstLevel, secondLevel;
+	MapSize(b.size, &firstLevel, &secondLevel);
+
+	if (b.previousFree != RANGE_NONE)
+		allocator->blocks[b.previousFree].nextFree = b.nextFree;
+	else
+		allocator->freeLists[firstLevel][secondLevel] = b.nextFree;
+	if (b.nextFree != RANGE_NONE)
+		allocator->blocks[b.nextFree].previousFree = b.previousFree;
+
+	if (allocator->freeLists[firstLevel][secondLevel] == RANGE_NONE)
+	{
+		allocator->secondLevelMasks[firstLevel] &= ~(1u << secondLevel);
+		if (allocator->secondLevelMasks[firstLevel] == 0)
+			allocator->firstLevelMask &= ~(1u << firstLevel);
+	}
+	b.free = false;
+	b.previousFree = RANGE_NONE;
+	b.nextFree = RANGE_NONE;
+}
+
+static u32 FindFreeBlock(const RangeAllocator* allocator, u32 size)
+{
+	u32 firstLevel, secondLevel;
+	MapSizeRoundedUp(size, &firstLevel, &secondLevel);
+
+	// A list of the class or, failing that, the smallest non-empty class above it
+	u32 secondLevelMask = firstLevel < RANGE_FIRST_LEVEL_COUNT ? allocator->secondLevelMasks[firstLevel] & (~0u << secondLevel) : 0;
+	if (secondLevelMask == 0)
+	{
+		u32 firstLevelMask = firstLevel + 1 < 32 ? allocator->firstLevelMask & (~0u << (firstLevel + 1)) : 0;
+		if (firstLevelMask != 0)
+		{
+			firstLevel = FindLowestBit(firstLevelMask);
+			secondLevelMask = allocator->secondLevelMasks[firstLevel];
+		}
+	}
+	if (secondLevelMask != 0)
+		return allocator->freeLists[firstLevel][FindLowestBit(secondLevelMask)];
+
+	// Nothing is sure to fit, but a block of the size's own class still might (e.g. when
+	// the request takes exactly the rest of the range)
+	MapSize(size, &firstLevel, &secondLevel);
+	for (u32 block = allocator->freeLists[firstLevel][secondLevel]; block != RANGE_NONE; block = allocator->blocks[block].nextFree)
+	{
+		if (allocator->blocks[block].size >= size)
+			return block;
+	}
+	return RANGE_NONE;
+}
+
+void InitRangeAllocator(RangeAllocator* allocator, u32 capacity)
+{
+	*allocator = RangeAllocator{};
+	for (u32 i = 0; i < RANGE_FIRST_LEVEL_COUNT; ++i)
+		for (u32 j = 0; j < RANGE_SECOND_LEVEL_COUNT; ++j)
+			allocator->freeLists[i][j] = RANGE_NONE;
+	allocator->lastBlock = RANGE_NONE;
+
+	GrowRangeAllocator(allocator, capacity);
+}
+
+RangeAllocation AllocateRange(RangeAllocator* allocator, u32 size)
+{
+	size = glm::max(size, 1u);
+
+	u32 block = FindFreeBlock(allocator, size);
+	if (block == RANGE_NONE)
+		return RangeAllocation{ 0, RANGE_NONE };
+	RemoveFreeBlock(allocator, block);
+
+	// The rest goes back as a free block right after it
+	if (allocator->blocks[block].size > size)
+	{
+		u32 remainder = NewBlock(allocator);
+		RangeBlock& b = allocator->blocks[block];
+		RangeBlock& r = allocator->blocks[remainder];
+		r.offset = b.offset + size;
+		r.size = b.size - size;
+		r.previousPhysical = block;
+		r.nextPhysical = b.nextPhysical;
+		if (b.nextPhysical != RANGE_NONE)
+			allocator->blocks[b.nextPhysical].previousPhysical = remainder;
+		else
+			allocator->lastBlock = remainder;
+		b.nextPhysical = remainder;
+		b.size = size;
+		InsertFreeBlock(allocator, remainder);
+	}
+
+	allocator->allocatedSize += size;
+	allocator->allocationCount++;
+	return RangeAllocation{ allocator->blocks[block].offset, block };
+}
+
+void FreeRange(RangeAllocator* allocator, u32 block)
+{
+	ASSERT(block < allocator->blocks.size() && !allocator->blocks[block].free && allocator->blocks[block].size > 0, "Freeing a range that is not allocated");
+	allocator->allocatedSize -= allocator->blocks[block].size;
+	allocator->allocationCount--;
+
+	u32 next = allocator->blocks[block].nextPhysical;
+	if (next != RANGE_NONE && allocator->blocks[next].free)
+	{
+		RemoveFreeBlock(allocator, next);
+		RangeBlock& b = allocator->blocks[block];
+		b.size += allocator->blocks[next].size;
+		b.nextPhysical = allocator->blocks[next].nextPhysical;
+		if (b.nextPhysical != RANGE_NONE)
+			allocator->blocks[b.nextPhysical].previousPhysical = block;
+		else
+			allocator->lastBlock = block;
+		RecycleBlock(allocator, next);
+	}
+
+	u32 previous = allocator->blocks[block].previousPhysical;
+	if (previous != RANGE_NONE && allocator->blocks[previous].free)
+	{
+		RemoveFreeBlock(allocator, previous);
+		RangeBlock& p = allocator->blocks[previous];
+		p.size += allocator->blocks[block].size;
+		p.nextPhysical = allocator->blocks[block].nextPhysical;
+		if (p.nextPhysical != RANGE_NONE)
+			allocator->blocks[p.nextPhysical].previousPhysical = previous;
+		else
+			allocator->lastBlock = previous;
+		RecycleBlock(allocator, block);
+		block = previous;
+	}
+
+	InsertFreeBlock(allocator, block);
+}
+
+void GrowRangeAllocator(RangeAllocator* allocator, u32 newCapacity)
+{
+	if (newCapacity <= allocator->capacity)
+		return;
+
+	u32 extra = newCapacity - allocator->capacity;
+	u32 last = allocator->lastBlock;
+	if (last != RANGE_NONE && allocator->blocks[last].free)
+	{
+		RemoveFreeBlock(allocator, last);
+		allocator->blocks[last].size += extra;
+		InsertFreeBlock(allocator, last);
+	}
+	else
+	{
+		u32 block = NewBlock(allocator);
+		RangeBlock& b = allocator->blocks[block];
+		b.offset = allocator->capacity;
+		b.size = extra;
+		b.previousPhysical = last;
+		b.nextPhysical = RANGE_NONE;
+		if (last != RANGE_NONE)
+			allocator->blocks[last].nextPhysical = block;
+		allocator->lastBlock = block;
+		InsertFreeBlock(allocator, block);
+	}
+	allocator->capacity = newCapacity;
+}
+
+RangeAllocatorStats GetRangeAllocatorStats(const RangeAllocator* allocator)
+{
+	RangeAllocatorStats stats = {};
+	stats.capacity = allocator->capacity;
+	stats.allocatedSize = allocator->allocatedSize;
+	stats.allocationCount = allocator->allocationCount;
+	for (const RangeBlock& block : allocator->blocks)
+	{
+		if (!block.free)
+			continue;
+
+		stats.freeSize += block.size;
+		stats.freeBlockCount++;
+		stats.largestFreeBlock = glm::max(stats.largestFreeBlock, block.size);
+	}
+	stats.fragmentation = stats.freeSize > 0 ? 1.0f - (f32)stats.largestFreeBlock / stats.freeSize : 0.0f;
+	return stats;
+}
+
+static f32 NextBenchmarkRandom(u32& state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+RangeAllocatorBenchmark BenchmarkRangeAllocator(u32 operationCount)
+{
+	RangeAllocatorBenchmark result = {};
+	result.operationCount = operationCount;
+
+	// Sizes from 16 to 64K units, log uniform, so the average is about 7.9K
+	const u32 targetLiveCount = 1024;
+	const f32 averageSize = (65536.0f - 16.0f) / logf(65536.0f / 16.0f);
+	RangeAllocator allocator;
+	InitRangeAllocator(&allocator, (u32)(targetLiveCount * averageSize * 1.25f));
+
+	// The operations are decided up front so only the allocator is timed
+	u32 random = 12345;
+	std::vector<u32> sizes(operationCount);
+	std::vector<f32> choices(operationCount);
+	for (u32 i = 0; i < operationCount; ++i)
+	{
+		sizes[i] = (u32)(16.0f * powf(4096.0f, NextBenchmarkRandom(random)));
+		choices[i] = NextBenchmarkRandom(random);
+	}
+
+	std::vector<u32> live;
+	live.reserve(operationCount);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (u32 i = 0; i < operationCount; ++i)
+	{
+		bool allocate = live.empty() || (live.size() < targetLiveCount ? choices[i] < 0.75f : choices[i] < 0.5f);
+		if (allocate)
+		{
+			RangeAllocation allocation = AllocateRange(&allocator, sizes[i]);
+			if (allocation.block != RANGE_NONE)
+				live.push_back(allocation.block);
+			else
+				result.failedAllocations++;
+		}
+		else
+		{
+			u32 index = (u32)(choices[i] * 2.0f * live.size()) % live.size();
+			FreeRange(&allocator, live[index]);
+			live[index] = live.back();
+			live.pop_back();
+		}
+	}
+	f64 nanoseconds = std::chrono::duration<f64, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+	result.nanosecondsPerOperation = nanoseconds / glm::max(operationCount, 1u);
+	result.stats = GetRangeAllocatorStats(&allocator);
+	return result;
+}
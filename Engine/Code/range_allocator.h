@@ -0,0 +1,94 @@
+//
+// range_allocator.h : Two level segregated fit (TLSF) suballocator of the range
+// [0, capacity) of some resource, e.g. a GPU buffer, in whatever unit the caller picks.
+// Free blocks are kept in lists by size class, a power of two split in linear steps, and
+// two levels of bitmasks find a list big enough in constant time. Freed blocks are merged
+// with their free neighbours. Only the bookkeeping lives here, it does not depend on the
+// graphics API.
+//
+
+#pragma once
+
+#include "platform.h"
+
+#define RANGE_NONE UINT32_MAX
+
+// Each power of two is split in 2^RANGE_SECOND_LEVEL_BITS size classes
+#define RANGE_SECOND_LEVEL_BITS  3
+#define RANGE_SECOND_LEVEL_COUNT (1 << RANGE_SECOND_LEVEL_BITS)
+#define RANGE_FIRST_LEVEL_COUNT  (32 - RANGE_SECOND_LEVEL_BITS + 1)
+
+struct RangeBlock
+{
+	u32  offset;
+	u32  size;
+	u32  previousPhysical;	// Neighbours in the range, RANGE_NONE at the ends
+	u32  nextPhysical;
+	u32  previousFree;		// Links of the free list of its size class
+	u32  nextFree;
+	bool free;
+};
+
+struct RangeAllocator
+{
+	u32 capacity;
+	u32 firstLevelMask;								// Bit per first level with a non-empty list
+	u32 secondLevelMasks[RANGE_FIRST_LEVEL_COUNT];	// Bit per non-empty list of each first level
+	u32 freeLists[RANGE_FIRST_LEVEL_COUNT][RANGE_SECOND_LEVEL_COUNT];
+	u32 lastBlock;									// The one ending at capacity
+
+	std::vector<RangeBlock> blocks;		// Handles are indices, records of merged blocks are reused
+	std::vector<u32>        unusedBlocks;
+
+	u32 allocatedSize;
+	u32 allocationCount;
+};
+
+struct RangeAllocation
+{
+	u32 offset;
+	u32 block;		// RANGE_NONE when there was no room
+};
+
+void InitRangeAllocator(RangeAllocator* allocator, u32 capacity);
+
+/**
+ * Takes size units from a free block of the smallest size class that is sure to fit,
+ * giving the rest back as a new free block.
+ */
+RangeAllocation AllocateRange(RangeAllocator* allocator, u32 size);
+
+void FreeRange(RangeAllocator* allocator, u32 block);
+
+/**
+ * Extends the range to newCapacity, the new space is merged with a free block at the end.
+ */
+void GrowRangeAllocator(RangeAllocator* allocator, u32 newCapacity);
+
+struct RangeAllocatorStats
+{
+	u32 capacity;
+	u32 allocatedSize;
+	u32 allocationCount;
+	u32 freeSize;
+	u32 freeBlockCount;
+	u32 largestFreeBlock;
+	f32 fragmentation;		// 1 - largest free block / free size: 0 when the free space is in one piece
+};
+
+RangeAllocatorStats GetRangeAllocatorStats(const RangeAllocator* allocator);
+
+struct RangeAllocatorBenchmark
+{
+	u32 operationCount;
+	f64 nanosecondsPerOperation;
+	u32 failedAllocations;
+	RangeAllocatorStats stats;	// At the end, with about a thousand allocations live
+};
+
+/**
+ * Random mix of allocations (sizes spread over several orders of magnitude, like meshes)
+ * and frees of random live ones, keeping about a thousand live in a range 25% bigger than
+ * they take on average.
+ */
+RangeAllocatorBenchmark BenchmarkRangeAllocator(u32 operationCount);
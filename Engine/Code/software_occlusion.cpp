@@ -0,0 +1,478 @@
+//
+// software_occlusion.cpp : Masked software occlusion culling, see software_occlusion.h.
+//
+
+#include "software_occlusion.h"
+#include "job_system.h"
+
+#include <emmintrin.h>
+#include <float.h>
+#include <chrono>
+#include <algorithm>
+
+void InitMaskedOcclusionBuffer(MaskedOcclusionBuffer* buffer, u32 width, u32 height)
+{
+	*buffer = MaskedOcclusionBuffer{};
+	buffer->tilesX = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+	buffer->tilesY = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+	buffer->width = buffer->tilesX * OCCLUSION_TILE_WIDTH;
+	buffer->height = buffer->tilesY * OCCLUSION_TILE_HEIGHT;
+
+	u32 tileCount = buffer->tilesX * buffer->tilesY;
+	buffer->masks.resize(tileCount * OCCLUSION_TILE_HEIGHT);
+	buffer->referenceDepth.resize(tileCount);
+	buffer->workingDepth.resize(tileCount);
+	ClearMaskedOcclusionBuffer(buffer);
+}
+
+void ClearMaskedOcclusionBuffer(MaskedOcclusionBuffer* buffer)
+{
+	std::fill(buffer->masks.begin(), buffer->masks.end(), 0u);
+	std::fill(buffer->referenceDepth.begin(), buffer->referenceDepth.end(), 0.0f);
+	std::fill(buffer->workingDepth.begin(), buffer->workingDepth.end(), FLT_MAX);
+}
+
+// Projects a clip space triangle (in front of the near plane) and prepares its edge
+// functions and depth plane
+static void SetupTriangle(const MaskedOcclusionBuffer* buffer, vec4 c0, vec4 c1, vec4 c2, OccluderTriangle& triangle)
+{
+	triangle.valid = false;
+
+	vec3 v[3];
+	const vec4 clip[3] = { c0, c1, c2 };
+	for (u32 i = 0; i < 3; ++i)
+	{
+		f32 inverseW = 1.0f / clip[i].w;
+		v[i] = vec3((clip[i].x * inverseW * 0.5f + 0.5f) * buffer->width, (clip[i].y * inverseW * 0.5f + 0.5f) * buffer->height, inverseW);
+	}
+
+	f32 area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+	if (fabsf(area) < 1e-6f)
+		return;
+
+	// Counterclockwise, whatever the facing
+	if (area < 0.0f)
+	{
+		std::swap(v[1], v[2]);
+		area = -area;
+	}
+
+	vec2 minPosition = glm::min(vec2(v[0]), glm::min(vec2(v[1]), vec2(v[2])));
+	vec2 maxPosition = glm::max(vec2(v[0]), glm::max(vec2(v[1]), vec2(v[2])));
+	if (maxPosition.x < 0.0f || maxPosition.y < 0.0f || minPosition.x > buffer->width || minPosition.y > buffer->height)
+		return;
+
+	// Pixels whose center is inside
+	triangle.firstRow = glm::max(0, (i32)ceilf(minPosition.y - 0.5f));
+	triangle.lastRow = glm::min((i32)buffer->height - 1, (i32)floorf(maxPosition.y - 0.5f));
+	if (triangle.firstRow > triangle.lastRow)
+		return;
+
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const vec3& a = v[i];
+		const vec3& b = v[(i + 1) % 3];
+		f32 edgeA = a.y - b.y;
+		f32 edgeB = b.x - a.x;
+		triangle.edges[i] = vec3(edgeA, edgeB, -(edgeA * a.x + edgeB * a.y));
+	}
+
+	triangle.depthDx = ((v[1].z - v[0].z) * (v[2].y - v[0].y) - (v[2].z - v[0].z) * (v[1].y - v[0].y)) / area;
+	triangle.depthDy = ((v[2].z - v[0].z) * (v[1].x - v[0].x) - (v[1].z - v[0].z) * (v[2].x - v[0].x)) / area;
+	triangle.depth = v[0].z - triangle.depthDx * v[0].x - triangle.depthDy * v[0].y;
+	triangle.minDepth = glm::min(v[0].z, glm::min(v[1].z, v[2].z));
+	triangle.valid = true;
+}
+
+// Clips against w = OCCLUSION_NEAR_W and sets up the one or two resulting triangles
+static void ClipAndSetupTriangle(const MaskedOcclusionBuffer* buffer, const vec4 clip[3], OccluderTriangle* output)
+{
+	output[0].valid = false;
+	output[1].valid = false;
+
+	u32 insideCount = 0;
+	for (u32 i = 0; i < 3; ++i)
+		insideCount += clip[i].w >= OCCLUSION_NEAR_W ? 1 : 0;
+
+	if (insideCount == 0)
+		return;
+	if (insideCount == 3)
+	{
+		SetupTriangle(buffer, clip[0], clip[1], clip[2], output[0]);
+		return;
+	}
+
+	// Sutherland-Hodgman against a single plane, at most a quad comes out
+	vec4 polygon[4];
+	u32 polygonCount = 0;
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const vec4& a = clip[i];
+		const vec4& b = clip[(i + 1) % 3];
+		bool aInside = a.w >= OCCLUSION_NEAR_W;
+		bool bInside = b.w >= OCCLUSION_NEAR_W;
+		if (aInside)
+			polygon[polygonCount++] = a;
+		if (aInside != bInside)
+			polygon[polygonCount++] = glm::mix(a, b, (OCCLUSION_NEAR_W - a.w) / (b.w - a.w));
+	}
+
+	SetupTriangle(buffer, polygon[0], polygon[1], polygon[2], output[0]);
+	if (polygonCount == 4)
+		SetupTriangle(buffer, polygon[0], polygon[2], polygon[3], output[1]);
+}
+
+// Bits [0, n) of a row of a tile
+static u32 RowMaskBelow(i32 n)
+{
+	return n >= 32 ? ~0u : (1u << n) - 1u;
+}
+
+// Merges the coverage of a triangle into a tile (the merge heuristic of the paper with
+// depths going the other way)
+static void UpdateTile(MaskedOcclusionBuffer* buffer, u32 tile, __m128i coverage, f32 triangleDepth)
+{
+	f32 referenceDepth = buffer->referenceDepth[tile];
+	if (triangleDepth <= referenceDepth)
+		return;
+
+	__m128i* maskAddress = (__m128i*)&buffer->masks[tile * OCCLUSION_TILE_HEIGHT];
+	__m128i mask = _mm_loadu_si128(maskAddress);
+	f32 workingDepth = buffer->workingDepth[tile];
+
+	// A triangle much closer than the working layer starts a new one, keeping the old
+	// one would hold the depth of the layer back when it fills up
+	bool workingEmpty = _mm_movemask_epi8(_mm_cmpeq_epi32(mask, _mm_setzero_si128())) == 0xFFFF;
+	if (!workingEmpty && triangleDepth - workingDepth > workingDepth - referenceDepth)
+	{
+		mask = _mm_setzero_si128();
+		workingDepth = FLT_MAX;
+	}
+
+	mask = _mm_or_si128(mask, coverage);
+	workingDepth = glm::min(workingDepth, triangleDepth);
+
+	// Full working layer, it becomes the reference
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(mask, _mm_set1_epi32(-1))) == 0xFFFF)
+	{
+		buffer->referenceDepth[tile] = glm::max(referenceDepth, workingDepth);
+		mask = _mm_setzero_si128();
+		workingDepth = FLT_MAX;
+	}
+
+	_mm_storeu_si128(maskAddress, mask);
+	buffer->workingDepth[tile] = workingDepth;
+}
+
+// Rasterizes the four pixel rows of tile row tileY covered by the triangle
+static void RasterizeTileRow(MaskedOcclusionBuffer* buffer, const OccluderTriangle& triangle, u32 tileY)
+{
+	const __m128 rowY = _mm_add_ps(_mm_set1_ps((f32)(tileY * OCCLUSION_TILE_HEIGHT) + 0.5f), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+	const __m128 big = _mm_set1_ps(1e30f);
+
+	// Span of each row between the edges: left edges bound it from below, right edges
+	// from above, and horizontal edges keep or reject the whole row
+	__m128 left = _mm_set1_ps(-1e30f);
+	__m128 right = big;
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const vec3& edge = triangle.edges[i];
+		__m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge.y), rowY), _mm_set1_ps(edge.z));
+		if (edge.x > 0.0f)
+			left = _mm_max_ps(left, _mm_div_ps(value, _mm_set1_ps(-edge.x)));
+		else if (edge.x < 0.0f)
+			right = _mm_min_ps(right, _mm_div_ps(value, _mm_set1_ps(-edge.x)));
+		else
+			left = _mm_max_ps(left, _mm_and_ps(_mm_cmplt_ps(value, _mm_setzero_ps()), big));
+	}
+
+	// First pixel whose center is right of the left bound, and one past the last one
+	// left of the right bound, in [0, width]
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 width = _mm_set1_ps((f32)buffer->width);
+	__m128 leftCenter = _mm_min_ps(_mm_max_ps(_mm_sub_ps(left, half), _mm_setzero_ps()), width);
+	__m128i start = _mm_cvttps_epi32(leftCenter);
+	start = _mm_sub_epi32(start, _mm_castps_si128(_mm_cmplt_ps(_mm_cvtepi32_ps(start), leftCenter)));
+
+	__m128 rightCenter = _mm_min_ps(_mm_max_ps(_mm_sub_ps(right, half), _mm_set1_ps(-1.0f)), width);
+	__m128i end = _mm_cvttps_epi32(rightCenter);
+	end = _mm_add_epi32(end, _mm_castps_si128(_mm_cmpgt_ps(_mm_cvtepi32_ps(end), rightCenter)));
+	end = _mm_add_epi32(end, _mm_set1_epi32(1));
+
+	alignas(16) i32 starts[4];
+	alignas(16) i32 ends[4];
+	_mm_store_si128((__m128i*)starts, start);
+	_mm_store_si128((__m128i*)ends, end);
+
+	i32 minStart = (i32)buffer->width;
+	i32 maxEnd = 0;
+	for (u32 r = 0; r < 4; ++r)
+	{
+		ends[r] = glm::min(ends[r], (i32)buffer->width);
+		if (starts[r] < ends[r])
+		{
+			minStart = glm::min(minStart, starts[r]);
+			maxEnd = glm::max(maxEnd, ends[r]);
+		}
+	}
+	if (minStart >= maxEnd)
+		return;
+
+	for (i32 tileX = minStart / OCCLUSION_TILE_WIDTH; tileX <= (maxEnd - 1) / OCCLUSION_TILE_WIDTH; ++tileX)
+	{
+		i32 tileLeft = tileX * OCCLUSION_TILE_WIDTH;
+		alignas(16) u32 rows[4];
+		for (u32 r = 0; r < 4; ++r)
+		{
+			i32 s = glm::clamp(starts[r] - tileLeft, 0, OCCLUSION_TILE_WIDTH);
+			i32 e = glm::clamp(ends[r] - tileLeft, 0, OCCLUSION_TILE_WIDTH);
+			rows[r] = s < e ? RowMaskBelow(e) & ~RowMaskBelow(s) : 0u;
+		}
+		__m128i coverage = _mm_load_si128((const __m128i*)rows);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(coverage, _mm_setzero_si128())) == 0xFFFF)
+			continue;
+
+		// Farthest point of the depth plane over the tile, no farther than the triangle
+		f32 x = triangle.depthDx > 0.0f ? (f32)tileLeft : (f32)(tileLeft + OCCLUSION_TILE_WIDTH);
+		f32 y = triangle.depthDy > 0.0f ? (f32)(tileY * OCCLUSION_TILE_HEIGHT) : (f32)((tileY + 1) * OCCLUSION_TILE_HEIGHT);
+		f32 tileDepth = glm::max(triangle.depth + triangle.depthDx * x + triangle.depthDy * y, triangle.minDepth);
+
+		UpdateTile(buffer, tileY * buffer->tilesX + tileX, coverage, tileDepth);
+	}
+}
+
+void RasterizeOccluders(MaskedOcclusionBuffer* buffer, const OccluderInstance* occluders, u32 occluderCount)
+{
+	// First triangle of each occluder
+	ScopedTemporaryMemory temp(GetTempArena());
+	u32* firstTriangles = PushArray(temp.temp.arena, u32, occluderCount + 1);
+	firstTriangles[0] = 0;
+	for (u32 i = 0; i < occluderCount; ++i)
+		firstTriangles[i + 1] = firstTriangles[i] + (u32)occluders[i].mesh->indices.size() / 3;
+	const u32 triangleCount = firstTriangles[occluderCount];
+
+	buffer->triangles.resize(triangleCount * 2);
+	ParallelFor(triangleCount, glm::max(1024u, triangleCount / (JOB_DEQUE_CAPACITY / 4)), [&](u32 begin, u32 end)
+	{
+		u32 occluder = (u32)(std::upper_bound(firstTriangles, firstTriangles + occluderCount + 1, begin) - firstTriangles) - 1;
+		for (u32 t = begin; t < end; ++t)
+		{
+			while (t >= firstTriangles[occluder + 1])
+				occluder++;
+
+			const OccluderMesh& mesh = *occluders[occluder].mesh;
+			const mat4& worldViewProjection = occluders[occluder].worldViewProjection;
+			const u32* indices = &mesh.indices[(t - firstTriangles[occluder]) * 3];
+			vec4 clip[3];
+			for (u32 i = 0; i < 3; ++i)
+				clip[i] = worldViewProjection * vec4(mesh.positions[indices[i]], 1.0f);
+
+			ClipAndSetupTriangle(buffer, clip, &buffer->triangles[t * 2]);
+		}
+	});
+
+	// Bands of tile rows are independent, each one goes over every triangle in order
+	const u32 bandCount = (buffer->tilesY + OCCLUSION_BAND_TILE_ROWS - 1) / OCCLUSION_BAND_TILE_ROWS;
+	ParallelFor(bandCount, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 band = begin; band < end; ++band)
+		{
+			u32 firstTileRow = band * OCCLUSION_BAND_TILE_ROWS;
+			u32 lastTileRow = glm::min(firstTileRow + OCCLUSION_BAND_TILE_ROWS, buffer->tilesY) - 1;
+			for (const OccluderTriangle& triangle : buffer->triangles)
+			{
+				if (!triangle.valid)
+					continue;
+
+				u32 firstRow = glm::max(firstTileRow, (u32)triangle.firstRow / OCCLUSION_TILE_HEIGHT);
+				u32 lastRow = glm::min(lastTileRow, (u32)triangle.lastRow / OCCLUSION_TILE_HEIGHT);
+				for (u32 tileY = firstRow; tileY <= lastRow && firstRow <= lastRow; ++tileY)
+					RasterizeTileRow(buffer, triangle, tileY);
+			}
+		}
+	});
+
+	buffer->rasterizedTriangles = 0;
+	for (const OccluderTriangle& triangle : buffer->triangles)
+		buffer->rasterizedTriangles += triangle.valid ? 1 : 0;
+}
+
+bool IsAabbOccluded(const MaskedOcclusionBuffer* buffer, const Aabb& bounds, const mat4& viewProjection)
+{
+	vec2 minPosition = vec2(FLT_MAX);
+	vec2 maxPosition = vec2(-FLT_MAX);
+	f32 nearestDepth = 0.0f;
+	for (u32 i = 0; i < 8; ++i)
+	{
+		vec3 corner = vec3(i & 1 ? bounds.max.x : bounds.min.x, i & 2 ? bounds.max.y : bounds.min.y, i & 4 ? bounds.max.z : bounds.min.z);
+		vec4 clip = viewProjection * vec4(corner, 1.0f);
+		if (clip.w < OCCLUSION_NEAR_W)
+			return false;
+
+		f32 inverseW = 1.0f / clip.w;
+		vec2 position = vec2((clip.x * inverseW * 0.5f + 0.5f) * buffer->width, (clip.y * inverseW * 0.5f + 0.5f) * buffer->height);
+		minPosition = glm::min(minPosition, position);
+		maxPosition = glm::max(maxPosition, position);
+		nearestDepth = glm::max(nearestDepth, inverseW);
+	}
+
+	if (maxPosition.x < 0.0f || maxPosition.y < 0.0f || minPosition.x >= buffer->width || minPosition.y >= buffer->height)
+		return false;
+
+	u32 firstTileX = (u32)glm::max(minPosition.x, 0.0f) / OCCLUSION_TILE_WIDTH;
+	u32 lastTileX = glm::min((u32)maxPosition.x / OCCLUSION_TILE_WIDTH, buffer->tilesX - 1);
+	u32 firstTileY = (u32)glm::max(minPosition.y, 0.0f) / OCCLUSION_TILE_HEIGHT;
+	u32 lastTileY = glm::min((u32)maxPosition.y / OCCLUSION_TILE_HEIGHT, buffer->tilesY - 1);
+
+	// Visible as soon as one tile has its farthest occluder behind the nearest point,
+	// four tiles of a row at a time
+	const __m128 nearest = _mm_set1_ps(nearestDepth);
+	for (u32 tileY = firstTileY; tileY <= lastTileY; ++tileY)
+	{
+		const f32* row = &buffer->referenceDepth[tileY * buffer->tilesX];
+		u32 tileX = firstTileX;
+		for (; tileX + 4 <= lastTileX + 1; tileX += 4)
+		{
+			if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + tileX), nearest)) != 0)
+				return false;
+		}
+		for (; tileX <= lastTileX; ++tileX)
+		{
+			if (row[tileX] <= nearestDepth)
+				return false;
+		}
+	}
+	return true;
+}
+
+u32 TestOccludedAabbs(const MaskedOcclusionBuffer* buffer, const Aabb* bounds, u32 count, const mat4& viewProjection, u8* occluded)
+{
+	ParallelFor(count, 256, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+			occluded[i] = IsAabbOccluded(buffer, bounds[i], viewProjection) ? 1 : 0;
+	});
+
+	u32 occludedCount = 0;
+	for (u32 i = 0; i < count; ++i)
+		occludedCount += occluded[i];
+	return occludedCount;
+}
+
+void BuildOccluderMesh(const vec3* positions, u32 vertexCount, const u32* indices, u32 indexCount, OccluderMesh& occluder)
+{
+	// Only the vertices the triangles use, renumbered
+	ScopedTemporaryMemory temp(GetTempArena());
+	u32* remap = PushArray(temp.temp.arena, u32, vertexCount);
+	for (u32 i = 0; i < vertexCount; ++i)
+		remap[i] = UINT32_MAX;
+
+	occluder.positions.clear();
+	occluder.indices.resize(indexCount);
+	for (u32 i = 0; i < indexCount; ++i)
+	{
+		u32 vertex = indices[i];
+		if (remap[vertex] == UINT32_MAX)
+		{
+			remap[vertex] = (u32)occluder.positions.size();
+			occluder.positions.push_back(positions[vertex]);
+		}
+		occluder.indices[i] = remap[vertex];
+	}
+}
+
+// Deterministic values in [0, 1) for the benchmark
+static f32 NextRandom(u32& state)
+{
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+void BenchmarkSoftwareOcclusion(const OccluderMesh* occluders, u32 occluderCount, u32 maxThreadCount, std::vector<SoftwareOcclusionBenchmark>& results)
+{
+	results.clear();
+	if (occluderCount == 0)
+		return;
+
+	Aabb sceneBounds = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+	u32 occluderTriangles = 0;
+	std::vector<OccluderInstance> instances(occluderCount);
+	for (u32 i = 0; i < occluderCount; ++i)
+	{
+		for (const vec3& position : occluders[i].positions)
+		{
+			sceneBounds.min = glm::min(sceneBounds.min, position);
+			sceneBounds.max = glm::max(sceneBounds.max, position);
+		}
+		occluderTriangles += (u32)occluders[i].indices.size() / 3;
+		instances[i].mesh = &occluders[i];
+	}
+	vec3 sceneSize = sceneBounds.max - sceneBounds.min;
+	vec3 sceneCenter = (sceneBounds.min + sceneBounds.max) * 0.5f;
+
+	// Small boxes all over the scene, like props
+	const u32 objectCount = 4096;
+	u32 random = 2024;
+	std::vector<Aabb> objects(objectCount);
+	for (u32 i = 0; i < objectCount; ++i)
+	{
+		vec3 center = sceneBounds.min + vec3(NextRandom(random), NextRandom(random), NextRandom(random)) * sceneSize;
+		vec3 extent = sceneSize * (0.005f + 0.01f * NextRandom(random));
+		objects[i] = Aabb{ center - extent, center + extent };
+	}
+
+	// Cameras on an ellipse inside the scene, at head height, looking across it
+	const u32 frameCount = 32;
+	std::vector<mat4> viewProjections(frameCount);
+	for (u32 i = 0; i < frameCount; ++i)
+	{
+		f32 angle = 6.2831853f * i / frameCount;
+		vec3 offset = vec3(cosf(angle) * sceneSize.x, 0.0f, sinf(angle) * sceneSize.z) * 0.3f;
+		vec3 eye = vec3(sceneCenter.x, sceneBounds.min.y + sceneSize.y * 0.35f, sceneCenter.z) + offset;
+		vec3 target = vec3(sceneCenter.x, eye.y, sceneCenter.z) - offset;
+		viewProjections[i] = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, glm::length(sceneSize) * 2.0f) *
+			glm::lookAt(eye, target, vec3(0.0f, 1.0f, 0.0f));
+	}
+
+	MaskedOcclusionBuffer buffer;
+	InitMaskedOcclusionBuffer(&buffer, OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+	std::vector<u8> occluded(objectCount);
+
+	const u32 previousThreadCount = GetJobThreadCount();
+	for (u32 threadCount = 1; ; threadCount = glm::min(threadCount * 2, maxThreadCount))
+	{
+		ShutdownJobSystem();
+		InitJobSystem(threadCount);
+
+		SoftwareOcclusionBenchmark result = {};
+		result.threadCount = GetJobThreadCount();
+		result.frameCount = frameCount;
+		result.occluderTriangles = occluderTriangles;
+		result.objectCount = objectCount;
+
+		u64 occludedCount = 0;
+		for (u32 frame = 0; frame < frameCount; ++frame)
+		{
+			for (OccluderInstance& instance : instances)
+				instance.worldViewProjection = viewProjections[frame];
+
+			auto start = std::chrono::high_resolution_clock::now();
+			ClearMaskedOcclusionBuffer(&buffer);
+			RasterizeOccluders(&buffer, instances.data(), occluderCount);
+			auto rasterized = std::chrono::high_resolution_clock::now();
+			occludedCount += TestOccludedAabbs(&buffer, objects.data(), objectCount, viewProjections[frame], occluded.data());
+			auto tested = std::chrono::high_resolution_clock::now();
+
+			result.rasterMilliseconds += std::chrono::duration<f64, std::milli>(rasterized - start).count() / frameCount;
+			result.testMilliseconds += std::chrono::duration<f64, std::milli>(tested - rasterized).count() / frameCount;
+		}
+		result.occludedRatio = (f32)occludedCount / (f32)(objectCount * frameCount);
+		results.push_back(result);
+
+		if (threadCount >= maxThreadCount)
+			break;
+	}
+
+	ShutdownJobSystem();
+	InitJobSystem(previousThreadCount);
+}
@@ -0,0 +1,130 @@
+//
+// software_occlusion.h : CPU occlusion culling in the spirit of Masked Occlusion
+// Culling (Hasselgren et al. 2016). Occluder triangles are rasterized with SSE into a
+// low resolution buffer of 32x4 pixel tiles; instead of a depth per pixel each tile
+// keeps a coverage mask and two depths, so it can be updated and tested a whole row of
+// pixels at a time. Object bounds are then tested against it before they are drawn.
+// Does not depend on the graphics API.
+//
+
+#pragma once
+
+#include "bvh.h"
+
+typedef glm::vec2 vec2;
+
+#define OCCLUSION_TILE_WIDTH  32
+#define OCCLUSION_TILE_HEIGHT 4
+
+// Buffer size used by the engine, a multiple of the tile size
+#define OCCLUSION_BUFFER_WIDTH  320
+#define OCCLUSION_BUFFER_HEIGHT 192
+
+// Occluders are clipped at this distance from the camera (clip space w)
+#define OCCLUSION_NEAR_W 0.01f
+
+// Rows of tiles rasterized by each job
+#define OCCLUSION_BAND_TILE_ROWS 4
+
+// Submeshes at least this big (fraction of the model bounds diagonal) become occluders
+// of models loaded with MeshLoad_Occluders
+#define OCCLUDER_MIN_RELATIVE_SIZE 0.25f
+
+/**
+ * Occluder geometry in model space. It must not stick out of the rendered surface, or
+ * objects behind the visible geometry could be culled.
+ */
+struct OccluderMesh
+{
+	std::vector<vec3> positions;
+	std::vector<u32>  indices;
+};
+
+struct OccluderInstance
+{
+	const OccluderMesh* mesh;
+	mat4                worldViewProjection;
+};
+
+// Screen space triangle ready to be rasterized, depths are 1 / w (bigger is closer, so
+// they interpolate linearly across the screen)
+struct OccluderTriangle
+{
+	vec3 edges[3];		// Edge functions (a, b, c): a * x + b * y + c >= 0 inside
+	f32  depth;			// 1 / w at the origin of the screen...
+	f32  depthDx;		// ...and its gradients
+	f32  depthDy;
+	f32  minDepth;		// Farthest vertex
+	i32  firstRow;		// Pixel rows the triangle covers
+	i32  lastRow;
+	bool valid;
+};
+
+/**
+ * Per tile: mask has a bit for each pixel covered by the working layer (a row of 32 per
+ * u32) and workingDepth is the farthest depth of those pixels. referenceDepth is the
+ * farthest depth over the whole tile, every pixel is covered at least that close.
+ * Once the working layer covers the tile it becomes the reference.
+ */
+struct MaskedOcclusionBuffer
+{
+	u32 width;
+	u32 height;
+	u32 tilesX;
+	u32 tilesY;
+	std::vector<u32> masks;				// OCCLUSION_TILE_HEIGHT per tile
+	std::vector<f32> referenceDepth;	// 0 where nothing covers the tile yet (infinitely far)
+	std::vector<f32> workingDepth;
+
+	// Scratch of RasterizeOccluders, two slots per occluder triangle for near plane clipping
+	std::vector<OccluderTriangle> triangles;
+	u32 rasterizedTriangles;			// Last RasterizeOccluders, after clipping and culling
+};
+
+/**
+ * width and height are rounded up to the tile size.
+ */
+void InitMaskedOcclusionBuffer(MaskedOcclusionBuffer* buffer, u32 width, u32 height);
+void ClearMaskedOcclusionBuffer(MaskedOcclusionBuffer* buffer);
+
+/**
+ * Adds the triangles of the occluders to the buffer, both faces. Setup runs in parallel
+ * over the triangles and rasterization in parallel over bands of tile rows.
+ */
+void RasterizeOccluders(MaskedOcclusionBuffer* buffer, const OccluderInstance* occluders, u32 occluderCount);
+
+/**
+ * True when the box is behind the occluders everywhere it covers on screen. Boxes
+ * crossing the near plane or outside the screen are never reported as occluded.
+ */
+bool IsAabbOccluded(const MaskedOcclusionBuffer* buffer, const Aabb& bounds, const mat4& viewProjection);
+
+/**
+ * IsAabbOccluded over many boxes in parallel, occluded receives 1 or 0 for each one.
+ * Returns the number of occluded boxes.
+ */
+u32 TestOccludedAabbs(const MaskedOcclusionBuffer* buffer, const Aabb* bounds, u32 count, const mat4& viewProjection, u8* occluded);
+
+/**
+ * Extracts the occluders of a submesh: its LOD 0 triangles with dequantized positions.
+ */
+void BuildOccluderMesh(const vec3* positions, u32 vertexCount, const u32* indices, u32 indexCount, OccluderMesh& occluder);
+
+struct SoftwareOcclusionBenchmark
+{
+	u32 threadCount;
+	u32 frameCount;
+	u32 occluderTriangles;
+	u32 objectCount;			// Tested every frame
+	f32 occludedRatio;			// Of the objects, over all the frames
+	f64 rasterMilliseconds;		// Per frame, clear and rasterization
+	f64 testMilliseconds;		// Per frame
+};
+
+/**
+ * Walks a camera through the bounds of the occluders (given in world space) and, every
+ * frame, rasterizes them and tests random boxes scattered in the same bounds, with 1,
+ * 2, 4... up to maxThreadCount threads. The job system is restarted for each count and
+ * restored at the end.
+ */
+void BenchmarkSoftwareOcclusion(const OccluderMesh* occluders, u32 occluderCount, u32 maxThreadCount, std::vector<SoftwareOcclusionBenchmark>& results);
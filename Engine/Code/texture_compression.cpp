@@ -0,0 +1,588 @@
+//
+// texture_compression.cpp : Block compression encoders and decoders, see texture_compression.h.
+//
+
+#include "texture_compression.h"
+#include "job_system.h"
+
+#include <emmintrin.h>
+#include <float.h>
+#include <algorithm>
+
+typedef glm::vec4   vec4;
+typedef glm::mat4   mat4;
+typedef glm::u8vec4  u8vec4;
+typedef glm::u32vec4 u32vec4;
+
+// Texels of a block as one row of 16 per channel, so four of them load at once
+struct BlockTexels
+{
+	f32 channels[4][16];
+};
+
+// Interpolation weights of the 4 bit BC7 indices, in 64ths
+static const u32 Bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Insets of the principal axis endpoints tried, as a fraction of their distance
+static const f32 EndpointInsets[] = { 0.0f, 1.0f / 32.0f, 1.0f / 16.0f, 1.0f / 8.0f };
+
+const char* GetBlockFormatName(BlockFormat format)
+{
+	static const char* names[BlockFormat_Count] = { "BC1", "BC3", "BC5", "BC7" };
+	return names[format];
+}
+
+u32 GetBlockBytes(BlockFormat format)
+{
+	return format == BlockFormat_BC1 ? 8 : 16;
+}
+
+u32 GetCompressedImageSize(BlockFormat format, ivec2 size)
+{
+	return (u32)((size.x + 3) / 4) * (u32)((size.y + 3) / 4) * GetBlockBytes(format);
+}
+
+static void LoadBlock(const u8* pixels, ivec2 size, u32 bytesPerPixel, u32 blockX, u32 blockY, BlockTexels& texels)
+{
+	for (u32 i = 0; i < 16; ++i)
+	{
+		i32 x = glm::min((i32)(blockX * 4 + i % 4), size.x - 1);
+		i32 y = glm::min((i32)(blockY * 4 + i / 4), size.y - 1);
+		const u8* texel = pixels + ((u64)y * size.x + x) * bytesPerPixel;
+		for (u32 c = 0; c < 4; ++c)
+			texels.channels[c][i] = c < bytesPerPixel ? (f32)texel[c] : 255.0f;
+	}
+}
+
+static vec4 GetTexel(const BlockTexels& texels, u32 i, u32 channelCount)
+{
+	vec4 texel(0.0f);
+	for (u32 c = 0; c < channelCount; ++c)
+		texel[c] = texels.channels[c][i];
+	return texel;
+}
+
+/**
+ * Sum of the squared errors of the texels against their closest palette entry, over the
+ * first channelCount channels, and the index of that entry for each texel.
+ */
+static f32 MatchPalette(const BlockTexels& texels, const vec4* palette, u32 paletteSize, u32 channelCount, u8* indices)
+{
+	f32 totalError = 0.0f;
+	for (u32 group = 0; group < 16; group += 4)
+	{
+		__m128  bestError = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+		for (u32 p = 0; p < paletteSize; ++p)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (u32 c = 0; c < channelCount; ++c)
+			{
+				__m128 difference = _mm_sub_ps(_mm_loadu_ps(&texels.channels[c][group]), _mm_set1_ps(palette[p][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(difference, difference));
+			}
+
+			__m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+			bestError = _mm_min_ps(error, bestError);
+			bestIndex = _mm_or_si128(_mm_andnot_si128(closer, bestIndex), _mm_and_si128(closer, _mm_set1_epi32((i32)p)));
+		}
+
+		alignas(16) f32 errors[4];
+		alignas(16) i32 groupIndices[4];
+		_mm_store_ps(errors, bestError);
+		_mm_store_si128((__m128i*)groupIndices, bestIndex);
+		for (u32 k = 0; k < 4; ++k)
+		{
+			totalError += errors[k];
+			indices[group + k] = (u8)groupIndices[k];
+		}
+	}
+	return totalError;
+}
+
+// Ends of the texels projected on their principal axis, found by power iteration
+static void FindPrincipalEndpoints(const BlockTexels& texels, u32 channelCount, vec4& endpoint0, vec4& endpoint1)
+{
+	vec4 mean(0.0f), minTexel(255.0f), maxTexel(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		vec4 texel = GetTexel(texels, i, channelCount);
+		mean += texel;
+		minTexel = glm::min(minTexel, texel);
+		maxTexel = glm::max(maxTexel, texel);
+	}
+	mean /= 16.0f;
+
+	mat4 covariance(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		vec4 difference = GetTexel(texels, i, channelCount) - mean;
+		covariance += glm::outerProduct(difference, difference);
+	}
+
+	vec4 axis = maxTexel - minTexel;
+	for (u32 c = channelCount; c < 4; ++c)
+		axis[c] = 0.0f;
+	if (glm::dot(axis, axis) < 1e-6f)
+	{
+		endpoint0 = mean;
+		endpoint1 = mean;
+		return;
+	}
+	for (u32 iteration = 0; iteration < 8; ++iteration)
+	{
+		vec4 next = covariance * axis;
+		f32 length = glm::length(next);
+		if (length < 1e-6f)
+			break;
+		axis = next / length;
+	}
+	axis = glm::normalize(axis);
+
+	f32 minProjection = FLT_MAX, maxProjection = -FLT_MAX;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 projection = glm::dot(GetTexel(texels, i, channelCount) - mean, axis);
+		minProjection = glm::min(minProjection, projection);
+		maxProjection = glm::max(maxProjection, projection);
+	}
+	endpoint0 = glm::clamp(mean + axis * minProjection, vec4(0.0f), vec4(255.0f));
+	endpoint1 = glm::clamp(mean + axis * maxProjection, vec4(0.0f), vec4(255.0f));
+}
+
+// Least squares endpoints for the indices chosen, weights[index] being how far along it is
+static bool FitEndpoints(const BlockTexels& texels, const u8* indices, const f32* weights, u32 channelCount, vec4& endpoint0, vec4& endpoint1)
+{
+	f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	vec4 ax(0.0f), bx(0.0f);
+	for (u32 i = 0; i < 16; ++i)
+	{
+		f32 b = weights[indices[i]];
+		f32 a = 1.0f - b;
+		vec4 texel = GetTexel(texels, i, channelCount);
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		ax += a * texel;
+		bx += b * texel;
+	}
+
+	f32 determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f)
+		return false;
+	endpoint0 = glm::clamp((ax * bb - bx * ab) / determinant, vec4(0.0f), vec4(255.0f));
+	endpoint1 = glm::clamp((bx * aa - ax * ab) / determinant, vec4(0.0f), vec4(255.0f));
+	return true;
+}
+
+struct BitWriter
+{
+	u8* bytes;
+	u32 position;
+};
+
+static void WriteBits(BitWriter& writer, u32 value, u32 count)
+{
+	for (u32 i = 0; i < count; ++i, ++writer.position)
+	{
+		if ((value >> i) & 1)
+			writer.bytes[writer.position / 8] |= (u8)(1 << (writer.position % 8));
+	}
+}
+
+static u32 ReadBits(const u8* bytes, u32& position, u32 count)
+{
+	u32 value = 0;
+	for (u32 i = 0; i < count; ++i, ++position)
+		value |= (u32)((bytes[position / 8] >> (position % 8)) & 1) << i;
+	return value;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC1
+
+static u16 PackRgb565(const vec4& color)
+{
+	u32 r = (u32)glm::round(color.r * 31.0f / 255.0f);
+	u32 g = (u32)glm::round(color.g * 63.0f / 255.0f);
+	u32 b = (u32)glm::round(color.b * 31.0f / 255.0f);
+	return (u16)((r << 11) | (g << 5) | b);
+}
+
+static u8vec4 UnpackRgb565(u16 color)
+{
+	u32 r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+	return u8vec4((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+}
+
+// The palette as the hardware builds it, three entries and black when color0 <= color1
+static void GetBc1Palette(u16 color0, u16 color1, bool fourColors, u8vec4* palette)
+{
+	u8vec4 endpoint0 = UnpackRgb565(color0), endpoint1 = UnpackRgb565(color1);
+	palette[0] = endpoint0;
+	palette[1] = endpoint1;
+	if (fourColors || color0 > color1)
+	{
+		palette[2] = u8vec4((2u * u32vec4(endpoint0) + u32vec4(endpoint1)) / 3u);
+		palette[3] = u8vec4((u32vec4(endpoint0) + 2u * u32vec4(endpoint1)) / 3u);
+	}
+	else
+	{
+		palette[2] = u8vec4((u32vec4(endpoint0) + u32vec4(endpoint1)) / 2u);
+		palette[3] = u8vec4(0, 0, 0, 255);
+	}
+}
+
+// Always four colours, color0 > color1 (or equal, with every index 0)
+static f32 EncodeBc1Endpoints(const BlockTexels& texels, const vec4& endpoint0, const vec4& endpoint1, u8* block, u8* indices)
+{
+	u16 color0 = PackRgb565(endpoint0), color1 = PackRgb565(endpoint1);
+	if (color0 < color1)
+		std::swap(color0, color1);
+
+	u8vec4 palette8[4];
+	GetBc1Palette(color0, color1, true, palette8);
+	vec4 palette[4];
+	for (u32 p = 0; p < 4; ++p)
+		palette[p] = vec4(palette8[p]);
+	f32 error = MatchPalette(texels, palette, color0 == color1 ? 1 : 4, 3, indices);
+
+	u32 indexBits = 0;
+	for (u32 i = 0; i < 16; ++i)
+		indexBits |= (u32)indices[i] << (2 * i);
+	memcpy(block + 0, &color0, sizeof(color0));
+	memcpy(block + 2, &color1, sizeof(color1));
+	memcpy(block + 4, &indexBits, sizeof(indexBits));
+	return error;
+}
+
+static void EncodeBc1Block(const BlockTexels& texels, u8* block)
+{
+	static const f32 weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	vec4 axisEndpoint0, axisEndpoint1;
+	FindPrincipalEndpoints(texels, 3, axisEndpoint0, axisEndpoint1);
+
+	f32 bestError = FLT_MAX;
+	u8 bestIndices[16];
+	for (f32 inset : EndpointInsets)
+	{
+		vec4 offset = (axisEndpoint1 - axisEndpoint0) * inset;
+		u8 candidate[8], indices[16];
+		f32 error = EncodeBc1Endpoints(texels, axisEndpoint0 + offset, axisEndpoint1 - offset, candidate, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			memcpy(block, candidate, sizeof(candidate));
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+	}
+
+	// The indices are of the palette written, whose first entry is color0
+	vec4 fitEndpoint0, fitEndpoint1;
+	if (FitEndpoints(texels, bestIndices, weights, 3, fitEndpoint0, fitEndpoint1))
+	{
+		u8 candidate[8], indices[16];
+		if (EncodeBc1Endpoints(texels, fitEndpoint0, fitEndpoint1, candidate, indices) < bestError)
+			memcpy(block, candidate, sizeof(candidate));
+	}
+}
+
+static void DecodeBc1Block(const u8* block, bool fourColors, u8vec4* texels)
+{
+	u16 color0, color1;
+	u32 indexBits;
+	memcpy(&color0, block + 0, sizeof(color0));
+	memcpy(&color1, block + 2, sizeof(color1));
+	memcpy(&indexBits, block + 4, sizeof(indexBits));
+
+	u8vec4 palette[4];
+	GetBc1Palette(color0, color1, fourColors, palette);
+	for (u32 i = 0; i < 16; ++i)
+		texels[i] = palette[(indexBits >> (2 * i)) & 3];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC4, a channel of BC3 and BC5
+
+// Always the eight value mode, the ends of the block as endpoints
+static void EncodeBc4Block(const BlockTexels& texels, u32 channel, u8* block)
+{
+	f32 minValue = 255.0f, maxValue = 0.0f;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		minValue = glm::min(minValue, texels.channels[channel][i]);
+		maxValue = glm::max(maxValue, texels.channels[channel][i]);
+	}
+	u8 value0 = (u8)glm::round(maxValue), value1 = (u8)glm::round(minValue);
+
+	// Position 0 is value0, 7 is value1, indices 0 and 1 and then the ones in between
+	u64 indexBits = 0;
+	if (value0 > value1)
+	{
+		for (u32 i = 0; i < 16; ++i)
+		{
+			f32 position = glm::round((value0 - texels.channels[channel][i]) * 7.0f / (value0 - value1));
+			u32 p = (u32)glm::clamp(position, 0.0f, 7.0f);
+			u64 index = p == 0 ? 0 : (p == 7 ? 1 : p + 1);
+			indexBits |= index << (3 * i);
+		}
+	}
+
+	block[0] = value0;
+	block[1] = value1;
+	for (u32 b = 0; b < 6; ++b)
+		block[2 + b] = (u8)(indexBits >> (8 * b));
+}
+
+static void DecodeBc4Block(const u8* block, u8* values, u32 stride)
+{
+	u32 palette[8];
+	palette[0] = block[0];
+	palette[1] = block[1];
+	if (palette[0] > palette[1])
+	{
+		for (u32 i = 2; i < 8; ++i)
+			palette[i] = ((8 - i) * palette[0] + (i - 1) * palette[1]) / 7;
+	}
+	else
+	{
+		for (u32 i = 2; i < 6; ++i)
+			palette[i] = ((6 - i) * palette[0] + (i - 1) * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	u64 indexBits = 0;
+	for (u32 b = 0; b < 6; ++b)
+		indexBits |= (u64)block[2 + b] << (8 * b);
+	for (u32 i = 0; i < 16; ++i)
+		values[i * stride] = (u8)palette[(indexBits >> (3 * i)) & 7];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BC7 mode 6
+
+// 7 bits a channel and a p-bit shared by the channels, the lowest bit of each of them
+static u8vec4 QuantizeBc7Endpoint(const vec4& endpoint, u32& pBit)
+{
+	u8vec4 best[2];
+	f32 bestError[2] = { 0.0f, 0.0f };
+	for (u32 p = 0; p < 2; ++p)
+	{
+		for (u32 c = 0; c < 4; ++c)
+		{
+			u32 value = (u32)glm::clamp(glm::round((endpoint[c] - p) / 2.0f), 0.0f, 127.0f);
+			best[p][c] = (u8)value;
+			f32 difference = (f32)((value << 1) | p) - endpoint[c];
+			bestError[p] += difference * difference;
+		}
+	}
+	pBit = bestError[1] < bestError[0] ? 1 : 0;
+	return best[pBit];
+}
+
+static void GetBc7Palette(const u8vec4* quantized, const u32* pBits, u8vec4* palette)
+{
+	u32vec4 endpoint0 = (u32vec4(quantized[0]) << 1u) | pBits[0];
+	u32vec4 endpoint1 = (u32vec4(quantized[1]) << 1u) | pBits[1];
+	for (u32 i = 0; i < 16; ++i)
+		palette[i] = u8vec4(((64u - Bc7Weights[i]) * endpoint0 + Bc7Weights[i] * endpoint1 + 32u) >> 6u);
+}
+
+static f32 EncodeBc7Endpoints(const BlockTexels& texels, const vec4& endpoint0, const vec4& endpoint1, u8* block, u8* indices)
+{
+	u8vec4 quantized[2];
+	u32 pBits[2];
+	quantized[0] = QuantizeBc7Endpoint(endpoint0, pBits[0]);
+	quantized[1] = QuantizeBc7Endpoint(endpoint1, pBits[1]);
+
+	u8vec4 palette8[16];
+	GetBc7Palette(quantized, pBits, palette8);
+	vec4 palette[16];
+	for (u32 p = 0; p < 16; ++p)
+		palette[p] = vec4(palette8[p]);
+	f32 error = MatchPalette(texels, palette, 16, 4, indices);
+
+	// The index of the first texel has its top bit implied 0, the ends swap if it is set
+	u8 written[16];
+	bool swapped = indices[0] >= 8;
+	if (swapped)
+	{
+		std::swap(quantized[0], quantized[1]);
+		std::swap(pBits[0], pBits[1]);
+	}
+	for (u32 i = 0; i < 16; ++i)
+		written[i] = swapped ? 15 - indices[i] : indices[i];
+
+	memset(block, 0, 16);
+	BitWriter writer = { block, 0 };
+	WriteBits(writer, 1 << 6, 7);
+	for (u32 c = 0; c < 4; ++c)
+	{
+		WriteBits(writer, quantized[0][c], 7);
+		WriteBits(writer, quantized[1][c], 7);
+	}
+	WriteBits(writer, pBits[0], 1);
+	WriteBits(writer, pBits[1], 1);
+	for (u32 i = 0; i < 16; ++i)
+		WriteBits(writer, written[i], i == 0 ? 3 : 4);
+	return error;
+}
+
+static void EncodeBc7Block(const BlockTexels& texels, u8* block)
+{
+	static const f32 weights[16] = { 0.0f / 64.0f, 4.0f / 64.0f, 9.0f / 64.0f, 13.0f / 64.0f, 17.0f / 64.0f, 21.0f / 64.0f, 26.0f / 64.0f,
+		30.0f / 64.0f, 34.0f / 64.0f, 38.0f / 64.0f, 43.0f / 64.0f, 47.0f / 64.0f, 51.0f / 64.0f, 55.0f / 64.0f, 60.0f / 64.0f, 64.0f / 64.0f };
+
+	vec4 axisEndpoint0, axisEndpoint1;
+	FindPrincipalEndpoints(texels, 4, axisEndpoint0, axisEndpoint1);
+
+	f32 bestError = FLT_MAX;
+	vec4 bestEndpoints[2];
+	u8 bestIndices[16];
+	for (f32 inset : EndpointInsets)
+	{
+		vec4 offset = (axisEndpoint1 - axisEndpoint0) * inset;
+		u8 candidate[16], indices[16];
+		f32 error = EncodeBc7Endpoints(texels, axisEndpoint0 + offset, axisEndpoint1 - offset, candidate, indices);
+		if (error < bestError)
+		{
+			bestError = error;
+			bestEndpoints[0] = axisEndpoint0 + offset;
+			bestEndpoints[1] = axisEndpoint1 - offset;
+			memcpy(block, candidate, sizeof(candidate));
+			memcpy(bestIndices, indices, sizeof(indices));
+		}
+	}
+
+	// Indices before the anchor swap, so they go with the endpoints in the order given
+	vec4 fitEndpoint0, fitEndpoint1;
+	if (FitEndpoints(texels, bestIndices, weights, 4, fitEndpoint0, fitEndpoint1))
+	{
+		u8 candidate[16], indices[16];
+		if (EncodeBc7Endpoints(texels, fitEndpoint0, fitEndpoint1, candidate, indices) < bestError)
+			memcpy(block, candidate, sizeof(candidate));
+	}
+}
+
+static void DecodeBc7Block(const u8* block, u8vec4* texels)
+{
+	// Only mode 6 is written, anything else decodes to black
+	u32 position = 0;
+	if (ReadBits(block, position, 7) != (1 << 6))
+	{
+		for (u32 i = 0; i < 16; ++i)
+			texels[i] = u8vec4(0, 0, 0, 255);
+		return;
+	}
+
+	u8vec4 quantized[2];
+	for (u32 c = 0; c < 4; ++c)
+	{
+		quantized[0][c] = (u8)ReadBits(block, position, 7);
+		quantized[1][c] = (u8)ReadBits(block, position, 7);
+	}
+	u32 pBits[2];
+	pBits[0] = ReadBits(block, position, 1);
+	pBits[1] = ReadBits(block, position, 1);
+
+	u8vec4 palette[16];
+	GetBc7Palette(quantized, pBits, palette);
+	for (u32 i = 0; i < 16; ++i)
+		texels[i] = palette[ReadBits(block, position, i == 0 ? 3 : 4)];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void CompressImage(BlockFormat format, const u8* pixels, ivec2 size, u32 bytesPerPixel, u8* blocks)
+{
+	const u32 blocksX = (size.x + 3) / 4;
+	const u32 blocksY = (size.y + 3) / 4;
+	const u32 blockBytes = GetBlockBytes(format);
+
+	// A row of blocks per job
+	ParallelFor(blocksY, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 blockY = begin; blockY < end; ++blockY)
+		{
+			for (u32 blockX = 0; blockX < blocksX; ++blockX)
+			{
+				BlockTexels texels;
+				LoadBlock(pixels, size, bytesPerPixel, blockX, blockY, texels);
+
+				u8* block = blocks + ((u64)blockY * blocksX + blockX) * blockBytes;
+				switch (format)
+				{
+				case BlockFormat_BC1: EncodeBc1Block(texels, block); break;
+				case BlockFormat_BC3: EncodeBc4Block(texels, 3, block); EncodeBc1Block(texels, block + 8); break;
+				case BlockFormat_BC5: EncodeBc4Block(texels, 0, block); EncodeBc4Block(texels, 1, block + 8); break;
+				case BlockFormat_BC7: EncodeBc7Block(texels, block); break;
+				default: break;
+				}
+			}
+		}
+	});
+}
+
+void DecompressImage(BlockFormat format, const u8* blocks, ivec2 size, u8* rgba)
+{
+	const u32 blocksX = (size.x + 3) / 4;
+	const u32 blocksY = (size.y + 3) / 4;
+	const u32 blockBytes = GetBlockBytes(format);
+
+	for (u32 blockY = 0; blockY < blocksY; ++blockY)
+	{
+		for (u32 blockX = 0; blockX < blocksX; ++blockX)
+		{
+			const u8* block = blocks + ((u64)blockY * blocksX + blockX) * blockBytes;
+			u8vec4 texels[16];
+			switch (format)
+			{
+			case BlockFormat_BC1:
+				DecodeBc1Block(block, false, texels);
+				break;
+			case BlockFormat_BC3:
+				DecodeBc1Block(block + 8, true, texels);
+				DecodeBc4Block(block, &texels[0].a, sizeof(u8vec4));
+				break;
+			case BlockFormat_BC5:
+				for (u32 i = 0; i < 16; ++i)
+					texels[i] = u8vec4(0, 0, 0, 255);
+				DecodeBc4Block(block, &texels[0].r, sizeof(u8vec4));
+				DecodeBc4Block(block + 8, &texels[0].g, sizeof(u8vec4));
+				break;
+			case BlockFormat_BC7:
+				DecodeBc7Block(block, texels);
+				break;
+			default:
+				break;
+			}
+
+			for (u32 i = 0; i < 16; ++i)
+			{
+				u32 x = blockX * 4 + i % 4, y = blockY * 4 + i / 4;
+				if (x < (u32)size.x && y < (u32)size.y)
+					memcpy(rgba + ((u64)y * size.x + x) * 4, &texels[i], 4);
+			}
+		}
+	}
+}
+
+f64 ComputeImagePsnr(const u8* pixels, u32 bytesPerPixel, const u8* rgba, ivec2 size, u32 channelCount)
+{
+	f64 squaredError = 0.0;
+	const u64 texelCount = (u64)size.x * size.y;
+	for (u64 i = 0; i < texelCount; ++i)
+	{
+		for (u32 c = 0; c < channelCount; ++c)
+		{
+			f64 source = c < bytesPerPixel ? pixels[i * bytesPerPixel + c] : 255.0;
+			f64 difference = source - rgba[i * 4 + c];
+			squaredError += difference * difference;
+		}
+	}
+
+	f64 meanSquaredError = squaredError / (f64)(texelCount * channelCount);
+	return meanSquaredError > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanSquaredError) : INFINITY;
+}
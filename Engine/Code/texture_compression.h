@@ -0,0 +1,54 @@
+//
+// texture_compression.h : CPU encoders (and decoders, to measure them) of the block
+// compressed formats, 4x4 texels per block:
+//   BC1  RGB, 4 bits a texel: two 565 endpoints and 2 bit indices
+//   BC3  RGBA, 8 bits a texel: BC1 colours plus a BC4 block for alpha
+//   BC5  RG, 8 bits a texel: a BC4 block per channel, for normal maps
+//   BC7  RGBA, 8 bits a texel: only mode 6 is written, 7777 endpoints with a p-bit each
+//        and 4 bit indices, enough to beat BC1 on colour and keep alpha
+// Endpoints come from the principal axis of the block, then a few insets and a least
+// squares fit are tried, the texels matched against each palette four at a time with SSE.
+// Images are split in rows of blocks over the job system.
+//
+
+#pragma once
+
+#include "platform.h"
+
+typedef glm::ivec2 ivec2;
+
+enum BlockFormat
+{
+	BlockFormat_BC1,
+	BlockFormat_BC3,
+	BlockFormat_BC5,
+	BlockFormat_BC7,
+	BlockFormat_Count
+};
+
+const char* GetBlockFormatName(BlockFormat format);
+
+u32 GetBlockBytes(BlockFormat format);
+
+/**
+ * Bytes of an image of the given size, partial blocks at the edges counted whole.
+ */
+u32 GetCompressedImageSize(BlockFormat format, ivec2 size);
+
+/**
+ * Encodes an image of 8 bit channels (3 or 4 a texel, tightly packed rows) into
+ * GetCompressedImageSize(format, size) bytes of blocks. Texels past the edges repeat
+ * the last row and column.
+ */
+void CompressImage(BlockFormat format, const u8* pixels, ivec2 size, u32 bytesPerPixel, u8* blocks);
+
+/**
+ * Decodes the blocks back to RGBA8 (BC5 with blue 0 and alpha 255).
+ */
+void DecompressImage(BlockFormat format, const u8* blocks, ivec2 size, u8* rgba);
+
+/**
+ * Peak signal to noise ratio in dB between an image of bytesPerPixel channels and an
+ * RGBA8 one, over the first channelCount channels. Infinite when they are equal.
+ */
+f64 ComputeImagePsnr(const u8* pixels, u32 bytesPerPixel, const u8* rgba, ivec2 size, u32 channelCount);
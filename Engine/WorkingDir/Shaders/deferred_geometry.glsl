@@ -19,17 +19,43 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3         uCameraPosition;
     unsigned int uLightCount;
     Light        uLight[16];
 };
 
+#if INSTANCED
+// Instanced draws read their LocalParams from the instance buffer (InstanceParams in engine.h)
+struct InstanceParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;
+    vec4 material; // Metallic, roughness
+};
+
+layout(binding = 0, std430) readonly buffer Instances
+{
+    InstanceParams uInstances[];
+};
+
+uniform uint uFirstInstance;
+
+#define uWorldMatrix               uInstances[uFirstInstance + gl_InstanceID].worldMatrix
+#define uWorldViewProjectionMatrix uInstances[uFirstInstance + gl_InstanceID].worldViewProjectionMatrix
+
+flat out vec2 vMaterial;
+#else
 layout(binding = 1, std140) uniform LocalParams
 {
     mat4 uWorldMatrix;
     mat4 uWorldViewProjectionMatrix;
 };
+#endif
+
+// Quantized positions are stored relative to the submesh bounds
+uniform vec3 uPositionScale = vec3(1.0);
+uniform vec3 uPositionOffset = vec3(0.0);
 
 out vec2 vTexCoord;
 out vec3 vPosition; //In worldspace
@@ -41,18 +67,22 @@ uniform mat4 projectionViewMatrix;
 
 void main()
 {
+    vec3 position = aPosition * uPositionScale + uPositionOffset;
     vTexCoord = aTexCoord;
+#if INSTANCED
+    vMaterial = uInstances[uFirstInstance + gl_InstanceID].material.xy;
+#endif
     
     mat4 model = mat4(1.0f);
     //vNormal   = vec3(uWorldMatrix * vec4(aNormal, 0.0));
     vNormal = mat3(transpose(inverse(model))) * aNormal;
 
-    //vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-    vPosition = vec3(model * vec4(aPosition, 1.0f));
+    //vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
+    vPosition = vec3(model * vec4(position, 1.0f));
 
     vViewDir  = uCameraPosition - vPosition;
 
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0f);
 }   
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -71,12 +101,18 @@ in vec3 vNormal;   //In worldspace
 in vec3 vViewDir;  //In worldspace
 
 uniform sampler2D uTexture;
+#if INSTANCED
+flat in vec2 vMaterial;
+#define uMetallic  vMaterial.x
+#define uRoughness vMaterial.y
+#else
 uniform float uMetallic;
 uniform float uRoughness;
+#endif
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
     Light uLight[16];
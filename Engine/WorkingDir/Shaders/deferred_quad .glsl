@@ -18,10 +18,10 @@ layout(location = 1) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(binding = 1, std140) uniform LocalParams
@@ -63,10 +63,10 @@ uniform sampler2D brdfLUT;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(location = 0) out vec4 oColor;
@@ -85,54 +85,43 @@ void main()
 
     oColor = vec4(vec3(0.0f), 1.0f);
 
-    switch(uRenderMode)
-    {
-        case 0:
-            oColor = vec4(vColor, 1.0f);
-            break;
-        case 1:
-            oColor = vec4(vNormal, 1.0f);
-            break;
-        case 2:
-            oColor = vec4(vPosition, 1.0f);
-            break;
-        case 3:
-            oColor = vec4(vec3(texture(uDepth, vTexCoord).r),1.0);
-            break;
-        case 4:
-            oColor = vec4(vec3(vMetallic),1.0);
-            break;
-        case 5:
-            oColor = vec4(vec3(vRoughness),1.0);
-            break;
-        case 6:
-            if(alpha>=0.1){
-                for(int i = 0; i < uLightCount; ++i)
-                {
-                        vec3 lightDir = normalize(uLight[i].direction);
-                        vec3 lightResult = vec3(0.0f);
-                        vec3 viewDir = normalize(uCameraPosition - vPosition);
-
-                        if(uLight[i].type == 0)
-                        {
-                            lightResult = CalculateDirectionalLight(uLight[i], vPosition, normalize(vNormal), viewDir);
-                        }
-                        else
-                        {
-                            lightResult = CalculatePointLight(uLight[i], vPosition, normalize(vNormal), viewDir);
-                        }
-                            
-                        oColor.rgb += lightResult * vColor.rgb;    
-                }
-            }
-            else{
-                oColor = vec4(vColor, 1.0f);
-            }
-            break;
-        default:
-            oColor = vec4(vColor, 1.0f);
-            break;
+    // DEBUG_VIEW follows RenderTargetsMode: 0 albedo, 1 normals, 2 position,
+    // 3 depth, 4 metallic, 5 roughness, 6 final render
+#if DEBUG_VIEW == 0
+    oColor = vec4(vColor, 1.0f);
+#elif DEBUG_VIEW == 1
+    oColor = vec4(vNormal, 1.0f);
+#elif DEBUG_VIEW == 2
+    oColor = vec4(vPosition, 1.0f);
+#elif DEBUG_VIEW == 3
+    oColor = vec4(vec3(texture(uDepth, vTexCoord).r),1.0);
+#elif DEBUG_VIEW == 4
+    oColor = vec4(vec3(vMetallic),1.0);
+#elif DEBUG_VIEW == 5
+    oColor = vec4(vec3(vRoughness),1.0);
+#else
+    if(alpha>=0.1){
+        vec3 viewDir = normalize(uCameraPosition - vPosition);
+
+        // Lights come sorted by type, LIGHT_TYPES strips the loops of the missing ones
+#if (LIGHT_TYPES & 1)
+        for(uint i = 0; i < uDirectionalLightCount; ++i)
+        {
+            oColor.rgb += CalculateDirectionalLight(uLight[i], vPosition, normalize(vNormal), viewDir) * vColor.rgb;
+        }
+#endif
+
+#if (LIGHT_TYPES & 2)
+        for(uint i = uDirectionalLightCount; i < uLightCount; ++i)
+        {
+            oColor.rgb += CalculatePointLight(uLight[i], vPosition, normalize(vNormal), viewDir) * vColor.rgb;
+        }
+#endif
     }
+    else{
+        oColor = vec4(vColor, 1.0f);
+    }
+#endif
 }
 
 vec3 CalculateDirectionalLight(Light light, vec3 position, vec3 normal, vec3 viewDir)
@@ -19,17 +19,43 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3         uCameraPosition;
     unsigned int uLightCount;
-    Light        uLight[16];
+    Light        uLight[MAX_LIGHTS];
 };
 
+#if INSTANCED
+// Instanced draws read their LocalParams from the instance buffer (InstanceParams in engine.h)
+struct InstanceParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;
+    vec4 material; // Metallic, roughness
+};
+
+layout(binding = 0, std430) readonly buffer Instances
+{
+    InstanceParams uInstances[];
+};
+
+uniform uint uFirstInstance;
+
+#define uWorldMatrix               uInstances[uFirstInstance + gl_InstanceID].worldMatrix
+#define uWorldViewProjectionMatrix uInstances[uFirstInstance + gl_InstanceID].worldViewProjectionMatrix
+
+flat out vec2 vMaterial;
+#else
 layout(binding = 1, std140) uniform LocalParams
 {
     mat4 uWorldMatrix;
     mat4 uWorldViewProjectionMatrix;
 };
+#endif
+
+// Quantized positions are stored relative to the submesh bounds
+uniform vec3 uPositionScale = vec3(1.0);
+uniform vec3 uPositionOffset = vec3(0.0);
 
 out vec2 vTexCoord;
 out vec3 vPosition; //In worldspace
@@ -40,11 +66,15 @@ uniform mat4 projectionViewMatrix;
 
 void main()
 {
+    vec3 position = aPosition * uPositionScale + uPositionOffset;
     vTexCoord = aTexCoord;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+#if INSTANCED
+    vMaterial = uInstances[uFirstInstance + gl_InstanceID].material.xy;
+#endif
+    vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
     vNormal   = vec3(uWorldMatrix * vec4(aNormal, 0.0)); 
     vViewDir  = uCameraPosition - vPosition;
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0f);
 }   
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -62,8 +92,14 @@ in vec3 vPosition; //In worldspace
 in vec3 vNormal;   //In worldspace
 in vec3 vViewDir;  //In worldspace
 
+#if INSTANCED
+flat in vec2 vMaterial;
+#define uMetallic  vMaterial.x
+#define uRoughness vMaterial.y
+#else
 uniform float uMetallic;
 uniform float uRoughness;
+#endif
 uniform sampler2D uTexture;
 uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
@@ -71,10 +107,10 @@ uniform sampler2D brdfLUT;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(location = 0) out vec4 rt0; //Albedo 
@@ -96,22 +132,20 @@ void main()
     rt4 = vec4(vec3(uRoughness), 1.0);
     rt5 = vec4(vec3(0.0), 1.0);
 
-    for(int i = 0; i < uLightCount; ++i)
+    // Lights come sorted by type, LIGHT_TYPES strips the loops of the missing ones
+#if (LIGHT_TYPES & 1)
+    for(uint i = 0; i < uDirectionalLightCount; ++i)
+    {
+        rt5.rgb += CalculateDirectionalLight(uLight[i], normalize(vNormal), vViewDir) * rt0.rgb;
+    }
+#endif
+
+#if (LIGHT_TYPES & 2)
+    for(uint i = uDirectionalLightCount; i < uLightCount; ++i)
     {
-        vec3 lightDir = normalize(uLight[i].direction);
-        vec3 lightResult = vec3(0.0f);
-
-        if(uLight[i].type == 0)
-        {
-            lightResult = CalculateDirectionalLight(uLight[i], normalize(vNormal), vViewDir);
-        }
-        else
-        {
-            lightResult = CalculatePointLight(uLight[i], normalize(vNormal), vViewDir);
-        }
-        
-        rt5.rgb += lightResult * rt0.rgb;    
+        rt5.rgb += CalculatePointLight(uLight[i], normalize(vNormal), vViewDir) * rt0.rgb;
     }
+#endif
 }
 
 vec3 CalculateDirectionalLight(Light light, vec3 normal, vec3 viewDir)
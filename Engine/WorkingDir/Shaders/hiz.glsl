@@ -0,0 +1,46 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef HIZ_BUILD
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// One level of the hierarchical Z pyramid: each texel keeps the farthest depth of the
+// texels it covers in the level above. Level 0 is copied from the depth buffer.
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uDepth;		// Level 0 only
+uniform int       uLevel;
+uniform ivec2     uSourceSize;	// Size of the level read from
+
+layout(binding = 0, r32f) uniform readonly  image2D uSource;
+layout(binding = 1, r32f) uniform writeonly image2D uDestination;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = imageSize(uDestination);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    if (uLevel == 0)
+    {
+        imageStore(uDestination, texel, vec4(texelFetch(uDepth, texel, 0).r));
+        return;
+    }
+
+    // With odd source sizes the last texel of a row or column also takes the one
+    // left over, so no source texel is skipped
+    ivec2 source = texel * 2;
+    ivec2 last = min(source + ivec2(1) + ivec2(equal(texel, size - 1)) * (uSourceSize & 1), uSourceSize - 1);
+    float depth = 0.0;
+    for (int y = source.y; y <= last.y; ++y)
+        for (int x = source.x; x <= last.x; ++x)
+            depth = max(depth, imageLoad(uSource, ivec2(x, y)).r);
+
+    imageStore(uDestination, texel, vec4(depth));
+}
+
+#endif
+#endif
\ No newline at end of file
@@ -19,7 +19,7 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3         uCameraPosition;
     unsigned int uLightCount;
     Light        uLight[16];
@@ -31,6 +31,10 @@ layout(binding = 1, std140) uniform LocalParams
     mat4 uWorldViewProjectionMatrix;
 };
 
+// Quantized positions are stored relative to the submesh bounds
+uniform vec3 uPositionScale = vec3(1.0);
+uniform vec3 uPositionOffset = vec3(0.0);
+
 out vec2 vTexCoord;
 out vec3 vPosition; //In worldspace
 out vec3 vNormal;   //In worldspace
@@ -40,11 +44,12 @@ uniform mat4 projectionViewMatrix;
 
 void main()
 {
+    vec3 position = aPosition * uPositionScale + uPositionOffset;
     vTexCoord = aTexCoord;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+    vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
     vNormal   = vec3(uWorldMatrix * vec4(aNormal, 0.0)); 
     vViewDir  = uCameraPosition - vPosition;
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0f);
 }   
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -66,7 +71,7 @@ uniform vec3 uLightColor;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
     Light uLight[16];
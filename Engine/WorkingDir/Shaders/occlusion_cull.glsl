@@ -0,0 +1,156 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+#ifdef OCCLUSION_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Tests the world bounds of each object against the hierarchical Z pyramid and writes
+// the instance count of its indirect draws.
+// Pass 0: against the pyramid of the previous frame, projected with its view projection.
+// Pass 1: the objects pass 0 rejected, against the pyramid of what pass 0 drew.
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int  baseVertex;
+    uint baseInstance;
+};
+
+struct Object
+{
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint firstCommand;
+    uint commandCount;
+    uint triangleCount;
+    uint padding;
+};
+
+layout(binding = 0, std430) readonly buffer Objects
+{
+    Object objects[];
+};
+
+// Two copies of the commands, one per pass
+layout(binding = 1, std430) buffer Commands
+{
+    DrawCommand commands[];
+};
+
+// 1 for the objects drawn in pass 0
+layout(binding = 2, std430) buffer Visibility
+{
+    uint visibility[];
+};
+
+layout(binding = 3, std430) buffer Stats
+{
+    uint objectsTested;
+    uint objectsVisible[2];
+    uint trianglesVisible[2];
+};
+
+uniform sampler2D uHiZ;
+uniform mat4      uViewProjection;
+uniform uint      uObjectCount;
+uniform uint      uCommandCount;	// Of one copy
+uniform int       uPass;
+uniform bool      uHiZValid;		// False until a pyramid has been built
+
+bool IsVisible(Object object)
+{
+    if (!uHiZValid)
+        return true;
+
+    // Screen rectangle and nearest depth of the box
+    vec3 ndcMin = vec3(1.0);
+    vec3 ndcMax = vec3(-1.0);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? object.boundsMax.x : object.boundsMin.x,
+                           (i & 2) != 0 ? object.boundsMax.y : object.boundsMin.y,
+                           (i & 4) != 0 ? object.boundsMax.z : object.boundsMin.z);
+        vec4 clip = uViewProjection * vec4(corner, 1.0);
+
+        // Crossing the near plane, the projection is meaningless
+        if (clip.w <= 1e-4)
+            return true;
+
+        vec3 ndc = clip.xyz / clip.w;
+        ndcMin = min(ndcMin, ndc);
+        ndcMax = max(ndcMax, ndc);
+    }
+
+    // Outside of the screen
+    if (any(greaterThan(ndcMin.xy, vec2(1.0))) || any(lessThan(ndcMax.xy, vec2(-1.0))))
+        return false;
+
+    vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+    vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+    float nearestDepth = ndcMin.z * 0.5 + 0.5;
+
+    // Level where the rectangle spans at most two texels in each direction
+    ivec2 baseSize = textureSize(uHiZ, 0);
+    vec2 pixels = (uvMax - uvMin) * vec2(baseSize);
+    int levelCount = textureQueryLevels(uHiZ);
+    int level = clamp(int(ceil(log2(max(max(pixels.x, pixels.y), 1.0)))), 0, levelCount - 1);
+
+    ivec2 levelSize = textureSize(uHiZ, level);
+    ivec2 texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+    ivec2 texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+
+    // The rounding of the level sizes can leave a rectangle over three texels, the
+    // next level then covers it with two
+    if (any(greaterThan(texelMax - texelMin, ivec2(1))) && level + 1 < levelCount)
+    {
+        level++;
+        levelSize = textureSize(uHiZ, level);
+        texelMin = clamp(ivec2(uvMin * vec2(levelSize)), ivec2(0), levelSize - 1);
+        texelMax = clamp(ivec2(uvMax * vec2(levelSize)), ivec2(0), levelSize - 1);
+    }
+
+    float farthestDepth = 0.0;
+    for (int y = texelMin.y; y <= texelMax.y; ++y)
+        for (int x = texelMin.x; x <= texelMax.x; ++x)
+            farthestDepth = max(farthestDepth, texelFetch(uHiZ, ivec2(x, y), level).r);
+
+    return nearestDepth <= farthestDepth;
+}
+
+void main()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uObjectCount)
+        return;
+
+    Object object = objects[index];
+    bool visible;
+    if (uPass == 0)
+    {
+        visible = IsVisible(object);
+        visibility[index] = visible ? 1u : 0u;
+        atomicAdd(objectsTested, 1u);
+    }
+    else
+    {
+        visible = visibility[index] == 0u && IsVisible(object);
+    }
+
+    uint firstCommand = uint(uPass) * uCommandCount + object.firstCommand;
+    for (uint i = 0u; i < object.commandCount; ++i)
+        commands[firstCommand + i].instanceCount = visible ? 1u : 0u;
+
+    if (visible)
+    {
+        atomicAdd(objectsVisible[uPass], 1u);
+        atomicAdd(trianglesVisible[uPass], object.triangleCount);
+    }
+}
+
+#endif
+#endif
\ No newline at end of file
@@ -18,10 +18,10 @@ layout(location = 1) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(binding = 1, std140) uniform LocalParams
@@ -66,10 +66,10 @@ uniform sampler2D brdfLUT;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(binding = 1, std140) uniform LocalParams
@@ -89,6 +89,7 @@ float GeometrySchlickGGX(float NdotV, float roughness);
 vec3 fresnelSchlick(float cosTheta, vec3 F0);
 float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness);
 vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
+vec3 CalculateRadiance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness);
 
 void main()
 {
@@ -101,113 +102,85 @@ void main()
 
     oColor = vec4(vec3(0.0f), 1.0f);
 
-    switch(uRenderMode)
+    // DEBUG_VIEW follows RenderTargetsMode: 0 albedo, 1 normals, 2 position,
+    // 3 depth, 4 metallic, 5 roughness, 6 final render
+#if DEBUG_VIEW == 0
+    oColor = vec4(vColor, 1.0f);
+#elif DEBUG_VIEW == 1
+    oColor = vec4(vNormal, 1.0f);
+#elif DEBUG_VIEW == 2
+    oColor = vec4(vPosition, 1.0f);
+#elif DEBUG_VIEW == 3
+    oColor = vec4(vec3(texture(uDepth, vTexCoord).r),1.0);
+#elif DEBUG_VIEW == 4
+    oColor = vec4(vec3(vMetallic),1.0);
+#elif DEBUG_VIEW == 5
+    oColor = vec4(vec3(vRoughness),1.0);
+#else
+    if(alpha>=0.1)
     {
-        case 0:
-            oColor = vec4(vColor, 1.0f);
-            break;
-        case 1:
-            oColor = vec4(vNormal, 1.0f);
-            break;
-        case 2:
-            oColor = vec4(vPosition, 1.0f);
-            break;
-        case 3:
-            oColor = vec4(vec3(texture(uDepth, vTexCoord).r),1.0);
-            break;
-        case 4:
-            oColor = vec4(vec3(vMetallic),1.0);
-            break;
-        case 5:
-            oColor = vec4(vec3(vRoughness),1.0);
-            break;
-        case 6:
-           if(alpha>=0.1)
-           {
-               vec3 N = vNormal;
-               vec3 V = normalize(uCameraPosition - vWorldPosition);
-               vec3 R = reflect(-V, N);
-
-               vec3 albedo = vColor.rgb; 
-
-               vec3 F0 = vec3(0.04); 
-               F0      = mix(F0, albedo, vMetallic);
-
-               // reflectance equation
-               vec3 Lo = vec3(0.0);
-               for(int i = 0; i < uLightCount; ++i)
-               {
-                       vec3 lightDir = normalize(uLight[i].direction);
-                       vec3 lightResult = vec3(0.0f);
-                       vec3 viewDir = normalize(uCameraPosition - vPosition);
-
-                       vec3 L; 
-                       vec3 radiance = uLight[i].color;
-                       if(uLight[i].type == 0)
-                       {
-                           L = uLight[i].direction;
-                           
-                       }
-                       else
-                       {
-                            L = normalize(uLight[i].position - vWorldPosition);
-                            float distance = length(uLight[i].position - vWorldPosition);
-                            float attenuation = 1.0 / (distance * distance);
-                            radiance *= attenuation;
-                       } 
-
-                        vec3 H = normalize(V + L);
-
-                        // Cook-Torrance BRDF
-                        float NDF = DistributionGGX(N, H, vRoughness);   
-                        float G   = GeometrySmith(N, V, L, vRoughness);    
-                        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);       
-
-                        vec3 numerator    = NDF * G * F;
-                        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0)  + 0.0001;
-                        vec3 specular     = numerator / denominator; 
-
-                        vec3 kS = F;
-                        vec3 kD = vec3(1.0) - kS;
-                        kD *= 1.0 - vMetallic;     
-
-                        // add to outgoing radiance Lo
-                        float NdotL = max(dot(N, L), 0.0);                
-                        Lo += (kD * albedo / PI + specular) * radiance * NdotL; 
-                        
-                       //oColor.rgb += lightResult * albedo.rgb;    
-               }
-
-                vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, vRoughness);
-               vec3 kS = F;
-               vec3 kD = 1.0 - kS;
-               kD *= 1.0 - vMetallic;
-
-               vec3 irradiance = texture(irradianceMap, N).rgb;
-               vec3 diffuse = irradiance * albedo;
-
-               const float MAX_REFLECTION_LOD = 4.0;
-               vec3 prefilteredColor = textureLod(prefilterMap, R,  vRoughness * MAX_REFLECTION_LOD).rgb;  
-               vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), vRoughness)).rg;
-               vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
-
-               vec3 ambient = kD * diffuse + specular;
-               
-               vec3 color = ambient + Lo;
-
-                color = color / (color + vec3(1.0f));
-                color = pow(color, vec3(1.0f/2.2f));
-
-                oColor = vec4(color, 1.0f);
-           }
-           else{
-               oColor = vec4(vColor, 1.0f);
-           }
-            break;
-        default:;
-            oColor = vec4(vColor, 1.0f);
-            break;
+        vec3 N = vNormal;
+        vec3 V = normalize(uCameraPosition - vWorldPosition);
+        vec3 R = reflect(-V, N);
+
+        vec3 albedo = vColor.rgb; 
+
+        vec3 F0 = vec3(0.04); 
+        F0      = mix(F0, albedo, vMetallic);
+
+        // reflectance equation
+        vec3 Lo = vec3(0.0);
+
+        // Lights come sorted by type, LIGHT_TYPES strips the loops of the missing ones
+#if (LIGHT_TYPES & 1)
+        for(uint i = 0; i < uDirectionalLightCount; ++i)
+        {
+            vec3 L = uLight[i].direction;
+            Lo += CalculateRadiance(N, V, L, uLight[i].color, albedo, F0, vMetallic, vRoughness);
+        }
+#endif
+
+#if (LIGHT_TYPES & 2)
+        for(uint i = uDirectionalLightCount; i < uLightCount; ++i)
+        {
+            vec3 L = normalize(uLight[i].position - vWorldPosition);
+            float distance = length(uLight[i].position - vWorldPosition);
+            float attenuation = 1.0 / (distance * distance);
+            Lo += CalculateRadiance(N, V, L, uLight[i].color * attenuation, albedo, F0, vMetallic, vRoughness);
+        }
+#endif
+
+#if USE_IBL
+        vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, vRoughness);
+        vec3 kS = F;
+        vec3 kD = 1.0 - kS;
+        kD *= 1.0 - vMetallic;
+
+        vec3 irradiance = texture(irradianceMap, N).rgb;
+        vec3 diffuse = irradiance * albedo;
+
+        const float MAX_REFLECTION_LOD = 4.0;
+        vec3 prefilteredColor = textureLod(prefilterMap, R,  vRoughness * MAX_REFLECTION_LOD).rgb;  
+        vec2 brdf  = texture(brdfLUT, vec2(max(dot(N, V), 0.0), vRoughness)).rg;
+        vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
+
+        vec3 ambient = kD * diffuse + specular;
+#else
+        vec3 ambient = vec3(0.0);
+#endif
+
+        vec3 color = ambient + Lo;
+
+        color = color / (color + vec3(1.0f));
+        color = pow(color, vec3(1.0f/2.2f));
+
+        oColor = vec4(color, 1.0f);
+    }
+    else
+    {
+        oColor = vec4(vColor, 1.0f);
     }
+#endif
 }
 
 float DistributionGGX(vec3 N, vec3 H, float roughness)
@@ -255,6 +228,28 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }   
 
+vec3 CalculateRadiance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness)
+{
+    vec3 H = normalize(V + L);
+
+    // Cook-Torrance BRDF
+    float NDF = DistributionGGX(N, H, roughness);
+    float G   = GeometrySmith(N, V, L, roughness);
+    vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+    vec3 numerator    = NDF * G * F;
+    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0)  + 0.0001;
+    vec3 specular     = numerator / denominator;
+
+    vec3 kS = F;
+    vec3 kD = vec3(1.0) - kS;
+    kD *= 1.0 - metallic;
+
+    // add to outgoing radiance Lo
+    float NdotL = max(dot(N, L), 0.0);
+    return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+
 #endif
 #endif
 
@@ -19,17 +19,43 @@ layout(location=2) in vec2 aTexCoord;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3         uCameraPosition;
     unsigned int uLightCount;
-    Light        uLight[16];
+    Light        uLight[MAX_LIGHTS];
 };
 
+#if INSTANCED
+// Instanced draws read their LocalParams from the instance buffer (InstanceParams in engine.h)
+struct InstanceParams
+{
+    mat4 worldMatrix;
+    mat4 worldViewProjectionMatrix;
+    vec4 material; // Metallic, roughness
+};
+
+layout(binding = 0, std430) readonly buffer Instances
+{
+    InstanceParams uInstances[];
+};
+
+uniform uint uFirstInstance;
+
+#define uWorldMatrix               uInstances[uFirstInstance + gl_InstanceID].worldMatrix
+#define uWorldViewProjectionMatrix uInstances[uFirstInstance + gl_InstanceID].worldViewProjectionMatrix
+
+flat out vec2 vMaterial;
+#else
 layout(binding = 1, std140) uniform LocalParams
 {
     mat4 uWorldMatrix;
     mat4 uWorldViewProjectionMatrix;
 };
+#endif
+
+// Quantized positions are stored relative to the submesh bounds
+uniform vec3 uPositionScale = vec3(1.0);
+uniform vec3 uPositionOffset = vec3(0.0);
 
 out vec2 vTexCoord;
 out vec3 vPosition; //In worldspace
@@ -40,11 +66,15 @@ uniform mat4 projectionViewMatrix;
 
 void main()
 {
+    vec3 position = aPosition * uPositionScale + uPositionOffset;
     vTexCoord = aTexCoord;
-    vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
+#if INSTANCED
+    vMaterial = uInstances[uFirstInstance + gl_InstanceID].material.xy;
+#endif
+    vPosition = vec3(uWorldMatrix * vec4(position, 1.0));
     vNormal   = vec3(uWorldMatrix * vec4(aNormal, 0.0)); 
     vViewDir  = uCameraPosition - vPosition;
-    gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uWorldViewProjectionMatrix * vec4(position, 1.0f);
 }   
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -62,8 +92,14 @@ in vec3 vPosition; //In worldspace
 in vec3 vNormal;   //In worldspace
 in vec3 vViewDir;  //In worldspace
 
+#if INSTANCED
+flat in vec2 vMaterial;
+#define uMetallic  vMaterial.x
+#define uRoughness vMaterial.y
+#else
 uniform float uMetallic;
 uniform float uRoughness;
+#endif
 uniform sampler2D uTexture;
 uniform samplerCube irradianceMap;
 uniform samplerCube prefilterMap;
@@ -71,10 +107,10 @@ uniform sampler2D brdfLUT;
 
 layout(binding = 0, std140) uniform GlobalParams
 {
-    unsigned int uRenderMode;
+    unsigned int uDirectionalLightCount;
     vec3 uCameraPosition;
     unsigned int uLightCount;
-    Light uLight[16];
+    Light uLight[MAX_LIGHTS];
 };
 
 layout(location = 0) out vec4 rt0; //Albedo 
@@ -93,6 +129,7 @@ float GeometrySchlickGGX(float NdotV, float roughness);
 vec3 fresnelSchlick(float cosTheta, vec3 F0);
 float GeometrySmith(vec3 N, vec3 V, vec3 L, float roughness);
 vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness);
+vec3 CalculateRadiance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness);
 
 void main()
 {
@@ -113,48 +150,27 @@ void main()
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < uLightCount; ++i)
+
+    // Lights come sorted by type, LIGHT_TYPES strips the loops of the missing ones
+#if (LIGHT_TYPES & 1)
+    for(uint i = 0; i < uDirectionalLightCount; ++i)
     {
-        vec3 lightDir = normalize(uLight[i].direction);
-        vec3 lightResult = vec3(0.0f);
-        vec3 viewDir = normalize(uCameraPosition - vPosition);
-
-        vec3 L; 
-        vec3 radiance = uLight[i].color;
-        //Directional light
-        if(uLight[i].type == 0)
-        {
-            L = uLight[i].direction;
-        }
-        //Point light
-        else
-        {
-            L = normalize(uLight[i].position - vPosition);
-            float distance = length(uLight[i].position - vPosition);
-            float attenuation = 1.0 / (distance * distance);
-            radiance *= attenuation;
-        }
-        
-        vec3 H = normalize(V + L);
-
-        // Cook-Torrance BRDF
-        float NDF = DistributionGGX(N, H, uRoughness);   
-        float G   = GeometrySmith(N, V, L, uRoughness);    
-        vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);       
-
-        vec3 numerator    = NDF * G * F;
-        float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0)  + 0.0001;
-        vec3 specular     = numerator / denominator; 
-
-        vec3 kS = F;
-        vec3 kD = vec3(1.0) - kS;
-        kD *= 1.0 - uMetallic;     
-
-        // add to outgoing radiance Lo
-        float NdotL = max(dot(N, L), 0.0);                
-        Lo += (kD * albedo / PI + specular) * radiance * NdotL; 
+        vec3 L = uLight[i].direction;
+        Lo += CalculateRadiance(N, V, L, uLight[i].color, albedo, F0, uMetallic, uRoughness);
     }
+#endif
 
+#if (LIGHT_TYPES & 2)
+    for(uint i = uDirectionalLightCount; i < uLightCount; ++i)
+    {
+        vec3 L = normalize(uLight[i].position - vPosition);
+        float distance = length(uLight[i].position - vPosition);
+        float attenuation = 1.0 / (distance * distance);
+        Lo += CalculateRadiance(N, V, L, uLight[i].color * attenuation, albedo, F0, uMetallic, uRoughness);
+    }
+#endif
+
+#if USE_IBL
     vec3 F = fresnelSchlickRoughness(max(dot(N, V), 0.0), F0, uRoughness);
     vec3 kS = F;
     vec3 kD = 1.0 - kS;
@@ -169,7 +185,10 @@ void main()
     vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
 
     vec3 ambient = kD * diffuse + specular;
-    
+#else
+    vec3 ambient = vec3(0.0);
+#endif
+
     vec3 color = ambient + Lo;
 
     color = color / (color + vec3(1.0f));
@@ -223,6 +242,28 @@ vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
 }   
 
+vec3 CalculateRadiance(vec3 N, vec3 V, vec3 L, vec3 radiance, vec3 albedo, vec3 F0, float metallic, float roughness)
+{
+    vec3 H = normalize(V + L);
+
+    // Cook-Torrance BRDF
+    float NDF = DistributionGGX(N, H, roughness);
+    float G   = GeometrySmith(N, V, L, roughness);
+    vec3 F    = fresnelSchlick(max(dot(H, V), 0.0), F0);
+
+    vec3 numerator    = NDF * G * F;
+    float denominator = 4.0 * max(dot(N, V), 0.0) * max(dot(N, L), 0.0)  + 0.0001;
+    vec3 specular     = numerator / denominator;
+
+    vec3 kS = F;
+    vec3 kD = vec3(1.0) - kS;
+    kD *= 1.0 - metallic;
+
+    // add to outgoing radiance Lo
+    float NdotL = max(dot(N, L), 0.0);
+    return (kD * albedo / PI + specular) * radiance * NdotL;
+}
+
 #endif
 #endif
 